@@ -46,13 +46,15 @@
 #include "util.h"
 #include "cryptlib.h"
 #include "version.h"
+#include "cryptodev_trace.h"
 
 
 /* make caop->dst available in scatterlist.
  * (caop->src is assumed to be equal to caop->dst)
  */
-static int get_userbuf_tls(struct csession *ses, struct kernel_crypt_auth_op *kcaop,
-			struct scatterlist **dst_sg)
+static int get_userbuf_tls(struct fcrypt *fcr, struct csession *ses,
+			struct cryptodev_pages *zc,
+			struct kernel_crypt_auth_op *kcaop, struct scatterlist **dst_sg)
 {
 	int pagecount = 0;
 	struct crypt_auth_op *caop = &kcaop->caop;
@@ -74,21 +76,21 @@ static int get_userbuf_tls(struct csession *ses, struct kernel_crypt_auth_op *kc
 
 	pagecount = PAGECOUNT(caop->dst, kcaop->dst_len);
 
-	ses->used_pages = pagecount;
-	ses->readonly_pages = 0;
+	zc->used_pages = pagecount;
+	zc->readonly_pages = 0;
 
-	rc = adjust_sg_array(ses, pagecount);
+	rc = adjust_sg_array(zc, pagecount);
 	if (rc)
 		return rc;
 
-	rc = __get_userbuf(caop->dst, kcaop->dst_len, 1, pagecount,
-	                   ses->pages, ses->sg, kcaop->task, kcaop->mm);
-	if (unlikely(rc)) {
+	rc = __get_userbuf(fcr, caop->dst, kcaop->dst_len, 1, pagecount,
+	                   zc->pages, zc->sg, kcaop->task, kcaop->mm);
+	if (unlikely(rc < 0)) {
 		derr(1, "failed to get user pages for data input");
 		return -EINVAL;
 	}
 
-	(*dst_sg) = ses->sg;
+	(*dst_sg) = zc->sg;
 
 	return 0;
 }
@@ -96,13 +98,20 @@ static int get_userbuf_tls(struct csession *ses, struct kernel_crypt_auth_op *kc
 
 #define MAX_SRTP_AUTH_DATA_DIFF 256
 
+/* the fixed part of an RTP header, the AES-CM IV and the authenticated
+ * rollover counter of COP_FLAG_SRTP_INDEX */
+#define RTP_HEADER_SIZE	12
+#define SRTP_IV_SIZE	16
+#define SRTP_ROC_SIZE	4
+
 /* Makes caop->auth_src available as scatterlist.
  * It also provides a pointer to caop->dst, which however,
  * is assumed to be within the caop->auth_src buffer. If not
  * (if their difference exceeds MAX_SRTP_AUTH_DATA_DIFF) it
  * returns error.
  */
-static int get_userbuf_srtp(struct csession *ses, struct kernel_crypt_auth_op *kcaop,
+static int get_userbuf_srtp(struct fcrypt *fcr, struct csession *ses,
+			struct kernel_crypt_auth_op *kcaop,
 			struct scatterlist **auth_sg, struct scatterlist **dst_sg)
 {
 	int pagecount, diff;
@@ -141,30 +150,30 @@ static int get_userbuf_srtp(struct csession *ses, struct kernel_crypt_auth_op *k
 
 	pagecount = auth_pagecount;
 
-	rc = adjust_sg_array(ses, pagecount*2); /* double pages to have pages for dst(=auth_src) */
+	rc = adjust_sg_array(&ses->zc, pagecount*2); /* double pages to have pages for dst(=auth_src) */
 	if (rc) {
 		derr(1, "cannot adjust sg array");
 		return rc;
 	}
 
-	rc = __get_userbuf(caop->auth_src, caop->auth_len, 1, auth_pagecount,
-			   ses->pages, ses->sg, kcaop->task, kcaop->mm);
-	if (unlikely(rc)) {
+	rc = __get_userbuf(fcr, caop->auth_src, caop->auth_len, 1, auth_pagecount,
+			   ses->zc.pages, ses->zc.sg, kcaop->task, kcaop->mm);
+	if (unlikely(rc < 0)) {
 		derr(1, "failed to get user pages for data input");
 		return -EINVAL;
 	}
 
-	ses->used_pages = pagecount;
-	ses->readonly_pages = 0;
+	ses->zc.used_pages = pagecount;
+	ses->zc.readonly_pages = 0;
 
-	(*auth_sg) = ses->sg;
+	(*auth_sg) = ses->zc.sg;
 
-	(*dst_sg) = ses->sg + auth_pagecount;
+	(*dst_sg) = ses->zc.sg + auth_pagecount;
 	sg_init_table(*dst_sg, auth_pagecount);
-	sg_copy(ses->sg, (*dst_sg), caop->auth_len);
+	sg_copy(ses->zc.sg, (*dst_sg), caop->auth_len);
 	(*dst_sg) = sg_advance(*dst_sg, diff);
 	if (*dst_sg == NULL) {
-		release_user_pages(ses);
+		release_user_pages(&ses->zc);
 		derr(1, "failed to get enough pages for auth data");
 		return -EINVAL;
 	}
@@ -232,12 +241,13 @@ static int fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop, struct fcryp
 	if (caop->tag_len == 0)
 		caop->tag_len = cryptodev_get_tag_len(ses_ptr);
 
-	kcaop->ivlen = caop->iv ? ses_ptr->cdata.ivsize : 0;
+	kcaop->iv_gen = crypto_op_gen_iv(ses_ptr, caop->op);
+	kcaop->ivlen = (caop->iv || kcaop->iv_gen) ? ses_ptr->cdata.ivsize : 0;
 	kcaop->dst_len = cryptodev_get_dst_len(caop, ses_ptr);
 	kcaop->task = current;
 	kcaop->mm = current->mm;
 
-	if (caop->iv) {
+	if (caop->iv && !kcaop->iv_gen) {
 		ret = copy_from_user(kcaop->iv, caop->iv, kcaop->ivlen);
 		if (unlikely(ret)) {
 			derr(1, "error copying IV (%d bytes), copy_from_user returned %d for address %p",
@@ -261,7 +271,8 @@ static int fill_caop_from_kcaop(struct kernel_crypt_auth_op *kcaop, struct fcryp
 
 	kcaop->caop.len = kcaop->dst_len;
 
-	if (kcaop->ivlen && kcaop->caop.flags & COP_FLAG_WRITE_IV) {
+	if (kcaop->ivlen && kcaop->caop.iv &&
+	    (kcaop->iv_gen || kcaop->caop.flags & COP_FLAG_WRITE_IV)) {
 		ret = copy_to_user(kcaop->caop.iv,
 				kcaop->iv, kcaop->ivlen);
 		if (unlikely(ret)) {
@@ -302,6 +313,56 @@ int kcaop_to_user(struct kernel_crypt_auth_op *kcaop,
 	return 0;
 }
 
+/* the same for a crypt_auth_op64, whose pointers are read as they are
+ * whether the caller is a 32 or a 64-bit program */
+int kcaop64_from_user(struct kernel_crypt_auth_op *kcaop,
+			struct fcrypt *fcr, void __user *arg)
+{
+	struct crypt_auth_op *caop = &kcaop->caop;
+	struct crypt_auth_op64 caop64;
+
+	if (unlikely(copy_from_user(&caop64, arg, sizeof(caop64)))) {
+		derr(1, "Error in copying from userspace");
+		return -EFAULT;
+	}
+
+	caop->ses = caop64.ses;
+	caop->op = caop64.op;
+	caop->flags = caop64.flags;
+	caop->len = caop64.len;
+	caop->auth_len = caop64.auth_len;
+	caop->auth_src = u64_to_user_ptr(caop64.auth_src);
+	caop->src = u64_to_user_ptr(caop64.src);
+	caop->dst = u64_to_user_ptr(caop64.dst);
+	caop->tag = u64_to_user_ptr(caop64.tag);
+	caop->tag_len = caop64.tag_len;
+	caop->iv = u64_to_user_ptr(caop64.iv);
+	caop->iv_len = caop64.iv_len;
+
+	return fill_kcaop_from_caop(kcaop, fcr);
+}
+
+/* only len and tag_len of the crypt_auth_op64 are set by an operation */
+int kcaop64_to_user(struct kernel_crypt_auth_op *kcaop,
+		struct fcrypt *fcr, void __user *arg)
+{
+	struct crypt_auth_op64 __user *caop64 = arg;
+	int ret;
+
+	ret = fill_caop_from_kcaop(kcaop, fcr);
+	if (unlikely(ret)) {
+		derr(1, "fill_caop_from_kcaop");
+		return ret;
+	}
+
+	if (unlikely(put_user(kcaop->caop.len, &caop64->len) ||
+		     put_user(kcaop->caop.tag_len, &caop64->tag_len))) {
+		derr(1, "Error in copying to userspace");
+		return -EFAULT;
+	}
+	return 0;
+}
+
 static void copy_tls_hash(struct scatterlist *dst_sg, int len, void *hash, int hash_len)
 {
 	scatterwalk_map_and_copy(hash, dst_sg, len, hash_len, 1);
@@ -348,6 +409,52 @@ static int verify_tls_record_pad(struct scatterlist *dst_sg, int len, int block_
 	return pad_size + 1;
 }
 
+/* Append the MAC and the padding to the len bytes of a TLS record in
+ * dst_sg that is to be encrypted; TLS authenticates the plaintext
+ * except for the padding. Returns the length to encrypt. */
+static int
+tls_mac_n_pad(struct csession *ses_ptr, struct crypt_auth_op *caop,
+		struct scatterlist *auth_sg, uint32_t auth_len,
+		struct scatterlist *dst_sg, uint32_t len)
+{
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+	int ret;
+
+	if (ses_ptr->hdata.init != 0) {
+		if (auth_len > 0) {
+			ret = cryptodev_hash_update(&ses_ptr->hdata,
+							auth_sg, auth_len);
+			if (unlikely(ret)) {
+				derr(0, "cryptodev_hash_update: %d", ret);
+				return ret;
+			}
+		}
+
+		if (len > 0) {
+			ret = cryptodev_hash_update(&ses_ptr->hdata,
+							dst_sg, len);
+			if (unlikely(ret)) {
+				derr(0, "cryptodev_hash_update: %d", ret);
+				return ret;
+			}
+		}
+
+		ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+		if (unlikely(ret)) {
+			derr(0, "cryptodev_hash_final: %d", ret);
+			return ret;
+		}
+
+		copy_tls_hash(dst_sg, len, hash_output, caop->tag_len);
+		len += caop->tag_len;
+	}
+
+	if (ses_ptr->cdata.init != 0 && ses_ptr->cdata.blocksize > 1)
+		len += pad_record(dst_sg, len, ses_ptr->cdata.blocksize);
+
+	return len;
+}
+
 /* Authenticate and encrypt the TLS way (also perform padding).
  * During decryption it verifies the pad and tag and returns -EBADMSG on error.
  */
@@ -361,44 +468,14 @@ tls_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 	uint8_t vhash[AALG_MAX_RESULT_LEN];
 	uint8_t hash_output[AALG_MAX_RESULT_LEN];
 
-	/* TLS authenticates the plaintext except for the padding.
-	 */
 	if (caop->op == COP_ENCRYPT) {
-		if (ses_ptr->hdata.init != 0) {
-			if (auth_len > 0) {
-				ret = cryptodev_hash_update(&ses_ptr->hdata,
-								auth_sg, auth_len);
-				if (unlikely(ret)) {
-					derr(0, "cryptodev_hash_update: %d", ret);
-					return ret;
-				}
-			}
-
-			if (len > 0) {
-				ret = cryptodev_hash_update(&ses_ptr->hdata,
-								dst_sg, len);
-				if (unlikely(ret)) {
-					derr(0, "cryptodev_hash_update: %d", ret);
-					return ret;
-				}
-			}
-
-			ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
-			if (unlikely(ret)) {
-				derr(0, "cryptodev_hash_final: %d", ret);
-				return ret;
-			}
-
-			copy_tls_hash(dst_sg, len, hash_output, caop->tag_len);
-			len += caop->tag_len;
-		}
+		ret = tls_mac_n_pad(ses_ptr, caop, auth_sg, auth_len,
+				dst_sg, len);
+		if (unlikely(ret < 0))
+			return ret;
+		len = ret;
 
 		if (ses_ptr->cdata.init != 0) {
-			if (ses_ptr->cdata.blocksize > 1) {
-				ret = pad_record(dst_sg, len, ses_ptr->cdata.blocksize);
-				len += ret;
-			}
-
 			ret = cryptodev_cipher_encrypt(&ses_ptr->cdata,
 							dst_sg, dst_sg, len);
 			if (unlikely(ret)) {
@@ -476,6 +553,7 @@ tls_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 static int
 srtp_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 		  struct scatterlist *auth_sg, uint32_t auth_len,
+		  struct scatterlist *roc_sg,
 		  struct scatterlist *dst_sg, uint32_t len)
 {
 	int ret, fail = 0;
@@ -505,6 +583,15 @@ srtp_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 				}
 			}
 
+			if (roc_sg) {
+				ret = cryptodev_hash_update(&ses_ptr->hdata,
+						roc_sg, SRTP_ROC_SIZE);
+				if (unlikely(ret)) {
+					derr(0, "cryptodev_hash_update: %d", ret);
+					return ret;
+				}
+			}
+
 			ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
 			if (unlikely(ret)) {
 				derr(0, "cryptodev_hash_final: %d", ret);
@@ -532,6 +619,15 @@ srtp_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 				return ret;
 			}
 
+			if (roc_sg) {
+				ret = cryptodev_hash_update(&ses_ptr->hdata,
+						roc_sg, SRTP_ROC_SIZE);
+				if (unlikely(ret)) {
+					derr(0, "cryptodev_hash_update: %d", ret);
+					return ret;
+				}
+			}
+
 			ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
 			if (unlikely(ret)) {
 				derr(0, "cryptodev_hash_final: %d", ret);
@@ -609,11 +705,68 @@ auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 	return 0;
 }
 
-static int crypto_auth_zc_srtp(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop)
+/* The rollover counter the packet with sequence number seq most likely
+ * has, RFC 3711 appendix A */
+static uint32_t srtp_guess_roc(const struct cryptodev_srtp *srtp, uint16_t seq)
 {
-	struct scatterlist *dst_sg, *auth_sg;
+	if (!srtp->seen)
+		return srtp->roc;
+
+	if (srtp->s_l < 32768) {
+		if ((int)seq - srtp->s_l > 32768)
+			return srtp->roc - 1;
+	} else if ((int)srtp->s_l - 32768 > seq) {
+		return srtp->roc + 1;
+	}
+
+	return srtp->roc;
+}
+
+/* account for a packet that was authenticated */
+static void srtp_update(struct cryptodev_srtp *srtp, uint16_t seq, uint32_t roc)
+{
+	if (!srtp->seen || roc == srtp->roc + 1) {
+		srtp->roc = roc;
+		srtp->s_l = seq;
+		srtp->seen = 1;
+	} else if (roc == srtp->roc && seq > srtp->s_l) {
+		srtp->s_l = seq;
+	}
+}
+
+/* Set the AES-CM IV of the packet whose RTP header starts auth_sg:
+ * IV = (salt * 2^16) XOR (SSRC * 2^64) XOR (index * 2^16) */
+static void srtp_set_iv(struct csession *ses_ptr, struct scatterlist *auth_sg,
+		uint16_t *seq, uint32_t *roc)
+{
+	uint8_t hdr[RTP_HEADER_SIZE], iv[SRTP_IV_SIZE];
+	int i;
+
+	scatterwalk_map_and_copy(hdr, auth_sg, 0, sizeof(hdr), 0);
+	*seq = (hdr[2] << 8) | hdr[3];
+	*roc = srtp_guess_roc(&ses_ptr->srtp, *seq);
+
+	memcpy(iv, ses_ptr->srtp.salt, sizeof(ses_ptr->srtp.salt));
+	iv[14] = iv[15] = 0;
+	for (i = 0; i < 4; i++) {
+		iv[4 + i] ^= hdr[8 + i];
+		iv[8 + i] ^= *roc >> (24 - 8 * i);
+	}
+	iv[12] ^= *seq >> 8;
+	iv[13] ^= *seq;
+
+	cryptodev_cipher_set_iv(&ses_ptr->cdata, iv, sizeof(iv));
+}
+
+static int crypto_auth_zc_srtp(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct kernel_crypt_auth_op *kcaop)
+{
+	struct scatterlist *dst_sg, *auth_sg, *roc_sg = NULL, tmp;
 	struct crypt_auth_op *caop = &kcaop->caop;
-	int ret;
+	int index = caop->flags & COP_FLAG_SRTP_INDEX;
+	uint32_t roc = 0;
+	uint16_t seq = 0;
+	int i, ret;
 
 	if (unlikely(ses_ptr->cdata.init != 0 &&
 		(ses_ptr->cdata.stream == 0 || ses_ptr->cdata.aead != 0))) {
@@ -621,45 +774,124 @@ static int crypto_auth_zc_srtp(struct csession *ses_ptr, struct kernel_crypt_aut
 		return -EINVAL;
 	}
 
-	ret = get_userbuf_srtp(ses_ptr, kcaop, &auth_sg, &dst_sg);
+	if (index && unlikely(!ses_ptr->srtp.init ||
+			      caop->auth_len < RTP_HEADER_SIZE)) {
+		derr(1, "no SRTP context or RTP header for the packet index");
+		return -EINVAL;
+	}
+
+	trace_cryptodev_pin_start(caop->len);
+	ret = get_userbuf_srtp(fcr, ses_ptr, kcaop, &auth_sg, &dst_sg);
+	trace_cryptodev_pin_end(ses_ptr->zc.used_pages, ret);
 	if (unlikely(ret)) {
 		derr(1, "get_userbuf_srtp(): Error getting user pages.");
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_USERBUF_ERR);
 		return ret;
 	}
 
+	/* the SRTP path does not use the auth buffer otherwise */
+	if (index) {
+		srtp_set_iv(ses_ptr, auth_sg, &seq, &roc);
+		for (i = 0; i < SRTP_ROC_SIZE; i++)
+			ses_ptr->auth_buf[i] = roc >> (24 - 8 * i);
+		sg_init_one(&tmp, ses_ptr->auth_buf, SRTP_ROC_SIZE);
+		roc_sg = &tmp;
+	}
+
 	ret = srtp_auth_n_crypt(ses_ptr, kcaop, auth_sg, caop->auth_len,
-			dst_sg, caop->len);
+			roc_sg, dst_sg, caop->len);
+	if (index && likely(!ret))
+		srtp_update(&ses_ptr->srtp, seq, roc);
 
-	release_user_pages(ses_ptr);
+	release_user_pages(&ses_ptr->zc);
 
 	return ret;
 }
 
-static int crypto_auth_zc_tls(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop)
+int crypto_srtp_setup(struct fcrypt *fcr, struct crypt_srtp_op *srop)
 {
-	struct crypt_auth_op *caop = &kcaop->caop;
-	struct scatterlist *dst_sg, *auth_sg;
-	unsigned char *auth_buf = NULL;
-	struct scatterlist tmp;
-	int ret;
+	struct csession *ses_ptr;
+	int ret = 0;
 
-	if (unlikely(caop->auth_len > PAGE_SIZE)) {
-		derr(1, "auth data len is excessive.");
+	if (unlikely(srop->flags || srop->__reserved))
+		return -EINVAL;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, srop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", srop->ses);
 		return -EINVAL;
 	}
 
-	auth_buf = (char *)__get_free_page(GFP_KERNEL);
-	if (unlikely(!auth_buf)) {
-		derr(1, "unable to get a free page.");
-		return -ENOMEM;
+	if (unlikely(ses_ptr->cdata.init == 0 || ses_ptr->cdata.stream == 0 ||
+		     ses_ptr->cdata.aead || ses_ptr->hdata.init == 0 ||
+		     ses_ptr->cdata.ivsize != SRTP_IV_SIZE)) {
+		derr(1, "SRTP needs an AES-CM session with a MAC");
+		ret = -EINVAL;
+		goto out;
 	}
 
-	if (caop->auth_src && caop->auth_len > 0) {
-		if (unlikely(copy_from_user(auth_buf, caop->auth_src, caop->auth_len))) {
-			derr(1, "unable to copy auth data from userspace.");
-			ret = -EFAULT;
-			goto free_auth_buf;
+	memcpy(ses_ptr->srtp.salt, srop->salt, sizeof(ses_ptr->srtp.salt));
+	ses_ptr->srtp.roc = srop->roc;
+	ses_ptr->srtp.seen = 0;
+	ses_ptr->srtp.init = 1;
+
+out:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* Copy the auth data from userspace. The short ones of TLS and GCM
+ * records go to the buffer in the session, only longer ones need an
+ * allocation. Release it with put_auth_buf(). */
+static uint8_t *get_auth_buf(struct csession *ses_ptr,
+		struct crypt_auth_op *caop)
+{
+	uint8_t *buf = ses_ptr->auth_buf;
+
+	if (unlikely(caop->auth_len > MAX_AUTH_DATA)) {
+		derr(1, "auth data len is excessive.");
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (caop->auth_len > sizeof(ses_ptr->auth_buf)) {
+		buf = kmalloc(caop->auth_len, GFP_KERNEL);
+		if (unlikely(!buf)) {
+			derr(1, "unable to allocate %u bytes of auth data.",
+					caop->auth_len);
+			return ERR_PTR(-ENOMEM);
 		}
+	}
+
+	if (unlikely(copy_from_user(buf, caop->auth_src, caop->auth_len))) {
+		derr(1, "unable to copy auth data from userspace.");
+		if (buf != ses_ptr->auth_buf)
+			kfree(buf);
+		return ERR_PTR(-EFAULT);
+	}
+
+	return buf;
+}
+
+static void put_auth_buf(struct csession *ses_ptr, uint8_t *buf)
+{
+	if (buf != ses_ptr->auth_buf)
+		kfree(buf);
+}
+
+static int crypto_auth_zc_tls(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct kernel_crypt_auth_op *kcaop)
+{
+	struct crypt_auth_op *caop = &kcaop->caop;
+	struct scatterlist *dst_sg, *auth_sg;
+	uint8_t *auth_buf = NULL;
+	struct scatterlist tmp;
+	int ret;
+
+	if (caop->auth_src && caop->auth_len > 0) {
+		auth_buf = get_auth_buf(ses_ptr, caop);
+		if (IS_ERR(auth_buf))
+			return PTR_ERR(auth_buf);
 
 		sg_init_one(&tmp, auth_buf, caop->auth_len);
 		auth_sg = &tmp;
@@ -667,27 +899,32 @@ static int crypto_auth_zc_tls(struct csession *ses_ptr, struct kernel_crypt_auth
 		auth_sg = NULL;
 	}
 
-	ret = get_userbuf_tls(ses_ptr, kcaop, &dst_sg);
+	trace_cryptodev_pin_start(caop->len);
+	ret = get_userbuf_tls(fcr, ses_ptr, &ses_ptr->zc, kcaop, &dst_sg);
+	trace_cryptodev_pin_end(ses_ptr->zc.used_pages, ret);
 	if (unlikely(ret)) {
 		derr(1, "get_userbuf_tls(): Error getting user pages.");
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_USERBUF_ERR);
 		goto free_auth_buf;
 	}
 
 	ret = tls_auth_n_crypt(ses_ptr, kcaop, auth_sg, caop->auth_len,
 			dst_sg, caop->len);
-	release_user_pages(ses_ptr);
+	release_user_pages(&ses_ptr->zc);
 
 free_auth_buf:
-	free_page((unsigned long)auth_buf);
+	if (auth_buf)
+		put_auth_buf(ses_ptr, auth_buf);
 	return ret;
 }
 
-static int crypto_auth_zc_aead(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop)
+static int crypto_auth_zc_aead(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct kernel_crypt_auth_op *kcaop)
 {
 	struct scatterlist *dst_sg;
 	struct scatterlist *src_sg;
 	struct crypt_auth_op *caop = &kcaop->caop;
-	unsigned char *auth_buf = NULL;
+	uint8_t *auth_buf = NULL;
 	int ret;
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0))
@@ -704,32 +941,22 @@ static int crypto_auth_zc_aead(struct csession *ses_ptr, struct kernel_crypt_aut
 		return -EINVAL;
 	}
 
-	if (unlikely(caop->auth_len > PAGE_SIZE)) {
-		derr(1, "auth data len is excessive.");
-		return -EINVAL;
-	}
-
-	auth_buf = (char *)__get_free_page(GFP_KERNEL);
-	if (unlikely(!auth_buf)) {
-		derr(1, "unable to get a free page.");
-		return -ENOMEM;
+	if (caop->auth_src && caop->auth_len > 0) {
+		auth_buf = get_auth_buf(ses_ptr, caop);
+		if (IS_ERR(auth_buf))
+			return PTR_ERR(auth_buf);
 	}
 
-	ret = get_userbuf(ses_ptr, caop->src, caop->len, caop->dst, kcaop->dst_len,
+	ret = get_userbuf(fcr, &ses_ptr->zc, caop->src, caop->len, caop->dst, kcaop->dst_len,
 			kcaop->task, kcaop->mm, &src_sg, &dst_sg);
 	if (unlikely(ret)) {
 		derr(1, "get_userbuf(): Error getting user pages.");
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_USERBUF_ERR);
 		goto free_auth_buf;
 	}
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0))
-	if (caop->auth_src && caop->auth_len > 0) {
-		if (unlikely(copy_from_user(auth_buf, caop->auth_src, caop->auth_len))) {
-			derr(1, "unable to copy auth data from userspace.");
-			ret = -EFAULT;
-			goto free_pages;
-		}
-
+	if (auth_buf) {
 		sg_init_one(&tmp, auth_buf, caop->auth_len);
 		auth_sg = &tmp;
 	} else {
@@ -739,13 +966,7 @@ static int crypto_auth_zc_aead(struct csession *ses_ptr, struct kernel_crypt_aut
 	ret = auth_n_crypt(ses_ptr, kcaop, auth_sg, caop->auth_len,
 			src_sg, dst_sg, caop->len);
 #else
-	if (caop->auth_src && caop->auth_len > 0) {
-		if (unlikely(copy_from_user(auth_buf, caop->auth_src, caop->auth_len))) {
-			derr(1, "unable to copy auth data from userspace.");
-			ret = -EFAULT;
-			goto free_pages;
-		}
-
+	if (auth_buf) {
 		sg_init_table(auth1, 2);
 		sg_set_buf(auth1, auth_buf, caop->auth_len);
 		sg_chain(auth1, 2, src_sg);
@@ -766,28 +987,29 @@ static int crypto_auth_zc_aead(struct csession *ses_ptr, struct kernel_crypt_aut
 			src_sg, dst_sg, caop->len);
 #endif
 
-free_pages:
-	release_user_pages(ses_ptr);
+	release_user_pages(&ses_ptr->zc);
 
 free_auth_buf:
-	free_page((unsigned long)auth_buf);
+	if (auth_buf)
+		put_auth_buf(ses_ptr, auth_buf);
 
 	return ret;
 }
 
 static int
-__crypto_auth_run_zc(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop)
+__crypto_auth_run_zc(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct kernel_crypt_auth_op *kcaop)
 {
 	struct crypt_auth_op *caop = &kcaop->caop;
 	int ret;
 
 	if (caop->flags & COP_FLAG_AEAD_SRTP_TYPE) {
-		ret = crypto_auth_zc_srtp(ses_ptr, kcaop);
+		ret = crypto_auth_zc_srtp(fcr, ses_ptr, kcaop);
 	} else if (caop->flags & COP_FLAG_AEAD_TLS_TYPE &&
 		   ses_ptr->cdata.aead == 0) {
-		ret = crypto_auth_zc_tls(ses_ptr, kcaop);
+		ret = crypto_auth_zc_tls(fcr, ses_ptr, kcaop);
 	} else if (ses_ptr->cdata.aead) {
-		ret = crypto_auth_zc_aead(ses_ptr, kcaop);
+		ret = crypto_auth_zc_aead(fcr, ses_ptr, kcaop);
 	} else {
 		ret = -EINVAL;
 	}
@@ -800,6 +1022,7 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 {
 	struct csession *ses_ptr;
 	struct crypt_auth_op *caop = &kcaop->caop;
+	ktime_t start;
 	int ret;
 
 	if (unlikely(caop->op != COP_ENCRYPT && caop->op != COP_DECRYPT)) {
@@ -807,12 +1030,15 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 		return -EINVAL;
 	}
 
+	trace_cryptodev_op_start(caop->ses, caop->op, caop->len, caop->flags);
+
 	/* this also enters ses_ptr->sem */
 	ses_ptr = crypto_get_session_by_sid(fcr, caop->ses);
 	if (unlikely(!ses_ptr)) {
 		derr(1, "invalid session ID=0x%08X", caop->ses);
 		return -EINVAL;
 	}
+	start = ktime_get();
 
 	if (unlikely(ses_ptr->cdata.init == 0)) {
 		derr(1, "cipher context not initialized");
@@ -829,10 +1055,14 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 		}
 	}
 
+	if (crypto_op_gen_iv(ses_ptr, caop->op)) {
+		crypto_gen_iv(ses_ptr, kcaop->iv, caop->len);
+		kcaop->ivlen = ses_ptr->cdata.ivsize;
+	}
 	cryptodev_cipher_set_iv(&ses_ptr->cdata, kcaop->iv,
 				min(ses_ptr->cdata.ivsize, kcaop->ivlen));
 
-	ret = __crypto_auth_run_zc(ses_ptr, kcaop);
+	ret = __crypto_auth_run_zc(fcr, ses_ptr, kcaop);
 	if (unlikely(ret)) {
 		derr(1, "error in __crypto_auth_run_zc()");
 		goto out_unlock;
@@ -840,10 +1070,222 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 
 	ret = 0;
 
-	cryptodev_cipher_get_iv(&ses_ptr->cdata, kcaop->iv,
-				min(ses_ptr->cdata.ivsize, kcaop->ivlen));
+	if (!crypto_op_gen_iv(ses_ptr, caop->op))
+		cryptodev_cipher_get_iv(&ses_ptr->cdata, kcaop->iv,
+					min(ses_ptr->cdata.ivsize, kcaop->ivlen));
+
+	cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC);
+	cryptodev_stat_op(&ses_ptr->stats, caop->len, start);
 
 out_unlock:
+	trace_cryptodev_op_done(caop->ses, caop->op, caop->len,
+			ses_ptr->stats.alg->name, 1, ret);
 	crypto_put_session(ses_ptr);
 	return ret;
 }
+
+/* Whether the records of a batch can be pipelined: TLS records to be
+ * encrypted on a single session */
+static int tls_batchable(struct kernel_crypt_auth_op *kcaop, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		struct crypt_auth_op *caop = &kcaop[i].caop;
+
+		if (!(caop->flags & COP_FLAG_AEAD_TLS_TYPE) ||
+		    caop->flags & COP_FLAG_AEAD_SRTP_TYPE ||
+		    caop->op != COP_ENCRYPT || caop->ses != kcaop[0].caop.ses)
+			return 0;
+	}
+
+	return n > 1;
+}
+
+/* Pin a TLS record of a batch and append its MAC and padding. Returns
+ * the length to encrypt. */
+static int tls_batch_prepare(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct cryptodev_pages *zc, struct kernel_crypt_auth_op *kcaop,
+		struct scatterlist **dst_sg)
+{
+	struct crypt_auth_op *caop = &kcaop->caop;
+	struct scatterlist tmp, *auth_sg = NULL;
+	uint8_t *auth_buf = NULL;
+	int ret;
+
+	trace_cryptodev_op_start(caop->ses, caop->op, caop->len, caop->flags);
+
+	if (ses_ptr->hdata.init != 0) {
+		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+		if (unlikely(ret)) {
+			derr(1, "error in cryptodev_hash_reset()");
+			return ret;
+		}
+	}
+
+	if (caop->auth_src && caop->auth_len > 0) {
+		auth_buf = get_auth_buf(ses_ptr, caop);
+		if (IS_ERR(auth_buf))
+			return PTR_ERR(auth_buf);
+
+		sg_init_one(&tmp, auth_buf, caop->auth_len);
+		auth_sg = &tmp;
+	}
+
+	trace_cryptodev_pin_start(caop->len);
+	ret = get_userbuf_tls(fcr, ses_ptr, zc, kcaop, dst_sg);
+	trace_cryptodev_pin_end(zc->used_pages, ret);
+	if (unlikely(ret)) {
+		derr(1, "get_userbuf_tls(): Error getting user pages.");
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_USERBUF_ERR);
+		goto free_auth_buf;
+	}
+
+	ret = tls_mac_n_pad(ses_ptr, caop, auth_sg, caop->auth_len,
+			*dst_sg, caop->len);
+	if (unlikely(ret < 0))
+		release_user_pages(zc);
+
+free_auth_buf:
+	if (auth_buf)
+		put_auth_buf(ses_ptr, auth_buf);
+	return ret;
+}
+
+/* Wait for the encryption of a record started by crypto_auth_run_tls_batch() */
+static int tls_batch_finish(struct csession *ses_ptr,
+		struct cryptodev_pages *zc, struct kernel_crypt_auth_op *kcaop,
+		int ret, uint32_t len, ktime_t start)
+{
+	struct crypt_auth_op *caop = &kcaop->caop;
+
+	ret = cryptodev_cipher_wait(&ses_ptr->cdata, ret);
+	release_user_pages(zc);
+	if (unlikely(ret)) {
+		derr(0, "cryptodev_cipher_encrypt: %d", ret);
+	} else {
+		kcaop->dst_len = len;
+		if (!crypto_op_gen_iv(ses_ptr, caop->op))
+			cryptodev_cipher_get_iv(&ses_ptr->cdata, kcaop->iv,
+					min(ses_ptr->cdata.ivsize, kcaop->ivlen));
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC);
+		cryptodev_stat_op(&ses_ptr->stats, caop->len, start);
+	}
+
+	trace_cryptodev_op_done(caop->ses, caop->op, caop->len,
+			ses_ptr->stats.alg->name, 1, ret);
+	return ret;
+}
+
+/* Encrypt TLS records of a single session, with the MAC of each record
+ * computed while the previous one is being encrypted. The records
+ * alternate between the pages of the session and those of a request
+ * borrowed from it. Returns the number of records run, or a negative
+ * value if the session does not allow this. */
+static int crypto_auth_run_tls_batch(struct fcrypt *fcr,
+		struct kernel_crypt_auth_op *kcaop, int *rets, unsigned int n,
+		int stop)
+{
+	struct cryptodev_pages *zcs[2];
+	struct scatterlist *dst_sg;
+	struct csession *ses_ptr;
+	struct cryptodev_req *req;
+	unsigned int i, prev = 0;
+	int ret, inflight = 0, cret = 0;
+	uint32_t clen = 0;
+	ktime_t start, cstart = 0;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, kcaop[0].caop.ses);
+	if (unlikely(!ses_ptr))
+		return -EINVAL;
+
+	if (ses_ptr->cdata.init == 0 || ses_ptr->cdata.aead ||
+	    ses_ptr->hdata.init == 0) {
+		crypto_put_session(ses_ptr);
+		return -EINVAL;
+	}
+
+	req = crypto_get_req(ses_ptr);
+	if (unlikely(!req)) {
+		crypto_put_session(ses_ptr);
+		return -ENOMEM;
+	}
+	zcs[0] = &ses_ptr->zc;
+	zcs[1] = &req->zc;
+
+	for (i = 0; i < n; i++) {
+		start = ktime_get();
+		if (crypto_op_gen_iv(ses_ptr, kcaop[i].caop.op)) {
+			crypto_gen_iv(ses_ptr, kcaop[i].iv, kcaop[i].caop.len);
+			kcaop[i].ivlen = ses_ptr->cdata.ivsize;
+		}
+		ret = tls_batch_prepare(fcr, ses_ptr, zcs[i & 1], &kcaop[i],
+				&dst_sg);
+
+		if (inflight) {
+			inflight = 0;
+			rets[prev] = tls_batch_finish(ses_ptr, zcs[prev & 1],
+					&kcaop[prev], cret, clen, cstart);
+			if (stop && unlikely(rets[prev])) {
+				if (ret >= 0)
+					release_user_pages(zcs[i & 1]);
+				n = prev + 1;
+				break;
+			}
+		}
+
+		if (unlikely(ret < 0)) {
+			rets[i] = ret;
+			if (stop) {
+				n = i + 1;
+				break;
+			}
+			continue;
+		}
+
+		/* the IV of the previous record has been read back */
+		cryptodev_cipher_set_iv(&ses_ptr->cdata, kcaop[i].iv,
+				min(ses_ptr->cdata.ivsize, kcaop[i].ivlen));
+		clen = ret;
+		cstart = start;
+		cret = cryptodev_cipher_start(&ses_ptr->cdata, dst_sg, dst_sg,
+				clen, 1);
+		inflight = 1;
+		prev = i;
+	}
+
+	if (inflight)
+		rets[prev] = tls_batch_finish(ses_ptr, zcs[prev & 1],
+				&kcaop[prev], cret, clen, cstart);
+
+	crypto_put_req(ses_ptr, req);
+	crypto_put_session(ses_ptr);
+	return n;
+}
+
+/* Run n operations of CIOCAUTHCRYPT_MULTI and store their results in
+ * rets. With stop set nothing after a failed one is reported. Returns
+ * the number of operations run. */
+unsigned int crypto_auth_run_batch(struct fcrypt *fcr,
+		struct kernel_crypt_auth_op *kcaop, int *rets, unsigned int n,
+		int stop)
+{
+	unsigned int i;
+	int ret;
+
+	if (tls_batchable(kcaop, n)) {
+		ret = crypto_auth_run_tls_batch(fcr, kcaop, rets, n, stop);
+		if (ret >= 0)
+			return ret;
+	}
+
+	for (i = 0; i < n; i++) {
+		rets[i] = crypto_auth_run(fcr, &kcaop[i]);
+		if (stop && unlikely(rets[i]))
+			return i + 1;
+		cond_resched();
+	}
+
+	return n;
+}
@@ -23,10 +23,15 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <linux/cred.h>
 #include <linux/mm.h>
+#include <linux/hashtable.h>
 #include <linux/highmem.h>
 #include <linux/ioctl.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
 #include <linux/random.h>
+#include <linux/sched.h>
 #include <linux/scatterlist.h>
 #include <linux/uaccess.h>
 #include <crypto/algapi.h>
@@ -35,8 +40,14 @@
 #include <crypto/aead.h>
 #include <linux/rtnetlink.h>
 #include <crypto/authenc.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+# include <crypto/akcipher.h>
+# include <crypto/kpp.h>
+# include <crypto/dh.h>
+#endif
 #include "cryptodev_int.h"
 #include "cipherapi.h"
+#include "cryptodev_trace.h"
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(5, 0, 0))
 extern const struct crypto_type crypto_givcipher_type;
@@ -124,6 +135,303 @@ error:
 	return ret;
 }
 
+/* Transforms of destroyed sessions are kept idle, with their request,
+ * for the next session of the same algorithm, which thus does not have
+ * to allocate them from the crypto API. Keyed transforms are given an
+ * all-zero key when they go idle, so that the key of a finished session
+ * does not linger, and the key of the new session before they are used
+ * again. The rsa
+ * transforms of CIOCKEY have no session and are put back after every
+ * operation; dh ones are not kept, as their private key cannot be
+ * overwritten with a harmless one. */
+enum { IDLE_SKCIPHER, IDLE_AEAD, IDLE_AHASH, IDLE_AKCIPHER };
+
+struct idle_tfm {
+	struct list_head entry;
+	int type;
+	void *tfm;
+	void *request;
+	int selected;
+	u32 cra_flags;
+	char name[CRYPTO_MAX_ALG_NAME];
+	char driver[CRYPTO_MAX_ALG_NAME];
+};
+
+static LIST_HEAD(idle_tfms);
+static DEFINE_SPINLOCK(idle_tfms_lock);
+static int idle_tfms_count;
+
+static void idle_tfm_free(int type, void *tfm, void *request)
+{
+	switch (type) {
+	case IDLE_SKCIPHER:
+		cryptodev_blkcipher_request_free(request);
+		cryptodev_crypto_free_blkcipher(tfm);
+		break;
+	case IDLE_AEAD:
+		aead_request_free(request);
+		crypto_free_aead(tfm);
+		break;
+	case IDLE_AHASH:
+		ahash_request_free(request);
+		crypto_free_ahash(tfm);
+		break;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+	case IDLE_AKCIPHER:
+		akcipher_request_free(request);
+		crypto_free_akcipher(tfm);
+		break;
+#endif
+	}
+}
+
+/* Does a transform of driver come from the implementation sel asks
+ * for? A default one is only handed out to those that did not ask. */
+static int alg_sel_match(int selected, const char *driver, u32 cra_flags,
+		const struct cryptodev_alg_sel *sel)
+{
+	if (!sel)
+		return !selected;
+	if (sel->driver && strcmp(driver, sel->driver))
+		return 0;
+	return ((cra_flags ^ sel->type) & sel->mask) == 0;
+}
+
+static int idle_tfm_match(const struct idle_tfm *it,
+		const struct cryptodev_alg_sel *sel)
+{
+	return alg_sel_match(it->selected, it->driver, it->cra_flags, sel);
+}
+
+/* Take an idle transform of algorithm name, as selected by sel.
+ * Returns 0 if there is none. */
+static int idle_tfm_get(int type, const char *name,
+		const struct cryptodev_alg_sel *sel, void **tfm, void **request)
+{
+	struct idle_tfm *it, *found = NULL;
+
+	spin_lock(&idle_tfms_lock);
+	list_for_each_entry(it, &idle_tfms, entry) {
+		if (it->type == type && !strcmp(it->name, name) &&
+		    idle_tfm_match(it, sel)) {
+			list_del(&it->entry);
+			idle_tfms_count--;
+			found = it;
+			break;
+		}
+	}
+	spin_unlock(&idle_tfms_lock);
+
+	if (!found)
+		return 0;
+
+	*tfm = found->tfm;
+	*request = found->request;
+	kfree(found);
+	return 1;
+}
+
+/* Overwrite the key schedule of a transform that is to be kept idle
+ * with the one of an all-zero key of keylen bytes, 0 if it has none.
+ * Returns 0 if the transform refuses that key and has to be freed. */
+static int idle_tfm_clear_key(int type, void *tfm, unsigned int keylen)
+{
+	static const u8 zero_key[CRYPTO_HMAC_MAX_KEY_LEN];
+
+	if (!keylen)
+		return 1;
+	if (keylen > sizeof(zero_key))
+		return 0;
+
+	switch (type) {
+	case IDLE_SKCIPHER:
+		return !cryptodev_crypto_blkcipher_setkey(tfm, zero_key, keylen);
+	case IDLE_AEAD:
+		return !crypto_aead_setkey(tfm, zero_key, keylen);
+	case IDLE_AHASH:
+		return !crypto_ahash_setkey(tfm, zero_key, keylen);
+	}
+	return 0;
+}
+
+/* Keep a transform that is no longer used, or free it if the cache
+ * is full. The key of the last session, keylen bytes, does not stay
+ * in the idle transform. */
+static void idle_tfm_put(int type, struct crypto_tfm *base, void *tfm,
+		void *request, int selected, unsigned int keylen)
+{
+	struct idle_tfm *it;
+
+	if (READ_ONCE(idle_tfms_count) >= cryptodev_tfm_cache ||
+	    !idle_tfm_clear_key(type, tfm, keylen))
+		goto free;
+
+	it = kmalloc(sizeof(*it), GFP_KERNEL);
+	if (unlikely(!it))
+		goto free;
+
+	it->type = type;
+	it->tfm = tfm;
+	it->request = request;
+	it->selected = selected;
+	it->cra_flags = base->__crt_alg->cra_flags;
+	snprintf(it->name, sizeof(it->name), "%s", crypto_tfm_alg_name(base));
+	snprintf(it->driver, sizeof(it->driver), "%s",
+		 crypto_tfm_alg_driver_name(base));
+
+	spin_lock(&idle_tfms_lock);
+	if (idle_tfms_count < cryptodev_tfm_cache) {
+		/* most recently used first */
+		list_add(&it->entry, &idle_tfms);
+		idle_tfms_count++;
+		it = NULL;
+	}
+	spin_unlock(&idle_tfms_lock);
+
+	if (!it)
+		return;
+	kfree(it);
+free:
+	idle_tfm_free(type, tfm, request);
+}
+
+/* A transform of a selected driver has to implement what was asked for,
+ * a driver name could as well be the one of another algorithm. */
+static int check_alg_sel(struct crypto_tfm *base, const char *alg_name,
+		const struct cryptodev_alg_sel *sel)
+{
+	if (sel && sel->driver && strcmp(crypto_tfm_alg_name(base), alg_name)) {
+		ddebug(1, "driver %s implements %s, not %s", sel->driver,
+		       crypto_tfm_alg_name(base), alg_name);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Free all idle transforms */
+void cryptodev_tfm_cache_flush(void)
+{
+	struct idle_tfm *it, *tmp;
+	LIST_HEAD(list);
+
+	spin_lock(&idle_tfms_lock);
+	list_splice_init(&idle_tfms, &list);
+	idle_tfms_count = 0;
+	spin_unlock(&idle_tfms_lock);
+
+	list_for_each_entry_safe(it, tmp, &list, entry) {
+		idle_tfm_free(it->type, it->tfm, it->request);
+		kfree(it);
+	}
+}
+
+/* HMAC transforms are shared by the sessions with the same key, so the
+ * key schedule is computed once per key rather than once per session;
+ * each session has a request of its own on the transform. A session
+ * that is given another key first gets a transform of its own. Only the
+ * sessions of one user share, so that how fast a session is set up does
+ * not tell whether someone else uses the same key. */
+struct keyed_tfm {
+	struct hlist_node node;
+	struct crypto_ahash *tfm;
+	unsigned int users;
+	int selected;
+	kuid_t owner;
+	u32 hash;
+	unsigned int keylen;
+	u8 key[];
+};
+
+static DEFINE_HASHTABLE(keyed_tfms, 6);
+static DEFINE_MUTEX(keyed_tfms_lock);
+
+static u32 keyed_tfm_hash(kuid_t owner, const char *name, const void *key,
+		unsigned int keylen)
+{
+	return jhash(key, keylen, jhash(name, strlen(name), __kuid_val(owner)));
+}
+
+/* Take a reference to a transform of algorithm name, as selected by
+ * sel, that has the key and belongs to the current user. Returns NULL
+ * if there is none. */
+static struct keyed_tfm *keyed_tfm_get(const char *name,
+		const struct cryptodev_alg_sel *sel, const void *key,
+		unsigned int keylen)
+{
+	kuid_t owner = current_euid();
+	u32 hash = keyed_tfm_hash(owner, name, key, keylen);
+	struct keyed_tfm *kt, *found = NULL;
+	struct crypto_tfm *base;
+
+	mutex_lock(&keyed_tfms_lock);
+	hash_for_each_possible(keyed_tfms, kt, node, hash) {
+		base = crypto_ahash_tfm(kt->tfm);
+		if (kt->hash == hash && uid_eq(kt->owner, owner) &&
+		    kt->keylen == keylen &&
+		    !strcmp(crypto_tfm_alg_name(base), name) &&
+		    alg_sel_match(kt->selected, crypto_tfm_alg_driver_name(base),
+				  base->__crt_alg->cra_flags, sel) &&
+		    !crypto_memneq(kt->key, key, keylen)) {
+			kt->users++;
+			found = kt;
+			break;
+		}
+	}
+	mutex_unlock(&keyed_tfms_lock);
+
+	return found;
+}
+
+/* Offer a transform that was just given key to the next sessions of the
+ * current user with that key. Returns NULL if it stays private. */
+static struct keyed_tfm *keyed_tfm_add(struct crypto_ahash *tfm,
+		int selected, const void *key, unsigned int keylen)
+{
+	struct keyed_tfm *kt;
+
+	kt = kmalloc(sizeof(*kt) + keylen, GFP_KERNEL);
+	if (unlikely(!kt))
+		return NULL;
+
+	kt->tfm = tfm;
+	kt->users = 1;
+	kt->selected = selected;
+	kt->owner = current_euid();
+	kt->keylen = keylen;
+	memcpy(kt->key, key, keylen);
+	kt->hash = keyed_tfm_hash(kt->owner,
+			crypto_tfm_alg_name(crypto_ahash_tfm(tfm)), key, keylen);
+
+	mutex_lock(&keyed_tfms_lock);
+	hash_add(keyed_tfms, &kt->node, kt->hash);
+	mutex_unlock(&keyed_tfms_lock);
+
+	return kt;
+}
+
+/* Drop a reference, or only the last one if last is set. Returns 1 if
+ * it was the last one, the caller then owns the transform. */
+static int keyed_tfm_put(struct keyed_tfm *kt, int last)
+{
+	int ret = 0;
+
+	mutex_lock(&keyed_tfms_lock);
+	if (kt->users == 1) {
+		hash_del(&kt->node);
+		ret = 1;
+	}
+	if (ret || !last)
+		kt->users--;
+	mutex_unlock(&keyed_tfms_lock);
+
+	if (ret) {
+		memzero_explicit(kt->key, kt->keylen);
+		kfree(kt);
+	}
+	return ret;
+}
+
 /* Was correct key length supplied? */
 static int check_key_size(size_t keylen, const char *alg_name,
 			  unsigned int min_keysize, unsigned int max_keysize)
@@ -139,8 +447,11 @@ static int check_key_size(size_t keylen, const char *alg_name,
 }
 
 int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
+				const struct cryptodev_alg_sel *sel,
 				uint8_t *keyp, size_t keylen, int stream, int aead)
 {
+	const char *name = sel && sel->driver ? sel->driver : alg_name;
+	u32 type = sel ? sel->type : 0, mask = sel ? sel->mask : 0;
 	int ret;
 
 	if (aead == 0) {
@@ -151,12 +462,23 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 		struct ablkcipher_alg *alg;
 #endif
 
-		out->async.s = cryptodev_crypto_alloc_blkcipher(alg_name, 0, 0);
-		if (unlikely(IS_ERR(out->async.s))) {
-			ddebug(1, "Failed to load cipher %s", alg_name);
+		out->async.request = NULL;
+		if (!idle_tfm_get(IDLE_SKCIPHER, alg_name, sel,
+				  (void **)&out->async.s,
+				  (void **)&out->async.request)) {
+			out->async.s = cryptodev_crypto_alloc_blkcipher(name,
+					type, mask);
+			if (unlikely(IS_ERR(out->async.s))) {
+				ddebug(1, "Failed to load cipher %s", name);
 				return -EINVAL;
+			}
 		}
 
+		ret = check_alg_sel(cryptodev_crypto_blkcipher_tfm(out->async.s),
+				    alg_name, sel);
+		if (ret)
+			goto error;
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
 		tfm = crypto_skcipher_tfm(out->async.s);
 		if ((tfm->__crt_alg->cra_type == &crypto_ablkcipher_type)
@@ -192,12 +514,22 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 
 		ret = cryptodev_crypto_blkcipher_setkey(out->async.s, keyp, keylen);
 	} else {
-		out->async.as = crypto_alloc_aead(alg_name, 0, 0);
-		if (unlikely(IS_ERR(out->async.as))) {
-			ddebug(1, "Failed to load cipher %s", alg_name);
-			return -EINVAL;
+		out->async.arequest = NULL;
+		if (!idle_tfm_get(IDLE_AEAD, alg_name, sel,
+				  (void **)&out->async.as,
+				  (void **)&out->async.arequest)) {
+			out->async.as = crypto_alloc_aead(name, type, mask);
+			if (unlikely(IS_ERR(out->async.as))) {
+				ddebug(1, "Failed to load cipher %s", name);
+				return -EINVAL;
+			}
 		}
 
+		ret = check_alg_sel(crypto_aead_tfm(out->async.as), alg_name,
+				    sel);
+		if (ret)
+			goto error;
+
 		out->blocksize = crypto_aead_blocksize(out->async.as);
 		out->ivsize = crypto_aead_ivsize(out->async.as);
 		out->alignmask = crypto_aead_alignmask(out->async.as);
@@ -210,14 +542,17 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 		ret = -EINVAL;
 		goto error;
 	}
+	out->keylen = keylen;
 
 	out->stream = stream;
 	out->aead = aead;
+	out->selected = sel != NULL;
 
 	init_completion(&out->async.result.completion);
 
 	if (aead == 0) {
-		out->async.request = cryptodev_blkcipher_request_alloc(out->async.s, GFP_KERNEL);
+		if (!out->async.request)
+			out->async.request = cryptodev_blkcipher_request_alloc(out->async.s, GFP_KERNEL);
 		if (unlikely(!out->async.request)) {
 			derr(1, "error allocating async crypto request");
 			ret = -ENOMEM;
@@ -228,7 +563,8 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 					CRYPTO_TFM_REQ_MAY_BACKLOG,
 					cryptodev_complete, &out->async.result);
 	} else {
-		out->async.arequest = aead_request_alloc(out->async.as, GFP_KERNEL);
+		if (!out->async.arequest)
+			out->async.arequest = aead_request_alloc(out->async.as, GFP_KERNEL);
 		if (unlikely(!out->async.arequest)) {
 			derr(1, "error allocating async crypto request");
 			ret = -ENOMEM;
@@ -259,20 +595,101 @@ error:
 void cryptodev_cipher_deinit(struct cipher_data *cdata)
 {
 	if (cdata->init) {
-		if (cdata->aead == 0) {
-			cryptodev_blkcipher_request_free(cdata->async.request);
-			cryptodev_crypto_free_blkcipher(cdata->async.s);
-		} else {
-			if (cdata->async.arequest)
-				aead_request_free(cdata->async.arequest);
-			if (cdata->async.as)
-				crypto_free_aead(cdata->async.as);
-		}
+		if (cdata->aead == 0)
+			idle_tfm_put(IDLE_SKCIPHER,
+				cryptodev_crypto_blkcipher_tfm(cdata->async.s),
+				cdata->async.s, cdata->async.request,
+				cdata->selected, cdata->keylen);
+		else
+			idle_tfm_put(IDLE_AEAD, crypto_aead_tfm(cdata->async.as),
+				cdata->async.as, cdata->async.arequest,
+				cdata->selected, cdata->keylen);
 
 		cdata->init = 0;
 	}
 }
 
+/* Replace the key of an initialized cipher. If this fails the
+ * transform is left without a usable key. */
+int cryptodev_cipher_setkey(struct cipher_data *cdata, uint8_t *keyp,
+			    size_t keylen)
+{
+	int ret;
+
+	if (unlikely(!cdata->init))
+		return -EINVAL;
+
+	if (cdata->aead == 0)
+		ret = cryptodev_crypto_blkcipher_setkey(cdata->async.s, keyp,
+							keylen);
+	else
+		ret = crypto_aead_setkey(cdata->async.as, keyp, keylen);
+	if (unlikely(ret)) {
+		ddebug(1, "Setting key failed for %zu bit key.", keylen*8);
+		return -EINVAL;
+	}
+
+	cdata->keylen = keylen;
+	return 0;
+}
+
+/* Set up req to run operations on the transform of cdata, with a
+ * request, result and IV of its own. Operations on req do not
+ * need to be serialized against the ones on cdata. */
+int cryptodev_cipher_init_request(struct cipher_data *req,
+		const struct cipher_data *cdata)
+{
+	if (unlikely(!cdata->init || cdata->aead))
+		return -EINVAL;
+
+	memset(req, 0, sizeof(*req));
+	req->blocksize = cdata->blocksize;
+	req->stream = cdata->stream;
+	req->ivsize = cdata->ivsize;
+	req->alignmask = cdata->alignmask;
+	req->async.s = cdata->async.s;
+
+	init_completion(&req->async.result.completion);
+	req->async.result.poll_us = cdata->async.result.poll_us;
+
+	req->async.request = cryptodev_blkcipher_request_alloc(req->async.s,
+			GFP_KERNEL);
+	if (unlikely(!req->async.request)) {
+		derr(1, "error allocating async crypto request");
+		return -ENOMEM;
+	}
+
+	cryptodev_blkcipher_request_set_callback(req->async.request,
+				CRYPTO_TFM_REQ_MAY_BACKLOG,
+				cryptodev_complete, &req->async.result);
+
+	req->init = 1;
+	return 0;
+}
+
+/* the transform is left to the cipher_data it was borrowed from */
+void cryptodev_cipher_deinit_request(struct cipher_data *req)
+{
+	if (req->init) {
+		cryptodev_blkcipher_request_free(req->async.request);
+		req->init = 0;
+	}
+}
+
+/* Give a driver that is about to finish cr->poll_us to do so before
+ * sleeping on the completion; the wakeup costs more than a small
+ * operation on a fast engine takes. */
+static void pollfor(struct cryptodev_result *cr)
+{
+	ktime_t end = ktime_add_us(ktime_get(), cr->poll_us);
+
+	while (!completion_done(&cr->completion)) {
+		if (need_resched() || !ktime_before(ktime_get(), end))
+			return;
+		cpu_relax();
+	}
+}
+
 static inline int waitfor(struct cryptodev_result *cr, ssize_t ret)
 {
 	switch (ret) {
@@ -280,7 +697,11 @@ static inline int waitfor(struct cryptodev_result *cr, ssize_t ret)
 		break;
 	case -EINPROGRESS:
 	case -EBUSY:
+		trace_cryptodev_wait_start(ret);
+		if (cr->poll_us)
+			pollfor(cr);
 		wait_for_completion(&cr->completion);
+		trace_cryptodev_wait_end(cr->err);
 		/* At this point we known for sure the request has finished,
 		 * because wait_for_completion above was not interruptible.
 		 * This is important because otherwise hardware or driver
@@ -300,23 +721,49 @@ static inline int waitfor(struct cryptodev_result *cr, ssize_t ret)
 	return 0;
 }
 
+/* Start a block cipher operation without waiting for it. The return
+ * value is to be passed to cryptodev_cipher_wait(), which must be
+ * called before the request is used again. */
+int cryptodev_cipher_start(struct cipher_data *cdata,
+		const struct scatterlist *src, struct scatterlist *dst,
+		size_t len, int encrypt)
+{
+	trace_cryptodev_crypto_submit(crypto_tfm_alg_driver_name(
+			cryptodev_crypto_blkcipher_tfm(cdata->async.s)), len,
+			encrypt ? CRYPTODEV_SUBMIT_ENCRYPT : CRYPTODEV_SUBMIT_DECRYPT);
+
+	reinit_completion(&cdata->async.result.completion);
+	cryptodev_blkcipher_request_set_crypt(cdata->async.request,
+		(struct scatterlist *)src, dst,
+		len, cdata->async.iv);
+
+	if (encrypt)
+		return cryptodev_crypto_blkcipher_encrypt(cdata->async.request);
+	else
+		return cryptodev_crypto_blkcipher_decrypt(cdata->async.request);
+}
+
+int cryptodev_cipher_wait(struct cipher_data *cdata, int ret)
+{
+	return waitfor(&cdata->async.result, ret);
+}
+
 ssize_t cryptodev_cipher_encrypt(struct cipher_data *cdata,
 		const struct scatterlist *src, struct scatterlist *dst,
 		size_t len)
 {
 	int ret;
 
-	reinit_completion(&cdata->async.result.completion);
-
 	if (cdata->aead == 0) {
-		cryptodev_blkcipher_request_set_crypt(cdata->async.request,
-			(struct scatterlist *)src, dst,
-			len, cdata->async.iv);
-		ret = cryptodev_crypto_blkcipher_encrypt(cdata->async.request);
+		ret = cryptodev_cipher_start(cdata, src, dst, len, 1);
 	} else {
+		reinit_completion(&cdata->async.result.completion);
 		aead_request_set_crypt(cdata->async.arequest,
 			(struct scatterlist *)src, dst,
 			len, cdata->async.iv);
+		trace_cryptodev_crypto_submit(crypto_tfm_alg_driver_name(
+				crypto_aead_tfm(cdata->async.as)), len,
+				CRYPTODEV_SUBMIT_ENCRYPT);
 		ret = crypto_aead_encrypt(cdata->async.arequest);
 	}
 
@@ -329,16 +776,16 @@ ssize_t cryptodev_cipher_decrypt(struct cipher_data *cdata,
 {
 	int ret;
 
-	reinit_completion(&cdata->async.result.completion);
 	if (cdata->aead == 0) {
-		cryptodev_blkcipher_request_set_crypt(cdata->async.request,
-			(struct scatterlist *)src, dst,
-			len, cdata->async.iv);
-		ret = cryptodev_crypto_blkcipher_decrypt(cdata->async.request);
+		ret = cryptodev_cipher_start(cdata, src, dst, len, 0);
 	} else {
+		reinit_completion(&cdata->async.result.completion);
 		aead_request_set_crypt(cdata->async.arequest,
 			(struct scatterlist *)src, dst,
 			len, cdata->async.iv);
+		trace_cryptodev_crypto_submit(crypto_tfm_alg_driver_name(
+				crypto_aead_tfm(cdata->async.as)), len,
+				CRYPTODEV_SUBMIT_DECRYPT);
 		ret = crypto_aead_decrypt(cdata->async.arequest);
 	}
 
@@ -348,16 +795,36 @@ ssize_t cryptodev_cipher_decrypt(struct cipher_data *cdata,
 /* Hash functions */
 
 int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
+			const struct cryptodev_alg_sel *sel,
 			int hmac_mode, void *mackey, size_t mackeylen)
 {
+	const char *name = sel && sel->driver ? sel->driver : alg_name;
 	int ret;
 
-	hdata->async.s = crypto_alloc_ahash(alg_name, 0, 0);
-	if (unlikely(IS_ERR(hdata->async.s))) {
-		ddebug(1, "Failed to load transform for %s", alg_name);
-		return -EINVAL;
+	hdata->async.request = NULL;
+	hdata->shared = NULL;
+	if (hmac_mode != 0 && cryptodev_share_keys) {
+		hdata->shared = keyed_tfm_get(alg_name, sel, mackey, mackeylen);
+		if (hdata->shared) {
+			hdata->async.s = hdata->shared->tfm;
+			goto keyed;
+		}
+	}
+
+	if (!idle_tfm_get(IDLE_AHASH, alg_name, sel, (void **)&hdata->async.s,
+			  (void **)&hdata->async.request)) {
+		hdata->async.s = crypto_alloc_ahash(name, sel ? sel->type : 0,
+						    sel ? sel->mask : 0);
+		if (unlikely(IS_ERR(hdata->async.s))) {
+			ddebug(1, "Failed to load transform for %s", name);
+			return -EINVAL;
+		}
 	}
 
+	ret = check_alg_sel(crypto_ahash_tfm(hdata->async.s), alg_name, sel);
+	if (ret)
+		goto error;
+
 	/* Copy the key from user and set to TFM. */
 	if (hmac_mode != 0) {
 		ret = crypto_ahash_setkey(hdata->async.s, mackey, mackeylen);
@@ -367,14 +834,21 @@ int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
 			ret = -EINVAL;
 			goto error;
 		}
+		if (cryptodev_share_keys)
+			hdata->shared = keyed_tfm_add(hdata->async.s, sel != NULL,
+					mackey, mackeylen);
 	}
 
+keyed:
+	hdata->keylen = hmac_mode ? mackeylen : 0;
 	hdata->digestsize = crypto_ahash_digestsize(hdata->async.s);
 	hdata->alignmask = crypto_ahash_alignmask(hdata->async.s);
+	hdata->selected = sel != NULL;
 
 	init_completion(&hdata->async.result.completion);
 
-	hdata->async.request = ahash_request_alloc(hdata->async.s, GFP_KERNEL);
+	if (!hdata->async.request)
+		hdata->async.request = ahash_request_alloc(hdata->async.s, GFP_KERNEL);
 	if (unlikely(!hdata->async.request)) {
 		derr(0, "error allocating async crypto request");
 		ret = -ENOMEM;
@@ -388,19 +862,92 @@ int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
 	return 0;
 
 error:
-	crypto_free_ahash(hdata->async.s);
+	if (hdata->async.request)
+		ahash_request_free(hdata->async.request);
+	if (!hdata->shared || keyed_tfm_put(hdata->shared, 0))
+		crypto_free_ahash(hdata->async.s);
+	hdata->shared = NULL;
 	return ret;
 }
 
 void cryptodev_hash_deinit(struct hash_data *hdata)
 {
 	if (hdata->init) {
-		ahash_request_free(hdata->async.request);
-		crypto_free_ahash(hdata->async.s);
+		if (hdata->shared && !keyed_tfm_put(hdata->shared, 0))
+			ahash_request_free(hdata->async.request);
+		else
+			idle_tfm_put(IDLE_AHASH, crypto_ahash_tfm(hdata->async.s),
+					hdata->async.s, hdata->async.request,
+					hdata->selected, hdata->keylen);
+		hdata->shared = NULL;
 		hdata->init = 0;
 	}
 }
 
+/* Give a session a transform of its own before its key is changed.
+ * The last user of a shared one just keeps it. */
+static int cryptodev_hash_unshare(struct hash_data *hdata)
+{
+	struct crypto_ahash *tfm;
+	struct ahash_request *req;
+
+	if (keyed_tfm_put(hdata->shared, 1)) {
+		hdata->shared = NULL;
+		return 0;
+	}
+
+	tfm = crypto_alloc_ahash(crypto_tfm_alg_driver_name(
+				crypto_ahash_tfm(hdata->async.s)), 0, 0);
+	if (unlikely(IS_ERR(tfm)))
+		return PTR_ERR(tfm);
+
+	req = ahash_request_alloc(tfm, GFP_KERNEL);
+	if (unlikely(!req)) {
+		crypto_free_ahash(tfm);
+		return -ENOMEM;
+	}
+	ahash_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+			cryptodev_complete, &hdata->async.result);
+
+	/* the others may have gone meanwhile */
+	ahash_request_free(hdata->async.request);
+	if (keyed_tfm_put(hdata->shared, 0))
+		idle_tfm_put(IDLE_AHASH, crypto_ahash_tfm(hdata->async.s),
+				hdata->async.s, NULL, hdata->selected,
+				hdata->keylen);
+	hdata->async.s = tfm;
+	hdata->async.request = req;
+	hdata->shared = NULL;
+	return 0;
+}
+
+/* Replace the key of an initialized hmac. The hash state has to be
+ * reset afterwards. */
+int cryptodev_hash_setkey(struct hash_data *hdata, void *mackey,
+			  size_t mackeylen)
+{
+	int ret;
+
+	if (unlikely(!hdata->init))
+		return -EINVAL;
+
+	if (hdata->shared) {
+		ret = cryptodev_hash_unshare(hdata);
+		if (unlikely(ret))
+			return ret;
+	}
+
+	ret = crypto_ahash_setkey(hdata->async.s, mackey, mackeylen);
+	if (unlikely(ret)) {
+		ddebug(1, "Setting hmac key failed for %zu bit key.",
+				mackeylen*8);
+		return -EINVAL;
+	}
+
+	hdata->keylen = mackeylen;
+	return 0;
+}
+
 int cryptodev_hash_reset(struct hash_data *hdata)
 {
 	int ret;
@@ -415,19 +962,31 @@ int cryptodev_hash_reset(struct hash_data *hdata)
 
 }
 
-ssize_t cryptodev_hash_update(struct hash_data *hdata,
-				struct scatterlist *sg, size_t len)
+/* Submit an update without waiting for it, which has to be done with
+ * cryptodev_hash_wait() before sg is released. */
+int cryptodev_hash_start(struct hash_data *hdata,
+			 struct scatterlist *sg, size_t len)
 {
-	int ret;
-
 	reinit_completion(&hdata->async.result.completion);
 	ahash_request_set_crypt(hdata->async.request, sg, NULL, len);
 
-	ret = crypto_ahash_update(hdata->async.request);
+	trace_cryptodev_crypto_submit(crypto_tfm_alg_driver_name(
+			crypto_ahash_tfm(hdata->async.s)), len,
+			CRYPTODEV_SUBMIT_HASH);
+	return crypto_ahash_update(hdata->async.request);
+}
 
+int cryptodev_hash_wait(struct hash_data *hdata, int ret)
+{
 	return waitfor(&hdata->async.result, ret);
 }
 
+ssize_t cryptodev_hash_update(struct hash_data *hdata,
+				struct scatterlist *sg, size_t len)
+{
+	return cryptodev_hash_wait(hdata, cryptodev_hash_start(hdata, sg, len));
+}
+
 int cryptodev_hash_final(struct hash_data *hdata, void *output)
 {
 	int ret;
@@ -441,12 +1000,108 @@ int cryptodev_hash_final(struct hash_data *hdata, void *output)
 }
 
 #ifdef CIOCCPHASH
+/* save the current hash state of hdata to state, which has room for
+ * cryptodev_hash_statesize() bytes */
+int cryptodev_hash_export(struct hash_data *hdata, void *state)
+{
+	struct crypto_tfm *tfm;
+	int ret;
+
+	ret = crypto_ahash_export(hdata->async.request, state);
+	if (unlikely(ret == -ENOSYS)) {
+		tfm = crypto_ahash_tfm(hdata->async.s);
+		derr(0, "crypto_ahash_export not implemented for "
+			"alg='%s', driver='%s'", crypto_tfm_alg_name(tfm),
+			crypto_tfm_alg_driver_name(tfm));
+	}
+	return ret;
+}
+
+/* continue the hash of hdata from a state saved by
+ * cryptodev_hash_export() */
+int cryptodev_hash_import(struct hash_data *hdata, const void *state)
+{
+	struct crypto_tfm *tfm;
+	int ret;
+
+	ret = crypto_ahash_import(hdata->async.request, state);
+	if (unlikely(ret == -ENOSYS)) {
+		tfm = crypto_ahash_tfm(hdata->async.s);
+		derr(0, "crypto_ahash_import not implemented for "
+			"alg='%s', driver='%s'", crypto_tfm_alg_name(tfm),
+			crypto_tfm_alg_driver_name(tfm));
+	}
+	return ret;
+}
+
+/* The key exported hash states are authenticated with, so that only
+ * states this module has written are handed to the drivers, which trust
+ * the lengths and counts in them. It is made when the module is loaded
+ * and a MAC over the driver name and the size binds a state to the
+ * implementation that exported it. */
+static struct crypto_shash *hash_state_mac;
+
+int cryptodev_hash_state_init(void)
+{
+	uint8_t key[32];
+	int ret;
+
+	hash_state_mac = crypto_alloc_shash("hmac(sha256)", 0, 0);
+	if (IS_ERR(hash_state_mac)) {
+		ret = PTR_ERR(hash_state_mac);
+		hash_state_mac = NULL;
+		return ret;
+	}
+
+	get_random_bytes(key, sizeof(key));
+	ret = crypto_shash_setkey(hash_state_mac, key, sizeof(key));
+	memzero_explicit(key, sizeof(key));
+	if (unlikely(ret)) {
+		crypto_free_shash(hash_state_mac);
+		hash_state_mac = NULL;
+	}
+	return ret;
+}
+
+void cryptodev_hash_state_exit(void)
+{
+	if (hash_state_mac)
+		crypto_free_shash(hash_state_mac);
+}
+
+/* the CRYPTODEV_HASH_STATE_TAG bytes of MAC of a state of hdata */
+int cryptodev_hash_state_tag(struct hash_data *hdata, const void *state,
+		void *tag)
+{
+	const char *driver =
+		crypto_tfm_alg_driver_name(crypto_ahash_tfm(hdata->async.s));
+	unsigned int statesize = cryptodev_hash_statesize(hdata);
+	__le32 size = cpu_to_le32(statesize);
+	SHASH_DESC_ON_STACK(desc, hash_state_mac);
+	int ret;
+
+	if (unlikely(!hash_state_mac))
+		return -EOPNOTSUPP;
+
+	desc->tfm = hash_state_mac;
+	ret = crypto_shash_init(desc);
+	if (likely(!ret))
+		ret = crypto_shash_update(desc, driver, strlen(driver) + 1);
+	if (likely(!ret))
+		ret = crypto_shash_update(desc, (const uint8_t *)&size,
+				sizeof(size));
+	if (likely(!ret))
+		ret = crypto_shash_finup(desc, state, statesize, tag);
+	shash_desc_zero(desc);
+
+	return ret;
+}
+
 /* import the current hash state of src to dst */
 int cryptodev_hash_copy(struct hash_data *dst, struct hash_data *src)
 {
 	int ret, statesize;
 	void *statedata = NULL;
-	struct crypto_tfm *tfm;
 
 	if (unlikely(src == NULL || dst == NULL)) {
 		return -EINVAL;
@@ -464,26 +1119,146 @@ int cryptodev_hash_copy(struct hash_data *dst, struct hash_data *src)
 		return -ENOMEM;
 	}
 
-	ret = crypto_ahash_export(src->async.request, statedata);
-	if (unlikely(ret < 0)) {
-		if (unlikely(ret == -ENOSYS)) {
-			tfm = crypto_ahash_tfm(src->async.s);
-			derr(0, "cryptodev_hash_copy: crypto_ahash_export not implemented for "
-				"alg='%s', driver='%s'", crypto_tfm_alg_name(tfm),
-				crypto_tfm_alg_driver_name(tfm));
-		}
+	ret = cryptodev_hash_export(src, statedata);
+	if (likely(ret >= 0))
+		ret = cryptodev_hash_import(dst, statedata);
+
+	kfree(statedata);
+	return ret;
+}
+#endif /* CIOCCPHASH */
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+/* An idle "rsa" transform and its request, or new ones */
+static int rsa_tfm_get(struct crypto_akcipher **tfm,
+		struct akcipher_request **req)
+{
+	if (idle_tfm_get(IDLE_AKCIPHER, "rsa", NULL, (void **)tfm,
+			 (void **)req))
+		return 0;
+
+	*tfm = crypto_alloc_akcipher("rsa", 0, 0);
+	if (IS_ERR(*tfm)) {
+		ddebug(1, "Failed to load transform for rsa: %ld",
+				PTR_ERR(*tfm));
+		return PTR_ERR(*tfm);
+	}
+
+	*req = akcipher_request_alloc(*tfm, GFP_KERNEL);
+	if (unlikely(!*req)) {
+		crypto_free_akcipher(*tfm);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/* The raw RSA public key operation in ^ e mod n of the "rsa" akcipher,
+ * with key a DER encoded RSAPublicKey. The result is big endian in out,
+ * which has room for *outlen bytes and at least the size of n; *outlen
+ * is set to its length. */
+int cryptodev_rsa_encrypt(const void *key, unsigned int keylen,
+		void *in, unsigned int inlen, void *out, unsigned int *outlen)
+{
+	struct cryptodev_result result;
+	struct crypto_akcipher *tfm;
+	struct akcipher_request *req;
+	struct scatterlist src, dst;
+	int ret;
+
+	ret = rsa_tfm_get(&tfm, &req);
+	if (unlikely(ret))
+		return ret;
+
+	ret = crypto_akcipher_set_pub_key(tfm, key, keylen);
+	if (unlikely(ret)) {
+		ddebug(1, "Setting key failed for rsa-%u: %d",
+				crypto_akcipher_maxsize(tfm) * 8, ret);
 		goto out;
 	}
 
-	ret = crypto_ahash_import(dst->async.request, statedata);
-	if (unlikely(ret == -ENOSYS)) {
-		tfm = crypto_ahash_tfm(dst->async.s);
-		derr(0, "cryptodev_hash_copy: crypto_ahash_import not implemented for "
-			"alg='%s', driver='%s'", crypto_tfm_alg_name(tfm),
-			crypto_tfm_alg_driver_name(tfm));
+	memset(&result, 0, sizeof(result));
+	init_completion(&result.completion);
+	sg_init_one(&src, in, inlen);
+	sg_init_one(&dst, out, *outlen);
+	akcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+			cryptodev_complete, &result);
+	akcipher_request_set_crypt(req, &src, &dst, inlen, *outlen);
+
+	ret = waitfor(&result, crypto_akcipher_encrypt(req));
+	*outlen = req->dst_len;
+out:
+	/* a public key */
+	idle_tfm_put(IDLE_AKCIPHER, crypto_akcipher_tfm(tfm), tfm, req, 0, 0);
+	return ret;
+}
+
+/* A "dh" transform and its request */
+static int dh_tfm_get(struct crypto_kpp **tfm, struct kpp_request **req)
+{
+	*tfm = crypto_alloc_kpp("dh", 0, 0);
+	if (IS_ERR(*tfm)) {
+		ddebug(1, "Failed to load transform for dh: %ld",
+				PTR_ERR(*tfm));
+		return PTR_ERR(*tfm);
+	}
+
+	*req = kpp_request_alloc(*tfm, GFP_KERNEL);
+	if (unlikely(!*req)) {
+		crypto_free_kpp(*tfm);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/* The Diffie-Hellman shared secret of the private key in params and the
+ * peer's public value pub, big endian in out as with
+ * cryptodev_rsa_encrypt(); out needs at least the size of the prime. */
+int cryptodev_dh_compute(const struct dh *params, void *pub,
+		unsigned int publen, void *out, unsigned int *outlen)
+{
+	struct cryptodev_result result;
+	struct crypto_kpp *tfm;
+	struct kpp_request *req;
+	struct scatterlist src, dst;
+	unsigned int len;
+	char *secret;
+	int ret;
+
+	ret = dh_tfm_get(&tfm, &req);
+	if (unlikely(ret))
+		return ret;
+
+	len = crypto_dh_key_len(params);
+	secret = kmalloc(len, GFP_KERNEL);
+	if (unlikely(!secret)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	ret = crypto_dh_encode_key(secret, len, params);
+	if (likely(!ret))
+		ret = crypto_kpp_set_secret(tfm, secret, len);
+	memzero_explicit(secret, len);
+	kfree(secret);
+	if (unlikely(ret)) {
+		ddebug(1, "Setting key failed for dh-%u: %d",
+				params->p_size * 8, ret);
+		goto out;
 	}
+
+	memset(&result, 0, sizeof(result));
+	init_completion(&result.completion);
+	sg_init_one(&src, pub, publen);
+	sg_init_one(&dst, out, *outlen);
+	kpp_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+			cryptodev_complete, &result);
+	kpp_request_set_input(req, &src, publen);
+	kpp_request_set_output(req, &dst, *outlen);
+
+	ret = waitfor(&result, crypto_kpp_compute_shared_secret(req));
+	*outlen = req->dst_len;
 out:
-	kfree(statedata);
+	kpp_request_free(req);
+	crypto_free_kpp(tfm);
 	return ret;
 }
-#endif /* CIOCCPHASH */
+#endif
@@ -6,17 +6,28 @@
 struct cryptodev_result {
 	struct completion completion;
 	int err;
+	unsigned int poll_us;	/* to poll for before sleeping */
 };
 
 #include "cipherapi.h"
 
+/* Which implementation of an algorithm a transform is to come from: the
+ * one of a cra_driver_name, or the crypto API's choice among the ones
+ * whose cra_flags match type under mask. */
+struct cryptodev_alg_sel {
+	const char *driver;	/* NULL for any */
+	u32 type, mask;
+};
+
 struct cipher_data {
 	int init; /* 0 uninitialized */
+	int selected; /* from a cryptodev_alg_sel */
 	int blocksize;
 	int aead;
 	int stream;
 	int ivsize;
 	int alignmask;
+	unsigned int keylen; /* cleared before the transform goes idle */
 	struct {
 		/* block ciphers */
 		cryptodev_crypto_blkcipher_t *s;
@@ -31,9 +42,17 @@ struct cipher_data {
 	} async;
 };
 
+void cryptodev_tfm_cache_flush(void);
+
 int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
+			  const struct cryptodev_alg_sel *sel,
 			  uint8_t *key, size_t keylen, int stream, int aead);
 void cryptodev_cipher_deinit(struct cipher_data *cdata);
+int cryptodev_cipher_setkey(struct cipher_data *cdata, uint8_t *key,
+			    size_t keylen);
+int cryptodev_cipher_init_request(struct cipher_data *req,
+			const struct cipher_data *cdata);
+void cryptodev_cipher_deinit_request(struct cipher_data *req);
 int cryptodev_get_cipher_key(uint8_t *key, struct session_op *sop, int aead);
 int cryptodev_get_cipher_keylen(unsigned int *keylen, struct session_op *sop,
 		int aead);
@@ -43,6 +62,10 @@ ssize_t cryptodev_cipher_decrypt(struct cipher_data *cdata,
 ssize_t cryptodev_cipher_encrypt(struct cipher_data *cdata,
 				const struct scatterlist *sg1,
 				struct scatterlist *sg2, size_t len);
+int cryptodev_cipher_start(struct cipher_data *cdata,
+			const struct scatterlist *sg1,
+			struct scatterlist *sg2, size_t len, int encrypt);
+int cryptodev_cipher_wait(struct cipher_data *cdata, int ret);
 
 /* AEAD */
 static inline void cryptodev_cipher_auth(struct cipher_data *cdata,
@@ -83,10 +106,15 @@ static inline void cryptodev_cipher_get_iv(struct cipher_data *cdata,
 }
 
 /* Hash */
+struct keyed_tfm;
+
 struct hash_data {
 	int init; /* 0 uninitialized */
+	int selected; /* from a cryptodev_alg_sel */
+	struct keyed_tfm *shared; /* the transform of all with the key */
 	int digestsize;
 	int alignmask;
+	unsigned int keylen; /* 0 unkeyed, else as for cipher_data */
 	struct {
 		struct crypto_ahash *s;
 		struct cryptodev_result result;
@@ -97,12 +125,43 @@ struct hash_data {
 int cryptodev_hash_final(struct hash_data *hdata, void *output);
 ssize_t cryptodev_hash_update(struct hash_data *hdata,
 			struct scatterlist *sg, size_t len);
+int cryptodev_hash_start(struct hash_data *hdata,
+			struct scatterlist *sg, size_t len);
+int cryptodev_hash_wait(struct hash_data *hdata, int ret);
 int cryptodev_hash_reset(struct hash_data *hdata);
+int cryptodev_hash_setkey(struct hash_data *hdata, void *mackey,
+			  size_t mackeylen);
 void cryptodev_hash_deinit(struct hash_data *hdata);
 int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
+			const struct cryptodev_alg_sel *sel,
 			int hmac_mode, void *mackey, size_t mackeylen);
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 29))
 int cryptodev_hash_copy(struct hash_data *dst, struct hash_data *src);
+int cryptodev_hash_export(struct hash_data *hdata, void *state);
+int cryptodev_hash_import(struct hash_data *hdata, const void *state);
+
+static inline unsigned int cryptodev_hash_statesize(struct hash_data *hdata)
+{
+	return crypto_ahash_statesize(hdata->async.s);
+}
+
+/* the MAC that follows a state given to userspace */
+#define CRYPTODEV_HASH_STATE_TAG 32
+
+int cryptodev_hash_state_init(void);
+void cryptodev_hash_state_exit(void);
+int cryptodev_hash_state_tag(struct hash_data *hdata, const void *state,
+		void *tag);
+#endif
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+struct dh;
+
+/* public key operations, for CIOCKEY */
+int cryptodev_rsa_encrypt(const void *key, unsigned int keylen,
+		void *in, unsigned int inlen, void *out, unsigned int *outlen);
+int cryptodev_dh_compute(const struct dh *params, void *pub,
+		unsigned int publen, void *out, unsigned int *outlen);
 #endif
 
 
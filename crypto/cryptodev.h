@@ -92,6 +92,69 @@ struct session_op {
 	__u32	ses;		/* session identifier */
 };
 
+/* input of CIOCGSESSION2, a session_op with options. New fields are
+ * only added at the end; the kernel takes the size from the ioctl
+ * number, so binaries built with a shorter session2_op keep working and
+ * get the defaults for what they do not know of. */
+struct session2_op {
+	__u32	cipher;		/* cryptodev_crypto_op_t */
+	__u32	mac;		/* cryptodev_crypto_op_t */
+
+	__u32	keylen;
+	__u8	__user *key;
+	__u32	mackeylen;
+	__u8	__user *mackey;
+
+	__u32	ses;		/* session identifier */
+	__u32	flags;		/* SES_FLAG_* */
+	/* the number of transforms an operation that brings its own IV
+	 * goes to the least busy of, up to CRYPTO_MAX_ENGINES; 0 or 1 for
+	 * a single one. Drivers of multi instance engines commonly bind a
+	 * transform to an instance. Only for ciphers without a MAC. */
+	__u32	engines;
+	/* the microseconds an operation waits for the driver to finish by
+	 * polling, up to CRYPTO_MAX_POLL_US, before it goes to sleep; spares
+	 * small operations on fast engines the wakeup. 0 sleeps at once. */
+	__u32	poll_us;
+	/* with SES_FLAG_NODE, the NUMA node for the memory of the session */
+	__u32	node;
+	__u32	__reserved[3];	/* must be zero */
+	/* the cra_driver_name of the implementation to use, e.g.
+	 * "cbc-aes-aesni", or empty for the crypto API's choice */
+	char	cipher_driver[CRYPTODEV_MAX_ALG_NAME];
+	char	mac_driver[CRYPTODEV_MAX_ALG_NAME];
+};
+
+#define CRYPTO_MAX_ENGINES	8
+#define CRYPTO_MAX_POLL_US	1000
+
+/* The kernel keeps the IV of the session for encryptions; the iv of an
+ * encryption is not read and, if set, receives the IV that was used. It
+ * starts out random and is then advanced by one for every AEAD operation,
+ * or as a counter block for every block processed. Decryptions read the
+ * iv of the operation as usual and leave the IV of the session alone.
+ * Needs CRYPTO_AES_CTR or CRYPTO_AES_GCM. */
+#define SES_FLAG_IV_GEN		(1 << 0)
+/* Only use implementations that are hardware drivers, i.e. those that
+ * CIOCGSESSINFO reports with SIOP_FLAG_KERNEL_DRIVER_ONLY, or only the
+ * others. A hardware engine may have the highest priority and still be
+ * slower than the CPU for small requests; these flags, or naming the
+ * driver, route a session to the one that suits it. */
+#define SES_FLAG_HW_ONLY	(1 << 1)
+#define SES_FLAG_SW_ONLY	(1 << 2)
+/* Allocate the session, its requests and bounce buffers on the NUMA
+ * node in the node field, usually the one the crypto device is attached
+ * to, instead of the node of the CPU creating the session. Asynchronous
+ * operations of the session are run by a CPU of that node when the
+ * descriptor has one. */
+#define SES_FLAG_NODE		(1 << 3)
+/* Cut large operations into chunks that are ciphered on several CPUs
+ * at once: those of CIOCCRYPT with ECB, CTR or a CBC decryption, and
+ * the runs of CIOCCRYPT_SECTORS. The others, including XTS beyond the
+ * sector boundaries, are still done as a whole. Needs a cipher-only
+ * session. */
+#define SES_FLAG_SPLIT		(1 << 4)
+
 struct session_info_op {
 	__u32 ses;		/* session identifier */
 
@@ -102,6 +165,7 @@ struct session_info_op {
 	} cipher_info, hash_info;
 
 	__u16	alignmask;	/* alignment constraints */
+	__s16	node;		/* NUMA node of the session's memory */
 	__u32   flags;          /* SIOP_FLAGS_* */
 };
 
@@ -202,6 +266,8 @@ struct crypt_auth_op {
  *  tag_size: the size of the desired authentication tag or zero to use
  *            the default mac output.
  *  tag     : Pointer to an address where the authentication tag will be copied.
+ *
+ * With COP_FLAG_SRTP_INDEX as well, iv is not used; see CIOCSRTPSETUP.
  */
 
 
@@ -219,6 +285,12 @@ struct crypt_auth_op {
 #define COP_FLAG_RESET		(1 << 6) /* multi-update reset the state.
                                           * should be used in combination
                                           * with COP_FLAG_UPDATE */
+#define COP_FLAG_SRTP_INDEX	(1 << 7) /* derive the IV of an SRTP packet
+                                          * from the context of
+                                          * CIOCSRTPSETUP */
+#define COP_FLAG_PRIO		(1 << 8) /* a latency critical CIOCASYNCCRYPT
+                                          * job, run ahead of the others
+                                          * of the descriptor */
 
 
 /* Stuff for bignum arithmetic and public key
@@ -237,7 +309,14 @@ struct crparam {
 
 #define CRK_MAXPARAM	8
 
-/* input of CIOCKEY */
+/* input of CIOCKEY. The numbers are little endian, of crp_nbits bits;
+ * results are padded with zeros to the crp_nbits of their parameter.
+ * Supported, as CIOCASYMFEAT reports, are
+ *  CRK_MOD_EXP: base, exponent, modulus in, base ^ exponent mod modulus
+ *	out, with the modulus of a size the kernel's RSA accepts
+ *  CRK_DH_COMPUTE_KEY: private key, peer's public value, prime in, the
+ *	shared secret out
+ * on the "rsa" akcipher and "dh" kpp implementations, respectively. */
 struct crypt_kop {
 	__u32	crk_op;		/* cryptodev_crk_op_t */
 	__u32	crk_status;
@@ -268,6 +347,468 @@ struct cphash_op {
 };
 #endif
 
+/* input of CIOCCRYPT_MULTI and CIOCAUTHCRYPT_MULTI
+ *  count  : the number of operations in ops
+ *  ops    : an array of struct crypt_op (CIOCCRYPT_MULTI) or of
+ *           struct crypt_auth_op (CIOCAUTHCRYPT_MULTI). Every element
+ *           is processed and updated exactly as by CIOCCRYPT or
+ *           CIOCAUTHCRYPT respectively.
+ *  status : an array of count integers that receives the result of each
+ *           operation (zero or a negative error code). If NULL, processing
+ *           stops at the first failing operation and its error is returned
+ *           by the ioctl.
+ *
+ * CIOCAUTHCRYPT_MULTI computes the MAC of a COP_FLAG_AEAD_TLS_TYPE record
+ * while the one before it on the same session is being encrypted. The
+ * records must not overlap; without status, the record after a failing
+ * one may have got its MAC and padding already.
+ */
+struct crypt_multi_op {
+	__u32	count;
+	__u32	flags;		/* reserved, must be zero */
+	void	__user *ops;
+	__s32	__user *status;
+};
+
+/* CIOCGSESSION_MULTI and CIOCFSESSION_MULTI take a crypt_multi_op too.
+ * For the former ops is an array of struct session_op, each of which is
+ * handled as by CIOCGSESSION, for the latter an array of __u32 session
+ * IDs, each of which is finished as by CIOCFSESSION. If a session_op
+ * fails without status being set, the sessions before it keep existing.
+ */
+
+/* Forms of crypt_op, crypt_auth_op and crypt_multi_op with the pointers
+ * in __u64 and the same layout for 32 and 64-bit userlands, so that a
+ * 32-bit program on a 64-bit kernel has its operations read as they are.
+ * The fields are those of the structures they stand for; the reserved
+ * ones must be zero.
+ */
+struct crypt_op64 {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u32	len;
+	__u32	__reserved;
+	__u64	src;
+	__u64	dst;
+	__u64	mac;
+	__u64	iv;
+};
+
+struct crypt_auth_op64 {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u32	len;
+	__u32	auth_len;
+	__u64	auth_src;
+	__u64	src;
+	__u64	dst;
+	__u64	tag;
+	__u64	iv;
+	__u32	tag_len;
+	__u32	iv_len;
+};
+
+/* for CIOCCRYPT_MULTI64 ops is an array of crypt_op64, for
+ * CIOCAUTHCRYPT_MULTI64 one of crypt_auth_op64 */
+struct crypt_multi_op64 {
+	__u32	count;
+	__u32	flags;		/* reserved, must be zero */
+	__u64	ops;
+	__u64	status;		/* array of __s32 */
+};
+
+/* input of CIOCHASH_MULTI
+ *  ses    : a session with a hash or MAC only
+ *  count  : the number of messages in vecs
+ *  flags  : COP_FLAG_NO_ZC or zero
+ *  vecs   : the messages, each of which is hashed on its own as by a
+ *           CIOCCRYPT without flags. The digest is written to mac.
+ *  status : as in crypt_multi_op
+ */
+struct crypt_hash_vec {
+	__u8	__user *src;
+	__u8	__user *mac;
+	__u32	len;
+	__u32	__reserved;
+};
+
+struct crypt_hash_multi_op {
+	__u32	ses;
+	__u32	count;
+	__u32	flags;
+	__u32	__reserved;
+	struct crypt_hash_vec __user *vecs;
+	__s32	__user *status;
+};
+
+/* input of CIOCCRYPTV, the same operation as CIOCCRYPT on data that
+ * is scattered over several segments of user memory
+ *  ses, op, mac, iv : as in crypt_op
+ *  flags   : COP_FLAG_NO_ZC or zero
+ *  src     : src_cnt segments with the input
+ *  dst     : dst_cnt segments that receive the output; they must hold
+ *            at least as many bytes as src. NULL for hash sessions, or
+ *            equal to src for in place operation.
+ * Each array holds at most CRYPTO_IOV_MAX segments.
+ */
+#define CRYPTO_IOV_MAX	64
+
+struct crypt_iovec {
+	void	__user *base;
+	__u32	len;
+};
+
+struct crypt_iov_op {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u32	src_cnt;
+	__u32	dst_cnt;
+	struct crypt_iovec __user *src;
+	struct crypt_iovec __user *dst;
+	__u8	__user *mac;
+	__u8	__user *iv;
+};
+
+/* input of CIOCCRYPT_SECTORS: len bytes of consecutive sectors of
+ * sector_size bytes, the first one numbered sector. Each sector is
+ * ciphered on its own, with the little endian sector number as IV
+ * (as dm-crypt's plain64 does), which makes CRYPTO_AES_XTS sessions
+ * suitable for block storage. */
+struct crypt_sector_op {
+	__u32	ses;		/* session identifier */
+	__u16	op;		/* COP_ENCRYPT or COP_DECRYPT */
+	__u16	flags;		/* COP_FLAG_NO_ZC */
+	__u32	len;		/* a multiple of sector_size */
+	__u32	sector_size;	/* a power of two, 512 to 4096 */
+	__u64	sector;
+	__u8	__user *src;
+	__u8	__user *dst;
+};
+
+#define CRYPTO_SECTOR_MIN	512
+#define CRYPTO_SECTOR_MAX	4096
+
+/* input of CIOCHASHFD: hash len bytes of the file fd, starting at offset,
+ * on a hash-only session. The flags COP_FLAG_UPDATE, COP_FLAG_FINAL and
+ * COP_FLAG_RESET work as with CIOCCRYPT, so a file may be hashed in
+ * parts. Hashing stops at the end of the file; len is set to the number
+ * of bytes that were hashed. fd may also be a pipe or a socket; the
+ * session is not held while waiting for it, so other hashing on the
+ * session must not be started until the call returned. */
+struct crypt_fd_op {
+	__u64	offset;		/* ignored if the file is not seekable */
+	__u64	len;
+	__u32	ses;		/* session identifier */
+	__s32	fd;		/* a file open for reading */
+	__u16	flags;
+	__u16	__reserved;
+	__u8	__user *mac;	/* the digest, unless COP_FLAG_UPDATE */
+};
+
+/* input of CIOCHASHMEM: hash len bytes of memory at src, on a hash-only
+ * session, with the flags of CIOCHASHFD. Unlike with CIOCCRYPT there is
+ * no limit of 4 GiB; the memory is pinned and hashed a part at a time,
+ * so a single call takes any length. len is set to the number of bytes
+ * that were hashed. */
+struct crypt_hash_mem_op {
+	__u64	len;
+	__u32	ses;		/* session identifier */
+	__u16	flags;
+	__u16	__reserved;
+	__u8	__user *src;
+	__u8	__user *mac;	/* the digest, unless COP_FLAG_UPDATE */
+};
+
+/* input of CIOCSESEXPORT and CIOCSESATTACH. CIOCSESEXPORT returns in fd
+ * a descriptor for the session ses, which can be handed to other
+ * processes, e.g. by fork() or over a unix socket. CIOCSESATTACH
+ * creates a session ses on another /dev/crypto descriptor from it that
+ * has the transform and key of the exported one, but an IV and requests
+ * of its own, so workers that each have a descriptor share a single key
+ * schedule. The keys of a session that has been exported can no longer
+ * be changed. Only cipher-only sessions without SES_FLAG_IV_GEN can be
+ * shared; the HMAC sessions of a user with the same key share their
+ * transform anyway. */
+struct crypt_ses_share_op {
+	__u32	ses;		/* session identifier */
+	__s32	fd;		/* the descriptor of the exported session */
+};
+
+/* input of CIOCSTREAM: bind a cipher session to the file descriptor, so
+ * that data written to it, or spliced into it, is encrypted or decrypted
+ * and can be read or spliced out of it in the same order. Only whole
+ * blocks become readable; the IV is chained from one write to the next.
+ * The session should not be used otherwise while it is bound, and a
+ * descriptor can carry a single stream, for as long as it is open. */
+struct crypt_stream_op {
+	__u32	ses;		/* session identifier */
+	__u16	op;		/* COP_ENCRYPT or COP_DECRYPT */
+	__u16	flags;		/* must be zero */
+	__u8	__user *iv;	/* the initial IV, or NULL to keep the session's */
+};
+
+/* input of CIOCSRTPSETUP: the SRTP cryptographic context of an AES-CM
+ * (CRYPTO_AES_CTR) session with an HMAC, for its COP_FLAG_SRTP_INDEX
+ * operations. The IV of a packet is then derived as in RFC 3711 from
+ * the salt, the SSRC and sequence number of its RTP header (the first
+ * 12 bytes of auth_src) and the rollover counter, which the session
+ * keeps track of; the rollover counter is also authenticated after the
+ * packet. The highest sequence number is taken from the first packet.
+ * Replayed packets are not detected. */
+struct crypt_srtp_op {
+	__u32	ses;		/* session identifier */
+	__u32	flags;		/* must be zero */
+	__u32	roc;		/* the initial rollover counter */
+	__u8	salt[14];	/* the session salt */
+	__u16	__reserved;
+};
+
+/* input of CIOCHASHEXPORT and CIOCHASHIMPORT: the intermediate state of
+ * the hash of a session, as left by COP_FLAG_UPDATE operations, is saved
+ * to or restored from state. It can be imported in any session of the
+ * same hash and driver, on any descriptor, which continues from there
+ * with COP_FLAG_UPDATE or COP_FLAG_FINAL. The state of an HMAC does not
+ * include its key, a session importing it needs the same key. The format
+ * is the driver's own, followed by a MAC with a key the module makes
+ * when it is loaded; CIOCHASHIMPORT fails with EBADMSG on a state that
+ * was changed, exported by another driver or before the module was
+ * loaded again. */
+struct crypt_hash_state_op {
+	__u32	ses;		/* session identifier */
+	/* the size of state; CIOCHASHEXPORT sets it to the size of the
+	 * state, and only does that if state is NULL */
+	__u32	len;
+	__u8	__user *state;
+};
+
+/* The structures of the ioctls above with their pointers in __u64, as
+ * crypt_op64 has them, for the ioctls numbered from 145 on. They have
+ * the same layout for 32 and 64-bit userlands; the fields are those of
+ * the structures they stand for and the reserved ones must be zero.
+ * Arrays the pointers lead to are of the 64 forms as well, except for
+ * the session IDs of CIOCFSESSION_MULTI64.
+ */
+struct session_op64 {
+	__u32	cipher;
+	__u32	mac;
+	__u32	keylen;
+	__u32	mackeylen;
+	__u64	key;
+	__u64	mackey;
+	__u32	ses;
+	__u32	__reserved;
+};
+
+struct crypt_hash_vec64 {
+	__u64	src;
+	__u64	mac;
+	__u32	len;
+	__u32	__reserved;
+};
+
+struct crypt_hash_multi_op64 {
+	__u32	ses;
+	__u32	count;
+	__u32	flags;
+	__u32	__reserved;
+	__u64	vecs;		/* array of crypt_hash_vec64 */
+	__u64	status;		/* array of __s32 */
+};
+
+struct crypt_iovec64 {
+	__u64	base;
+	__u32	len;
+	__u32	__reserved;
+};
+
+struct crypt_iov_op64 {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u32	src_cnt;
+	__u32	dst_cnt;
+	__u64	src;		/* array of crypt_iovec64 */
+	__u64	dst;
+	__u64	mac;
+	__u64	iv;
+};
+
+struct crypt_sector_op64 {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u32	len;
+	__u32	sector_size;
+	__u64	sector;
+	__u64	src;
+	__u64	dst;
+};
+
+struct crypt_fd_op64 {
+	__u64	offset;
+	__u64	len;
+	__u32	ses;
+	__s32	fd;
+	__u16	flags;
+	__u16	__reserved[3];
+	__u64	mac;
+};
+
+struct crypt_hash_mem_op64 {
+	__u64	len;
+	__u32	ses;
+	__u16	flags;
+	__u16	__reserved;
+	__u64	src;
+	__u64	mac;
+};
+
+struct crypt_stream_op64 {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u64	iv;
+};
+
+struct crypt_hash_state_op64 {
+	__u32	ses;
+	__u32	len;
+	__u64	state;
+};
+
+/* Shared memory submission and completion rings.
+ *
+ * CIOCRINGSETUP allocates a ring pair for the file descriptor, which
+ * is then mapped with mmap(fd, offset 0, length crypt_ring_setup.size).
+ * The mapping starts with struct crypt_ring_hdr, followed by the arrays
+ * of submission and completion entries at the offsets given in it.
+ *
+ * Userspace fills struct crypt_ring_sqe entries at sq_tail and then
+ * advances sq_tail; the kernel consumes them once CIOCRINGENTER is
+ * called and advances sq_head. For each consumed entry a struct
+ * crypt_ring_cqe is placed at cq_tail, which userspace reaps and
+ * acknowledges by advancing cq_head. The indices are free running and
+ * wrap at 2^32; an entry's slot is (index & mask).
+ *
+ * Operations on the ring are identical to CIOCCRYPT, except that the
+ * IV is passed inline and the resulting IV and digest are returned in
+ * the completion entry. poll() reports POLLIN while completions are
+ * pending.
+ */
+struct crypt_ring_setup {
+	__u32	sq_entries;	/* number of submission entries, rounded up
+				 * to a power of two */
+	__u32	cq_entries;	/* number of completion entries, or zero for
+				 * twice sq_entries; rounded up as well */
+	__u32	flags;		/* reserved, must be zero */
+	__u32	size;		/* output: the length of the mapping */
+};
+
+struct crypt_ring_hdr {
+	__u32	sq_head;	/* written by the kernel */
+	__u32	sq_tail;	/* written by userspace */
+	__u32	sq_mask;
+	__u32	sq_entries;
+	__u32	cq_head;	/* written by userspace */
+	__u32	cq_tail;	/* written by the kernel */
+	__u32	cq_mask;
+	__u32	cq_entries;
+	__u32	sqes;		/* offset of the submission entries */
+	__u32	cqes;		/* offset of the completion entries */
+};
+
+struct crypt_ring_sqe {
+	__u64	user_data;	/* copied to the completion entry */
+	__u32	ses;		/* session identifier */
+	__u16	op;		/* COP_ENCRYPT or COP_DECRYPT */
+	__u16	flags;		/* see COP_FLAG_* */
+	__u32	len;		/* length of source data */
+	__u32	__reserved;
+	__u64	src;		/* source data */
+	__u64	dst;		/* pointer to output data */
+	__u8	iv[EALG_MAX_BLOCK_LEN];	/* initialization vector */
+};
+
+struct crypt_ring_cqe {
+	__u64	user_data;	/* as given in the submission entry */
+	__s32	res;		/* zero or a negative error code */
+	__u32	mac_len;	/* the number of valid bytes in mac */
+	__u8	iv[EALG_MAX_BLOCK_LEN];	/* the IV after the operation */
+	__u8	mac[AALG_MAX_RESULT_LEN];
+};
+
+/* input of CIOCRINGENTER: consume all pending submission entries and
+ * wait until at least min_complete completion entries are available */
+struct crypt_ring_enter {
+	__u32	min_complete;
+	__u32	flags;		/* reserved, must be zero */
+};
+
+/* Registered buffers.
+ *
+ * CIOCREGBUF pins a region of the caller's memory once. Operations of
+ * any kind whose source and destination lie within a registered region
+ * then use its pages directly instead of pinning them again, which
+ * saves the page table walk and the mmap lock for each operation. The
+ * region is passed to operations by ordinary pointers into it; the
+ * returned id is only needed to unregister it with CIOCUNREGBUF.
+ * Registered and allocated buffers count against the RLIMIT_MEMLOCK of
+ * the user, over all its descriptors. As with the registered buffers of
+ * io_uring, a region keeps the pages it pinned: memory mapped at its
+ * addresses after munmap() is not what operations on them use.
+ */
+struct crypt_buf_op {
+	__u64	addr;		/* start of the region */
+	__u32	len;		/* length of the region */
+	__u32	flags;		/* see CRYPT_BUF_* */
+	__u32	id;		/* output: identifier of the region */
+	__u32	__reserved;
+};
+
+#define CRYPT_BUF_RDONLY	(1 << 0) /* only to be used as a source */
+
+/* Kernel allocated buffers.
+ *
+ * CIOCALLOCBUF allocates len bytes of page aligned kernel memory and
+ * returns in addr the offset at which the buffer is mmap()ed from the
+ * /dev/crypto descriptor; flags must be zero. Once mapped, operations
+ * on pointers into the mapping use the buffer's pages directly, like
+ * those of a registered region, so buffers that satisfy any alignmask
+ * need neither pinning nor bouncing. The buffer is released with
+ * CIOCUNREGBUF after it has been unmapped.
+ */
+
+/* Performance counters.
+ *
+ * CIOCGSTATS fills in the counters of session ses, or with ses zero
+ * the totals of all sessions since the module was loaded, which needs
+ * CAP_SYS_ADMIN. The
+ * counters that are not tied to a session (sg_reallocs and the async
+ * ones) are only kept in the totals; async_pending always refers to
+ * the descriptor. latency[i] counts the operations that took less
+ * than 2^i microseconds, the last bucket also all slower ones.
+ */
+#define CRYPTO_STATS_LAT_BUCKETS	16
+
+struct crypt_stats_op {
+	__u32	ses;		/* session, or zero for the totals */
+	__u32	__reserved;
+	__u64	ops;		/* completed operations */
+	__u64	bytes;		/* bytes processed by them */
+	__u64	zc_ops;		/* operations on the user pages */
+	__u64	bounced_ops;	/* operations through a bounce buffer */
+	__u64	zc_fallbacks;	/* zero copy operations that had to bounce */
+	__u64	userbuf_errors;	/* failures to get the user pages */
+	__u64	sg_reallocs;	/* growths of the page arrays */
+	__u64	async_queued;	/* accepted CIOCASYNCCRYPT jobs */
+	__u64	async_busy;	/* CIOCASYNCCRYPT jobs refused with EBUSY */
+	__u64	async_pending;	/* jobs of this descriptor not fetched yet */
+	__u64	latency[CRYPTO_STATS_LAT_BUCKETS];
+};
+
 #define CRK_ALGORITHM_MAX	(CRK_ALGORITHM_ALL-1)
 
 /* features to be queried with CIOCASYMFEAT ioctl
@@ -312,4 +853,105 @@ struct cphash_op {
 #define CIOCCPHASH	_IOW('c', 112, struct cphash_op)
 #endif
 
+/* additional ioctls for submitting several operations at once.
+ * The crypt_multi_op parameter points to an array of crypt_op
+ * (respectively crypt_auth_op) structures which are processed in order.
+ */
+#define CIOCCRYPT_MULTI		_IOW('c', 113, struct crypt_multi_op)
+#define CIOCAUTHCRYPT_MULTI	_IOW('c', 114, struct crypt_multi_op)
+
+/* additional ioctls for the shared memory rings */
+#define CIOCRINGSETUP	_IOWR('c', 115, struct crypt_ring_setup)
+#define CIOCRINGENTER	_IOW('c', 116, struct crypt_ring_enter)
+
+/* additional ioctls for registered buffers */
+#define CIOCREGBUF	_IOWR('c', 117, struct crypt_buf_op)
+#define CIOCUNREGBUF	_IOW('c', 118, __u32)
+#define CIOCALLOCBUF	_IOWR('c', 119, struct crypt_buf_op)
+
+/* performance counters */
+#define CIOCGSTATS	_IOWR('c', 120, struct crypt_stats_op)
+
+/* hashing of many independent messages on a single session */
+#define CIOCHASH_MULTI	_IOW('c', 121, struct crypt_hash_multi_op)
+
+/* operations on scattered user memory */
+#define CIOCCRYPTV	_IOW('c', 122, struct crypt_iov_op)
+
+/* Create a session with the algorithms of the session in the ses field
+ * of the session_op and the keys given in it. The cipher and mac fields
+ * are set to the ones of that session, and ses to the new one. */
+#define CIOCCLONESESSION _IOWR('c', 123, struct session_op)
+
+/* Replace the keys of the session in the ses field of the session_op,
+ * keeping its transforms. The cipher key is set if key is not NULL and
+ * the MAC key if mackey is not NULL; cipher and mac are ignored. An
+ * unfinished multi-update hash is discarded. If setting a key fails the
+ * session has to be given a valid one before it can be used again. */
+#define CIOCSETKEY	_IOW('c', 124, struct session_op)
+
+/* creation and removal of many sessions at once */
+#define CIOCGSESSION_MULTI	_IOW('c', 125, struct crypt_multi_op)
+#define CIOCFSESSION_MULTI	_IOW('c', 126, struct crypt_multi_op)
+
+/* like CIOCGSESSION, with the options of struct session2_op */
+#define CIOCGSESSION2	_IOWR('c', 127, struct session2_op)
+
+/* operations on runs of storage sectors */
+#define CIOCCRYPT_SECTORS	_IOW('c', 128, struct crypt_sector_op)
+
+/* hashing of file contents */
+#define CIOCHASHFD	_IOWR('c', 129, struct crypt_fd_op)
+
+/* read()/write() and splice() through a cipher session */
+#define CIOCSTREAM	_IOW('c', 130, struct crypt_stream_op)
+
+/* signal an eventfd with the number of CIOCASYNCCRYPT jobs completed,
+ * so many of them can be fetched after a single wakeup; -1 removes it */
+#define CIOCASYNCEVENTFD	_IOW('c', 131, __s32)
+
+/* the SRTP context of a session, see struct crypt_srtp_op; with
+ * CIOCAUTHCRYPT_MULTI whole bursts of packets are protected at once */
+#define CIOCSRTPSETUP	_IOW('c', 132, struct crypt_srtp_op)
+
+/* saving and restoring of hash states, see struct crypt_hash_state_op */
+#define CIOCHASHEXPORT	_IOWR('c', 133, struct crypt_hash_state_op)
+#define CIOCHASHIMPORT	_IOW('c', 134, struct crypt_hash_state_op)
+
+/* hashing of memory regions of any size */
+#define CIOCHASHMEM	_IOWR('c', 135, struct crypt_hash_mem_op)
+
+/* sessions shared between descriptors, see struct crypt_ses_share_op */
+#define CIOCSESEXPORT	_IOWR('c', 136, struct crypt_ses_share_op)
+#define CIOCSESATTACH	_IOWR('c', 137, struct crypt_ses_share_op)
+
+/* the number of CIOCASYNCCRYPT jobs the descriptor can have queued and
+ * not yet fetched, up to a limit set by the module; 0 only returns it */
+#define CIOCASYNCDEPTH	_IOWR('c', 138, __u32)
+
+/* CIOCCRYPT, CIOCAUTHCRYPT, CIOCASYNCCRYPT, CIOCASYNCFETCH and the
+ * batched ioctls with the fixed-layout structures, the same for 32 and
+ * 64-bit programs */
+#define CIOCCRYPT64		_IOWR('c', 139, struct crypt_op64)
+#define CIOCAUTHCRYPT64		_IOWR('c', 140, struct crypt_auth_op64)
+#define CIOCASYNCCRYPT64	_IOW('c', 141, struct crypt_op64)
+#define CIOCASYNCFETCH64	_IOR('c', 142, struct crypt_op64)
+#define CIOCCRYPT_MULTI64	_IOW('c', 143, struct crypt_multi_op64)
+#define CIOCAUTHCRYPT_MULTI64	_IOW('c', 144, struct crypt_multi_op64)
+
+/* CIOCHASH_MULTI, CIOCCRYPTV, the session batches, CIOCCRYPT_SECTORS,
+ * CIOCHASHFD, CIOCSTREAM, the hash states and CIOCHASHMEM with the
+ * fixed-layout structures; CIOCGSESSION_MULTI64 takes an array of
+ * session_op64 */
+#define CIOCHASH_MULTI64	_IOW('c', 145, struct crypt_hash_multi_op64)
+#define CIOCCRYPTV64		_IOW('c', 146, struct crypt_iov_op64)
+#define CIOCGSESSION_MULTI64	_IOW('c', 147, struct crypt_multi_op64)
+#define CIOCFSESSION_MULTI64	_IOW('c', 148, struct crypt_multi_op64)
+#define CIOCCRYPT_SECTORS64	_IOW('c', 149, struct crypt_sector_op64)
+#define CIOCHASHFD64		_IOWR('c', 150, struct crypt_fd_op64)
+#define CIOCSTREAM64		_IOW('c', 151, struct crypt_stream_op64)
+#define CIOCHASHEXPORT64	_IOWR('c', 152, struct crypt_hash_state_op64)
+#define CIOCHASHIMPORT64	_IOW('c', 153, struct crypt_hash_state_op64)
+#define CIOCHASHMEM64		_IOWR('c', 154, struct crypt_hash_mem_op64)
+
 #endif /* L_CRYPTODEV_H */
@@ -17,6 +17,10 @@
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/scatterlist.h>
+#include <linux/hashtable.h>
+#include <linux/rhashtable.h>
+#include <linux/kref.h>
+#include <linux/cache.h>
 #include <crypto/cryptodev.h>
 #include <crypto/aead.h>
 
@@ -36,10 +40,28 @@
 
 
 extern int cryptodev_verbosity;
+extern int cryptodev_tfm_cache;
+extern int cryptodev_share_keys;
+extern struct workqueue_struct *cryptodev_wq;
+
+/* sessions are hashed by their sid, in a table that grows and shrinks
+ * with them where the kernel can resize one */
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 6, 0))
+#define CRYPTODEV_SESSION_HASH_BITS 10
+#endif
 
 struct fcrypt {
-	struct list_head list;
+	/* readers walk the table under RCU, fcr->sem serializes writers */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0))
+	struct rhashtable sessions;
+#else
+	DECLARE_HASHTABLE(sessions, CRYPTODEV_SESSION_HASH_BITS);
+#endif
 	struct mutex sem;
+
+	/* buffers registered with CIOCREGBUF, see zc.c */
+	struct list_head bufs;
+	uint32_t buf_id;
 };
 
 /* compatibility stuff */
@@ -61,6 +83,25 @@ struct compat_session_op {
 	uint32_t	ses;		/* session identifier */
 };
 
+struct compat_session2_op {
+	uint32_t	cipher;		/* cryptodev_crypto_op_t */
+	uint32_t	mac;		/* cryptodev_crypto_op_t */
+
+	uint32_t	keylen;
+	compat_uptr_t	key;		/* pointer to key data */
+	uint32_t	mackeylen;
+	compat_uptr_t	mackey;		/* pointer to mac key data */
+
+	uint32_t	ses;		/* session identifier */
+	uint32_t	flags;		/* SES_FLAG_* */
+	uint32_t	engines;
+	uint32_t	poll_us;
+	uint32_t	node;
+	uint32_t	__reserved[3];
+	char		cipher_driver[CRYPTODEV_MAX_ALG_NAME];
+	char		mac_driver[CRYPTODEV_MAX_ALG_NAME];
+};
+
 /* input of CIOCCRYPT */
 struct compat_crypt_op {
 	uint32_t	ses;		/* session identifier */
@@ -75,18 +116,29 @@ struct compat_crypt_op {
 
 /* compat ioctls, defined for the above structs */
 #define COMPAT_CIOCGSESSION    _IOWR('c', 102, struct compat_session_op)
+#define COMPAT_CIOCCLONESESSION _IOWR('c', 123, struct compat_session_op)
+#define COMPAT_CIOCSETKEY      _IOW('c', 124, struct compat_session_op)
+#define COMPAT_CIOCGSESSION2   _IOWR('c', 127, struct compat_session2_op)
+/* and of those built before it had driver names */
+#define COMPAT_CIOCGSESSION2_V1 _IOC(_IOC_READ | _IOC_WRITE, 'c', 127, \
+		offsetof(struct compat_session2_op, cipher_driver))
 #define COMPAT_CIOCCRYPT       _IOWR('c', 104, struct compat_crypt_op)
 #define COMPAT_CIOCASYNCCRYPT  _IOW('c', 107, struct compat_crypt_op)
 #define COMPAT_CIOCASYNCFETCH  _IOR('c', 108, struct compat_crypt_op)
 
 #endif /* CONFIG_COMPAT */
 
+/* CIOCGSESSION2 of binaries built before session2_op had driver names */
+#define CIOCGSESSION2_V1 _IOC(_IOC_READ | _IOC_WRITE, 'c', 127, \
+		offsetof(struct session2_op, cipher_driver))
+
 /* kernel-internal extension to struct crypt_op */
 struct kernel_crypt_op {
 	struct crypt_op cop;
 
 	int ivlen;
 	__u8 iv[EALG_MAX_BLOCK_LEN];
+	int iv_gen; /* the IV comes from the session, cop.iv receives it */
 
 	int digestsize;
 	uint8_t hash_output[AALG_MAX_RESULT_LEN];
@@ -101,6 +153,7 @@ struct kernel_crypt_auth_op {
 	int dst_len; /* based on src_len + pad + tag */
 	int ivlen;
 	__u8 iv[EALG_MAX_BLOCK_LEN];
+	int iv_gen; /* the IV comes from the session, caop.iv receives it */
 
 	struct task_struct *task;
 	struct mm_struct *mm;
@@ -112,34 +165,197 @@ int kcaop_from_user(struct kernel_crypt_auth_op *kcop,
 			struct fcrypt *fcr, void __user *arg);
 int kcaop_to_user(struct kernel_crypt_auth_op *kcaop,
 		struct fcrypt *fcr, void __user *arg);
+int kcaop64_from_user(struct kernel_crypt_auth_op *kcaop,
+			struct fcrypt *fcr, void __user *arg);
+int kcaop64_to_user(struct kernel_crypt_auth_op *kcaop,
+		struct fcrypt *fcr, void __user *arg);
 int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop);
+int crypto_srtp_setup(struct fcrypt *fcr, struct crypt_srtp_op *srop);
+unsigned int crypto_auth_run_batch(struct fcrypt *fcr,
+		struct kernel_crypt_auth_op *kcaop, int *rets, unsigned int n,
+		int stop);
 int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop);
+int crypto_hash_multi(struct fcrypt *fcr, struct crypt_hash_multi_op *hmop,
+		size_t size,
+		int (*from_user)(struct crypt_hash_vec *vec, void __user *arg));
+int crypto_run_iov(struct fcrypt *fcr, struct crypt_iov_op *iop,
+		int (*from_user)(struct crypt_iovec *iov, void __user *arg,
+				unsigned int cnt));
+int crypto_run_sectors(struct fcrypt *fcr, struct crypt_sector_op *sop);
+int crypto_hash_fd(struct fcrypt *fcr, struct crypt_fd_op *fop);
+int crypto_hash_mem(struct fcrypt *fcr, struct crypt_hash_mem_op *hmop);
 
 #include <cryptlib.h>
+#include "stats.h"
 
 /* other internal structs */
-struct csession {
-	struct list_head entry;
-	struct mutex sem;
-	struct cipher_data cdata;
-	struct hash_data hdata;
-	uint32_t sid;
-	uint32_t alignmask;
 
+#define SMALL_OP_MAX 64
+
+/* older kernels only define it where DMA is not cache coherent */
+#ifndef ARCH_DMA_MINALIGN
+#define ARCH_DMA_MINALIGN __alignof__(unsigned long long)
+#endif
+
+/* the alignment of the small buffer: safe for DMA, and enough for the
+ * alignmask of engines that want up to a cache line */
+#define SMALL_OP_ALIGN (ARCH_DMA_MINALIGN > SMP_CACHE_BYTES ? \
+		ARCH_DMA_MINALIGN : SMP_CACHE_BYTES)
+
+/* user pages pinned for a zero-copy operation; the arrays are
+ * allocated by the first operation that needs them */
+struct cryptodev_pages {
 	unsigned int array_size;
+	unsigned int small_ops; /* since the arrays were last well used */
 	unsigned int used_pages; /* the number of pages that are used */
 	/* the number of pages marked as NOT-writable; they preceed writeables */
 	unsigned int readonly_pages;
 	struct page **pages;
 	struct scatterlist *sg;
+
+	/* bounce area for operations that cannot use zero copy, taken by
+	 * the first operation that needs it and given back to the pool
+	 * when the session or request is freed */
+	char *bounce;
+	unsigned int bounce_order;
+	int node;	/* the NUMA node all of them go to */
+
+	/* operations of at most SMALL_OP_MAX bytes are copied here, which
+	 * is cheaper than pinning their pages; it may be mapped for DMA,
+	 * so it is last and has SMALL_OP_ALIGN, which also pads the
+	 * struct to it. The structs containing it come from slab caches
+	 * of their own, which honour that alignment. */
+	uint8_t small[SMALL_OP_MAX] __aligned(SMALL_OP_ALIGN);
+};
+
+/* size of the bounce area we try to get, and the number of them kept
+ * for new sessions once their owners are freed */
+#define BOUNCE_ORDER 4
+#define BOUNCE_POOL_SIZE 16
+void __release_bounce_buf(struct cryptodev_pages *zc);
+static inline void release_bounce_buf(struct cryptodev_pages *zc)
+{
+	if (zc->bounce)
+		__release_bounce_buf(zc);
+}
+void cryptodev_bounce_pool_flush(void);
+
+/* the largest associated data of CIOCAUTHCRYPT, and the size up to
+ * which it is kept in the session rather than allocated */
+#define MAX_AUTH_DATA	(64 * 1024)
+#define AUTH_BUF_SIZE	64
+
+/* The state of an SRTP stream: the rollover counter and the highest
+ * sequence number seen with it, as of RFC 3711 section 3.3.1 */
+struct cryptodev_srtp {
+	uint8_t salt[14];
+	uint8_t init;	/* set up with CIOCSRTPSETUP */
+	uint8_t seen;	/* s_l is valid */
+	uint32_t roc;
+	uint16_t s_l;
 };
 
+struct csession {
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0))
+	struct rhash_head entry;
+#else
+	struct hlist_node entry;
+#endif
+	struct kref refcount;
+	struct rcu_head rcu;
+	struct mutex sem;
+	struct cipher_data cdata;
+	struct hash_data hdata;
+	uint32_t sid;
+	uint32_t alignmask;
+	/* the algorithms, SES_FLAG_* and drivers it was created with,
+	 * for CIOCCLONESESSION */
+	uint32_t cipher, mac;
+	uint32_t flags;
+	char cipher_driver[CRYPTODEV_MAX_ALG_NAME];
+	char mac_driver[CRYPTODEV_MAX_ALG_NAME];
+	/* the transforms operations on requests of their own are spread
+	 * over, none if there is just cdata's */
+	struct cryptodev_engine *engines;
+	unsigned int nengines;
+	/* how long operations poll before sleeping, in microseconds */
+	unsigned int poll_us;
+	/* the NUMA node of the session and its requests */
+	int node;
+	/* the exported session whose transform cdata borrows with
+	 * CIOCSESATTACH; the one that is exported is marked shared */
+	struct csession *parent;
+	int shared;
+	/* the next IV with SES_FLAG_IV_GEN, see crypto_gen_iv() */
+	uint8_t next_iv[EALG_MAX_BLOCK_LEN];
+	/* the SRTP context of CIOCSRTPSETUP */
+	struct cryptodev_srtp srtp;
+
+	struct cryptodev_pages zc;
+	/* a copy of the source list for a hash that runs next to the
+	 * cipher, since the engines may both map it for DMA */
+	struct scatterlist *hash_sg;
+	unsigned int hash_sg_size;
+	struct cryptodev_ses_stats stats;
+
+	/* cached requests for operations that run in parallel */
+	spinlock_t reqs_lock;
+	struct list_head reqs;
+	unsigned int nreqs;
+	/* requests in use, CIOCSETKEY waits for them */
+	unsigned int nactive;
+	/* CIOCASYNCCRYPT jobs submitted straight to the crypto API, which
+	 * complete in any context; CIOCSETKEY waits for them too */
+	atomic_t ndirect;
+	wait_queue_head_t reqs_idle;
+
+	/* associated data of CIOCAUTHCRYPT that is short enough; it may be
+	 * mapped for DMA, so it is last and starts a cache line of its own */
+	uint8_t auth_buf[AUTH_BUF_SIZE] ____cacheline_aligned;
+};
+
+/* One of the transforms of a session with several engines. The first
+ * one is the session's own cdata. */
+struct cryptodev_engine {
+	struct cipher_data *cdata;
+	struct cipher_data own;
+	atomic_t inflight;	/* operations running on it */
+};
+
+/* The state of a single operation on a cipher-only session. Unlike the
+ * one embedded in struct csession, using it does not require holding
+ * the session locked. */
+struct cryptodev_req {
+	struct list_head entry;
+	struct cipher_data cdata; /* borrows the transform of the session */
+	struct cryptodev_engine *engine; /* the one it borrows, or NULL */
+	struct cryptodev_pages zc;
+};
+
+/* the number of unused requests a session keeps around */
+#define MAX_SESSION_REQS 8
+
 struct csession *crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid);
+void crypto_put_session(struct csession *ses_ptr);
+void crypto_release_session(struct csession *ses_ptr);
+struct cryptodev_engine *crypto_get_engine(struct csession *ses_ptr);
+struct cryptodev_req *crypto_get_req(struct csession *ses_ptr);
+void crypto_put_req(struct csession *ses_ptr, struct cryptodev_req *req);
+int adjust_sg_array(struct cryptodev_pages *zc, int pagecount);
+void crypto_gen_iv(struct csession *ses_ptr, uint8_t *iv, size_t len);
+int crypto_cipher_chains(struct csession *ses_ptr);
+
+/* Whether the IV of an operation comes from the session: only for
+ * encryptions, a decryption needs the IV the data were encrypted with */
+static inline int crypto_op_gen_iv(struct csession *ses_ptr, int op)
+{
+	return (ses_ptr->flags & SES_FLAG_IV_GEN) && op == COP_ENCRYPT;
+}
 
-static inline void crypto_put_session(struct csession *ses_ptr)
+static inline void crypto_put_engine(struct cryptodev_engine *engine)
 {
-	mutex_unlock(&ses_ptr->sem);
+	if (engine)
+		atomic_dec(&engine->inflight);
 }
-int adjust_sg_array(struct csession *ses, int pagecount);
 
 #endif /* CRYPTODEV_INT_H */
@@ -0,0 +1,175 @@
+/* Tracepoints of /dev/crypto. The events mark the boundaries of the
+ * steps of an operation, so that the time spent in each can be told
+ * apart with perf or bpftrace. */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cryptodev
+
+#if !defined(CRYPTODEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define CRYPTODEV_TRACE_H
+
+#include <linux/version.h>
+#include <linux/tracepoint.h>
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0))
+# define cryptodev_assign_str(dst, src) __assign_str(dst)
+#else
+# define cryptodev_assign_str(dst, src) __assign_str(dst, src)
+#endif
+
+/* an operation entered crypto_run() or crypto_auth_run() */
+TRACE_EVENT(cryptodev_op_start,
+	TP_PROTO(u32 sid, u16 op, u32 len, u16 flags),
+	TP_ARGS(sid, op, len, flags),
+	TP_STRUCT__entry(
+		__field(u32, sid)
+		__field(u16, op)
+		__field(u16, flags)
+		__field(u32, len)
+	),
+	TP_fast_assign(
+		__entry->sid = sid;
+		__entry->op = op;
+		__entry->flags = flags;
+		__entry->len = len;
+	),
+	TP_printk("sid=0x%08x op=%u len=%u flags=0x%x", __entry->sid,
+		__entry->op, __entry->len, __entry->flags)
+);
+
+/* the session was found and locked */
+TRACE_EVENT(cryptodev_session_found,
+	TP_PROTO(u32 sid, const char *driver),
+	TP_ARGS(sid, driver),
+	TP_STRUCT__entry(
+		__field(u32, sid)
+		__string(driver, driver)
+	),
+	TP_fast_assign(
+		__entry->sid = sid;
+		cryptodev_assign_str(driver, driver);
+	),
+	TP_printk("sid=0x%08x driver=%s", __entry->sid, __get_str(driver))
+);
+
+TRACE_EVENT(cryptodev_op_done,
+	TP_PROTO(u32 sid, u16 op, u32 len, const char *driver, int zc, int ret),
+	TP_ARGS(sid, op, len, driver, zc, ret),
+	TP_STRUCT__entry(
+		__field(u32, sid)
+		__field(u16, op)
+		__field(u16, zc)
+		__field(u32, len)
+		__field(int, ret)
+		__string(driver, driver)
+	),
+	TP_fast_assign(
+		__entry->sid = sid;
+		__entry->op = op;
+		__entry->zc = zc;
+		__entry->len = len;
+		__entry->ret = ret;
+		cryptodev_assign_str(driver, driver);
+	),
+	TP_printk("sid=0x%08x op=%u len=%u driver=%s %s ret=%d",
+		__entry->sid, __entry->op, __entry->len, __get_str(driver),
+		__entry->zc ? "zc" : "bounced", __entry->ret)
+);
+
+/* pinning and unpinning of the user pages in zc.c */
+TRACE_EVENT(cryptodev_pin_start,
+	TP_PROTO(u32 len),
+	TP_ARGS(len),
+	TP_STRUCT__entry(
+		__field(u32, len)
+	),
+	TP_fast_assign(
+		__entry->len = len;
+	),
+	TP_printk("len=%u", __entry->len)
+);
+
+DECLARE_EVENT_CLASS(cryptodev_pages,
+	TP_PROTO(unsigned int pages, int ret),
+	TP_ARGS(pages, ret),
+	TP_STRUCT__entry(
+		__field(unsigned int, pages)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->pages = pages;
+		__entry->ret = ret;
+	),
+	TP_printk("pages=%u ret=%d", __entry->pages, __entry->ret)
+);
+
+DEFINE_EVENT(cryptodev_pages, cryptodev_pin_end,
+	TP_PROTO(unsigned int pages, int ret),
+	TP_ARGS(pages, ret)
+);
+
+DEFINE_EVENT(cryptodev_pages, cryptodev_unpin_start,
+	TP_PROTO(unsigned int pages, int ret),
+	TP_ARGS(pages, ret)
+);
+
+DEFINE_EVENT(cryptodev_pages, cryptodev_unpin_end,
+	TP_PROTO(unsigned int pages, int ret),
+	TP_ARGS(pages, ret)
+);
+
+/* a request is handed to the crypto API */
+#define CRYPTODEV_SUBMIT_DECRYPT	0
+#define CRYPTODEV_SUBMIT_ENCRYPT	1
+#define CRYPTODEV_SUBMIT_HASH		2
+
+TRACE_EVENT(cryptodev_crypto_submit,
+	TP_PROTO(const char *driver, u32 len, int kind),
+	TP_ARGS(driver, len, kind),
+	TP_STRUCT__entry(
+		__string(driver, driver)
+		__field(u32, len)
+		__field(int, kind)
+	),
+	TP_fast_assign(
+		cryptodev_assign_str(driver, driver);
+		__entry->len = len;
+		__entry->kind = kind;
+	),
+	TP_printk("driver=%s len=%u %s", __get_str(driver), __entry->len,
+		__print_symbolic(__entry->kind,
+			{ CRYPTODEV_SUBMIT_DECRYPT, "decrypt" },
+			{ CRYPTODEV_SUBMIT_ENCRYPT, "encrypt" },
+			{ CRYPTODEV_SUBMIT_HASH, "hash" }))
+);
+
+/* waiting in waitfor() for an asynchronous request */
+DECLARE_EVENT_CLASS(cryptodev_wait,
+	TP_PROTO(int ret),
+	TP_ARGS(ret),
+	TP_STRUCT__entry(
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->ret = ret;
+	),
+	TP_printk("ret=%d", __entry->ret)
+);
+
+DEFINE_EVENT(cryptodev_wait, cryptodev_wait_start,
+	TP_PROTO(int ret),
+	TP_ARGS(ret)
+);
+
+DEFINE_EVENT(cryptodev_wait, cryptodev_wait_end,
+	TP_PROTO(int ret),
+	TP_ARGS(ret)
+);
+
+#endif /* CRYPTODEV_TRACE_H */
+
+/* this part must be outside the protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE cryptodev_trace
+#include <trace/define_trace.h>
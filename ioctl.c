@@ -41,6 +41,11 @@
 #include <linux/syscalls.h>
 #include <linux/pagemap.h>
 #include <linux/poll.h>
+#include <linux/llist.h>
+#include <linux/eventfd.h>
+#include <linux/anon_inodes.h>
+#include <linux/capability.h>
+#include <linux/file.h>
 #include <linux/uaccess.h>
 #include <crypto/cryptodev.h>
 #include <linux/scatterlist.h>
@@ -48,22 +53,33 @@
 #include <crypto/authenc.h>
 
 #include <linux/sysctl.h>
+#include <linux/topology.h>
 
 #include "cryptodev_int.h"
 #include "zc.h"
+#include "ring.h"
+#include "stream.h"
+#include "pk.h"
 #include "version.h"
 #include "cipherapi.h"
 
+#define CREATE_TRACE_POINTS
+#include "cryptodev_trace.h"
+
 MODULE_AUTHOR("Nikos Mavrogiannopoulos <nmav@gnutls.org>");
 MODULE_DESCRIPTION("CryptoDev driver");
 MODULE_LICENSE("GPL");
 
 /* ====== Compile-time config ====== */
 
-/* Default (pre-allocated) and maximum size of the job queue.
- * These are free, pending and done items all together. */
-#define DEF_COP_RINGSIZE 16
-#define MAX_COP_RINGSIZE 64
+/* Default depth of the job queue of a descriptor and the default of the
+ * most that CIOCASYNCDEPTH can set. These are free, pending and done
+ * items all together, allocated as jobs are submitted. */
+#define DEF_COP_RINGSIZE 64
+#define MAX_COP_RINGSIZE 4096
+
+/* Upper limit for the number of async workers per file descriptor */
+#define MAX_CRYPT_LANES 64
 
 /* ====== Module parameters ====== */
 
@@ -71,24 +87,91 @@ int cryptodev_verbosity;
 module_param(cryptodev_verbosity, int, 0644);
 MODULE_PARM_DESC(cryptodev_verbosity, "0: normal, 1: verbose, 2: debug");
 
+int cryptodev_tfm_cache = 64;
+module_param(cryptodev_tfm_cache, int, 0644);
+MODULE_PARM_DESC(cryptodev_tfm_cache,
+	"number of idle transforms kept for new sessions (0: none)");
+
+int cryptodev_share_keys = 1;
+module_param(cryptodev_share_keys, int, 0644);
+MODULE_PARM_DESC(cryptodev_share_keys,
+	"share the transform of the HMAC sessions of a user with the same key");
+
+static int cryptodev_async_queue = DEF_COP_RINGSIZE;
+module_param(cryptodev_async_queue, int, 0644);
+MODULE_PARM_DESC(cryptodev_async_queue,
+	"number of async jobs a descriptor can have queued by default");
+
+static int cryptodev_async_queue_max = MAX_COP_RINGSIZE;
+module_param(cryptodev_async_queue_max, int, 0644);
+MODULE_PARM_DESC(cryptodev_async_queue_max,
+	"most async jobs a descriptor can have queued with CIOCASYNCDEPTH");
+
+static int cryptodev_async_lanes;
+module_param(cryptodev_async_lanes, int, 0644);
+MODULE_PARM_DESC(cryptodev_async_lanes,
+	"number of CPUs async jobs of a descriptor are spread over (0: all online)");
+
+#ifdef ENABLE_ASYNC
+static int cryptodev_async_direct = 1;
+module_param(cryptodev_async_direct, int, 0644);
+MODULE_PARM_DESC(cryptodev_async_direct,
+	"complete async cipher jobs from the crypto API callback instead of a worker");
+#endif
+
 /* ====== CryptoAPI ====== */
 struct todo_list_item {
-	struct list_head __hook;
+	struct list_head __hook;	/* on the done list */
+	struct llist_node node;		/* on the free or a todo list */
 	struct kernel_crypt_op kcop;
 	int result;
+
+	/* state of a job that is completed by the crypto API callback */
+	struct crypt_priv *pcr;
+	struct csession *ses;
+	struct cryptodev_engine *engine;
+	cryptodev_blkcipher_request_t *req;
+	struct cryptodev_pages zc;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	ktime_t start;
 };
 
-struct locked_list {
-	struct list_head list;
-	struct mutex lock;
+static struct kmem_cache *cryptodev_item_cache;
+
+/* An async worker bound to a CPU. Jobs of a session always go to the
+ * same lane, so they complete in the order they were submitted; the
+ * COP_FLAG_PRIO ones are run first, in order among themselves. */
+struct crypt_lane {
+	struct crypt_priv *pcr;
+	struct llist_head todo;
+	struct llist_head prio;
+	struct work_struct cryptask;
+	int cpu;
+	int node;
 };
 
 struct crypt_priv {
 	struct fcrypt fcrypt;
-	struct locked_list free, todo, done;
-	int itemcount;
-	struct work_struct cryptask;
+	/* Jobs are returned to the free list locklessly, taking one off
+	 * needs the lock to be serialized against other submitters. */
+	struct {
+		struct llist_head list;
+		spinlock_t lock;
+	} free;
+	/* jobs may be completed from interrupt context */
+	struct {
+		struct list_head list;
+		spinlock_t lock;
+		int inflight;	/* jobs submitted to the crypto API */
+		struct eventfd_ctx *evfd;	/* counts completed jobs */
+	} done;
+	int itemcount;	/* allocated, under free.lock */
+	int depth;	/* the most itemcount can grow to */
+	struct crypt_lane *lanes;
+	int nlanes;
 	wait_queue_head_t user_waiter;
+	struct crypt_ring *ring;
+	struct crypt_stream *stream;
 };
 
 #define FILL_SG(sg, ptr, len)					\
@@ -100,14 +183,212 @@ struct crypt_priv {
 	} while (0)
 
 /* cryptodev's own workqueue, keeps crypto tasks from disturbing the force */
-static struct workqueue_struct *cryptodev_wq;
+struct workqueue_struct *cryptodev_wq;
+
+/* sessions come and go with every TLS handshake, so they have a slab
+ * cache of their own */
+static struct kmem_cache *cryptodev_ses_cache;
+/* and so do their requests, which keep the DMA alignment of zc.small */
+static struct kmem_cache *cryptodev_req_cache;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0))
+/* a descriptor with a few sessions only has a few buckets */
+static const struct rhashtable_params crypto_session_params = {
+	.key_len = sizeof(uint32_t),
+	.key_offset = offsetof(struct csession, sid),
+	.head_offset = offsetof(struct csession, entry),
+	.automatic_shrinking = true,
+};
 
-/* Prepare session for future use. */
+static inline int
+crypto_init_session_table(struct fcrypt *fcr)
+{
+	return rhashtable_init(&fcr->sessions, &crypto_session_params);
+}
+
+/* Find a session in the table. Must be called under rcu_read_lock()
+ * or with fcr->sem held; no reference is taken. */
+static struct csession *
+crypto_find_session(struct fcrypt *fcr, uint32_t sid)
+{
+	return rhashtable_lookup_fast(&fcr->sessions, &sid,
+			crypto_session_params);
+}
+
+/* Returns -EEXIST if the sid is taken */
+static inline int
+crypto_add_session(struct fcrypt *fcr, struct csession *ses_ptr)
+{
+	return rhashtable_lookup_insert_fast(&fcr->sessions, &ses_ptr->entry,
+			crypto_session_params);
+}
+
+static inline void
+crypto_del_session(struct fcrypt *fcr, struct csession *ses_ptr)
+{
+	rhashtable_remove_fast(&fcr->sessions, &ses_ptr->entry,
+			crypto_session_params);
+}
+#else
+static inline int
+crypto_init_session_table(struct fcrypt *fcr)
+{
+	hash_init(fcr->sessions);
+	return 0;
+}
+
+static struct csession *
+crypto_find_session(struct fcrypt *fcr, uint32_t sid)
+{
+	struct csession *ses_ptr;
+
+	hash_for_each_possible_rcu(fcr->sessions, ses_ptr, entry, sid) {
+		if (ses_ptr->sid == sid)
+			return ses_ptr;
+	}
+
+	return NULL;
+}
+
+static inline int
+crypto_add_session(struct fcrypt *fcr, struct csession *ses_ptr)
+{
+	if (crypto_find_session(fcr, ses_ptr->sid))
+		return -EEXIST;
+
+	hash_add_rcu(fcr->sessions, &ses_ptr->entry, ses_ptr->sid);
+	return 0;
+}
+
+static inline void
+crypto_del_session(struct fcrypt *fcr, struct csession *ses_ptr)
+{
+	hash_del_rcu(&ses_ptr->entry);
+}
+#endif
+
+/* the counters of the drivers a session runs on */
+static struct cryptodev_alg_stats *
+crypto_session_alg_stats(struct csession *ses_ptr)
+{
+	const char *cipher = NULL, *hash = NULL;
+	struct crypto_tfm *tfm;
+
+	if (ses_ptr->cdata.init) {
+		if (ses_ptr->cdata.aead == 0)
+			tfm = cryptodev_crypto_blkcipher_tfm(ses_ptr->cdata.async.s);
+		else
+			tfm = crypto_aead_tfm(ses_ptr->cdata.async.as);
+		cipher = crypto_tfm_alg_driver_name(tfm);
+	}
+	if (ses_ptr->hdata.init)
+		hash = crypto_tfm_alg_driver_name(
+				crypto_ahash_tfm(ses_ptr->hdata.async.s));
+
+	return cryptodev_stats_get_alg(cipher, hash);
+}
+
+/* Free a session that never made it to the table. We count on it to
+ * be initialized with zeroes. Since hdata and cdata are embedded within
+ * it, it follows that hdata->init and cdata->init are either zero or
+ * one as they have been initialized or not */
+static void
+crypto_free_engines(struct csession *ses_ptr)
+{
+	unsigned int i;
+
+	for (i = 1; i < ses_ptr->nengines; i++)
+		cryptodev_cipher_deinit(&ses_ptr->engines[i].own);
+	kfree(ses_ptr->engines);
+}
+
+static void
+crypto_free_unused_session(struct csession *ses_ptr)
+{
+	cryptodev_hash_deinit(&ses_ptr->hdata);
+	crypto_free_engines(ses_ptr);
+	cryptodev_cipher_deinit(&ses_ptr->cdata);
+	kfree(ses_ptr->zc.sg);
+	kfree(ses_ptr->zc.pages);
+	kmem_cache_free(cryptodev_ses_cache, ses_ptr);
+}
+
+/* The rest of a session whose transforms are set up */
+static void
+crypto_init_session(struct csession *ses_new)
+{
+	ses_new->stats.alg = crypto_session_alg_stats(ses_new);
+
+	mutex_init(&ses_new->sem);
+	kref_init(&ses_new->refcount);
+	spin_lock_init(&ses_new->reqs_lock);
+	INIT_LIST_HEAD(&ses_new->reqs);
+	init_waitqueue_head(&ses_new->reqs_idle);
+}
+
+/* Fill sel with the implementation the SES_FLAG_* flags and driver,
+ * which may be empty, ask for. Returns NULL to leave the choice to
+ * the crypto API. */
+static const struct cryptodev_alg_sel *
+crypto_session_alg_sel(struct cryptodev_alg_sel *sel, uint32_t flags,
+		const char *driver)
+{
+	sel->driver = driver[0] ? driver : NULL;
+	sel->type = 0;
+	sel->mask = 0;
+#ifdef CRYPTO_ALG_KERN_DRIVER_ONLY
+	if (flags & (SES_FLAG_HW_ONLY | SES_FLAG_SW_ONLY))
+		sel->mask = CRYPTO_ALG_KERN_DRIVER_ONLY;
+	if (flags & SES_FLAG_HW_ONLY)
+		sel->type = CRYPTO_ALG_KERN_DRIVER_ONLY;
+#endif
+
+	return sel->driver || sel->mask ? sel : NULL;
+}
+
+/* Give the session n - 1 more transforms of its cipher, with the same
+ * key. The session frees them, also on errors. */
 static int
-crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
+crypto_add_engines(struct csession *ses_ptr, unsigned int n,
+		const char *alg_name, const struct cryptodev_alg_sel *sel,
+		uint8_t *key, size_t keylen, int stream)
 {
-	struct csession	*ses_new = NULL, *ses_ptr;
-	int ret = 0;
+	unsigned int i;
+	int ret;
+
+	ses_ptr->engines = kzalloc_node(n * sizeof(*ses_ptr->engines),
+			GFP_KERNEL, ses_ptr->node);
+	if (unlikely(!ses_ptr->engines))
+		return -ENOMEM;
+	ses_ptr->nengines = n;
+
+	ses_ptr->engines[0].cdata = &ses_ptr->cdata;
+	for (i = 1; i < n; i++) {
+		ret = cryptodev_cipher_init(&ses_ptr->engines[i].own, alg_name,
+				sel, key, keylen, stream, 0);
+		if (unlikely(ret < 0))
+			return ret;
+		ses_ptr->engines[i].cdata = &ses_ptr->engines[i].own;
+	}
+
+	return 0;
+}
+
+/* the options of sessions that are not created with CIOCGSESSION2 */
+static const struct session2_op default_session_opts;
+
+/* Set up a session as described by sop, with the options of opts, or
+ * the defaults if it is NULL. It is not visible to lookups until it was
+ * handed to crypto_insert_session(). */
+static struct csession *
+crypto_alloc_session(struct session_op *sop, const struct session2_op *opts)
+{
+	struct cryptodev_alg_sel csel, hsel;
+	const struct cryptodev_alg_sel *cipher_sel;
+	uint32_t flags;
+	struct csession	*ses_new = NULL;
+	unsigned int i;
+	int node, ret = 0;
 	const char *alg_name = NULL;
 	const char *hash_name = NULL;
 	int hmac_mode = 1, stream = 0, aead = 0;
@@ -123,10 +404,14 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 		uint8_t pad[RTA_SPACE(sizeof(struct crypto_authenc_key_param))];
 	} keys;
 
+	if (!opts)
+		opts = &default_session_opts;
+	flags = opts->flags;
+
 	/* Does the request make sense? */
 	if (unlikely(!sop->cipher && !sop->mac)) {
 		ddebug(1, "Both 'cipher' and 'mac' unset.");
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	switch (sop->cipher) {
@@ -147,6 +432,9 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 	case CRYPTO_AES_ECB:
 		alg_name = "ecb(aes)";
 		break;
+	case CRYPTO_AES_XTS:
+		alg_name = "xts(aes)";
+		break;
 	case CRYPTO_CAMELLIA_CBC:
 		alg_name = "cbc(camellia)";
 		break;
@@ -165,7 +453,7 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 		break;
 	default:
 		ddebug(1, "bad cipher: %d", sop->cipher);
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	switch (sop->mac) {
@@ -225,14 +513,79 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 		break;
 	default:
 		ddebug(1, "bad mac: %d", sop->mac);
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (unlikely(flags & ~(SES_FLAG_IV_GEN | SES_FLAG_HW_ONLY |
+			       SES_FLAG_SW_ONLY | SES_FLAG_NODE |
+			       SES_FLAG_SPLIT))) {
+		ddebug(1, "bad flags: 0x%x", flags);
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (unlikely((flags & SES_FLAG_HW_ONLY) && (flags & SES_FLAG_SW_ONLY))) {
+		ddebug(1, "both hardware and software only requested");
+		return ERR_PTR(-EINVAL);
+	}
+#ifndef CRYPTO_ALG_KERN_DRIVER_ONLY
+	/* hardware drivers cannot be told apart */
+	if (unlikely(flags & (SES_FLAG_HW_ONLY | SES_FLAG_SW_ONLY)))
+		return ERR_PTR(-EOPNOTSUPP);
+#endif
+
+	/* only operations on requests of their own are spread */
+	if (unlikely(opts->engines > CRYPTO_MAX_ENGINES ||
+		     (opts->engines > 1 && (!alg_name || aead || hash_name)))) {
+		ddebug(1, "bad number of engines: %u", opts->engines);
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (unlikely(opts->poll_us > CRYPTO_MAX_POLL_US)) {
+		ddebug(1, "bad polling time: %u us", opts->poll_us);
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (flags & SES_FLAG_NODE) {
+		if (unlikely(opts->node >= MAX_NUMNODES ||
+			     !node_online(opts->node))) {
+			ddebug(1, "bad NUMA node: %u", opts->node);
+			return ERR_PTR(-EINVAL);
+		}
+		node = opts->node;
+	} else {
+		node = numa_node_id();
+	}
+
+	/* counters only make safe IVs for these */
+	if (unlikely(flags & SES_FLAG_IV_GEN && sop->cipher != CRYPTO_AES_CTR &&
+		     sop->cipher != CRYPTO_AES_GCM)) {
+		ddebug(1, "IV generation is not supported for cipher %d",
+			sop->cipher);
+		return ERR_PTR(-EINVAL);
+	}
+
+	/* the chunks run on requests of their own */
+	if (unlikely(flags & SES_FLAG_SPLIT && (!alg_name || aead || hash_name))) {
+		ddebug(1, "splitting needs a cipher-only session");
+		return ERR_PTR(-EINVAL);
 	}
 
 	/* Create a session and put it to the list. Zeroing the structure helps
 	 * also with a single exit point in case of errors */
-	ses_new = kzalloc(sizeof(*ses_new), GFP_KERNEL);
+	ses_new = kmem_cache_alloc_node(cryptodev_ses_cache,
+			GFP_KERNEL | __GFP_ZERO, node);
 	if (!ses_new)
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
+	ses_new->node = node;
+	ses_new->zc.node = node;
+	ses_new->cipher = sop->cipher;
+	ses_new->mac = sop->mac;
+	ses_new->flags = flags;
+	ses_new->poll_us = opts->poll_us;
+	snprintf(ses_new->cipher_driver, sizeof(ses_new->cipher_driver), "%s",
+		 opts->cipher_driver);
+	snprintf(ses_new->mac_driver, sizeof(ses_new->mac_driver), "%s",
+		 opts->mac_driver);
 
 	/* Set-up crypto transform. */
 	if (alg_name) {
@@ -248,13 +601,30 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 		if (unlikely(ret < 0))
 			goto session_error;
 
-		ret = cryptodev_cipher_init(&ses_new->cdata, alg_name, keys.ckey,
-						keylen, stream, aead);
+		cipher_sel = crypto_session_alg_sel(&csel, flags,
+						    ses_new->cipher_driver);
+		ret = cryptodev_cipher_init(&ses_new->cdata, alg_name,
+				cipher_sel, keys.ckey, keylen, stream, aead);
 		if (ret < 0) {
 			ddebug(1, "Failed to load cipher for %s", alg_name);
 			ret = -EINVAL;
 			goto session_error;
 		}
+
+		if (opts->engines > 1) {
+			ret = crypto_add_engines(ses_new, opts->engines,
+					alg_name, cipher_sel, keys.ckey,
+					keylen, stream);
+			if (unlikely(ret < 0)) {
+				ddebug(1, "Failed to load %u engines for %s",
+				       opts->engines, alg_name);
+				goto session_error;
+			}
+		}
+
+		if (flags & SES_FLAG_IV_GEN)
+			get_random_bytes(ses_new->next_iv,
+					 ses_new->cdata.ivsize);
 	}
 
 	if (hash_name && aead == 0) {
@@ -271,8 +641,10 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 			goto session_error;
 		}
 
-		ret = cryptodev_hash_init(&ses_new->hdata, hash_name, hmac_mode,
-							keys.mkey, sop->mackeylen);
+		ret = cryptodev_hash_init(&ses_new->hdata, hash_name,
+				crypto_session_alg_sel(&hsel, flags,
+						       ses_new->mac_driver),
+				hmac_mode, keys.mkey, sop->mackeylen);
 		if (ret != 0) {
 			ddebug(1, "Failed to load hash for %s", hash_name);
 			ret = -EINVAL;
@@ -287,252 +659,973 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 
 	ses_new->alignmask = max(ses_new->cdata.alignmask,
 	                                          ses_new->hdata.alignmask);
+	ses_new->cdata.async.result.poll_us = opts->poll_us;
+	ses_new->hdata.async.result.poll_us = opts->poll_us;
+	for (i = 1; i < ses_new->nengines; i++)
+		ses_new->engines[i].own.async.result.poll_us = opts->poll_us;
 	ddebug(2, "got alignmask %d", ses_new->alignmask);
+	crypto_init_session(ses_new);
+	return ses_new;
 
-	ses_new->array_size = DEFAULT_PREALLOC_PAGES;
-	ddebug(2, "preallocating for %d user pages", ses_new->array_size);
-	ses_new->pages = kzalloc(ses_new->array_size *
-			sizeof(struct page *), GFP_KERNEL);
-	ses_new->sg = kzalloc(ses_new->array_size *
-			sizeof(struct scatterlist), GFP_KERNEL);
-	if (ses_new->sg == NULL || ses_new->pages == NULL) {
-		ddebug(0, "Memory error");
-		ret = -ENOMEM;
-		goto session_error;
-	}
-
-	/* put the new session to the list */
-	get_random_bytes(&ses_new->sid, sizeof(ses_new->sid));
-	mutex_init(&ses_new->sem);
-
-	mutex_lock(&fcr->sem);
-restart:
-	list_for_each_entry(ses_ptr, &fcr->list, entry) {
-		/* Check for duplicate SID */
-		if (unlikely(ses_new->sid == ses_ptr->sid)) {
-			get_random_bytes(&ses_new->sid, sizeof(ses_new->sid));
-			/* Unless we have a broken RNG this
-			   shouldn't loop forever... ;-) */
-			goto restart;
-		}
-	}
+session_error:
+	crypto_free_unused_session(ses_new);
+	return ERR_PTR(ret);
+}
 
-	list_add(&ses_new->entry, &fcr->list);
-	mutex_unlock(&fcr->sem);
+/* Give the session a nonzero ID and put it to the table. Called with
+ * fcr->sem held. */
+static int
+crypto_insert_session(struct fcrypt *fcr, struct csession *ses_new)
+{
+	int ret;
 
-	/* Fill in some values for the user. */
-	sop->ses = ses_new->sid;
-	return 0;
+	do {
+		/* Unless we have a broken RNG this
+		   shouldn't loop forever... ;-) */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0))
+		ses_new->sid = get_random_u32();
+#else
+		get_random_bytes(&ses_new->sid, sizeof(ses_new->sid));
+#endif
+		/* CIOCGSTATS takes sid 0 for the totals */
+		ret = ses_new->sid ? crypto_add_session(fcr, ses_new) : -EEXIST;
+	} while (unlikely(ret == -EEXIST));
 
-	/* We count on ses_new to be initialized with zeroes
-	 * Since hdata and cdata are embedded within ses_new, it follows that
-	 * hdata->init and cdata->init are either zero or one as they have been
-	 * initialized or not */
-session_error:
-	cryptodev_hash_deinit(&ses_new->hdata);
-	cryptodev_cipher_deinit(&ses_new->cdata);
-	kfree(ses_new->sg);
-	kfree(ses_new->pages);
-	kfree(ses_new);
 	return ret;
 }
 
-/* Everything that needs to be done when removing a session. */
-static inline void
-crypto_destroy_session(struct csession *ses_ptr)
+/* Prepare session for future use. */
+static int
+crypto_create_session(struct fcrypt *fcr, struct session_op *sop,
+		const struct session2_op *opts)
 {
-	if (!mutex_trylock(&ses_ptr->sem)) {
-		ddebug(2, "Waiting for semaphore of sid=0x%08X", ses_ptr->sid);
-		mutex_lock(&ses_ptr->sem);
+	struct csession *ses_new;
+	int ret;
+
+	ses_new = crypto_alloc_session(sop, opts);
+	if (IS_ERR(ses_new))
+		return PTR_ERR(ses_new);
+
+	mutex_lock(&fcr->sem);
+	ret = crypto_insert_session(fcr, ses_new);
+	mutex_unlock(&fcr->sem);
+	if (unlikely(ret)) {
+		crypto_release_session(ses_new);
+		return ret;
 	}
-	ddebug(2, "Removed session 0x%08X", ses_ptr->sid);
-	cryptodev_cipher_deinit(&ses_ptr->cdata);
-	cryptodev_hash_deinit(&ses_ptr->hdata);
-	ddebug(2, "freeing space for %d user pages", ses_ptr->array_size);
-	kfree(ses_ptr->pages);
-	kfree(ses_ptr->sg);
-	mutex_unlock(&ses_ptr->sem);
-	mutex_destroy(&ses_ptr->sem);
-	kfree(ses_ptr);
+
+	/* Fill in some values for the user. */
+	sop->ses = ses_new->sid;
+	return 0;
 }
 
-/* Look up a session by ID and remove. */
+/* CIOCGSESSION2: a session_op with options */
 static int
-crypto_finish_session(struct fcrypt *fcr, uint32_t sid)
+crypto_create_session2(struct fcrypt *fcr, struct session2_op *s2op)
 {
-	struct csession *tmp, *ses_ptr;
-	struct list_head *head;
-	int ret = 0;
+	struct session_op sop;
+	unsigned int i;
+	int ret;
 
-	mutex_lock(&fcr->sem);
-	head = &fcr->list;
-	list_for_each_entry_safe(ses_ptr, tmp, head, entry) {
-		if (ses_ptr->sid == sid) {
-			list_del(&ses_ptr->entry);
-			crypto_destroy_session(ses_ptr);
-			break;
+	for (i = 0; i < ARRAY_SIZE(s2op->__reserved); i++) {
+		if (unlikely(s2op->__reserved[i])) {
+			ddebug(1, "reserved fields of session2_op are set");
+			return -EINVAL;
 		}
 	}
 
-	if (unlikely(!ses_ptr)) {
-		derr(1, "Session with sid=0x%08X not found!", sid);
-		ret = -ENOENT;
+	sop.cipher = s2op->cipher;
+	sop.mac = s2op->mac;
+	sop.keylen = s2op->keylen;
+	sop.key = s2op->key;
+	sop.mackeylen = s2op->mackeylen;
+	sop.mackey = s2op->mackey;
+
+	if (unlikely(!memchr(s2op->cipher_driver, '\0',
+			     sizeof(s2op->cipher_driver)) ||
+		     !memchr(s2op->mac_driver, '\0', sizeof(s2op->mac_driver)))) {
+		ddebug(1, "driver names of session2_op are not terminated");
+		return -EINVAL;
 	}
-	mutex_unlock(&fcr->sem);
 
-	return ret;
+	ret = crypto_create_session(fcr, &sop, s2op);
+	if (unlikely(ret))
+		return ret;
+
+	s2op->ses = sop.ses;
+	return 0;
 }
 
-/* Remove all sessions when closing the file */
+/* Create a session with the algorithms of sop->ses and the keys in
+ * sop. The new session's transforms likely come from the idle ones
+ * of earlier sessions of the same algorithms. */
 static int
-crypto_finish_all_sessions(struct fcrypt *fcr)
+crypto_clone_session(struct fcrypt *fcr, struct session_op *sop)
 {
-	struct csession *tmp, *ses_ptr;
-	struct list_head *head;
-
-	mutex_lock(&fcr->sem);
+	struct csession *ses_ptr;
+	struct session2_op opts;
+
+	memset(&opts, 0, sizeof(opts));
+
+	/* the algorithms never change, no need to lock the session */
+	rcu_read_lock();
+	ses_ptr = crypto_find_session(fcr, sop->ses);
+	if (likely(ses_ptr)) {
+		sop->cipher = ses_ptr->cipher;
+		sop->mac = ses_ptr->mac;
+		opts.flags = ses_ptr->flags;
+		opts.engines = ses_ptr->nengines;
+		opts.poll_us = ses_ptr->poll_us;
+		opts.node = ses_ptr->node;
+		memcpy(opts.cipher_driver, ses_ptr->cipher_driver,
+		       sizeof(opts.cipher_driver));
+		memcpy(opts.mac_driver, ses_ptr->mac_driver,
+		       sizeof(opts.mac_driver));
+	}
+	rcu_read_unlock();
 
-	head = &fcr->list;
-	list_for_each_entry_safe(ses_ptr, tmp, head, entry) {
-		list_del(&ses_ptr->entry);
-		crypto_destroy_session(ses_ptr);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", sop->ses);
+		return -EINVAL;
 	}
-	mutex_unlock(&fcr->sem);
 
+	return crypto_create_session(fcr, sop, &opts);
+}
+
+/* An exported session; the descriptor holds a reference to it */
+static int
+crypto_ses_handle_release(struct inode *inode, struct file *filp)
+{
+	crypto_release_session(filp->private_data);
 	return 0;
 }
 
-/* Look up session by session ID. The returned session is locked. */
-struct csession *
-crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid)
+static const struct file_operations cryptodev_ses_fops = {
+	.owner = THIS_MODULE,
+	.release = crypto_ses_handle_release,
+};
+
+/* CIOCSESEXPORT: a descriptor for shop->ses, or for the session it is
+ * attached to */
+static int
+crypto_export_session(struct fcrypt *fcr, struct crypt_ses_share_op *shop)
 {
-	struct csession *ses_ptr, *retval = NULL;
+	struct csession *ses_ptr, *root;
+	int fd;
 
-	if (unlikely(fcr == NULL))
-		return NULL;
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, shop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", shop->ses);
+		return -EINVAL;
+	}
 
-	mutex_lock(&fcr->sem);
-	list_for_each_entry(ses_ptr, &fcr->list, entry) {
-		if (ses_ptr->sid == sid) {
-			mutex_lock(&ses_ptr->sem);
-			retval = ses_ptr;
-			break;
-		}
+	/* a generated IV would not be unique across the sessions */
+	if (unlikely(!ses_ptr->cdata.init || ses_ptr->cdata.aead ||
+		     ses_ptr->hdata.init ||
+		     (ses_ptr->flags & SES_FLAG_IV_GEN))) {
+		ddebug(1, "only cipher-only sessions can be shared");
+		crypto_put_session(ses_ptr);
+		return -EINVAL;
 	}
-	mutex_unlock(&fcr->sem);
 
-	return retval;
+	root = ses_ptr->parent ? ses_ptr->parent : ses_ptr;
+	root->shared = 1;
+	kref_get(&root->refcount);
+	crypto_put_session(ses_ptr);
+
+	fd = anon_inode_getfd("[cryptodev-session]", &cryptodev_ses_fops, root,
+			O_RDONLY | O_CLOEXEC);
+	if (unlikely(fd < 0)) {
+		crypto_release_session(root);
+		return fd;
+	}
+
+	shop->fd = fd;
+	return 0;
 }
 
-#ifdef CIOCCPHASH
-/* Copy the hash state from one session to another */
+/* CIOCSESATTACH: a session on the transform of the one exported as
+ * shop->fd. It comes with a request, IV and bounce buffers of its own
+ * and keeps the exported session alive. */
 static int
-crypto_copy_hash_state(struct fcrypt *fcr, uint32_t dst_sid, uint32_t src_sid)
+crypto_attach_session(struct fcrypt *fcr, struct crypt_ses_share_op *shop)
 {
-	struct csession *src_ses, *dst_ses;
+	struct csession *parent, *ses_new;
+	struct file *file;
 	int ret;
 
-	src_ses = crypto_get_session_by_sid(fcr, src_sid);
-	if (unlikely(src_ses == NULL)) {
-		derr(1, "Session with sid=0x%08X not found!", src_sid);
-		return -ENOENT;
+	file = fget(shop->fd);
+	if (unlikely(!file))
+		return -EBADF;
+	if (unlikely(file->f_op != &cryptodev_ses_fops)) {
+		ret = -EINVAL;
+		goto out;
 	}
+	parent = file->private_data;
 
-	dst_ses = crypto_get_session_by_sid(fcr, dst_sid);
-	if (unlikely(dst_ses == NULL)) {
-		derr(1, "Session with sid=0x%08X not found!", dst_sid);
-		crypto_put_session(src_ses);
-		return -ENOENT;
+	ses_new = kmem_cache_alloc_node(cryptodev_ses_cache,
+			GFP_KERNEL | __GFP_ZERO, parent->node);
+	if (unlikely(!ses_new)) {
+		ret = -ENOMEM;
+		goto out;
 	}
 
-	ret = cryptodev_hash_copy(&dst_ses->hdata, &src_ses->hdata);
-	crypto_put_session(src_ses);
-	crypto_put_session(dst_ses);
+	/* the transform and everything it is described by never change */
+	ret = cryptodev_cipher_init_request(&ses_new->cdata, &parent->cdata);
+	if (unlikely(ret)) {
+		kmem_cache_free(cryptodev_ses_cache, ses_new);
+		goto out;
+	}
+	kref_get(&parent->refcount);
+	ses_new->parent = parent;
+	ses_new->node = parent->node;
+	ses_new->zc.node = parent->node;
+	ses_new->cipher = parent->cipher;
+	ses_new->flags = parent->flags;
+	ses_new->poll_us = parent->poll_us;
+	ses_new->alignmask = parent->alignmask;
+	memcpy(ses_new->cipher_driver, parent->cipher_driver,
+	       sizeof(ses_new->cipher_driver));
+	crypto_init_session(ses_new);
+
+	mutex_lock(&fcr->sem);
+	ret = crypto_insert_session(fcr, ses_new);
+	mutex_unlock(&fcr->sem);
+	if (unlikely(ret)) {
+		crypto_release_session(ses_new);
+		goto out;
+	}
+
+	shop->ses = ses_new->sid;
+	ddebug(2, "session 0x%08X attached to 0x%08X", ses_new->sid,
+			parent->sid);
+out:
+	fput(file);
 	return ret;
 }
-#endif /* CIOCCPHASH */
 
-static void cryptask_routine(struct work_struct *work)
+/* Set new keys on the session sop->ses, keeping its transforms. The
+ * cipher key is replaced if sop->key is set, the MAC key if
+ * sop->mackey is. For AEAD sessions both go into the cipher key. */
+static int
+crypto_set_session_keys(struct fcrypt *fcr, struct session_op *sop)
 {
-	struct crypt_priv *pcr = container_of(work, struct crypt_priv, cryptask);
-	struct todo_list_item *item;
-	LIST_HEAD(tmp);
+	struct csession *ses_ptr;
+	uint8_t ckey[CRYPTO_CIPHER_MAX_KEY_LEN + CRYPTO_HMAC_MAX_KEY_LEN +
+		     RTA_SPACE(sizeof(struct crypto_authenc_key_param))];
+	uint8_t mkey[CRYPTO_HMAC_MAX_KEY_LEN];
+	unsigned int keylen = 0, i;
+	int ret = 0;
 
-	/* fetch all pending jobs into the temporary list */
-	mutex_lock(&pcr->todo.lock);
-	list_cut_position(&tmp, &pcr->todo.list, pcr->todo.list.prev);
-	mutex_unlock(&pcr->todo.lock);
+	if (unlikely(!sop->key && !sop->mackey)) {
+		ddebug(1, "Both 'key' and 'mackey' unset.");
+		return -EINVAL;
+	}
 
-	/* handle each job locklessly */
-	list_for_each_entry(item, &tmp, __hook) {
-		item->result = crypto_run(&pcr->fcrypt, &item->kcop);
-		if (unlikely(item->result))
-			derr(0, "crypto_run() failed: %d", item->result);
+	ses_ptr = crypto_get_session_by_sid(fcr, sop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", sop->ses);
+		return -EINVAL;
 	}
 
-	/* push all handled jobs to the done list at once */
-	mutex_lock(&pcr->done.lock);
-	list_splice_tail(&tmp, &pcr->done.list);
-	mutex_unlock(&pcr->done.lock);
+	/* the others would be rekeyed underneath */
+	if (unlikely(ses_ptr->parent || ses_ptr->shared)) {
+		ddebug(1, "session 0x%08X is shared", sop->ses);
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (unlikely((sop->key && !ses_ptr->cdata.init) ||
+		     (sop->mackey && !ses_ptr->hdata.init &&
+		      !(ses_ptr->cdata.aead && sop->key)))) {
+		ddebug(1, "session 0x%08X has no such key", sop->ses);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (sop->key) {
+		ret = cryptodev_get_cipher_keylen(&keylen, sop,
+				ses_ptr->cdata.aead);
+		if (unlikely(ret < 0))
+			goto out;
+
+		ret = cryptodev_get_cipher_key(ckey, sop, ses_ptr->cdata.aead);
+		if (unlikely(ret < 0))
+			goto out;
+	}
+
+	if (sop->mackey && ses_ptr->hdata.init) {
+		if (unlikely(sop->mackeylen > CRYPTO_HMAC_MAX_KEY_LEN)) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		if (unlikely(copy_from_user(mkey, sop->mackey,
+					    sop->mackeylen))) {
+			ret = -EFAULT;
+			goto out;
+		}
+	}
+
+	/* new operations are locked out, wait for the ones running on
+	 * requests of their own and the jobs in the crypto API */
+	wait_event(ses_ptr->reqs_idle, READ_ONCE(ses_ptr->nactive) == 0 &&
+			atomic_read(&ses_ptr->ndirect) == 0);
+
+	if (sop->key) {
+		ret = cryptodev_cipher_setkey(&ses_ptr->cdata, ckey, keylen);
+		for (i = 1; i < ses_ptr->nengines && !ret; i++)
+			ret = cryptodev_cipher_setkey(&ses_ptr->engines[i].own,
+					ckey, keylen);
+		if (unlikely(ret))
+			goto out;
+	}
+
+	if (sop->mackey && ses_ptr->hdata.init) {
+		ret = cryptodev_hash_setkey(&ses_ptr->hdata, mkey,
+				sop->mackeylen);
+		if (unlikely(ret))
+			goto out;
+
+		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+	}
+
+out:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* Everything that needs to be done when removing a session. Called
+ * once the last reference is gone, so the session is not locked. */
+static void
+crypto_free_req(struct cryptodev_req *req)
+{
+	cryptodev_cipher_deinit_request(&req->cdata);
+	kfree(req->zc.pages);
+	kfree(req->zc.sg);
+	release_bounce_buf(&req->zc);
+	kmem_cache_free(cryptodev_req_cache, req);
+}
+
+static void
+crypto_free_session_rcu(struct rcu_head *rcu)
+{
+	kmem_cache_free(cryptodev_ses_cache,
+			container_of(rcu, struct csession, rcu));
+}
+
+static void
+crypto_destroy_session(struct kref *kref)
+{
+	struct csession *ses_ptr = container_of(kref, struct csession, refcount);
+	struct cryptodev_req *req, *tmp;
+
+	ddebug(2, "Removed session 0x%08X", ses_ptr->sid);
+	list_for_each_entry_safe(req, tmp, &ses_ptr->reqs, entry)
+		crypto_free_req(req);
+	crypto_free_engines(ses_ptr);
+	if (ses_ptr->parent) {
+		cryptodev_cipher_deinit_request(&ses_ptr->cdata);
+		crypto_release_session(ses_ptr->parent);
+	} else {
+		cryptodev_cipher_deinit(&ses_ptr->cdata);
+	}
+	cryptodev_hash_deinit(&ses_ptr->hdata);
+	ddebug(2, "freeing space for %d user pages", ses_ptr->zc.array_size);
+	kfree(ses_ptr->zc.pages);
+	kfree(ses_ptr->zc.sg);
+	kfree(ses_ptr->hash_sg);
+	release_bounce_buf(&ses_ptr->zc);
+	mutex_destroy(&ses_ptr->sem);
+	/* lookups may still see the session until a grace period elapsed */
+	call_rcu(&ses_ptr->rcu, crypto_free_session_rcu);
+}
+
+/* Unlock a session returned by crypto_get_session_by_sid() and drop
+ * the reference that came with it. */
+void
+crypto_put_session(struct csession *ses_ptr)
+{
+	mutex_unlock(&ses_ptr->sem);
+	crypto_release_session(ses_ptr);
+}
+
+/* Drop a reference to a session that has already been unlocked. */
+void
+crypto_release_session(struct csession *ses_ptr)
+{
+	kref_put(&ses_ptr->refcount, crypto_destroy_session);
+}
+
+/* Take the engine of the session that has the fewest operations in
+ * flight, or NULL if the session has its own transform only. It is
+ * given back with crypto_put_engine(). */
+struct cryptodev_engine *
+crypto_get_engine(struct csession *ses_ptr)
+{
+	struct cryptodev_engine *engine;
+	unsigned int i;
+
+	if (!ses_ptr->nengines)
+		return NULL;
+
+	engine = &ses_ptr->engines[0];
+	for (i = 1; i < ses_ptr->nengines; i++) {
+		if (atomic_read(&ses_ptr->engines[i].inflight) <
+		    atomic_read(&engine->inflight))
+			engine = &ses_ptr->engines[i];
+	}
+	atomic_inc(&engine->inflight);
+
+	return engine;
+}
+
+/* Get a request to run an operation on a cipher-only session without
+ * keeping the session locked. Returns NULL if none could be set up. */
+struct cryptodev_req *
+crypto_get_req(struct csession *ses_ptr)
+{
+	struct cryptodev_engine *engine = crypto_get_engine(ses_ptr);
+	struct cryptodev_req *req = NULL, *it;
+
+	spin_lock(&ses_ptr->reqs_lock);
+	list_for_each_entry(it, &ses_ptr->reqs, entry) {
+		if (it->engine == engine) {
+			list_del(&it->entry);
+			ses_ptr->nreqs--;
+			req = it;
+			break;
+		}
+	}
+	ses_ptr->nactive++;
+	spin_unlock(&ses_ptr->reqs_lock);
+
+	if (req)
+		return req;
+
+	req = kmem_cache_alloc_node(cryptodev_req_cache,
+			GFP_KERNEL | __GFP_ZERO, ses_ptr->node);
+	if (unlikely(!req))
+		goto error;
+	req->zc.node = ses_ptr->node;
+
+	if (unlikely(cryptodev_cipher_init_request(&req->cdata,
+			engine ? engine->cdata : &ses_ptr->cdata))) {
+		kmem_cache_free(cryptodev_req_cache, req);
+		goto error;
+	}
+	req->engine = engine;
+
+	return req;
+error:
+	crypto_put_engine(engine);
+	spin_lock(&ses_ptr->reqs_lock);
+	if (--ses_ptr->nactive == 0)
+		wake_up(&ses_ptr->reqs_idle);
+	spin_unlock(&ses_ptr->reqs_lock);
+	return NULL;
+}
+
+void
+crypto_put_req(struct csession *ses_ptr, struct cryptodev_req *req)
+{
+	crypto_put_engine(req->engine);
+
+	spin_lock(&ses_ptr->reqs_lock);
+	if (ses_ptr->nreqs < MAX_SESSION_REQS) {
+		list_add(&req->entry, &ses_ptr->reqs);
+		ses_ptr->nreqs++;
+		req = NULL;
+	}
+	if (--ses_ptr->nactive == 0)
+		wake_up(&ses_ptr->reqs_idle);
+	spin_unlock(&ses_ptr->reqs_lock);
+
+	if (req)
+		crypto_free_req(req);
+}
+
+/* Copy the next IV of a SES_FLAG_IV_GEN session to iv and advance it past
+ * an operation on len bytes: a nonce by one, a counter block by the
+ * number of blocks. Called with the session locked. */
+void
+crypto_gen_iv(struct csession *ses_ptr, uint8_t *iv, size_t len)
+{
+	int ivsize = ses_ptr->cdata.ivsize;
+	uint8_t *ctr = ses_ptr->next_iv;
+	uint64_t n;
+	int i;
+
+	memcpy(iv, ctr, ivsize);
+
+	if (ses_ptr->cdata.aead)
+		n = 1;
+	else
+		n = DIV_ROUND_UP(len, ivsize);
+
+	/* big endian addition */
+	for (i = ivsize - 1; i >= 0 && n; i--) {
+		n += ctr[i];
+		ctr[i] = n & 0xff;
+		n >>= 8;
+	}
+}
+
+/* Look up a session by ID and remove. */
+static int
+crypto_finish_session(struct fcrypt *fcr, uint32_t sid)
+{
+	struct csession *ses_ptr;
+
+	mutex_lock(&fcr->sem);
+	ses_ptr = crypto_find_session(fcr, sid);
+	if (unlikely(!ses_ptr)) {
+		mutex_unlock(&fcr->sem);
+		derr(1, "Session with sid=0x%08X not found!", sid);
+		return -ENOENT;
+	}
+	crypto_del_session(fcr, ses_ptr);
+	mutex_unlock(&fcr->sem);
+
+	/* operations in progress keep the session alive until they finish */
+	kref_put(&ses_ptr->refcount, crypto_destroy_session);
+
+	return 0;
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0))
+static void
+crypto_drop_session(void *ptr, void *arg)
+{
+	struct csession *ses_ptr = ptr;
+
+	kref_put(&ses_ptr->refcount, crypto_destroy_session);
+}
+
+/* Remove all sessions when closing the file, nothing looks them up
+ * any more */
+static int
+crypto_finish_all_sessions(struct fcrypt *fcr)
+{
+	rhashtable_free_and_destroy(&fcr->sessions, crypto_drop_session, NULL);
+
+	return 0;
+}
+#else
+/* Remove all sessions when closing the file */
+static int
+crypto_finish_all_sessions(struct fcrypt *fcr)
+{
+	struct csession *ses_ptr;
+	struct hlist_node *tmp;
+	int bkt;
+
+	mutex_lock(&fcr->sem);
+	hash_for_each_safe(fcr->sessions, bkt, tmp, ses_ptr, entry) {
+		hash_del_rcu(&ses_ptr->entry);
+		kref_put(&ses_ptr->refcount, crypto_destroy_session);
+	}
+	mutex_unlock(&fcr->sem);
+
+	return 0;
+}
+#endif
+
+/* Look up session by session ID. The returned session is locked and
+ * referenced; release it with crypto_put_session(). */
+struct csession *
+crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid)
+{
+	struct csession *ses_ptr;
+
+	if (unlikely(fcr == NULL))
+		return NULL;
+
+	rcu_read_lock();
+	ses_ptr = crypto_find_session(fcr, sid);
+	/* the session may be on its way out */
+	if (ses_ptr && unlikely(!kref_get_unless_zero(&ses_ptr->refcount)))
+		ses_ptr = NULL;
+	rcu_read_unlock();
+
+	if (ses_ptr) {
+		mutex_lock(&ses_ptr->sem);
+		trace_cryptodev_session_found(sid, ses_ptr->stats.alg->name);
+	}
+
+	return ses_ptr;
+}
+
+#ifdef CIOCCPHASH
+/* Copy the hash state from one session to another */
+static int
+crypto_copy_hash_state(struct fcrypt *fcr, uint32_t dst_sid, uint32_t src_sid)
+{
+	struct csession *src_ses, *dst_ses;
+	int ret;
+
+	src_ses = crypto_get_session_by_sid(fcr, src_sid);
+	if (unlikely(src_ses == NULL)) {
+		derr(1, "Session with sid=0x%08X not found!", src_sid);
+		return -ENOENT;
+	}
+
+	dst_ses = crypto_get_session_by_sid(fcr, dst_sid);
+	if (unlikely(dst_ses == NULL)) {
+		derr(1, "Session with sid=0x%08X not found!", dst_sid);
+		crypto_put_session(src_ses);
+		return -ENOENT;
+	}
+
+	ret = cryptodev_hash_copy(&dst_ses->hdata, &src_ses->hdata);
+	crypto_put_session(src_ses);
+	crypto_put_session(dst_ses);
+	return ret;
+}
+
+/* CIOCHASHEXPORT and CIOCHASHIMPORT */
+static int
+crypto_hash_state(struct fcrypt *fcr, struct crypt_hash_state_op *hsop,
+		int export)
+{
+	uint8_t tag[CRYPTODEV_HASH_STATE_TAG];
+	uint8_t expected[CRYPTODEV_HASH_STATE_TAG];
+	struct csession *ses_ptr;
+	unsigned int statesize;
+	void *state = NULL;
+	int ret = 0;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, hsop->ses);
+	if (unlikely(ses_ptr == NULL)) {
+		derr(1, "invalid session ID=0x%08X", hsop->ses);
+		return -EINVAL;
+	}
+
+	if (unlikely(!ses_ptr->hdata.init)) {
+		derr(1, "no hash state in session 0x%08X", hsop->ses);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* the state is followed by its MAC */
+	statesize = cryptodev_hash_statesize(&ses_ptr->hdata);
+	if (export && !hsop->state) {
+		hsop->len = statesize + sizeof(tag);
+		goto out;
+	}
+	/* a state of another algorithm or driver is unlikely to fit */
+	if (unlikely(export ? hsop->len < statesize + sizeof(tag) :
+			      hsop->len != statesize + sizeof(tag))) {
+		ddebug(1, "hash state is %zu bytes, not %u",
+				statesize + sizeof(tag), hsop->len);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	state = kmalloc(statesize, GFP_KERNEL);
+	if (unlikely(!state)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (export) {
+		ret = cryptodev_hash_export(&ses_ptr->hdata, state);
+		if (likely(ret >= 0))
+			ret = cryptodev_hash_state_tag(&ses_ptr->hdata, state, tag);
+		if (likely(ret >= 0) &&
+		    unlikely(copy_to_user(hsop->state, state, statesize) ||
+			     copy_to_user(hsop->state + statesize, tag,
+					  sizeof(tag))))
+			ret = -EFAULT;
+		hsop->len = statesize + sizeof(tag);
+		goto out;
+	}
+
+	if (unlikely(copy_from_user(state, hsop->state, statesize) ||
+		     copy_from_user(tag, hsop->state + statesize,
+				    sizeof(tag)))) {
+		ret = -EFAULT;
+		goto out;
+	}
+	/* only states this module exported, from the same driver */
+	ret = cryptodev_hash_state_tag(&ses_ptr->hdata, state, expected);
+	if (likely(!ret) &&
+	    unlikely(crypto_memneq(tag, expected, sizeof(tag)))) {
+		ddebug(1, "hash state was not exported by this driver");
+		ret = -EBADMSG;
+	}
+	if (likely(!ret))
+		ret = cryptodev_hash_import(&ses_ptr->hdata, state);
+
+out:
+	kfree(state);
+	crypto_put_session(ses_ptr);
+	return ret < 0 ? ret : 0;
+}
+#endif /* CIOCCPHASH */
+
+/* Count n newly completed jobs on the eventfd, if one is registered.
+ * Called with pcr->done.lock held. */
+static void crypto_async_notify(struct crypt_priv *pcr, unsigned int n)
+{
+	if (!pcr->done.evfd || !n)
+		return;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0))
+	/* the counter can only be increased by one */
+	while (n--)
+		eventfd_signal(pcr->done.evfd);
+#else
+	eventfd_signal(pcr->done.evfd, n);
+#endif
+}
+
+/* push n handled jobs to the done list at once */
+static void crypto_async_done(struct crypt_priv *pcr, struct list_head *jobs,
+		unsigned int n)
+{
+	spin_lock_irq(&pcr->done.lock);
+	list_splice_tail(jobs, &pcr->done.list);
+	crypto_async_notify(pcr, n);
+	spin_unlock_irq(&pcr->done.lock);
 
 	/* wake for POLLIN */
 	wake_up_interruptible(&pcr->user_waiter);
 }
 
+/* Run the COP_FLAG_PRIO jobs of the lane, including the ones that come
+ * in meanwhile, and complete them right away. */
+static void crypto_async_run_prio(struct crypt_lane *lane)
+{
+	struct crypt_priv *pcr = lane->pcr;
+	struct todo_list_item *item, *next;
+	struct llist_node *jobs;
+	unsigned int n = 0;
+	LIST_HEAD(tmp);
+
+	while ((jobs = llist_del_all(&lane->prio))) {
+		jobs = llist_reverse_order(jobs);
+		llist_for_each_entry_safe(item, next, jobs, node) {
+			item->result = crypto_run(&pcr->fcrypt, &item->kcop);
+			if (unlikely(item->result))
+				derr(0, "crypto_run() failed: %d", item->result);
+			list_add_tail(&item->__hook, &tmp);
+			n++;
+		}
+	}
+
+	if (n)
+		crypto_async_done(pcr, &tmp, n);
+}
+
+/* Large jobs are run this much at a time, with the COP_FLAG_PRIO jobs
+ * that came in run in between */
+#define ASYNC_CHUNK	(64 * 1024)
+
+/* Whether a job can be cut into chunks: the chunks of a cipher-only
+ * session of a mode that chains chain through the IV that crypto_run()
+ * returns. A job without an IV of its own would have the one of the
+ * session changed by other operations between its chunks, and a session
+ * generating IVs would give each chunk a new one. */
+static int crypto_async_chunkable(struct crypt_priv *pcr,
+		struct kernel_crypt_op *kcop)
+{
+	struct crypt_op *cop = &kcop->cop;
+	struct csession *ses_ptr;
+	int ret = 0;
+
+	if (cop->len <= ASYNC_CHUNK || !cop->src || !cop->dst)
+		return 0;
+
+	rcu_read_lock();
+	ses_ptr = crypto_find_session(&pcr->fcrypt, cop->ses);
+	if (likely(ses_ptr))
+		ret = ses_ptr->cdata.init && !ses_ptr->cdata.aead &&
+			!ses_ptr->hdata.init && crypto_cipher_chains(ses_ptr) &&
+			(cop->iv || !ses_ptr->cdata.ivsize) &&
+			!crypto_op_gen_iv(ses_ptr, cop->op) &&
+			ASYNC_CHUNK % ses_ptr->cdata.blocksize == 0;
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static int crypto_async_run_bulk(struct crypt_lane *lane,
+		struct todo_list_item *item)
+{
+	struct crypt_priv *pcr = lane->pcr;
+	struct crypt_op *cop = &item->kcop.cop;
+	struct crypt_op whole = *cop;
+	uint32_t off;
+	int ret = 0;
+
+	if (!crypto_async_chunkable(pcr, &item->kcop))
+		return crypto_run(&pcr->fcrypt, &item->kcop);
+
+	for (off = 0; off < whole.len && !ret; off += cop->len) {
+		cop->src = whole.src + off;
+		cop->dst = whole.dst + off;
+		cop->len = min_t(uint32_t, whole.len - off, ASYNC_CHUNK);
+		ret = crypto_run(&pcr->fcrypt, &item->kcop);
+		crypto_async_run_prio(lane);
+	}
+
+	*cop = whole;
+	return ret;
+}
+
+static void cryptask_routine(struct work_struct *work)
+{
+	struct crypt_lane *lane = container_of(work, struct crypt_lane, cryptask);
+	struct crypt_priv *pcr = lane->pcr;
+	struct todo_list_item *item, *next;
+	struct llist_node *jobs;
+	unsigned int n = 0;
+	LIST_HEAD(tmp);
+
+	crypto_async_run_prio(lane);
+
+	/* fetch all pending jobs, oldest first */
+	jobs = llist_reverse_order(llist_del_all(&lane->todo));
+
+	llist_for_each_entry_safe(item, next, jobs, node) {
+		item->result = crypto_async_run_bulk(lane, item);
+		if (unlikely(item->result))
+			derr(0, "crypto_run() failed: %d", item->result);
+		list_add_tail(&item->__hook, &tmp);
+		n++;
+		crypto_async_run_prio(lane);
+	}
+
+	crypto_async_done(pcr, &tmp, n);
+}
+
+/* Release what a job completed by the crypto API callback held.
+ * This has to be called from process context. */
+static void crypto_async_direct_release(struct todo_list_item *item)
+{
+	if (!item->req)
+		return;
+
+	release_user_pages(&item->zc);
+	cryptodev_blkcipher_request_free(item->req);
+	item->req = NULL;
+	crypto_release_session(item->ses);
+	item->ses = NULL;
+}
+
+static int crypto_async_idle(struct crypt_priv *pcr)
+{
+	int idle;
+
+	spin_lock_irq(&pcr->done.lock);
+	idle = pcr->done.inflight == 0;
+	spin_unlock_irq(&pcr->done.lock);
+
+	return idle;
+}
+
+static void crypto_async_free_item(struct todo_list_item *item)
+{
+	ddebug(2, "freeing item at %p", item);
+	crypto_async_direct_release(item);
+	kfree(item->zc.pages);
+	kfree(item->zc.sg);
+	kmem_cache_free(cryptodev_item_cache, item);
+}
+
+/* Free the jobs on the free list and the ones left pending in the
+ * lanes, which must not run anymore. Returns how many there were. */
+static int crypto_async_free_items(struct crypt_priv *pcr)
+{
+	struct todo_list_item *item, *next;
+	int i, n = 0;
+
+	for (i = 0; i < pcr->nlanes; i++) {
+		llist_for_each_entry_safe(item, next,
+				llist_del_all(&pcr->lanes[i].todo), node)
+			llist_add(&item->node, &pcr->free.list);
+		llist_for_each_entry_safe(item, next,
+				llist_del_all(&pcr->lanes[i].prio), node)
+			llist_add(&item->node, &pcr->free.list);
+	}
+
+	llist_for_each_entry_safe(item, next, llist_del_all(&pcr->free.list),
+			node) {
+		crypto_async_free_item(item);
+		n++;
+	}
+
+	return n;
+}
+
 /* ====== /dev/crypto ====== */
 
 static int
 cryptodev_open(struct inode *inode, struct file *filp)
 {
-	struct todo_list_item *tmp, *tmp_next;
 	struct crypt_priv *pcr;
-	int i;
+	struct crypt_lane *lane;
+	int i, cpu;
 
 	pcr = kzalloc(sizeof(*pcr), GFP_KERNEL);
 	if (!pcr)
 		return -ENOMEM;
 	filp->private_data = pcr;
 
+	pcr->nlanes = num_online_cpus();
+	if (cryptodev_async_lanes > 0 && cryptodev_async_lanes < pcr->nlanes)
+		pcr->nlanes = cryptodev_async_lanes;
+	pcr->nlanes = min(pcr->nlanes, MAX_CRYPT_LANES);
+	pcr->lanes = kcalloc(pcr->nlanes, sizeof(*pcr->lanes), GFP_KERNEL);
+	if (!pcr->lanes) {
+		kfree(pcr);
+		filp->private_data = NULL;
+		return -ENOMEM;
+	}
+
+	if (unlikely(crypto_init_session_table(&pcr->fcrypt))) {
+		kfree(pcr->lanes);
+		kfree(pcr);
+		filp->private_data = NULL;
+		return -ENOMEM;
+	}
+
 	mutex_init(&pcr->fcrypt.sem);
-	mutex_init(&pcr->free.lock);
-	mutex_init(&pcr->todo.lock);
-	mutex_init(&pcr->done.lock);
+	spin_lock_init(&pcr->free.lock);
+	spin_lock_init(&pcr->done.lock);
 
-	INIT_LIST_HEAD(&pcr->fcrypt.list);
-	INIT_LIST_HEAD(&pcr->free.list);
-	INIT_LIST_HEAD(&pcr->todo.list);
+	INIT_LIST_HEAD(&pcr->fcrypt.bufs);
+	init_llist_head(&pcr->free.list);
 	INIT_LIST_HEAD(&pcr->done.list);
 
-	INIT_WORK(&pcr->cryptask, cryptask_routine);
+	/* spread the lanes over the online CPUs */
+	i = 0;
+	for_each_online_cpu(cpu) {
+		if (i == pcr->nlanes)
+			break;
+		lane = &pcr->lanes[i++];
+		lane->pcr = pcr;
+		lane->cpu = cpu;
+		lane->node = cpu_to_node(cpu);
+		init_llist_head(&lane->todo);
+		init_llist_head(&lane->prio);
+		INIT_WORK(&lane->cryptask, cryptask_routine);
+	}
+	/* CPUs may have gone offline meanwhile */
+	pcr->nlanes = i;
 
 	init_waitqueue_head(&pcr->user_waiter);
 
-	for (i = 0; i < DEF_COP_RINGSIZE; i++) {
-		tmp = kzalloc(sizeof(struct todo_list_item), GFP_KERNEL);
-		if (!tmp)
-			goto err_ringalloc;
-		pcr->itemcount++;
-		ddebug(2, "allocated new item at %p", tmp);
-		list_add(&tmp->__hook, &pcr->free.list);
-	}
+	/* the queue is allocated as jobs are submitted, descriptors that
+	 * are only used synchronously never have one */
+	pcr->depth = clamp(cryptodev_async_queue, 1,
+			max(cryptodev_async_queue_max, 1));
 
-	ddebug(2, "Cryptodev handle initialised, %d elements in queue",
-			DEF_COP_RINGSIZE);
+	ddebug(2, "Cryptodev handle initialised, queue depth %d", pcr->depth);
 	return 0;
-
-/* In case of errors, free any memory allocated so far */
-err_ringalloc:
-	list_for_each_entry_safe(tmp, tmp_next, &pcr->free.list, __hook) {
-		list_del(&tmp->__hook);
-		kfree(tmp);
-	}
-	mutex_destroy(&pcr->done.lock);
-	mutex_destroy(&pcr->todo.lock);
-	mutex_destroy(&pcr->free.lock);
-	mutex_destroy(&pcr->fcrypt.sem);
-	kfree(pcr);
-	filp->private_data = NULL;
-	return -ENOMEM;
 }
 
 static int
@@ -540,22 +1633,25 @@ cryptodev_release(struct inode *inode, struct file *filp)
 {
 	struct crypt_priv *pcr = filp->private_data;
 	struct todo_list_item *item, *item_safe;
-	int items_freed = 0;
+	int items_freed, i;
 
 	if (!pcr)
 		return 0;
 
-	cancel_work_sync(&pcr->cryptask);
+	/* the crypto API may still be working on our jobs */
+	wait_event(pcr->user_waiter, crypto_async_idle(pcr));
 
-	list_splice_tail(&pcr->todo.list, &pcr->free.list);
-	list_splice_tail(&pcr->done.list, &pcr->free.list);
+	for (i = 0; i < pcr->nlanes; i++)
+		cancel_work_sync(&pcr->lanes[i].cryptask);
+	cryptodev_ring_free(pcr->ring);
+	cryptodev_stream_free(pcr->stream);
+	if (pcr->done.evfd)
+		eventfd_ctx_put(pcr->done.evfd);
 
-	list_for_each_entry_safe(item, item_safe, &pcr->free.list, __hook) {
-		ddebug(2, "freeing item at %p", item);
-		list_del(&item->__hook);
-		kfree(item);
-		items_freed++;
-	}
+	list_for_each_entry_safe(item, item_safe, &pcr->done.list, __hook)
+		llist_add(&item->node, &pcr->free.list);
+
+	items_freed = crypto_async_free_items(pcr);
 
 	if (items_freed != pcr->itemcount) {
 		derr(0, "freed %d items, but %d should exist!",
@@ -563,12 +1659,11 @@ cryptodev_release(struct inode *inode, struct file *filp)
 	}
 
 	crypto_finish_all_sessions(&pcr->fcrypt);
+	crypto_free_all_bufs(&pcr->fcrypt);
 
-	mutex_destroy(&pcr->done.lock);
-	mutex_destroy(&pcr->todo.lock);
-	mutex_destroy(&pcr->free.lock);
 	mutex_destroy(&pcr->fcrypt.sem);
 
+	kfree(pcr->lanes);
 	kfree(pcr);
 	filp->private_data = NULL;
 
@@ -591,82 +1686,354 @@ clonefd(struct file *filp)
 }
 
 #ifdef ENABLE_ASYNC
-/* enqueue a job for asynchronous completion
+/* move a job submitted to the crypto API to the done list; this may
+ * run in interrupt context */
+static void crypto_async_direct_done(struct todo_list_item *item, int err)
+{
+	struct crypt_priv *pcr = item->pcr;
+	unsigned long flags;
+
+	item->result = err;
+	crypto_put_engine(item->engine);
+	item->engine = NULL;
+	/* the transform is no longer used, it may be given a new key */
+	if (atomic_dec_and_test(&item->ses->ndirect))
+		wake_up(&item->ses->reqs_idle);
+	if (unlikely(err))
+		derr(0, "error from async request: %d", err);
+	else {
+		cryptodev_stat_inc(&item->ses->stats, CRYPTODEV_STAT_ZC);
+		cryptodev_stat_op(&item->ses->stats, item->kcop.cop.len,
+				item->start);
+	}
+	/* a generated IV is returned as it was used */
+	if (!item->kcop.iv_gen)
+		memcpy(item->kcop.iv, item->iv, sizeof(item->iv));
+
+	/* pcr must not be touched after the lock is released, since
+	 * cryptodev_release() waits for the inflight count only */
+	spin_lock_irqsave(&pcr->done.lock, flags);
+	list_add_tail(&item->__hook, &pcr->done.list);
+	pcr->done.inflight--;
+	crypto_async_notify(pcr, 1);
+	/* wake for POLLIN, and a pending release */
+	wake_up(&pcr->user_waiter);
+	spin_unlock_irqrestore(&pcr->done.lock, flags);
+}
+
+static void crypto_async_direct_complete(struct crypto_async_request *req,
+		int err)
+{
+	/* a backlogged request has been started */
+	if (err == -EINPROGRESS)
+		return;
+
+	crypto_async_direct_done(req->data, err);
+}
+
+/* Submit a plain cipher job directly to the crypto API, to be completed
+ * by its callback rather than in a worker. This way many jobs may be
+ * queued to an accelerator at once.
  *
  * returns:
- * -EBUSY when there are no free queue slots left
- *        (and the number of slots has reached it MAX_COP_RINGSIZE)
- * -EFAULT when there was a memory allocation error
- * 0 on success */
-static int crypto_async_run(struct crypt_priv *pcr, struct kernel_crypt_op *kcop)
+ * 1 if the job is not suitable and must go through a worker
+ * 0 if the job was submitted
+ * a negative error code otherwise */
+static int crypto_async_direct_run(struct crypt_priv *pcr,
+		struct todo_list_item *item)
 {
-	struct todo_list_item *item = NULL;
+	struct kernel_crypt_op *kcop = &item->kcop;
+	struct crypt_op *cop = &kcop->cop;
+	struct scatterlist *src_sg, *dst_sg;
+	cryptodev_blkcipher_request_t *req;
+	struct cryptodev_engine *engine;
+	struct csession *ses_ptr;
+	int ret;
 
-	if (unlikely(kcop->cop.flags & COP_FLAG_NO_ZC))
-		return -EINVAL;
+	ses_ptr = crypto_get_session_by_sid(&pcr->fcrypt, cop->ses);
+	if (unlikely(!ses_ptr))
+		return 1;
+
+	/* Hash and AEAD sessions, as well as jobs that rely on the IV
+	 * kept in the session, take the worker path. Note that the session
+	 * IV is not advanced by jobs submitted here. */
+	if (ses_ptr->cdata.init == 0 || ses_ptr->cdata.aead ||
+	    ses_ptr->hdata.init != 0 || cop->len == 0 ||
+	    (cop->op != COP_ENCRYPT && cop->op != COP_DECRYPT) ||
+	    cop->len % ses_ptr->cdata.blocksize ||
+	    kcop->ivlen < ses_ptr->cdata.ivsize ||
+	    (ses_ptr->alignmask &&
+	     (!IS_ALIGNED((unsigned long)cop->src, ses_ptr->alignmask + 1) ||
+	      !IS_ALIGNED((unsigned long)cop->dst, ses_ptr->alignmask + 1)))) {
+		ret = 1;
+		goto out_unlock;
+	}
+
+	engine = crypto_get_engine(ses_ptr);
+	req = cryptodev_blkcipher_request_alloc(engine ?
+			engine->cdata->async.s : ses_ptr->cdata.async.s,
+			GFP_KERNEL);
+	if (unlikely(!req)) {
+		crypto_put_engine(engine);
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+
+	ret = get_userbuf(&pcr->fcrypt, &item->zc, cop->src, cop->len, cop->dst, cop->len,
+			kcop->task, kcop->mm, &src_sg, &dst_sg);
+	if (unlikely(ret)) {
+		cryptodev_blkcipher_request_free(req);
+		crypto_put_engine(engine);
+		ret = 1;
+		goto out_unlock;
+	}
+
+	if (kcop->iv_gen)
+		crypto_gen_iv(ses_ptr, kcop->iv, cop->len);
+	memcpy(item->iv, kcop->iv, sizeof(item->iv));
+	cryptodev_blkcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+			crypto_async_direct_complete, item);
+	cryptodev_blkcipher_request_set_crypt(req, src_sg, dst_sg, cop->len,
+			item->iv);
+
+	/* the request keeps a reference to the session */
+	kref_get(&ses_ptr->refcount);
+	item->ses = ses_ptr;
+	item->engine = engine;
+	item->req = req;
+	item->pcr = pcr;
+	item->start = ktime_get();
+	/* counted while the session is locked, so CIOCSETKEY sees it */
+	atomic_inc(&ses_ptr->ndirect);
+	crypto_put_session(ses_ptr);
 
-	mutex_lock(&pcr->free.lock);
-	if (likely(!list_empty(&pcr->free.list))) {
-		item = list_first_entry(&pcr->free.list,
-				struct todo_list_item, __hook);
-		list_del(&item->__hook);
-	} else if (pcr->itemcount < MAX_COP_RINGSIZE) {
+	spin_lock_irq(&pcr->done.lock);
+	pcr->done.inflight++;
+	spin_unlock_irq(&pcr->done.lock);
+
+	if (cop->op == COP_ENCRYPT)
+		ret = cryptodev_crypto_blkcipher_encrypt(req);
+	else
+		ret = cryptodev_crypto_blkcipher_decrypt(req);
+
+	/* otherwise the callback takes over */
+	if (ret != -EINPROGRESS && ret != -EBUSY)
+		crypto_async_direct_done(item, ret);
+
+	return 0;
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* The lane of the jobs of session sid, which is always the same one to
+ * keep them in order. It is one on the node of the session's memory,
+ * if the descriptor has any there. */
+static struct crypt_lane *
+crypto_async_lane(struct crypt_priv *pcr, uint32_t sid)
+{
+	struct csession *ses_ptr;
+	int node = NUMA_NO_NODE;
+	unsigned int i, n = 0;
+
+	rcu_read_lock();
+	ses_ptr = crypto_find_session(&pcr->fcrypt, sid);
+	if (likely(ses_ptr))
+		node = ses_ptr->node;
+	rcu_read_unlock();
+
+	for (i = 0; i < pcr->nlanes; i++)
+		n += pcr->lanes[i].node == node;
+	if (!n)
+		return &pcr->lanes[sid % pcr->nlanes];
+
+	n = sid % n;
+	for (i = 0; pcr->lanes[i].node != node || n--; i++)
+		;
+	return &pcr->lanes[i];
+}
+
+/* enqueue the job at arg for asynchronous completion, decoded by
+ * from_user straight into its queue item
+ *
+ * returns:
+ * -EBUSY when the queue is at its depth
+ * -ENOMEM when a job could not be allocated
+ * 0 on success */
+static int crypto_async_run(struct crypt_priv *pcr, void __user *arg,
+		int (*from_user)(struct kernel_crypt_op *kcop,
+				 struct fcrypt *fcr, void __user *arg))
+{
+	struct todo_list_item *item;
+	struct kernel_crypt_op *kcop;
+	struct llist_node *node;
+	struct crypt_lane *lane;
+	int ret, grow = 0;
+
+	spin_lock(&pcr->free.lock);
+	node = llist_del_first(&pcr->free.list);
+	if (!node && pcr->itemcount < pcr->depth) {
 		pcr->itemcount++;
+		grow = 1;
+	}
+	spin_unlock(&pcr->free.lock);
+	if (node) {
+		item = llist_entry(node, struct todo_list_item, node);
+	} else if (grow) {
+		item = kmem_cache_zalloc(cryptodev_item_cache, GFP_KERNEL);
+		if (unlikely(!item)) {
+			spin_lock(&pcr->free.lock);
+			pcr->itemcount--;
+			spin_unlock(&pcr->free.lock);
+			return -ENOMEM;
+		}
+		item->zc.node = NUMA_NO_NODE;
 	} else {
-		mutex_unlock(&pcr->free.lock);
+		cryptodev_stat_inc(NULL, CRYPTODEV_STAT_ASYNC_BUSY);
 		return -EBUSY;
 	}
-	mutex_unlock(&pcr->free.lock);
 
-	if (unlikely(!item)) {
-		item = kzalloc(sizeof(struct todo_list_item), GFP_KERNEL);
-		if (unlikely(!item))
-			return -EFAULT;
-		dinfo(1, "increased item count to %d", pcr->itemcount);
+	kcop = &item->kcop;
+	ret = from_user(kcop, &pcr->fcrypt, arg);
+	if (likely(!ret) && unlikely(kcop->cop.flags & COP_FLAG_NO_ZC))
+		ret = -EINVAL;
+	if (unlikely(ret)) {
+		llist_add(&item->node, &pcr->free.list);
+		return ret;
 	}
+	cryptodev_stat_inc(NULL, CRYPTODEV_STAT_ASYNC_QUEUED);
 
-	memcpy(&item->kcop, kcop, sizeof(struct kernel_crypt_op));
+	if (cryptodev_async_direct) {
+		ret = crypto_async_direct_run(pcr, item);
+		if (ret <= 0) {
+			if (unlikely(ret))
+				llist_add(&item->node, &pcr->free.list);
+			return ret;
+		}
+	}
 
-	mutex_lock(&pcr->todo.lock);
-	list_add_tail(&item->__hook, &pcr->todo.list);
-	mutex_unlock(&pcr->todo.lock);
+	lane = crypto_async_lane(pcr, kcop->cop.ses);
 
-	queue_work(cryptodev_wq, &pcr->cryptask);
+	llist_add(&item->node, kcop->cop.flags & COP_FLAG_PRIO ?
+			&lane->prio : &lane->todo);
+	queue_work_on(lane->cpu, cryptodev_wq, &lane->cryptask);
 	return 0;
 }
 
-/* get the first completed job from the "done" queue
+/* Return a fetched job to the free list, or free it if the queue is
+ * deeper than CIOCASYNCDEPTH allows now */
+static void crypto_async_put_item(struct crypt_priv *pcr,
+		struct todo_list_item *item)
+{
+	if (likely(READ_ONCE(pcr->itemcount) <= READ_ONCE(pcr->depth))) {
+		llist_add(&item->node, &pcr->free.list);
+		return;
+	}
+
+	spin_lock(&pcr->free.lock);
+	if (pcr->itemcount > pcr->depth) {
+		pcr->itemcount--;
+		spin_unlock(&pcr->free.lock);
+		crypto_async_free_item(item);
+		return;
+	}
+	llist_add(&item->node, &pcr->free.list);
+	spin_unlock(&pcr->free.lock);
+}
+
+/* Set the depth of the job queue, freeing the free jobs above it; the
+ * others are freed as they are fetched. 0 keeps the depth. */
+static int crypto_async_set_depth(struct crypt_priv *pcr,
+		uint32_t __user *arg)
+{
+	struct llist_node *node;
+	uint32_t depth;
+	int ret;
+
+	ret = get_user(depth, arg);
+	if (unlikely(ret))
+		return ret;
+
+	if (unlikely(depth > max(cryptodev_async_queue_max, 1))) {
+		derr(1, "queue depth %u is above the limit of %d", depth,
+				max(cryptodev_async_queue_max, 1));
+		return -EINVAL;
+	}
+
+	spin_lock(&pcr->free.lock);
+	if (depth)
+		WRITE_ONCE(pcr->depth, depth);
+	while (pcr->itemcount > pcr->depth &&
+	       (node = llist_del_first(&pcr->free.list))) {
+		pcr->itemcount--;
+		spin_unlock(&pcr->free.lock);
+		crypto_async_free_item(llist_entry(node,
+					struct todo_list_item, node));
+		spin_lock(&pcr->free.lock);
+	}
+	depth = pcr->depth;
+	spin_unlock(&pcr->free.lock);
+
+	return put_user(depth, arg);
+}
+
+/* get the first completed job from the "done" queue and have to_user
+ * write its results to arg straight from its queue item
  *
  * returns:
  * -EBUSY if no completed jobs are ready (yet)
  * the return value of crypto_run() otherwise */
-static int crypto_async_fetch(struct crypt_priv *pcr,
-		struct kernel_crypt_op *kcop)
+static int crypto_async_fetch(struct crypt_priv *pcr, void __user *arg,
+		int (*to_user)(struct kernel_crypt_op *kcop,
+			       struct fcrypt *fcr, void __user *arg))
 {
 	struct todo_list_item *item;
 	int retval;
 
-	mutex_lock(&pcr->done.lock);
+	spin_lock_irq(&pcr->done.lock);
 	if (list_empty(&pcr->done.list)) {
-		mutex_unlock(&pcr->done.lock);
+		spin_unlock_irq(&pcr->done.lock);
 		return -EBUSY;
 	}
 	item = list_first_entry(&pcr->done.list, struct todo_list_item, __hook);
 	list_del(&item->__hook);
-	mutex_unlock(&pcr->done.lock);
+	spin_unlock_irq(&pcr->done.lock);
 
-	memcpy(kcop, &item->kcop, sizeof(struct kernel_crypt_op));
+	crypto_async_direct_release(item);
 	retval = item->result;
+	if (likely(!retval))
+		retval = to_user(&item->kcop, &pcr->fcrypt, arg);
 
-	mutex_lock(&pcr->free.lock);
-	list_add_tail(&item->__hook, &pcr->free.list);
-	mutex_unlock(&pcr->free.lock);
+	crypto_async_put_item(pcr, item);
 
 	/* wake for POLLOUT */
 	wake_up_interruptible(&pcr->user_waiter);
 
 	return retval;
 }
+
+/* register the eventfd that completions are counted on, or remove it */
+static int crypto_async_set_eventfd(struct crypt_priv *pcr, int fd)
+{
+	struct eventfd_ctx *ctx = NULL, *old;
+
+	if (fd >= 0) {
+		ctx = eventfd_ctx_fdget(fd);
+		if (IS_ERR(ctx))
+			return PTR_ERR(ctx);
+	} else if (fd != -1)
+		return -EINVAL;
+
+	spin_lock_irq(&pcr->done.lock);
+	old = pcr->done.evfd;
+	pcr->done.evfd = ctx;
+	spin_unlock_irq(&pcr->done.lock);
+
+	if (old)
+		eventfd_ctx_put(old);
+	return 0;
+}
 #endif
 
 /* this function has to be called from process context */
@@ -682,7 +2049,8 @@ static int fill_kcop_from_cop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
 		derr(1, "invalid session ID=0x%08X", cop->ses);
 		return -EINVAL;
 	}
-	kcop->ivlen = cop->iv ? ses_ptr->cdata.ivsize : 0;
+	kcop->iv_gen = crypto_op_gen_iv(ses_ptr, cop->op);
+	kcop->ivlen = (cop->iv || kcop->iv_gen) ? ses_ptr->cdata.ivsize : 0;
 	kcop->digestsize = 0; /* will be updated during operation */
 
 	crypto_put_session(ses_ptr);
@@ -690,7 +2058,7 @@ static int fill_kcop_from_cop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
 	kcop->task = current;
 	kcop->mm = current->mm;
 
-	if (cop->iv) {
+	if (cop->iv && !kcop->iv_gen) {
 		rc = copy_from_user(kcop->iv, cop->iv, kcop->ivlen);
 		if (unlikely(rc)) {
 			derr(1, "error copying IV (%d bytes), copy_from_user returned %d for address %p",
@@ -713,7 +2081,8 @@ static int fill_cop_from_kcop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
 		if (unlikely(ret))
 			return -EFAULT;
 	}
-	if (kcop->ivlen && kcop->cop.flags & COP_FLAG_WRITE_IV) {
+	if (kcop->ivlen && kcop->cop.iv &&
+	    (kcop->iv_gen || kcop->cop.flags & COP_FLAG_WRITE_IV)) {
 		ret = copy_to_user(kcop->cop.iv,
 				kcop->iv, kcop->ivlen);
 		if (unlikely(ret))
@@ -749,6 +2118,322 @@ static int kcop_to_user(struct kernel_crypt_op *kcop,
 	return 0;
 }
 
+/* the same for a crypt_op64, whose pointers are read as they are whether
+ * the caller is a 32 or a 64-bit program */
+static int kcop64_from_user(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void __user *arg)
+{
+	struct crypt_op *cop = &kcop->cop;
+	struct crypt_op64 cop64;
+
+	if (unlikely(copy_from_user(&cop64, arg, sizeof(cop64))))
+		return -EFAULT;
+	if (unlikely(cop64.__reserved))
+		return -EINVAL;
+
+	cop->ses = cop64.ses;
+	cop->op = cop64.op;
+	cop->flags = cop64.flags;
+	cop->len = cop64.len;
+	cop->src = u64_to_user_ptr(cop64.src);
+	cop->dst = u64_to_user_ptr(cop64.dst);
+	cop->mac = u64_to_user_ptr(cop64.mac);
+	cop->iv = u64_to_user_ptr(cop64.iv);
+
+	return fill_kcop_from_cop(kcop, fcr);
+}
+
+/* only flags and len of the crypt_op64 are set by a synchronous
+ * operation */
+static int kcop64_to_user(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void __user *arg)
+{
+	struct crypt_op64 __user *cop64 = arg;
+	int ret;
+
+	ret = fill_cop_from_kcop(kcop, fcr);
+	if (unlikely(ret)) {
+		derr(1, "Error in fill_cop_from_kcop");
+		return ret;
+	}
+
+	if (unlikely(put_user(kcop->cop.flags, &cop64->flags) ||
+		     put_user(kcop->cop.len, &cop64->len))) {
+		derr(1, "Cannot copy to userspace");
+		return -EFAULT;
+	}
+	return 0;
+}
+
+#ifdef ENABLE_ASYNC
+/* CIOCASYNCFETCH64 fills in the whole crypt_op64, by which the caller
+ * tells which of its jobs has completed */
+static int kcop64_fetch_to_user(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void __user *arg)
+{
+	struct crypt_op *cop = &kcop->cop;
+	struct crypt_op64 cop64;
+	int ret;
+
+	ret = fill_cop_from_kcop(kcop, fcr);
+	if (unlikely(ret)) {
+		derr(1, "Error in fill_cop_from_kcop");
+		return ret;
+	}
+
+	memset(&cop64, 0, sizeof(cop64));
+	cop64.ses = cop->ses;
+	cop64.op = cop->op;
+	cop64.flags = cop->flags;
+	cop64.len = cop->len;
+	cop64.src = (uintptr_t)cop->src;
+	cop64.dst = (uintptr_t)cop->dst;
+	cop64.mac = (uintptr_t)cop->mac;
+	cop64.iv = (uintptr_t)cop->iv;
+
+	if (unlikely(copy_to_user(arg, &cop64, sizeof(cop64)))) {
+		derr(1, "Cannot copy to userspace");
+		return -EFAULT;
+	}
+	return 0;
+}
+#endif
+
+/* the crypt_multi_op a crypt_multi_op64 stands for */
+static int multi_op64_from_user(struct crypt_multi_op *mop, void __user *arg)
+{
+	struct crypt_multi_op64 mop64;
+
+	if (unlikely(copy_from_user(&mop64, arg, sizeof(mop64))))
+		return -EFAULT;
+
+	mop->count = mop64.count;
+	mop->flags = mop64.flags;
+	mop->ops = u64_to_user_ptr(mop64.ops);
+	mop->status = u64_to_user_ptr(mop64.status);
+	return 0;
+}
+
+/* The elements of the arrays of CIOCGSESSION_MULTI, CIOCHASH_MULTI and
+ * CIOCCRYPTV, and those of their 64 forms */
+static int sop_from_user(struct session_op *sop, void __user *arg)
+{
+	if (unlikely(copy_from_user(sop, arg, sizeof(*sop))))
+		return -EFAULT;
+	return 0;
+}
+
+static int sop_ses_to_user(uint32_t ses, void __user *arg)
+{
+	struct session_op __user *usop = arg;
+
+	return put_user(ses, &usop->ses);
+}
+
+static int sop64_from_user(struct session_op *sop, void __user *arg)
+{
+	struct session_op64 sop64;
+
+	if (unlikely(copy_from_user(&sop64, arg, sizeof(sop64))))
+		return -EFAULT;
+	if (unlikely(sop64.__reserved))
+		return -EINVAL;
+
+	memset(sop, 0, sizeof(*sop));
+	sop->cipher = sop64.cipher;
+	sop->mac = sop64.mac;
+	sop->keylen = sop64.keylen;
+	sop->key = u64_to_user_ptr(sop64.key);
+	sop->mackeylen = sop64.mackeylen;
+	sop->mackey = u64_to_user_ptr(sop64.mackey);
+	sop->ses = sop64.ses;
+	return 0;
+}
+
+static int sop64_ses_to_user(uint32_t ses, void __user *arg)
+{
+	struct session_op64 __user *usop64 = arg;
+
+	return put_user(ses, &usop64->ses);
+}
+
+static int hash_vec_from_user(struct crypt_hash_vec *vec, void __user *arg)
+{
+	if (unlikely(copy_from_user(vec, arg, sizeof(*vec))))
+		return -EFAULT;
+	return 0;
+}
+
+static int hash_vec64_from_user(struct crypt_hash_vec *vec, void __user *arg)
+{
+	struct crypt_hash_vec64 vec64;
+
+	if (unlikely(copy_from_user(&vec64, arg, sizeof(vec64))))
+		return -EFAULT;
+	if (unlikely(vec64.__reserved))
+		return -EINVAL;
+
+	memset(vec, 0, sizeof(*vec));
+	vec->src = u64_to_user_ptr(vec64.src);
+	vec->mac = u64_to_user_ptr(vec64.mac);
+	vec->len = vec64.len;
+	return 0;
+}
+
+static int iovec_from_user(struct crypt_iovec *iov, void __user *arg,
+		unsigned int cnt)
+{
+	if (unlikely(copy_from_user(iov, arg, cnt * sizeof(*iov))))
+		return -EFAULT;
+	return 0;
+}
+
+static int iovec64_from_user(struct crypt_iovec *iov, void __user *arg,
+		unsigned int cnt)
+{
+	struct crypt_iovec64 __user *uiov64 = arg;
+	struct crypt_iovec64 iov64;
+	unsigned int i;
+
+	for (i = 0; i < cnt; i++) {
+		if (unlikely(copy_from_user(&iov64, &uiov64[i], sizeof(iov64))))
+			return -EFAULT;
+		if (unlikely(iov64.__reserved))
+			return -EINVAL;
+
+		iov[i].base = u64_to_user_ptr(iov64.base);
+		iov[i].len = iov64.len;
+	}
+	return 0;
+}
+
+/* the structures the remaining 64 forms stand for */
+static int hash_multi_op64_from_user(struct crypt_hash_multi_op *hmop,
+		void __user *arg)
+{
+	struct crypt_hash_multi_op64 hmop64;
+
+	if (unlikely(copy_from_user(&hmop64, arg, sizeof(hmop64))))
+		return -EFAULT;
+
+	hmop->ses = hmop64.ses;
+	hmop->count = hmop64.count;
+	hmop->flags = hmop64.flags;
+	hmop->__reserved = hmop64.__reserved;
+	hmop->vecs = u64_to_user_ptr(hmop64.vecs);
+	hmop->status = u64_to_user_ptr(hmop64.status);
+	return 0;
+}
+
+static int iov_op64_from_user(struct crypt_iov_op *iop, void __user *arg)
+{
+	struct crypt_iov_op64 iop64;
+
+	if (unlikely(copy_from_user(&iop64, arg, sizeof(iop64))))
+		return -EFAULT;
+
+	iop->ses = iop64.ses;
+	iop->op = iop64.op;
+	iop->flags = iop64.flags;
+	iop->src_cnt = iop64.src_cnt;
+	iop->dst_cnt = iop64.dst_cnt;
+	iop->src = u64_to_user_ptr(iop64.src);
+	iop->dst = u64_to_user_ptr(iop64.dst);
+	iop->mac = u64_to_user_ptr(iop64.mac);
+	iop->iv = u64_to_user_ptr(iop64.iv);
+	return 0;
+}
+
+static int sector_op64_from_user(struct crypt_sector_op *secop,
+		void __user *arg)
+{
+	struct crypt_sector_op64 secop64;
+
+	if (unlikely(copy_from_user(&secop64, arg, sizeof(secop64))))
+		return -EFAULT;
+
+	secop->ses = secop64.ses;
+	secop->op = secop64.op;
+	secop->flags = secop64.flags;
+	secop->len = secop64.len;
+	secop->sector_size = secop64.sector_size;
+	secop->sector = secop64.sector;
+	secop->src = u64_to_user_ptr(secop64.src);
+	secop->dst = u64_to_user_ptr(secop64.dst);
+	return 0;
+}
+
+static int fd_op64_from_user(struct crypt_fd_op *fdop, void __user *arg)
+{
+	struct crypt_fd_op64 fdop64;
+	unsigned int i;
+
+	if (unlikely(copy_from_user(&fdop64, arg, sizeof(fdop64))))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(fdop64.__reserved); i++)
+		if (unlikely(fdop64.__reserved[i]))
+			return -EINVAL;
+
+	memset(fdop, 0, sizeof(*fdop));
+	fdop->offset = fdop64.offset;
+	fdop->len = fdop64.len;
+	fdop->ses = fdop64.ses;
+	fdop->fd = fdop64.fd;
+	fdop->flags = fdop64.flags;
+	fdop->mac = u64_to_user_ptr(fdop64.mac);
+	return 0;
+}
+
+static int hash_mem_op64_from_user(struct crypt_hash_mem_op *hmemop,
+		void __user *arg)
+{
+	struct crypt_hash_mem_op64 hmemop64;
+
+	if (unlikely(copy_from_user(&hmemop64, arg, sizeof(hmemop64))))
+		return -EFAULT;
+	if (unlikely(hmemop64.__reserved))
+		return -EINVAL;
+
+	memset(hmemop, 0, sizeof(*hmemop));
+	hmemop->len = hmemop64.len;
+	hmemop->ses = hmemop64.ses;
+	hmemop->flags = hmemop64.flags;
+	hmemop->src = u64_to_user_ptr(hmemop64.src);
+	hmemop->mac = u64_to_user_ptr(hmemop64.mac);
+	return 0;
+}
+
+static int stream_op64_from_user(struct crypt_stream_op *stop,
+		void __user *arg)
+{
+	struct crypt_stream_op64 stop64;
+
+	if (unlikely(copy_from_user(&stop64, arg, sizeof(stop64))))
+		return -EFAULT;
+
+	stop->ses = stop64.ses;
+	stop->op = stop64.op;
+	stop->flags = stop64.flags;
+	stop->iv = u64_to_user_ptr(stop64.iv);
+	return 0;
+}
+
+#ifdef CIOCCPHASH
+static int hash_state_op64_from_user(struct crypt_hash_state_op *hsop,
+		void __user *arg)
+{
+	struct crypt_hash_state_op64 hsop64;
+
+	if (unlikely(copy_from_user(&hsop64, arg, sizeof(hsop64))))
+		return -EFAULT;
+
+	hsop->ses = hsop64.ses;
+	hsop->len = hsop64.len;
+	hsop->state = u64_to_user_ptr(hsop64.state);
+	return 0;
+}
+#endif
+
 static inline void tfm_info_to_alg_info(struct alg_info *dst, struct crypto_tfm *tfm)
 {
 	snprintf(dst->cra_name, CRYPTODEV_MAX_ALG_NAME,
@@ -825,24 +2510,329 @@ static int get_session_info(struct fcrypt *fcr, struct session_info_op *siop)
 	}
 
 	siop->alignmask = ses_ptr->alignmask;
+	siop->node = ses_ptr->node;
 
 	crypto_put_session(ses_ptr);
 	return 0;
 }
 
+static int get_stats(struct crypt_priv *pcr, struct crypt_stats_op __user *arg)
+{
+	struct crypt_stats_op stop;
+	struct csession *ses_ptr;
+	struct llist_node *pos;
+	int nfree = 0;
+
+	if (unlikely(copy_from_user(&stop, arg, sizeof(stop))))
+		return -EFAULT;
+
+	if (stop.ses) {
+		/* this also enters ses_ptr->sem */
+		ses_ptr = crypto_get_session_by_sid(&pcr->fcrypt, stop.ses);
+		if (unlikely(!ses_ptr)) {
+			derr(1, "invalid session ID=0x%08X", stop.ses);
+			return -EINVAL;
+		}
+		cryptodev_stats_read(&ses_ptr->stats, &stop);
+		crypto_put_session(ses_ptr);
+	} else {
+		/* the totals tell about the sessions of everyone */
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		cryptodev_stats_read(NULL, &stop);
+	}
+
+	/* every job that is not on the free list has not been fetched */
+	spin_lock(&pcr->free.lock);
+	llist_for_each(pos, READ_ONCE(pcr->free.list.first))
+		nfree++;
+	spin_unlock(&pcr->free.lock);
+	stop.async_pending = READ_ONCE(pcr->itemcount) - nfree;
+
+	return copy_to_user(arg, &stop, sizeof(stop)) ? -EFAULT : 0;
+}
+
+/* Run an array of crypt_op, or of crypt_op64 as given by size, from_user
+ * and to_user, through crypto_run(). Each element is handled like a
+ * separate CIOCCRYPT; its result is stored in mop->status, if given. */
+static int crypto_run_multi(struct fcrypt *fcr, struct crypt_multi_op *mop,
+		size_t size,
+		int (*from_user)(struct kernel_crypt_op *kcop,
+				struct fcrypt *fcr, void __user *arg),
+		int (*to_user)(struct kernel_crypt_op *kcop,
+				struct fcrypt *fcr, void __user *arg))
+{
+	void __user *uops = mop->ops;
+	struct kernel_crypt_op kcop;
+	unsigned int i;
+	int ret;
+
+	if (unlikely(mop->flags || (mop->count && !uops)))
+		return -EINVAL;
+
+	for (i = 0; i < mop->count; i++) {
+		ret = from_user(&kcop, fcr, uops + i * size);
+		if (likely(!ret))
+			ret = crypto_run(fcr, &kcop);
+		if (likely(!ret))
+			ret = to_user(&kcop, fcr, uops + i * size);
+
+		if (mop->status) {
+			if (unlikely(put_user(ret, &mop->status[i])))
+				return -EFAULT;
+		} else if (unlikely(ret)) {
+			dwarning(1, "operation %u of %u failed: %d", i, mop->count, ret);
+			return ret;
+		}
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* the number of crypt_auth_op that are read before any is run, so that
+ * TLS records can be pipelined */
+#define AUTH_BATCH	16
+
+/* Same as crypto_run_multi() for an array of crypt_auth_op or of
+ * crypt_auth_op64 */
+static int crypto_auth_run_multi(struct fcrypt *fcr, struct crypt_multi_op *mop,
+		size_t size,
+		int (*from_user)(struct kernel_crypt_auth_op *kcaop,
+				struct fcrypt *fcr, void __user *arg),
+		int (*to_user)(struct kernel_crypt_auth_op *kcaop,
+				struct fcrypt *fcr, void __user *arg))
+{
+	void __user *uops = mop->ops;
+	struct kernel_crypt_auth_op *kcaop;
+	int rets[AUTH_BATCH];
+	unsigned int i, j, n, cnt;
+	int ret = 0;
+
+	if (unlikely(mop->flags || (mop->count && !uops)))
+		return -EINVAL;
+	if (!mop->count)
+		return 0;
+
+	kcaop = kmalloc_array(min_t(unsigned int, mop->count, AUTH_BATCH),
+			sizeof(*kcaop), GFP_KERNEL);
+	if (unlikely(!kcaop))
+		return -ENOMEM;
+
+	for (i = 0; i < mop->count; i += n) {
+		cnt = min_t(unsigned int, mop->count - i, AUTH_BATCH);
+
+		/* the batch ends before an operation that cannot be read,
+		 * whose error is reported after it */
+		for (j = 0; j < cnt; j++) {
+			rets[j] = from_user(&kcaop[j], fcr,
+					uops + (i + j) * size);
+			if (unlikely(rets[j]))
+				break;
+		}
+		n = crypto_auth_run_batch(fcr, kcaop, rets, j, !mop->status);
+		if (n == j && j < cnt)
+			n++;
+
+		for (j = 0; j < n; j++) {
+			if (likely(!rets[j]))
+				rets[j] = to_user(&kcaop[j], fcr,
+						uops + (i + j) * size);
+
+			if (mop->status) {
+				if (unlikely(put_user(rets[j], &mop->status[i + j]))) {
+					ret = -EFAULT;
+					goto out;
+				}
+			} else if (unlikely(rets[j])) {
+				dwarning(1, "operation %u of %u failed: %d",
+						i + j, mop->count, rets[j]);
+				ret = rets[j];
+				goto out;
+			}
+		}
+		cond_resched();
+	}
+
+out:
+	kfree(kcaop);
+	return ret;
+}
+
+/* the number of sessions that are entered into or removed from the
+ * table under a single acquisition of fcr->sem */
+#define SESSION_BATCH	64
+
+/* Create the sessions of an array of session_op, or of session_op64 as
+ * given by size, from_user and ses_to_user. Each element is handled like
+ * a separate CIOCGSESSION, but the new sessions are put to the table in
+ * batches. */
+static int crypto_create_sessions(struct fcrypt *fcr, struct crypt_multi_op *mop,
+		size_t size,
+		int (*from_user)(struct session_op *sop, void __user *arg),
+		int (*ses_to_user)(uint32_t ses, void __user *arg))
+{
+	void __user *uops = mop->ops;
+	struct csession *batch[SESSION_BATCH];
+	struct session_op sop;
+	unsigned int i, n, done;
+	int ret = 0;
+
+	if (unlikely(mop->flags || (mop->count && !uops)))
+		return -EINVAL;
+
+	for (done = 0; done < mop->count; done += n) {
+		n = min_t(unsigned int, mop->count - done, SESSION_BATCH);
+
+		for (i = 0; i < n; i++) {
+			ret = from_user(&sop, uops + (done + i) * size);
+			if (unlikely(ret))
+				batch[i] = ERR_PTR(ret);
+			else
+				batch[i] = crypto_alloc_session(&sop, NULL);
+
+			/* without status, nothing after a failure is run */
+			if (!mop->status && unlikely(IS_ERR(batch[i]))) {
+				n = i + 1;
+				break;
+			}
+		}
+
+		mutex_lock(&fcr->sem);
+		for (i = 0; i < n; i++) {
+			if (IS_ERR(batch[i]))
+				continue;
+			ret = crypto_insert_session(fcr, batch[i]);
+			if (unlikely(ret)) {
+				crypto_release_session(batch[i]);
+				batch[i] = ERR_PTR(ret);
+			}
+		}
+		mutex_unlock(&fcr->sem);
+
+		for (i = 0; i < n; i++) {
+			if (IS_ERR(batch[i])) {
+				ret = PTR_ERR(batch[i]);
+			} else {
+				ret = ses_to_user(batch[i]->sid,
+						uops + (done + i) * size);
+				if (unlikely(ret))
+					crypto_finish_session(fcr, batch[i]->sid);
+			}
+
+			if (mop->status) {
+				if (unlikely(put_user(ret, &mop->status[done + i])))
+					ret = -EFAULT;
+				else
+					ret = 0;
+			}
+			if (unlikely(ret)) {
+				dwarning(1, "session %u of %u failed: %d",
+						done + i, mop->count, ret);
+				/* the rest of the batch is in the table */
+				for (i++; i < n; i++)
+					if (!IS_ERR(batch[i]))
+						crypto_finish_session(fcr,
+								batch[i]->sid);
+				return ret;
+			}
+		}
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* Finish the sessions in an array of session IDs, removing them from
+ * the table in batches. */
+static int crypto_finish_sessions(struct fcrypt *fcr, struct crypt_multi_op *mop)
+{
+	uint32_t __user *usids = mop->ops;
+	struct csession *batch[SESSION_BATCH];
+	uint32_t sids[SESSION_BATCH];
+	unsigned int i, n, done;
+	int ret, err = 0;
+
+	if (unlikely(mop->flags || (mop->count && !usids)))
+		return -EINVAL;
+
+	for (done = 0; done < mop->count; done += n) {
+		n = min_t(unsigned int, mop->count - done, SESSION_BATCH);
+		if (unlikely(copy_from_user(sids, &usids[done],
+					    n * sizeof(sids[0]))))
+			return -EFAULT;
+
+		mutex_lock(&fcr->sem);
+		for (i = 0; i < n; i++) {
+			batch[i] = crypto_find_session(fcr, sids[i]);
+			if (likely(batch[i])) {
+				crypto_del_session(fcr, batch[i]);
+			} else if (!mop->status) {
+				n = i + 1;
+				break;
+			}
+		}
+		mutex_unlock(&fcr->sem);
+
+		for (i = 0; i < n; i++) {
+			ret = 0;
+			if (likely(batch[i])) {
+				/* operations in progress keep the session
+				 * alive until they finish */
+				kref_put(&batch[i]->refcount,
+						crypto_destroy_session);
+			} else {
+				derr(1, "Session with sid=0x%08X not found!",
+						sids[i]);
+				ret = -ENOENT;
+			}
+
+			/* the whole batch is out of the table, so every
+			 * session in it needs to be put */
+			if (mop->status) {
+				if (unlikely(put_user(ret, &mop->status[done + i])))
+					err = -EFAULT;
+			} else if (unlikely(ret)) {
+				return ret;
+			}
+		}
+		if (unlikely(err))
+			return err;
+		cond_resched();
+	}
+
+	return 0;
+}
+
 static long
 cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 {
 	void __user *arg = (void __user *)arg_;
 	int __user *p = arg;
 	struct session_op sop;
+	struct session2_op s2op;
 	struct kernel_crypt_op kcop;
 	struct kernel_crypt_auth_op kcaop;
 	struct crypt_priv *pcr = filp->private_data;
 	struct fcrypt *fcr;
 	struct session_info_op siop;
+	struct crypt_multi_op mop;
+	struct crypt_hash_multi_op hmop;
+	struct crypt_iov_op iop;
+	struct crypt_sector_op secop;
+	struct crypt_fd_op fdop;
+	struct crypt_hash_mem_op hmemop;
+	struct crypt_ses_share_op shop;
+	struct crypt_stream_op stop;
+	struct crypt_srtp_op srop;
+	struct crypt_kop kop;
+	struct crypt_ring_setup rsetup;
+	struct crypt_ring_enter renter;
+	struct crypt_buf_op bop;
+	uint32_t bufid;
 #ifdef CIOCCPHASH
 	struct cphash_op cphop;
+	struct crypt_hash_state_op hsop;
 #endif
 	uint32_t ses;
 	int ret, fd;
@@ -854,7 +2844,15 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 
 	switch (cmd) {
 	case CIOCASYMFEAT:
-		return put_user(0, p);
+		return put_user(cryptodev_pk_features(), p);
+	case CIOCKEY:
+		if (unlikely(copy_from_user(&kop, arg, sizeof(kop))))
+			return -EFAULT;
+
+		ret = cryptodev_pk_run(&kop);
+		if (unlikely(ret))
+			return ret;
+		return copy_to_user(arg, &kop, sizeof(kop)) ? -EFAULT : 0;
 	case CRIOGET:
 		fd = clonefd(filp);
 		ret = put_user(fd, p);
@@ -871,7 +2869,36 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 		if (unlikely(copy_from_user(&sop, arg, sizeof(sop))))
 			return -EFAULT;
 
-		ret = crypto_create_session(fcr, &sop);
+		ret = crypto_create_session(fcr, &sop, NULL);
+		if (unlikely(ret))
+			return ret;
+		ret = copy_to_user(arg, &sop, sizeof(sop));
+		if (unlikely(ret)) {
+			crypto_finish_session(fcr, sop.ses);
+			return -EFAULT;
+		}
+		return ret;
+	case CIOCGSESSION2:
+	case CIOCGSESSION2_V1:
+		/* what a shorter session2_op lacks is left at the defaults */
+		memset(&s2op, 0, sizeof(s2op));
+		if (unlikely(copy_from_user(&s2op, arg, _IOC_SIZE(cmd))))
+			return -EFAULT;
+
+		ret = crypto_create_session2(fcr, &s2op);
+		if (unlikely(ret))
+			return ret;
+		ret = copy_to_user(arg, &s2op, _IOC_SIZE(cmd));
+		if (unlikely(ret)) {
+			crypto_finish_session(fcr, s2op.ses);
+			return -EFAULT;
+		}
+		return ret;
+	case CIOCCLONESESSION:
+		if (unlikely(copy_from_user(&sop, arg, sizeof(sop))))
+			return -EFAULT;
+
+		ret = crypto_clone_session(fcr, &sop);
 		if (unlikely(ret))
 			return ret;
 		ret = copy_to_user(arg, &sop, sizeof(sop));
@@ -880,6 +2907,33 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 			return -EFAULT;
 		}
 		return ret;
+	case CIOCSETKEY:
+		if (unlikely(copy_from_user(&sop, arg, sizeof(sop))))
+			return -EFAULT;
+
+		return crypto_set_session_keys(fcr, &sop);
+	case CIOCGSESSION_MULTI:
+		if (unlikely(copy_from_user(&mop, arg, sizeof(mop))))
+			return -EFAULT;
+
+		return crypto_create_sessions(fcr, &mop,
+				sizeof(struct session_op),
+				sop_from_user, sop_ses_to_user);
+	case CIOCFSESSION_MULTI:
+		if (unlikely(copy_from_user(&mop, arg, sizeof(mop))))
+			return -EFAULT;
+
+		return crypto_finish_sessions(fcr, &mop);
+	case CIOCGSESSION_MULTI64:
+		if (unlikely(ret = multi_op64_from_user(&mop, arg)))
+			return ret;
+		return crypto_create_sessions(fcr, &mop,
+				sizeof(struct session_op64),
+				sop64_from_user, sop64_ses_to_user);
+	case CIOCFSESSION_MULTI64:
+		if (unlikely(ret = multi_op64_from_user(&mop, arg)))
+			return ret;
+		return crypto_finish_sessions(fcr, &mop);
 	case CIOCFSESSION:
 		ret = get_user(ses, (uint32_t __user *)arg);
 		if (unlikely(ret))
@@ -894,12 +2948,39 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 		if (unlikely(ret))
 			return ret;
 		return copy_to_user(arg, &siop, sizeof(siop));
+	case CIOCGSTATS:
+		return get_stats(pcr, arg);
 #ifdef CIOCCPHASH
 	case CIOCCPHASH:
 		if (unlikely(copy_from_user(&cphop, arg, sizeof(cphop))))
 			return -EFAULT;
 		return crypto_copy_hash_state(fcr, cphop.dst_ses, cphop.src_ses);
-#endif /* CIOCPHASH */
+	case CIOCHASHEXPORT:
+		if (unlikely(copy_from_user(&hsop, arg, sizeof(hsop))))
+			return -EFAULT;
+
+		ret = crypto_hash_state(fcr, &hsop, 1);
+		if (unlikely(ret))
+			return ret;
+		return copy_to_user(arg, &hsop, sizeof(hsop)) ? -EFAULT : 0;
+	case CIOCHASHIMPORT:
+		if (unlikely(copy_from_user(&hsop, arg, sizeof(hsop))))
+			return -EFAULT;
+		return crypto_hash_state(fcr, &hsop, 0);
+	case CIOCHASHEXPORT64:
+		if (unlikely(ret = hash_state_op64_from_user(&hsop, arg)))
+			return ret;
+
+		ret = crypto_hash_state(fcr, &hsop, 1);
+		if (unlikely(ret))
+			return ret;
+		return put_user(hsop.len,
+				&((struct crypt_hash_state_op64 __user *)arg)->len);
+	case CIOCHASHIMPORT64:
+		if (unlikely(ret = hash_state_op64_from_user(&hsop, arg)))
+			return ret;
+		return crypto_hash_state(fcr, &hsop, 0);
+#endif /* CIOCCPHASH */
 	case CIOCCRYPT:
 		if (unlikely(ret = kcop_from_user(&kcop, fcr, arg))) {
 			dwarning(1, "Error copying from user");
@@ -925,18 +3006,198 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 			return ret;
 		}
 		return kcaop_to_user(&kcaop, fcr, arg);
-#ifdef ENABLE_ASYNC
-	case CIOCASYNCCRYPT:
-		if (unlikely(ret = kcop_from_user(&kcop, fcr, arg)))
+	case CIOCCRYPT_MULTI:
+		if (unlikely(copy_from_user(&mop, arg, sizeof(mop))))
+			return -EFAULT;
+		return crypto_run_multi(fcr, &mop, sizeof(struct crypt_op),
+				kcop_from_user, kcop_to_user);
+	case CIOCAUTHCRYPT_MULTI:
+		if (unlikely(copy_from_user(&mop, arg, sizeof(mop))))
+			return -EFAULT;
+		return crypto_auth_run_multi(fcr, &mop,
+				sizeof(struct crypt_auth_op),
+				kcaop_from_user, kcaop_to_user);
+	case CIOCCRYPT64:
+		ret = kcop64_from_user(&kcop, fcr, arg);
+		if (unlikely(ret))
+			return ret;
+
+		ret = crypto_run(fcr, &kcop);
+		if (unlikely(ret))
+			return ret;
+
+		return kcop64_to_user(&kcop, fcr, arg);
+	case CIOCAUTHCRYPT64:
+		ret = kcaop64_from_user(&kcaop, fcr, arg);
+		if (unlikely(ret))
+			return ret;
+
+		ret = crypto_auth_run(fcr, &kcaop);
+		if (unlikely(ret))
 			return ret;
 
-		return crypto_async_run(pcr, &kcop);
+		return kcaop64_to_user(&kcaop, fcr, arg);
+	case CIOCCRYPT_MULTI64:
+		if (unlikely(ret = multi_op64_from_user(&mop, arg)))
+			return ret;
+		return crypto_run_multi(fcr, &mop, sizeof(struct crypt_op64),
+				kcop64_from_user, kcop64_to_user);
+	case CIOCAUTHCRYPT_MULTI64:
+		if (unlikely(ret = multi_op64_from_user(&mop, arg)))
+			return ret;
+		return crypto_auth_run_multi(fcr, &mop,
+				sizeof(struct crypt_auth_op64),
+				kcaop64_from_user, kcaop64_to_user);
+	case CIOCHASH_MULTI:
+		if (unlikely(copy_from_user(&hmop, arg, sizeof(hmop))))
+			return -EFAULT;
+		return crypto_hash_multi(fcr, &hmop,
+				sizeof(struct crypt_hash_vec), hash_vec_from_user);
+	case CIOCHASH_MULTI64:
+		if (unlikely(ret = hash_multi_op64_from_user(&hmop, arg)))
+			return ret;
+		return crypto_hash_multi(fcr, &hmop,
+				sizeof(struct crypt_hash_vec64),
+				hash_vec64_from_user);
+	case CIOCCRYPTV:
+		if (unlikely(copy_from_user(&iop, arg, sizeof(iop))))
+			return -EFAULT;
+		return crypto_run_iov(fcr, &iop, iovec_from_user);
+	case CIOCCRYPTV64:
+		if (unlikely(ret = iov_op64_from_user(&iop, arg)))
+			return ret;
+		return crypto_run_iov(fcr, &iop, iovec64_from_user);
+	case CIOCCRYPT_SECTORS:
+		if (unlikely(copy_from_user(&secop, arg, sizeof(secop))))
+			return -EFAULT;
+		return crypto_run_sectors(fcr, &secop);
+	case CIOCCRYPT_SECTORS64:
+		if (unlikely(ret = sector_op64_from_user(&secop, arg)))
+			return ret;
+		return crypto_run_sectors(fcr, &secop);
+	case CIOCHASHFD:
+		if (unlikely(copy_from_user(&fdop, arg, sizeof(fdop))))
+			return -EFAULT;
+
+		ret = crypto_hash_fd(fcr, &fdop);
+		if (unlikely(ret))
+			return ret;
+		return copy_to_user(arg, &fdop, sizeof(fdop)) ? -EFAULT : 0;
+	case CIOCHASHFD64:
+		if (unlikely(ret = fd_op64_from_user(&fdop, arg)))
+			return ret;
+
+		ret = crypto_hash_fd(fcr, &fdop);
+		if (unlikely(ret))
+			return ret;
+		return put_user(fdop.len,
+				&((struct crypt_fd_op64 __user *)arg)->len);
+	case CIOCHASHMEM:
+		if (unlikely(copy_from_user(&hmemop, arg, sizeof(hmemop))))
+			return -EFAULT;
+
+		ret = crypto_hash_mem(fcr, &hmemop);
+		if (unlikely(ret))
+			return ret;
+		return copy_to_user(arg, &hmemop, sizeof(hmemop)) ? -EFAULT : 0;
+	case CIOCHASHMEM64:
+		if (unlikely(ret = hash_mem_op64_from_user(&hmemop, arg)))
+			return ret;
+
+		ret = crypto_hash_mem(fcr, &hmemop);
+		if (unlikely(ret))
+			return ret;
+		return put_user(hmemop.len,
+				&((struct crypt_hash_mem_op64 __user *)arg)->len);
+	case CIOCSESEXPORT:
+	case CIOCSESATTACH:
+		if (unlikely(copy_from_user(&shop, arg, sizeof(shop))))
+			return -EFAULT;
+
+		if (cmd == CIOCSESEXPORT)
+			ret = crypto_export_session(fcr, &shop);
+		else
+			ret = crypto_attach_session(fcr, &shop);
+		if (unlikely(ret))
+			return ret;
+		return copy_to_user(arg, &shop, sizeof(shop)) ? -EFAULT : 0;
+	case CIOCSTREAM:
+		if (unlikely(copy_from_user(&stop, arg, sizeof(stop))))
+			return -EFAULT;
+
+		return cryptodev_stream_setup(&pcr->stream, fcr,
+				&pcr->user_waiter, &stop);
+	case CIOCSTREAM64:
+		if (unlikely(ret = stream_op64_from_user(&stop, arg)))
+			return ret;
+
+		return cryptodev_stream_setup(&pcr->stream, fcr,
+				&pcr->user_waiter, &stop);
+	case CIOCSRTPSETUP:
+		if (unlikely(copy_from_user(&srop, arg, sizeof(srop))))
+			return -EFAULT;
+		return crypto_srtp_setup(fcr, &srop);
+	case CIOCRINGSETUP:
+		if (unlikely(copy_from_user(&rsetup, arg, sizeof(rsetup))))
+			return -EFAULT;
+
+		ret = cryptodev_ring_setup(&pcr->ring, fcr, &pcr->user_waiter,
+				cryptodev_wq, &rsetup);
+		if (unlikely(ret))
+			return ret;
+		return copy_to_user(arg, &rsetup, sizeof(rsetup));
+	case CIOCRINGENTER:
+		if (unlikely(copy_from_user(&renter, arg, sizeof(renter))))
+			return -EFAULT;
+		return cryptodev_ring_enter(pcr->ring, &renter);
+	case CIOCREGBUF:
+		if (unlikely(copy_from_user(&bop, arg, sizeof(bop))))
+			return -EFAULT;
+
+		ret = crypto_register_buf(fcr, &bop);
+		if (unlikely(ret))
+			return ret;
+		ret = copy_to_user(arg, &bop, sizeof(bop));
+		if (unlikely(ret)) {
+			crypto_unregister_buf(fcr, bop.id);
+			return -EFAULT;
+		}
+		return ret;
+	case CIOCUNREGBUF:
+		ret = get_user(bufid, (uint32_t __user *)arg);
+		if (unlikely(ret))
+			return ret;
+		return crypto_unregister_buf(fcr, bufid);
+	case CIOCALLOCBUF:
+		if (unlikely(copy_from_user(&bop, arg, sizeof(bop))))
+			return -EFAULT;
+
+		ret = crypto_alloc_buf(fcr, &bop);
+		if (unlikely(ret))
+			return ret;
+		ret = copy_to_user(arg, &bop, sizeof(bop));
+		if (unlikely(ret)) {
+			crypto_unregister_buf(fcr, bop.id);
+			return -EFAULT;
+		}
+		return ret;
+#ifdef ENABLE_ASYNC
+	case CIOCASYNCCRYPT:
+		return crypto_async_run(pcr, arg, kcop_from_user);
 	case CIOCASYNCFETCH:
-		ret = crypto_async_fetch(pcr, &kcop);
+		return crypto_async_fetch(pcr, arg, kcop_to_user);
+	case CIOCASYNCCRYPT64:
+		return crypto_async_run(pcr, arg, kcop64_from_user);
+	case CIOCASYNCFETCH64:
+		return crypto_async_fetch(pcr, arg, kcop64_fetch_to_user);
+	case CIOCASYNCEVENTFD:
+		ret = get_user(fd, (int __user *)arg);
 		if (unlikely(ret))
 			return ret;
 
-		return kcop_to_user(&kcop, fcr, arg);
+		return crypto_async_set_eventfd(pcr, fd);
+	case CIOCASYNCDEPTH:
+		return crypto_async_set_depth(pcr, arg);
 #endif
 	default:
 		return -EINVAL;
@@ -972,6 +3233,28 @@ session_op_to_compat(struct session_op *sop, struct compat_session_op *compat)
 	compat->ses       = sop->ses;
 }
 
+static inline void
+compat_to_session2_op(struct compat_session2_op *compat,
+		struct session2_op *s2op)
+{
+	s2op->cipher = compat->cipher;
+	s2op->mac = compat->mac;
+	s2op->keylen = compat->keylen;
+
+	s2op->key       = compat_ptr(compat->key);
+	s2op->mackeylen = compat->mackeylen;
+	s2op->mackey    = compat_ptr(compat->mackey);
+	s2op->ses       = compat->ses;
+	s2op->flags     = compat->flags;
+	memcpy(s2op->cipher_driver, compat->cipher_driver,
+	       sizeof(s2op->cipher_driver));
+	memcpy(s2op->mac_driver, compat->mac_driver, sizeof(s2op->mac_driver));
+	s2op->engines   = compat->engines;
+	s2op->poll_us   = compat->poll_us;
+	s2op->node      = compat->node;
+	memcpy(s2op->__reserved, compat->__reserved, sizeof(s2op->__reserved));
+}
+
 static inline void
 compat_to_crypt_op(struct compat_crypt_op *compat, struct crypt_op *cop)
 {
@@ -1040,6 +3323,8 @@ cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 	struct fcrypt *fcr;
 	struct session_op sop;
 	struct compat_session_op compat_sop;
+	struct session2_op s2op;
+	struct compat_session2_op compat_s2op;
 	struct kernel_crypt_op kcop;
 	int ret;
 
@@ -1053,15 +3338,49 @@ cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 	case CRIOGET:
 	case CIOCFSESSION:
 	case CIOCGSESSINFO:
+	case CIOCRINGSETUP:
+	case CIOCRINGENTER:
+	case CIOCREGBUF:
+	case CIOCUNREGBUF:
+	case CIOCALLOCBUF:
+	case CIOCGSTATS:
+	case CIOCASYNCEVENTFD:
+	case CIOCASYNCDEPTH:
+	case CIOCSRTPSETUP:
+	case CIOCSESEXPORT:
+	case CIOCSESATTACH:
+	/* the same layout for 32-bit programs */
+	case CIOCCRYPT64:
+	case CIOCAUTHCRYPT64:
+	case CIOCASYNCCRYPT64:
+	case CIOCASYNCFETCH64:
+	case CIOCCRYPT_MULTI64:
+	case CIOCAUTHCRYPT_MULTI64:
+	case CIOCHASH_MULTI64:
+	case CIOCCRYPTV64:
+	case CIOCGSESSION_MULTI64:
+	case CIOCFSESSION_MULTI64:
+	case CIOCCRYPT_SECTORS64:
+	case CIOCHASHFD64:
+	case CIOCHASHMEM64:
+	case CIOCSTREAM64:
+#ifdef CIOCCPHASH
+	case CIOCHASHEXPORT64:
+	case CIOCHASHIMPORT64:
+#endif
 		return cryptodev_ioctl(file, cmd, arg_);
 
 	case COMPAT_CIOCGSESSION:
+	case COMPAT_CIOCCLONESESSION:
 		if (unlikely(copy_from_user(&compat_sop, arg,
 					    sizeof(compat_sop))))
 			return -EFAULT;
 		compat_to_session_op(&compat_sop, &sop);
 
-		ret = crypto_create_session(fcr, &sop);
+		if (cmd == COMPAT_CIOCGSESSION)
+			ret = crypto_create_session(fcr, &sop, NULL);
+		else
+			ret = crypto_clone_session(fcr, &sop);
 		if (unlikely(ret))
 			return ret;
 
@@ -1073,6 +3392,34 @@ cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 		}
 		return ret;
 
+	case COMPAT_CIOCGSESSION2:
+	case COMPAT_CIOCGSESSION2_V1:
+		memset(&compat_s2op, 0, sizeof(compat_s2op));
+		if (unlikely(copy_from_user(&compat_s2op, arg,
+					    _IOC_SIZE(cmd))))
+			return -EFAULT;
+		compat_to_session2_op(&compat_s2op, &s2op);
+
+		ret = crypto_create_session2(fcr, &s2op);
+		if (unlikely(ret))
+			return ret;
+
+		compat_s2op.ses = s2op.ses;
+		ret = copy_to_user(arg, &compat_s2op, _IOC_SIZE(cmd));
+		if (unlikely(ret)) {
+			crypto_finish_session(fcr, s2op.ses);
+			return -EFAULT;
+		}
+		return ret;
+
+	case COMPAT_CIOCSETKEY:
+		if (unlikely(copy_from_user(&compat_sop, arg,
+					    sizeof(compat_sop))))
+			return -EFAULT;
+		compat_to_session_op(&compat_sop, &sop);
+
+		return crypto_set_session_keys(fcr, &sop);
+
 	case COMPAT_CIOCCRYPT:
 		ret = compat_kcop_from_user(&kcop, fcr, arg);
 		if (unlikely(ret))
@@ -1085,16 +3432,9 @@ cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 		return compat_kcop_to_user(&kcop, fcr, arg);
 #ifdef ENABLE_ASYNC
 	case COMPAT_CIOCASYNCCRYPT:
-		if (unlikely(ret = compat_kcop_from_user(&kcop, fcr, arg)))
-			return ret;
-
-		return crypto_async_run(pcr, &kcop);
+		return crypto_async_run(pcr, arg, compat_kcop_from_user);
 	case COMPAT_CIOCASYNCFETCH:
-		ret = crypto_async_fetch(pcr, &kcop);
-		if (unlikely(ret))
-			return ret;
-
-		return compat_kcop_to_user(&kcop, fcr, arg);
+		return crypto_async_fetch(pcr, arg, compat_kcop_to_user);
 #endif
 	default:
 		return -EINVAL;
@@ -1112,12 +3452,51 @@ static unsigned int cryptodev_poll(struct file *file, poll_table *wait)
 
 	if (!list_empty_careful(&pcr->done.list))
 		ret |= POLLIN | POLLRDNORM;
-	if (!list_empty_careful(&pcr->free.list) || pcr->itemcount < MAX_COP_RINGSIZE)
+	/* a stream can be written to only while it has space */
+	if (pcr->stream)
+		ret |= cryptodev_stream_poll(pcr->stream);
+	else if (!llist_empty(&pcr->free.list) ||
+		 READ_ONCE(pcr->itemcount) < READ_ONCE(pcr->depth))
 		ret |= POLLOUT | POLLWRNORM;
 
+	ret |= cryptodev_ring_poll(pcr->ring);
+
 	return ret;
 }
 
+static int cryptodev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct crypt_priv *pcr = file->private_data;
+
+	/* offset zero is the ring, the others are kernel buffers */
+	if (vma->vm_pgoff == 0)
+		return cryptodev_ring_mmap(pcr->ring, vma);
+
+	return crypto_mmap_buf(&pcr->fcrypt, vma);
+}
+
+static int cryptodev_nonblock(struct kiocb *iocb)
+{
+	return (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+		(iocb->ki_flags & IOCB_NOWAIT);
+}
+
+static ssize_t cryptodev_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct crypt_priv *pcr = iocb->ki_filp->private_data;
+
+	return cryptodev_stream_read(READ_ONCE(pcr->stream), to,
+			cryptodev_nonblock(iocb));
+}
+
+static ssize_t cryptodev_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct crypt_priv *pcr = iocb->ki_filp->private_data;
+
+	return cryptodev_stream_write(READ_ONCE(pcr->stream), from,
+			cryptodev_nonblock(iocb));
+}
+
 static const struct file_operations cryptodev_fops = {
 	.owner = THIS_MODULE,
 	.open = cryptodev_open,
@@ -1127,6 +3506,16 @@ static const struct file_operations cryptodev_fops = {
 	.compat_ioctl = cryptodev_compat_ioctl,
 #endif /* CONFIG_COMPAT */
 	.poll = cryptodev_poll,
+	.mmap = cryptodev_mmap,
+	.read_iter = cryptodev_read_iter,
+	.write_iter = cryptodev_write_iter,
+	/* splice() goes through the stream with a single copy each way */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0))
+	.splice_read = copy_splice_read,
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0))
+	.splice_read = generic_file_splice_read,
+#endif
+	.splice_write = iter_file_splice_write,
 };
 
 static struct miscdevice cryptodev = {
@@ -1181,15 +3570,63 @@ static int __init init_cryptodev(void)
 {
 	int rc;
 
+	rc = cryptodev_stats_init();
+	if (unlikely(rc)) {
+		pr_err(PFX "failed to allocate the counters\n");
+		return rc;
+	}
+
+	cryptodev_ses_cache = KMEM_CACHE(csession, 0);
+	if (unlikely(!cryptodev_ses_cache)) {
+		pr_err(PFX "failed to create the session cache\n");
+		cryptodev_stats_exit();
+		return -ENOMEM;
+	}
+
+	cryptodev_req_cache = KMEM_CACHE(cryptodev_req, 0);
+	if (unlikely(!cryptodev_req_cache)) {
+		pr_err(PFX "failed to create the request cache\n");
+		kmem_cache_destroy(cryptodev_ses_cache);
+		cryptodev_stats_exit();
+		return -ENOMEM;
+	}
+
+	cryptodev_item_cache = KMEM_CACHE(todo_list_item, 0);
+	if (unlikely(!cryptodev_item_cache)) {
+		pr_err(PFX "failed to create the async job cache\n");
+		kmem_cache_destroy(cryptodev_req_cache);
+		kmem_cache_destroy(cryptodev_ses_cache);
+		cryptodev_stats_exit();
+		return -ENOMEM;
+	}
+
 	cryptodev_wq = create_workqueue("cryptodev_queue");
 	if (unlikely(!cryptodev_wq)) {
 		pr_err(PFX "failed to allocate the cryptodev workqueue\n");
+		kmem_cache_destroy(cryptodev_item_cache);
+		kmem_cache_destroy(cryptodev_req_cache);
+		kmem_cache_destroy(cryptodev_ses_cache);
+		cryptodev_stats_exit();
 		return -EFAULT;
 	}
 
+#ifdef CIOCCPHASH
+	/* without it hash states cannot be exported or imported */
+	rc = cryptodev_hash_state_init();
+	if (unlikely(rc))
+		pr_warn(PFX "no key for hash states: %d\n", rc);
+#endif
+
 	rc = cryptodev_register();
 	if (unlikely(rc)) {
+#ifdef CIOCCPHASH
+		cryptodev_hash_state_exit();
+#endif
 		destroy_workqueue(cryptodev_wq);
+		kmem_cache_destroy(cryptodev_item_cache);
+		kmem_cache_destroy(cryptodev_req_cache);
+		kmem_cache_destroy(cryptodev_ses_cache);
+		cryptodev_stats_exit();
 		return rc;
 	}
 
@@ -1209,6 +3646,17 @@ static void __exit exit_cryptodev(void)
 		unregister_sysctl_table(verbosity_sysctl_header);
 
 	cryptodev_deregister();
+	/* sessions are freed after a grace period */
+	rcu_barrier();
+	kmem_cache_destroy(cryptodev_ses_cache);
+	kmem_cache_destroy(cryptodev_req_cache);
+	kmem_cache_destroy(cryptodev_item_cache);
+	cryptodev_tfm_cache_flush();
+	cryptodev_bounce_pool_flush();
+#ifdef CIOCCPHASH
+	cryptodev_hash_state_exit();
+#endif
+	cryptodev_stats_exit();
 	pr_info(PFX "driver unloaded.\n");
 }
 
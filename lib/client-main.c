@@ -0,0 +1,131 @@
+/*
+ * Runs requests of many sizes through the client library, both one by
+ * one and queued, and checks them against OpenSSL. Given a file name,
+ * the crossover points are cached there.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <crypto/cryptodev.h>
+#include <openssl/evp.h>
+#include "client.h"
+
+#define	MAX_SIZE	(64 * 1024)
+#define	NQUEUED		(CDEV_BATCH_MAX + 3)	/* more than a batch */
+
+static const size_t sizes[] = {16, 64, 256, 1024, 4096, 16 * 1024, MAX_SIZE};
+
+#define	NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static unsigned char key[16], iv[16];
+
+static int check_cipher(struct cdev *cd, unsigned char *src, unsigned char *dst)
+{
+	unsigned char expected[MAX_SIZE];
+	struct cdev_session *s;
+	EVP_CIPHER_CTX *ctx;
+	size_t i;
+	int len;
+
+	s = cdev_session_get(cd, CRYPTO_AES_CBC, key, sizeof(key), 0, NULL, 0);
+	ctx = EVP_CIPHER_CTX_new();
+	if (!s || !ctx) {
+		fprintf(stderr, "no aes-128-cbc session\n");
+		return 1;
+	}
+
+	for (i = 0; i < NSIZES; i++) {
+		if (!EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv) ||
+		    !EVP_CIPHER_CTX_set_padding(ctx, 0) ||
+		    !EVP_EncryptUpdate(ctx, expected, &len, src, sizes[i]))
+			return 1;
+
+		/* an unaligned destination is bounced */
+		if (cdev_encrypt(s, iv, src, dst + 1, sizes[i], NULL) ||
+		    memcmp(dst + 1, expected, sizes[i])) {
+			fprintf(stderr, "FAIL: encryption of %zu bytes\n", sizes[i]);
+			return 1;
+		}
+		if (cdev_decrypt(s, iv, dst + 1, dst, sizes[i], NULL) ||
+		    memcmp(dst, src, sizes[i])) {
+			fprintf(stderr, "FAIL: decryption of %zu bytes\n", sizes[i]);
+			return 1;
+		}
+	}
+
+	EVP_CIPHER_CTX_free(ctx);
+	cdev_session_put(s);
+	return 0;
+}
+
+static int check_queue(struct cdev *cd, unsigned char *src)
+{
+	unsigned char digests[NQUEUED][32], expected[32];
+	int status[NQUEUED];
+	struct cdev_session *s;
+	int i;
+
+	s = cdev_session_get(cd, 0, NULL, 0, CRYPTO_SHA2_256, NULL, 0);
+	if (!s) {
+		fprintf(stderr, "no sha256 session\n");
+		return 1;
+	}
+
+	for (i = 0; i < NQUEUED; i++) {
+		status[i] = 1;
+		if (cdev_queue(s, COP_ENCRYPT, NULL, src + i, NULL, 64,
+			       digests[i], &status[i])) {
+			fprintf(stderr, "FAIL: request %d was not queued\n", i);
+			return 1;
+		}
+	}
+	if (cdev_flush(cd))
+		fprintf(stderr, "FAIL: queued requests failed\n");
+
+	for (i = 0; i < NQUEUED; i++) {
+		if (!EVP_Digest(src + i, 64, expected, NULL, EVP_sha256(), NULL))
+			return 1;
+		if (status[i] || memcmp(digests[i], expected, sizeof(expected))) {
+			fprintf(stderr, "FAIL: queued request %d\n", i);
+			return 1;
+		}
+	}
+
+	cdev_session_put(s);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char *src, *dst;
+	struct cdev *cd;
+	int i;
+
+	if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+		fprintf(stderr, "Usage: %s [cache-file]\n", argv[0]);
+		return 1;
+	}
+
+	cd = cdev_open(argc == 2 ? argv[1] : NULL, 0);
+	src = cdev_malloc(MAX_SIZE + NQUEUED);
+	dst = cdev_malloc(MAX_SIZE + 1);
+	if (!cd || !src || !dst)
+		return 1;
+
+	memset(key, 0x33, sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+	for (i = 0; i < MAX_SIZE + NQUEUED; i++)
+		src[i] = i * 7;
+
+	if (check_cipher(cd, src, dst) || check_queue(cd, src))
+		return 1;
+
+	free(src);
+	free(dst);
+	cdev_close(cd);
+	printf("client: all requests give the same results as OpenSSL\n");
+	return 0;
+}
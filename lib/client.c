@@ -0,0 +1,535 @@
+/*
+ * A client of /dev/crypto that pools sessions, keeps buffers aligned for
+ * zero copy, batches small requests and leaves the ones OpenSSL is faster
+ * with to OpenSSL.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include "crossover.h"
+#include "client.h"
+
+/* more than the alignmask of any driver */
+#define BUF_ALIGN 4096
+
+struct cdev {
+	int cfd;		/* -1 without /dev/crypto */
+	int flags;
+
+	struct cdev_session *idle;	/* the most recently put first */
+	int nidle;
+
+	unsigned char *bounce;
+	size_t bounce_size;
+
+	struct crypt_op batch[CDEV_BATCH_MAX];
+	int *batch_status[CDEV_BATCH_MAX];
+	__s32 kstatus[CDEV_BATCH_MAX];
+	int nbatch;
+};
+
+struct cdev_session {
+	struct cdev *cd;
+	struct cdev_session *next;	/* in the pool */
+
+	int cipher, keylen, mac, mackeylen;
+	unsigned char key[CRYPTO_CIPHER_MAX_KEY_LEN];
+	unsigned char mackey[CRYPTO_HMAC_MAX_KEY_LEN];
+
+	int kernel;		/* ses is a session of /dev/crypto */
+	uint32_t ses;
+	uint16_t alignmask;
+
+	/* the OpenSSL counterpart, if requests may fall back to it */
+	const EVP_CIPHER *evp_cipher;
+	const EVP_MD *evp_md;
+	EVP_CIPHER_CTX *ctx;
+	int ctx_enc;		/* the direction ctx is keyed for, or -1 */
+};
+
+static const struct {
+	int cipher, keylen;
+	const EVP_CIPHER *(*evp)(void);
+} evp_ciphers[] = {
+	{ CRYPTO_3DES_CBC, 24, EVP_des_ede3_cbc },
+	{ CRYPTO_AES_CBC, 16, EVP_aes_128_cbc },
+	{ CRYPTO_AES_CBC, 24, EVP_aes_192_cbc },
+	{ CRYPTO_AES_CBC, 32, EVP_aes_256_cbc },
+	{ CRYPTO_AES_ECB, 16, EVP_aes_128_ecb },
+	{ CRYPTO_AES_ECB, 24, EVP_aes_192_ecb },
+	{ CRYPTO_AES_ECB, 32, EVP_aes_256_ecb },
+	{ CRYPTO_AES_CTR, 16, EVP_aes_128_ctr },
+	{ CRYPTO_AES_CTR, 24, EVP_aes_192_ctr },
+	{ CRYPTO_AES_CTR, 32, EVP_aes_256_ctr },
+	{ CRYPTO_CAMELLIA_CBC, 16, EVP_camellia_128_cbc },
+	{ CRYPTO_CAMELLIA_CBC, 24, EVP_camellia_192_cbc },
+	{ CRYPTO_CAMELLIA_CBC, 32, EVP_camellia_256_cbc },
+};
+
+static const struct {
+	int mac;
+	const EVP_MD *(*evp)(void);
+} evp_mds[] = {
+	{ CRYPTO_MD5, EVP_md5 },
+	{ CRYPTO_SHA1, EVP_sha1 },
+	{ CRYPTO_SHA2_224, EVP_sha224 },
+	{ CRYPTO_SHA2_256, EVP_sha256 },
+	{ CRYPTO_SHA2_384, EVP_sha384 },
+	{ CRYPTO_SHA2_512, EVP_sha512 },
+	{ CRYPTO_MD5_HMAC, EVP_md5 },
+	{ CRYPTO_SHA1_HMAC, EVP_sha1 },
+	{ CRYPTO_SHA2_224_HMAC, EVP_sha224 },
+	{ CRYPTO_SHA2_256_HMAC, EVP_sha256 },
+	{ CRYPTO_SHA2_384_HMAC, EVP_sha384 },
+	{ CRYPTO_SHA2_512_HMAC, EVP_sha512 },
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Only sessions with either a cipher or a MAC fall back to OpenSSL */
+static void find_evp(struct cdev_session *s)
+{
+	size_t i;
+
+	if (s->cipher && s->mac)
+		return;
+
+	for (i = 0; s->cipher && i < ARRAY_SIZE(evp_ciphers); i++)
+		if (evp_ciphers[i].cipher == s->cipher &&
+		    evp_ciphers[i].keylen == s->keylen)
+			s->evp_cipher = evp_ciphers[i].evp();
+
+	for (i = 0; s->mac && i < ARRAY_SIZE(evp_mds); i++)
+		if (evp_mds[i].mac == s->mac)
+			s->evp_md = evp_mds[i].evp();
+}
+
+static int open_session(struct cdev_session *s)
+{
+	struct session_info_op siop;
+	struct session_op sess;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = s->cipher;
+	sess.keylen = s->keylen;
+	sess.key = s->keylen ? s->key : NULL;
+	sess.mac = s->mac;
+	sess.mackeylen = s->mackeylen;
+	sess.mackey = s->mackeylen ? s->mackey : NULL;
+	if (ioctl(s->cd->cfd, CIOCGSESSION, &sess))
+		return -1;
+	s->ses = sess.ses;
+
+	memset(&siop, 0, sizeof(siop));
+	siop.ses = s->ses;
+	if (ioctl(s->cd->cfd, CIOCGSESSINFO, &siop) == 0)
+		s->alignmask = siop.alignmask;
+
+	return 0;
+}
+
+static void free_session(struct cdev_session *s)
+{
+	if (s->kernel && ioctl(s->cd->cfd, CIOCFSESSION, &s->ses))
+		perror("ioctl(CIOCFSESSION)");
+	if (s->ctx)
+		EVP_CIPHER_CTX_free(s->ctx);
+	OPENSSL_cleanse(s->key, sizeof(s->key));
+	OPENSSL_cleanse(s->mackey, sizeof(s->mackey));
+	free(s);
+}
+
+static int same_alg(const struct cdev_session *s, int cipher, int keylen,
+		int mac, int mackeylen)
+{
+	return s->cipher == cipher && s->keylen == keylen &&
+		s->mac == mac && s->mackeylen == mackeylen;
+}
+
+static int same_keys(const struct cdev_session *s, const void *key,
+		const void *mackey)
+{
+	return (!s->keylen || memcmp(s->key, key, s->keylen) == 0) &&
+		(!s->mackeylen || memcmp(s->mackey, mackey, s->mackeylen) == 0);
+}
+
+/* give a pooled session of the same algorithm other keys */
+static int rekey_session(struct cdev_session *s, const void *key,
+		const void *mackey)
+{
+	struct session_op sess;
+
+	if (s->keylen)
+		memcpy(s->key, key, s->keylen);
+	if (s->mackeylen)
+		memcpy(s->mackey, mackey, s->mackeylen);
+	s->ctx_enc = -1;
+
+	if (!s->kernel)
+		return 0;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.ses = s->ses;
+	sess.keylen = s->keylen;
+	sess.key = s->keylen ? s->key : NULL;
+	sess.mackeylen = s->mackeylen;
+	sess.mackey = s->mackeylen ? s->mackey : NULL;
+	return ioctl(s->cd->cfd, CIOCSETKEY, &sess);
+}
+
+struct cdev *cdev_open(const char *cache, int flags)
+{
+	struct cdev *cd;
+
+	cd = calloc(1, sizeof(*cd));
+	if (!cd)
+		return NULL;
+	cd->flags = flags;
+
+	cd->cfd = open("/dev/crypto", O_RDWR | O_CLOEXEC, 0);
+	if (cd->cfd < 0 && (flags & CDEV_F_NO_FALLBACK)) {
+		perror("open(/dev/crypto)");
+		free(cd);
+		return NULL;
+	}
+
+	/* without crossover points every request goes to the kernel */
+	if (cd->cfd >= 0 && !(flags & CDEV_F_NO_FALLBACK) &&
+	    crossover_init(cache) < 0)
+		fprintf(stderr, "crossover points could not be measured\n");
+
+	return cd;
+}
+
+void cdev_close(struct cdev *cd)
+{
+	struct cdev_session *s;
+
+	cdev_flush(cd);
+	while ((s = cd->idle)) {
+		cd->idle = s->next;
+		free_session(s);
+	}
+	free(cd->bounce);
+	if (cd->cfd >= 0)
+		close(cd->cfd);
+	free(cd);
+}
+
+struct cdev_session *cdev_session_get(struct cdev *cd, int cipher,
+		const void *key, int keylen, int mac, const void *mackey,
+		int mackeylen)
+{
+	struct cdev_session *s, **pp, **other = NULL;
+
+	if (keylen < 0 || (size_t)keylen > sizeof(s->key) ||
+	    mackeylen < 0 || (size_t)mackeylen > sizeof(s->mackey))
+		return NULL;
+
+	/* a pooled session with the same keys, or else with other ones */
+	for (pp = &cd->idle; *pp; pp = &(*pp)->next) {
+		s = *pp;
+		if (!same_alg(s, cipher, keylen, mac, mackeylen))
+			continue;
+		if (same_keys(s, key, mackey))
+			break;
+		if (!other)
+			other = pp;
+	}
+	if (!*pp)
+		pp = other;
+	if (pp) {
+		s = *pp;
+		*pp = s->next;
+		s->next = NULL;
+		cd->nidle--;
+		if (pp != other || rekey_session(s, key, mackey) == 0)
+			return s;
+		free_session(s);
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->cd = cd;
+	s->cipher = cipher;
+	s->keylen = keylen;
+	s->mac = mac;
+	s->mackeylen = mackeylen;
+	if (keylen)
+		memcpy(s->key, key, keylen);
+	if (mackeylen)
+		memcpy(s->mackey, mackey, mackeylen);
+	s->ctx_enc = -1;
+
+	if (!(cd->flags & CDEV_F_NO_FALLBACK))
+		find_evp(s);
+	if (cd->cfd >= 0 && open_session(s) == 0)
+		s->kernel = 1;
+	if (!s->kernel && !s->evp_cipher && !s->evp_md) {
+		free_session(s);
+		return NULL;
+	}
+
+	return s;
+}
+
+void cdev_session_put(struct cdev_session *s)
+{
+	struct cdev *cd = s->cd;
+	struct cdev_session **pp;
+
+	/* requests queued on it must not see another key */
+	cdev_flush(cd);
+
+	s->next = cd->idle;
+	cd->idle = s;
+	if (++cd->nidle <= CDEV_POOL_MAX)
+		return;
+
+	/* drop the least recently used one */
+	for (pp = &cd->idle; (*pp)->next; pp = &(*pp)->next)
+		;
+	free_session(*pp);
+	*pp = NULL;
+	cd->nidle--;
+}
+
+static int aligned(const struct cdev_session *s, const void *p)
+{
+	return !((uintptr_t)p & s->alignmask);
+}
+
+/* whether the kernel or OpenSSL is faster for len bytes */
+static int use_kernel(const struct cdev_session *s, size_t len, int zc)
+{
+	int flags = 0;
+
+	if (!s->kernel)
+		return 0;
+	if (!s->evp_cipher && !s->evp_md)
+		return 1;
+	/* not measured */
+	if (!crossover_find(s->cipher, s->keylen, s->mac))
+		return 1;
+
+	if (zc)
+		flags |= CROSSOVER_F_ZC;
+	if (s->cd->flags & CDEV_F_THROUGHPUT)
+		flags |= CROSSOVER_F_THROUGHPUT;
+	return crossover_use_kernel(s->cipher, s->keylen, s->mac, len, flags);
+}
+
+static unsigned char *get_bounce(struct cdev *cd, size_t len)
+{
+	if (len <= cd->bounce_size)
+		return cd->bounce;
+
+	free(cd->bounce);
+	cd->bounce_size = 0;
+	cd->bounce = cdev_malloc(len);
+	if (cd->bounce)
+		cd->bounce_size = len;
+	return cd->bounce;
+}
+
+static int kernel_op(struct cdev_session *s, int op, const void *iv,
+		const void *src, void *dst, size_t len, void *digest)
+{
+	unsigned char *buf = NULL;
+	struct crypt_op cop;
+
+	if (len > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&cop, 0, sizeof(cop));
+	cop.ses = s->ses;
+	cop.op = op;
+	cop.len = len;
+	cop.src = (void *)src;
+	cop.dst = dst;
+	cop.iv = (void *)iv;
+	cop.mac = digest;
+
+	/* ciphered in place in an aligned copy, to keep zero copy */
+	if (!aligned(s, src) || !aligned(s, dst)) {
+		buf = get_bounce(s->cd, len);
+		if (!buf)
+			return -1;
+		memcpy(buf, src, len);
+		cop.src = buf;
+		cop.dst = dst ? buf : NULL;
+	}
+
+	if (ioctl(s->cd->cfd, CIOCCRYPT, &cop))
+		return -1;
+
+	if (buf && dst)
+		memcpy(dst, buf, len);
+	return 0;
+}
+
+static int user_cipher(struct cdev_session *s, int enc, const void *iv,
+		const void *src, void *dst, size_t len)
+{
+	int outl, finl;
+
+	if (len > INT_MAX)
+		return -1;
+
+	if (!s->ctx) {
+		s->ctx = EVP_CIPHER_CTX_new();
+		if (!s->ctx)
+			return -1;
+	}
+	/* the key schedule is kept as long as the direction is */
+	if (s->ctx_enc != enc) {
+		if (!EVP_CipherInit_ex(s->ctx, s->evp_cipher, NULL, s->key,
+				       NULL, enc))
+			return -1;
+		EVP_CIPHER_CTX_set_padding(s->ctx, 0);
+		s->ctx_enc = enc;
+	}
+
+	if (!EVP_CipherInit_ex(s->ctx, NULL, NULL, NULL, iv, -1) ||
+	    !EVP_CipherUpdate(s->ctx, dst, &outl, src, len) ||
+	    !EVP_CipherFinal_ex(s->ctx, (unsigned char *)dst + outl, &finl))
+		return -1;
+
+	return 0;
+}
+
+static int user_digest(struct cdev_session *s, const void *src, size_t len,
+		void *digest)
+{
+	if (s->mackeylen)
+		return HMAC(s->evp_md, s->mackey, s->mackeylen, src, len,
+			    digest, NULL) ? 0 : -1;
+
+	return EVP_Digest(src, len, digest, NULL, s->evp_md, NULL) ? 0 : -1;
+}
+
+static int run(struct cdev_session *s, int op, const void *iv,
+		const void *src, void *dst, size_t len, void *digest)
+{
+	/* without an iv the cipher goes on from the state of the kernel
+	 * session, which OpenSSL does not have */
+	if (s->kernel && s->evp_cipher && !iv &&
+	    EVP_CIPHER_iv_length(s->evp_cipher) > 0)
+		return kernel_op(s, op, iv, src, dst, len, digest);
+
+	if (use_kernel(s, len, aligned(s, src) && aligned(s, dst)))
+		return kernel_op(s, op, iv, src, dst, len, digest);
+
+	if (s->evp_cipher)
+		return user_cipher(s, op == COP_ENCRYPT, iv, src, dst, len);
+	return user_digest(s, src, len, digest);
+}
+
+int cdev_encrypt(struct cdev_session *s, const void *iv, const void *src,
+		void *dst, size_t len, void *digest)
+{
+	return run(s, COP_ENCRYPT, iv, src, dst, len, digest);
+}
+
+int cdev_decrypt(struct cdev_session *s, const void *iv, const void *src,
+		void *dst, size_t len, void *digest)
+{
+	return run(s, COP_DECRYPT, iv, src, dst, len, digest);
+}
+
+int cdev_digest(struct cdev_session *s, const void *src, size_t len,
+		void *digest)
+{
+	return run(s, COP_ENCRYPT, NULL, src, NULL, len, digest);
+}
+
+int cdev_queue(struct cdev_session *s, int op, const void *iv,
+		const void *src, void *dst, size_t len, void *digest,
+		int *status)
+{
+	struct cdev *cd = s->cd;
+	struct crypt_op *cop;
+	int ret;
+
+	if (!s->kernel) {
+		ret = run(s, op, iv, src, dst, len, digest);
+		if (status)
+			*status = ret ? -EIO : 0;
+		return 0;
+	}
+	if (len > UINT32_MAX)
+		return -1;
+
+	/* the batch makes up for the system call, so it is not routed by
+	 * its size; the kernel copies the buffers that are not aligned */
+	cop = &cd->batch[cd->nbatch];
+	memset(cop, 0, sizeof(*cop));
+	cop->ses = s->ses;
+	cop->op = op;
+	cop->len = len;
+	cop->src = (void *)src;
+	cop->dst = dst;
+	cop->iv = (void *)iv;
+	cop->mac = digest;
+	if (!aligned(s, src) || !aligned(s, dst))
+		cop->flags = COP_FLAG_NO_ZC;
+	cd->batch_status[cd->nbatch++] = status;
+
+	if (cd->nbatch == CDEV_BATCH_MAX)
+		cdev_flush(cd);
+	return 0;
+}
+
+int cdev_flush(struct cdev *cd)
+{
+	struct crypt_multi_op mop;
+	int i, err, ret = 0;
+
+	if (!cd->nbatch)
+		return 0;
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = cd->nbatch;
+	mop.ops = cd->batch;
+	mop.status = cd->kstatus;
+	if (ioctl(cd->cfd, CIOCCRYPT_MULTI, &mop)) {
+		err = errno;
+		for (i = 0; i < cd->nbatch; i++)
+			cd->kstatus[i] = -err;
+	}
+
+	for (i = 0; i < cd->nbatch; i++) {
+		if (cd->kstatus[i])
+			ret = -1;
+		if (cd->batch_status[i])
+			*cd->batch_status[i] = cd->kstatus[i];
+	}
+	cd->nbatch = 0;
+
+	return ret;
+}
+
+void *cdev_malloc(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, BUF_ALIGN, size ? size : 1))
+		return NULL;
+	return p;
+}
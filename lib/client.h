@@ -0,0 +1,83 @@
+#ifndef CLIENT_H
+# define CLIENT_H
+
+#include <stddef.h>
+
+/* A client of /dev/crypto for applications.
+ *
+ * Sessions are pooled: a session that is put back is kept open and
+ * handed out again for the same key, or given another key with
+ * CIOCSETKEY, so most requests need no CIOCGSESSION. Buffers that are not
+ * aligned as the driver of a session needs are bounced through an
+ * aligned one, so that the kernel can still use them in place. Requests
+ * below the crossover point measured by crossover.c, and requests for
+ * algorithms the kernel does not have, are run by OpenSSL instead. Small
+ * requests can also be queued and submitted together with a single
+ * CIOCCRYPT_MULTI.
+ *
+ * Ciphers, hashes and HMACs are supported. Sessions with both a cipher
+ * and a MAC are always run by the kernel. A handle must not be used by
+ * several threads at once.
+ */
+
+struct cdev;
+struct cdev_session;
+
+/* flags of cdev_open() */
+#define CDEV_F_THROUGHPUT	(1 << 0) /* route by throughput, not latency */
+#define CDEV_F_NO_FALLBACK	(1 << 1) /* never use OpenSSL */
+
+/* the most sessions kept open after being put back */
+#define CDEV_POOL_MAX	32
+
+/* the most requests submitted together */
+#define CDEV_BATCH_MAX	64
+
+/* Opens /dev/crypto and loads the crossover points with crossover_init()
+ * from cache, which measures them if it is missing or stale. Without
+ * /dev/crypto every request is run by OpenSSL, unless CDEV_F_NO_FALLBACK
+ * is set, in which case NULL is returned. */
+struct cdev *cdev_open(const char *cache, int flags);
+void cdev_close(struct cdev *cd);
+
+/* A session for cipher and/or mac, given as in struct session_op; 0 for
+ * neither. The keys are copied. NULL if neither the kernel nor OpenSSL
+ * has the algorithm. */
+struct cdev_session *cdev_session_get(struct cdev *cd, int cipher,
+		const void *key, int keylen, int mac, const void *mackey,
+		int mackeylen);
+/* Submits the queued requests and returns the session to the pool */
+void cdev_session_put(struct cdev_session *s);
+
+/* Ciphers len bytes from src to dst, which may be the same, with the iv
+ * of the cipher. The iv is left as it is, as by CIOCCRYPT. With a NULL iv
+ * the cipher goes on from where the previous request the kernel ran on
+ * the session left it, so such requests are always run by the kernel if
+ * the session has it, whatever their size. For sessions with a MAC, its
+ * digest is written to digest. Return 0 on success and -1 on error. */
+int cdev_encrypt(struct cdev_session *s, const void *iv, const void *src,
+		void *dst, size_t len, void *digest);
+int cdev_decrypt(struct cdev_session *s, const void *iv, const void *src,
+		void *dst, size_t len, void *digest);
+/* The digest of len bytes at src on a hash or HMAC session */
+int cdev_digest(struct cdev_session *s, const void *src, size_t len,
+		void *digest);
+
+/* Queues a request of cdev_encrypt() (op COP_ENCRYPT), cdev_decrypt()
+ * (COP_DECRYPT) or cdev_digest() (COP_ENCRYPT with dst NULL). The iv and
+ * the buffers must be kept until the request has been submitted, which
+ * is when CDEV_BATCH_MAX requests are queued, or by cdev_flush() or
+ * cdev_session_put(). Its result is stored in status then; 0 or a
+ * negative errno. Queued requests are run by the kernel whatever their
+ * size, if it has the algorithm. Returns 0 if the request was queued or
+ * run. */
+int cdev_queue(struct cdev_session *s, int op, const void *iv,
+		const void *src, void *dst, size_t len, void *digest,
+		int *status);
+/* Submits the queued requests. Returns 0 if all of them succeeded. */
+int cdev_flush(struct cdev *cd);
+
+/* a buffer aligned for any driver, to be freed with free() */
+void *cdev_malloc(size_t size);
+
+#endif
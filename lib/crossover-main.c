@@ -0,0 +1,51 @@
+/*
+ * Prints the sizes from which on /dev/crypto outperforms OpenSSL.
+ * Given a file name, the results are cached there for applications
+ * calling crossover_init() with the same file, e.g. when run at boot.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include "crossover.h"
+
+static const char *size_str(int size, char *buf)
+{
+	if (size < 0)
+		return "never";
+	sprintf(buf, "%d", size);
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	const struct crossover *c;
+	char b[4][16];
+	int i;
+
+	if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+		fprintf(stderr, "Usage: %s [cache-file]\n", argv[0]);
+		return 1;
+	}
+
+	if (crossover_init(argc == 2 ? argv[1] : NULL) < 0)
+		return 1;
+
+	printf("%-24s %10s %10s %10s %10s\n", "", "latency", "",
+		"throughput", "");
+	printf("%-24s %10s %10s %10s %10s\n", "algorithm", "copy", "zc",
+		"copy", "zc");
+	for (i = 0; i < crossover_count(); i++) {
+		c = crossover_get(i);
+		if (!c->available)
+			continue;
+		printf("%-24s %10s %10s %10s %10s\n", c->name,
+			size_str(c->latency[CROSSOVER_COPY], b[0]),
+			size_str(c->latency[CROSSOVER_ZC], b[1]),
+			size_str(c->throughput[CROSSOVER_COPY], b[2]),
+			size_str(c->throughput[CROSSOVER_ZC], b[3]));
+	}
+
+	return 0;
+}
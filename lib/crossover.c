@@ -0,0 +1,469 @@
+/*
+ * Measures the input sizes from which on /dev/crypto outperforms
+ * OpenSSL, so that applications can use the faster of the two for
+ * every request.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+#include <crypto/cryptodev.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include "benchmark.h"
+#include "crossover.h"
+
+struct crossover_alg {
+	struct crossover c;
+	int mackeylen, ivlen;
+	int aead;
+	/* the OpenSSL counterpart */
+	const EVP_CIPHER *(*evp_cipher)(void);
+	const EVP_MD *(*evp_md)(void);
+};
+
+#define ALG(name, cipher, keylen, mac, mackeylen, ivlen, aead, evp_cipher, evp_md) \
+	{ { name, cipher, keylen, mac, 0, { -1, -1 }, { -1, -1 } }, \
+	  mackeylen, ivlen, aead, evp_cipher, evp_md }
+
+static struct crossover_alg algs[] = {
+	ALG("3des-cbc", CRYPTO_3DES_CBC, 24, 0, 0, 8, 0, EVP_des_ede3_cbc, NULL),
+	ALG("aes-128-cbc", CRYPTO_AES_CBC, 16, 0, 0, 16, 0, EVP_aes_128_cbc, NULL),
+	ALG("aes-256-cbc", CRYPTO_AES_CBC, 32, 0, 0, 16, 0, EVP_aes_256_cbc, NULL),
+	ALG("aes-128-ecb", CRYPTO_AES_ECB, 16, 0, 0, 0, 0, EVP_aes_128_ecb, NULL),
+	ALG("aes-128-ctr", CRYPTO_AES_CTR, 16, 0, 0, 16, 0, EVP_aes_128_ctr, NULL),
+	ALG("aes-256-ctr", CRYPTO_AES_CTR, 32, 0, 0, 16, 0, EVP_aes_256_ctr, NULL),
+	ALG("aes-128-gcm", CRYPTO_AES_GCM, 16, 0, 0, 12, 1, EVP_aes_128_gcm, NULL),
+	ALG("aes-256-gcm", CRYPTO_AES_GCM, 32, 0, 0, 12, 1, EVP_aes_256_gcm, NULL),
+	ALG("camellia-128-cbc", CRYPTO_CAMELLIA_CBC, 16, 0, 0, 16, 0, EVP_camellia_128_cbc, NULL),
+	ALG("md5", 0, 0, CRYPTO_MD5, 0, 0, 0, NULL, EVP_md5),
+	ALG("sha1", 0, 0, CRYPTO_SHA1, 0, 0, 0, NULL, EVP_sha1),
+	ALG("sha224", 0, 0, CRYPTO_SHA2_224, 0, 0, 0, NULL, EVP_sha224),
+	ALG("sha256", 0, 0, CRYPTO_SHA2_256, 0, 0, 0, NULL, EVP_sha256),
+	ALG("sha384", 0, 0, CRYPTO_SHA2_384, 0, 0, 0, NULL, EVP_sha384),
+	ALG("sha512", 0, 0, CRYPTO_SHA2_512, 0, 0, 0, NULL, EVP_sha512),
+	ALG("hmac-md5", 0, 0, CRYPTO_MD5_HMAC, 16, 0, 0, NULL, EVP_md5),
+	ALG("hmac-sha1", 0, 0, CRYPTO_SHA1_HMAC, 20, 0, 0, NULL, EVP_sha1),
+	ALG("hmac-sha256", 0, 0, CRYPTO_SHA2_256_HMAC, 32, 0, 0, NULL, EVP_sha256),
+	ALG("hmac-sha512", 0, 0, CRYPTO_SHA2_512_HMAC, 64, 0, 0, NULL, EVP_sha512),
+	ALG("aes-128-cbc-hmac-sha1", CRYPTO_AES_CBC, 16, CRYPTO_SHA1_HMAC, 20, 16, 0,
+		EVP_aes_128_cbc, EVP_sha1),
+	ALG("aes-256-cbc-hmac-sha256", CRYPTO_AES_CBC, 32, CRYPTO_SHA2_256_HMAC, 32, 16, 0,
+		EVP_aes_256_cbc, EVP_sha256),
+};
+
+#define NALGS (sizeof(algs) / sizeof(algs[0]))
+
+static const int sizes[] = {16, 64, 256, 512, 1024, 2048, 4096, 16*1024, 64*1024};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+#define MAX_SIZE (64*1024)
+
+/* room for padding, tags and digests */
+#define EXTRA_ROOM 128
+
+/* latency samples kept per measurement */
+#define MAX_SAMPLES 4096
+
+#define CACHE_MAGIC "cryptodev-crossover 1"
+
+enum mode { KERNEL_COPY, KERNEL_ZC, USER };
+
+struct job {
+	const struct crossover_alg *alg;
+	int cfd;
+	uint32_t ses;
+	EVP_CIPHER_CTX *ctx;
+	unsigned char *src, *dst;
+	int size;
+	enum mode mode;
+};
+
+static unsigned char key[64], mackey[64], iv[16];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int kernel_op(struct job *j)
+{
+	unsigned char mac[AALG_MAX_RESULT_LEN];
+	struct crypt_auth_op cao;
+	struct crypt_op cop;
+
+	if (j->alg->aead) {
+		memset(&cao, 0, sizeof(cao));
+		cao.ses = j->ses;
+		cao.op = COP_ENCRYPT;
+		cao.len = j->size;
+		cao.src = j->src;
+		cao.dst = j->dst;
+		cao.iv = iv;
+		cao.iv_len = j->alg->ivlen;
+		return ioctl(j->cfd, CIOCAUTHCRYPT, &cao);
+	}
+
+	memset(&cop, 0, sizeof(cop));
+	cop.ses = j->ses;
+	cop.op = COP_ENCRYPT;
+	cop.flags = j->mode == KERNEL_COPY ? COP_FLAG_NO_ZC : 0;
+	cop.len = j->size;
+	cop.src = j->src;
+	cop.dst = j->alg->c.cipher ? j->dst : NULL;
+	cop.iv = j->alg->ivlen ? iv : NULL;
+	cop.mac = j->alg->c.mac ? mac : NULL;
+	return ioctl(j->cfd, CIOCCRYPT, &cop);
+}
+
+/* the same operation as kernel_op() in OpenSSL */
+static int user_op(struct job *j)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	const struct crossover_alg *alg = j->alg;
+	int len;
+
+	if (alg->evp_md && alg->mackeylen) {
+		if (!HMAC(alg->evp_md(), mackey, alg->mackeylen, j->src, j->size,
+			  md, NULL))
+			return -1;
+	} else if (alg->evp_md) {
+		if (!EVP_Digest(j->src, j->size, md, NULL, alg->evp_md(), NULL))
+			return -1;
+	}
+
+	if (!alg->evp_cipher)
+		return 0;
+
+	if (!EVP_EncryptInit_ex(j->ctx, NULL, NULL, NULL, alg->ivlen ? iv : NULL) ||
+	    !EVP_EncryptUpdate(j->ctx, j->dst, &len, j->src, j->size))
+		return -1;
+	if (alg->aead &&
+	    (!EVP_EncryptFinal_ex(j->ctx, j->dst + len, &len) ||
+	     !EVP_CIPHER_CTX_ctrl(j->ctx, EVP_CTRL_GCM_GET_TAG, 16, md)))
+		return -1;
+
+	return 0;
+}
+
+/* Runs the job for the benchmark period and returns the data rate in
+ * bytes per msec and the median time of an operation in usec. */
+static int measure(struct job *j, double *rate, double *latency)
+{
+	static double samples[MAX_SAMPLES];
+	struct benchmark_st bst;
+	unsigned long elapsed, counted = 0, n = 0;
+	double t0;
+	int ret;
+
+	if (start_benchmark(&bst) < 0)
+		return -1;
+
+	do {
+		t0 = now();
+		ret = j->mode == USER ? user_op(j) : kernel_op(j);
+		if (ret) {
+			stop_benchmark(&bst, NULL);
+			return -1;
+		}
+		samples[n++ % MAX_SAMPLES] = now() - t0;
+		counted += j->size;
+	} while (benchmark_must_finish == 0);
+
+	if (stop_benchmark(&bst, &elapsed) < 0)
+		return -1;
+
+	if (n > MAX_SAMPLES)
+		n = MAX_SAMPLES;
+	qsort(samples, n, sizeof(double), cmp_double);
+
+	*rate = (double)counted / (elapsed ? elapsed : 1);
+	*latency = samples[n / 2] * 1e6;
+	return 0;
+}
+
+/* the smallest size from which on the kernel is better for this and
+ * every larger size */
+static int crossover_point(const int *better)
+{
+	int i, point = -1;
+
+	for (i = NSIZES - 1; i >= 0 && better[i]; i--)
+		point = sizes[i];
+
+	return point;
+}
+
+static int open_session(int cfd, const struct crossover_alg *alg, uint32_t *ses)
+{
+	struct session_op sess;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = alg->c.cipher;
+	sess.keylen = alg->c.keylen;
+	sess.key = key;
+	sess.mac = alg->c.mac;
+	sess.mackeylen = alg->mackeylen;
+	sess.mackey = alg->mackeylen ? mackey : NULL;
+	if (ioctl(cfd, CIOCGSESSION, &sess))
+		return -1;
+
+	*ses = sess.ses;
+	return 0;
+}
+
+static void measure_alg(int cfd, struct crossover_alg *alg,
+		unsigned char *src, unsigned char *dst)
+{
+	struct crossover *c = &alg->c;
+	int better_lat[2][NSIZES], better_rate[2][NSIZES];
+	double rate[3], latency[3];
+	struct job job;
+	size_t i;
+	int m;
+
+	memset(&job, 0, sizeof(job));
+	job.alg = alg;
+	job.cfd = cfd;
+	job.src = src;
+	job.dst = dst;
+
+	c->available = 0;
+	if (open_session(cfd, alg, &job.ses))
+		return;
+
+	if (alg->evp_cipher) {
+		job.ctx = EVP_CIPHER_CTX_new();
+		if (!job.ctx ||
+		    !EVP_EncryptInit_ex(job.ctx, alg->evp_cipher(), NULL, key, NULL))
+			goto finish;
+		EVP_CIPHER_CTX_set_padding(job.ctx, 0);
+	}
+
+	for (i = 0; i < NSIZES; i++) {
+		job.size = sizes[i];
+		for (m = KERNEL_COPY; m <= USER; m++) {
+			job.mode = m;
+			/* zero copy cannot be disabled for AEAD operations */
+			if (m == KERNEL_COPY && alg->aead)
+				continue;
+			if (measure(&job, &rate[m], &latency[m]) < 0)
+				goto finish;
+		}
+		if (alg->aead) {
+			rate[KERNEL_COPY] = rate[KERNEL_ZC];
+			latency[KERNEL_COPY] = latency[KERNEL_ZC];
+		}
+#ifdef DEBUG
+		printf("%s %d: kernel: %.4f/%.4f bytes/msec %.2f/%.2f usec, "
+			"user: %.4f bytes/msec %.2f usec\n", c->name, sizes[i],
+			rate[KERNEL_COPY], rate[KERNEL_ZC], latency[KERNEL_COPY],
+			latency[KERNEL_ZC], rate[USER], latency[USER]);
+#endif
+		for (m = KERNEL_COPY; m <= KERNEL_ZC; m++) {
+			better_lat[m][i] = latency[m] < latency[USER];
+			better_rate[m][i] = rate[m] > rate[USER];
+		}
+	}
+
+	for (m = KERNEL_COPY; m <= KERNEL_ZC; m++) {
+		c->latency[m] = crossover_point(better_lat[m]);
+		c->throughput[m] = crossover_point(better_rate[m]);
+	}
+	c->available = 1;
+
+finish:
+	if (job.ctx)
+		EVP_CIPHER_CTX_free(job.ctx);
+	if (ioctl(cfd, CIOCFSESSION, &job.ses))
+		perror("ioctl(CIOCFSESSION)");
+}
+
+/* Worst case running time: around a minute
+ */
+int crossover_measure(void)
+{
+	unsigned char *src = NULL, *dst = NULL;
+	int cfd, ret = -1;
+	size_t i;
+
+	/* Open the crypto device */
+	cfd = open("/dev/crypto", O_RDWR, 0);
+	if (cfd < 0) {
+		perror("open(/dev/crypto)");
+		return -1;
+	}
+
+	if (posix_memalign((void **)&src, 4096, MAX_SIZE + EXTRA_ROOM) ||
+	    posix_memalign((void **)&dst, 4096, MAX_SIZE + EXTRA_ROOM)) {
+		perror("posix_memalign");
+		goto finish;
+	}
+	memset(src, 0x15, MAX_SIZE + EXTRA_ROOM);
+	memset(key, 0x33, sizeof(key));
+	memset(mackey, 0x44, sizeof(mackey));
+	memset(iv, 0x03, sizeof(iv));
+
+	for (i = 0; i < NALGS; i++)
+		measure_alg(cfd, &algs[i], src, dst);
+	ret = 0;
+
+finish:
+	free(src);
+	free(dst);
+	close(cfd);
+	return ret;
+}
+
+int crossover_save(const char *path)
+{
+	struct utsname uts;
+	size_t i;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return -1;
+
+	uname(&uts);
+	fprintf(fp, "%s %s\n", CACHE_MAGIC, uts.release);
+	for (i = 0; i < NALGS; i++) {
+		const struct crossover *c = &algs[i].c;
+
+		if (c->available)
+			fprintf(fp, "%s %d %d %d %d\n", c->name,
+				c->latency[CROSSOVER_COPY], c->latency[CROSSOVER_ZC],
+				c->throughput[CROSSOVER_COPY],
+				c->throughput[CROSSOVER_ZC]);
+	}
+
+	return fclose(fp) ? -1 : 0;
+}
+
+/* Fails if the file was written on another kernel, whose algorithms
+ * and drivers may perform differently. */
+int crossover_load(const char *path)
+{
+	struct utsname uts;
+	char line[256], name[64], release[sizeof(uts.release)];
+	struct crossover tmp;
+	int ret = -1;
+	size_t i;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	uname(&uts);
+	if (!fgets(line, sizeof(line), fp) ||
+	    strncmp(line, CACHE_MAGIC " ", sizeof(CACHE_MAGIC)) ||
+	    sscanf(line + sizeof(CACHE_MAGIC), "%63s", release) != 1 ||
+	    strcmp(release, uts.release))
+		goto finish;
+
+	for (i = 0; i < NALGS; i++)
+		algs[i].c.available = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%63s %d %d %d %d", name,
+			   &tmp.latency[CROSSOVER_COPY], &tmp.latency[CROSSOVER_ZC],
+			   &tmp.throughput[CROSSOVER_COPY],
+			   &tmp.throughput[CROSSOVER_ZC]) != 5)
+			goto finish;
+
+		for (i = 0; i < NALGS; i++) {
+			struct crossover *c = &algs[i].c;
+
+			if (strcmp(c->name, name))
+				continue;
+			memcpy(c->latency, tmp.latency, sizeof(c->latency));
+			memcpy(c->throughput, tmp.throughput, sizeof(c->throughput));
+			c->available = 1;
+		}
+	}
+	ret = 0;
+
+finish:
+	fclose(fp);
+	return ret;
+}
+
+int crossover_init(const char *cache)
+{
+	if (cache && crossover_load(cache) == 0)
+		return 0;
+
+	if (crossover_measure() < 0)
+		return -1;
+
+	if (cache && crossover_save(cache) < 0)
+		perror(cache);
+
+	return 0;
+}
+
+int crossover_count(void)
+{
+	return NALGS;
+}
+
+const struct crossover *crossover_get(int i)
+{
+	return i >= 0 && (size_t)i < NALGS ? &algs[i].c : NULL;
+}
+
+const struct crossover *crossover_find(int cipher, int keylen, int mac)
+{
+	const struct crossover *found = NULL;
+	size_t i;
+
+	for (i = 0; i < NALGS; i++) {
+		const struct crossover *c = &algs[i].c;
+
+		if (!c->available || c->cipher != cipher || c->mac != mac)
+			continue;
+		if (!cipher || c->keylen == keylen)
+			return c;
+		/* the nearest measured key size otherwise */
+		if (!found || abs(c->keylen - keylen) < abs(found->keylen - keylen))
+			found = c;
+	}
+
+	return found;
+}
+
+int crossover_use_kernel(int cipher, int keylen, int mac, size_t size,
+		int flags)
+{
+	const struct crossover *c;
+	int point, zc = (flags & CROSSOVER_F_ZC) ? CROSSOVER_ZC : CROSSOVER_COPY;
+
+	c = crossover_find(cipher, keylen, mac);
+	if (!c)
+		return 0;
+
+	if (flags & CROSSOVER_F_THROUGHPUT)
+		point = c->throughput[zc];
+	else
+		point = c->latency[zc];
+
+	return point >= 0 && size >= (size_t)point;
+}
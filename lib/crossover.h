@@ -0,0 +1,64 @@
+#ifndef CROSSOVER_H
+# define CROSSOVER_H
+
+#include <stddef.h>
+
+/* Crossover points between OpenSSL and /dev/crypto.
+ *
+ * For every algorithm the library knows, the input size is measured
+ * from which on an operation through /dev/crypto is faster than the
+ * same operation in OpenSSL. This is done once for the latency of a
+ * single operation and once for the throughput of back to back
+ * operations, both with zero copy and with the data copied through a
+ * kernel buffer (COP_FLAG_NO_ZC). Applications can then route every
+ * request by its size with crossover_use_kernel().
+ *
+ * Measuring takes in the order of a minute, so the results are
+ * normally cached in a file, which is only trusted on the kernel it
+ * was measured on.
+ */
+
+/* indices of the latency and throughput arrays */
+#define CROSSOVER_COPY	0
+#define CROSSOVER_ZC	1
+
+/* flags of crossover_use_kernel() */
+#define CROSSOVER_F_ZC		(1 << 0) /* the buffers allow zero copy */
+#define CROSSOVER_F_THROUGHPUT	(1 << 1) /* optimize for throughput */
+
+struct crossover {
+	const char *name;
+	int cipher;
+	int keylen;
+	int mac;
+	int available;
+	/* the smallest measured size from which on /dev/crypto is faster,
+	 * or -1 if it never is */
+	int latency[2];
+	int throughput[2];
+};
+
+/* Loads the crossover points from cache, or measures them and writes
+ * them to cache if it is missing or stale. cache may be NULL to always
+ * measure. Returns 0 on success or -1 if /dev/crypto is unusable. */
+int crossover_init(const char *cache);
+
+int crossover_measure(void);
+int crossover_load(const char *path);
+int crossover_save(const char *path);
+
+/* NULL if the algorithm is unknown or not available in the kernel;
+ * keylen selects between the key sizes of a cipher that were measured
+ * and is ignored for hashes */
+const struct crossover *crossover_find(int cipher, int keylen, int mac);
+
+/* all the algorithms, whether available or not */
+int crossover_count(void);
+const struct crossover *crossover_get(int i);
+
+/* Returns 1 if an operation of size bytes should be run by /dev/crypto
+ * and 0 if it should be run by OpenSSL. */
+int crossover_use_kernel(int cipher, int keylen, int mac, size_t size,
+		int flags);
+
+#endif
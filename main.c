@@ -33,14 +33,19 @@
  */
 #include <crypto/hash.h>
 #include <linux/crypto.h>
+#include <linux/file.h>
+#include <linux/fs.h>
 #include <linux/mm.h>
 #include <linux/highmem.h>
+#include <linux/log2.h>
 #include <linux/ioctl.h>
 #include <linux/random.h>
 #include <linux/syscalls.h>
 #include <linux/pagemap.h>
 #include <linux/poll.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
 #include <crypto/cryptodev.h>
 #include <crypto/scatterwalk.h>
 #include <linux/scatterlist.h>
@@ -48,13 +53,17 @@
 #include "zc.h"
 #include "cryptlib.h"
 #include "version.h"
+#include "cryptodev_trace.h"
 
 /* This file contains the traditional operations of encryption
  * and hashing of /dev/crypto.
  */
 
+/* cdata is either the session's own cipher state or that of a
+ * struct cryptodev_req borrowed from it. */
 static int
-hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
+hash_n_crypt(struct csession *ses_ptr, struct cipher_data *cdata,
+		struct crypt_op *cop,
 		struct scatterlist *src_sg, struct scatterlist *dst_sg,
 		uint32_t len)
 {
@@ -70,16 +79,16 @@ hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
 			if (unlikely(ret))
 				goto out_err;
 		}
-		if (ses_ptr->cdata.init != 0) {
-			ret = cryptodev_cipher_encrypt(&ses_ptr->cdata,
+		if (cdata->init != 0) {
+			ret = cryptodev_cipher_encrypt(cdata,
 							src_sg, dst_sg, len);
 
 			if (unlikely(ret))
 				goto out_err;
 		}
 	} else {
-		if (ses_ptr->cdata.init != 0) {
-			ret = cryptodev_cipher_decrypt(&ses_ptr->cdata,
+		if (cdata->init != 0) {
+			ret = cryptodev_cipher_decrypt(cdata,
 							src_sg, dst_sg, len);
 
 			if (unlikely(ret))
@@ -99,10 +108,434 @@ out_err:
 	return ret;
 }
 
+/* Encryption with a MAC hashes the plaintext, so as long as the output
+ * goes elsewhere the hash does not have to wait for the cipher. */
+static inline int
+crypto_hash_cipher_concurrent(struct csession *ses_ptr,
+		struct cipher_data *cdata, struct crypt_op *cop)
+{
+	unsigned long src = (unsigned long)cop->src;
+	unsigned long dst = (unsigned long)cop->dst;
+
+	return cop->op == COP_ENCRYPT && ses_ptr->hdata.init != 0 &&
+		cdata->init != 0 && cdata->aead == 0 &&
+		(dst + cop->len <= src || src + cop->len <= dst);
+}
+
+/* Same as hash_n_crypt() for an encryption that satisfies
+ * crypto_hash_cipher_concurrent(). Both requests are submitted before
+ * waiting for either, so engines that complete them asynchronously
+ * work on them at the same time. Returns 1 if that is not possible. */
+static int
+hash_n_crypt_concurrent(struct csession *ses_ptr, struct cipher_data *cdata,
+		struct scatterlist *src_sg, struct scatterlist *dst_sg,
+		uint32_t len)
+{
+	unsigned int nents = sg_nents(src_sg);
+	int hret, cret;
+
+	if (ses_ptr->hash_sg_size < nents) {
+		kfree(ses_ptr->hash_sg);
+		ses_ptr->hash_sg_size = 0;
+		ses_ptr->hash_sg = kmalloc_node(nents *
+				sizeof(struct scatterlist), GFP_KERNEL,
+				ses_ptr->node);
+		if (unlikely(!ses_ptr->hash_sg))
+			return 1;
+		ses_ptr->hash_sg_size = nents;
+	}
+	memcpy(ses_ptr->hash_sg, src_sg, nents * sizeof(struct scatterlist));
+
+	hret = cryptodev_hash_start(&ses_ptr->hdata, ses_ptr->hash_sg, len);
+	cret = cryptodev_cipher_start(cdata, src_sg, dst_sg, len, 1);
+
+	/* both have to finish before the pages are released */
+	hret = cryptodev_hash_wait(&ses_ptr->hdata, hret);
+	cret = cryptodev_cipher_wait(cdata, cret);
+	if (unlikely(hret || cret)) {
+		derr(0, "CryptoAPI failure: %d", hret ? hret : cret);
+		return hret ? hret : cret;
+	}
+
+	return 0;
+}
+
+/* Cipher one sector of a CIOCCRYPT_SECTORS run */
+static int
+crypt_sector(struct cipher_data *cdata, struct crypt_sector_op *sop,
+		struct scatterlist *src, struct scatterlist *dst, uint64_t sector)
+{
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	int i, ret;
+
+	memset(iv, 0, sizeof(iv));
+	for (i = 0; i < 8; i++)
+		iv[i] = sector >> (8 * i);
+	cryptodev_cipher_set_iv(cdata, iv, cdata->ivsize);
+
+	if (sop->op == COP_ENCRYPT)
+		ret = cryptodev_cipher_encrypt(cdata, src, dst, sop->sector_size);
+	else
+		ret = cryptodev_cipher_decrypt(cdata, src, dst, sop->sector_size);
+	if (unlikely(ret))
+		derr(0, "CryptoAPI failure: %d", ret);
+	return ret;
+}
+
+/* Whether an operation of the session is continued by one that starts
+ * with the IV it returned: there is none for ECB, and CTR and CBC chain
+ * through it. The XTS tweak of a block cannot be passed as an IV. */
+int crypto_cipher_chains(struct csession *ses_ptr)
+{
+	switch (ses_ptr->cipher) {
+	case CRYPTO_AES_ECB:
+	case CRYPTO_AES_CTR:
+	case CRYPTO_DES_CBC:
+	case CRYPTO_3DES_CBC:
+	case CRYPTO_BLF_CBC:
+	case CRYPTO_AES_CBC:
+	case CRYPTO_CAMELLIA_CBC:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0))
+/* Operations of SES_FLAG_SPLIT sessions are cut into chunks of at
+ * least this size, one per online CPU up to SPLIT_MAX_CHUNKS */
+#define SPLIT_MIN_CHUNK		(256 * 1024)
+#define SPLIT_MAX_CHUNKS	16U
+
+/* How the IV of a chunk of CIOCCRYPT follows from that of the operation */
+enum {
+	SPLIT_NONE,	/* it cannot be split */
+	SPLIT_SAME,	/* no IV, or one that is not chained */
+	SPLIT_CTR,	/* the counter advanced by the blocks before it */
+	SPLIT_CBC,	/* the last ciphertext block before it */
+};
+
+static int crypto_split_mode(struct csession *ses_ptr, int op)
+{
+	if (!crypto_cipher_chains(ses_ptr))
+		return SPLIT_NONE;
+
+	switch (ses_ptr->cipher) {
+	case CRYPTO_AES_ECB:
+		return SPLIT_SAME;
+	case CRYPTO_AES_CTR:
+		return SPLIT_CTR;
+	default:
+		/* the chunks of an encryption depend on each other */
+		return op == COP_DECRYPT ? SPLIT_CBC : SPLIT_NONE;
+	}
+}
+
+/* A part of a split operation; all but the last one are run by
+ * cryptodev_wq workers on requests of their own. */
+struct split_chunk {
+	struct work_struct work;
+	struct cryptodev_req *req;
+	struct scatterlist sbuf[2], dbuf[2];
+	struct scatterlist *src, *dst;
+	uint32_t len;
+	int op;
+	/* the sectors from sector on, or NULL for a plain one with iv */
+	struct crypt_sector_op *sop;
+	uint64_t sector;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	int ret;
+	struct completion done;
+};
+
+static int split_chunk_crypt(struct cipher_data *cdata, struct split_chunk *c)
+{
+	struct scatterlist sbuf[2], dbuf[2], *src, *dst;
+	uint32_t off;
+	int ret;
+
+	if (c->sop) {
+		for (off = 0; off < c->len; off += c->sop->sector_size) {
+			src = scatterwalk_ffwd(sbuf, c->src, off);
+			dst = c->src == c->dst ? src :
+				scatterwalk_ffwd(dbuf, c->dst, off);
+			ret = crypt_sector(cdata, c->sop, src, dst, c->sector +
+					off / c->sop->sector_size);
+			if (unlikely(ret))
+				return ret;
+		}
+		return 0;
+	}
+
+	cryptodev_cipher_set_iv(cdata, c->iv, cdata->ivsize);
+	if (c->op == COP_ENCRYPT)
+		ret = cryptodev_cipher_encrypt(cdata, c->src, c->dst, c->len);
+	else
+		ret = cryptodev_cipher_decrypt(cdata, c->src, c->dst, c->len);
+	if (unlikely(ret))
+		derr(0, "CryptoAPI failure: %d", ret);
+	return ret;
+}
+
+static void split_chunk_run(struct work_struct *work)
+{
+	struct split_chunk *c = container_of(work, struct split_chunk, work);
+
+	c->ret = split_chunk_crypt(&c->req->cdata, c);
+	complete(&c->done);
+}
+
+/* big endian addition */
+static void ctr_add(uint8_t *ctr, int size, uint64_t n)
+{
+	int i;
+
+	for (i = size - 1; i >= 0 && n; i--) {
+		n += ctr[i];
+		ctr[i] = n & 0xff;
+		n >>= 8;
+	}
+}
+
+/* Cipher len bytes of a SES_FLAG_SPLIT session in chunks on several
+ * CPUs, the last one on cdata by the caller, and wait for all of them.
+ * cdata is left with the IV that follows the whole operation. With sop
+ * the chunks are whole runs of its sectors. Returns 1 if the operation
+ * is not split. */
+static int
+crypt_split(struct csession *ses_ptr, struct cipher_data *cdata,
+		struct scatterlist *src_sg, struct scatterlist *dst_sg,
+		uint32_t len, int op, struct crypt_sector_op *sop)
+{
+	int mode = sop ? SPLIT_SAME : crypto_split_mode(ses_ptr, op);
+	int ivsize = cdata->ivsize;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	struct split_chunk *chunks, *c;
+	unsigned int n, i, unit, cpu;
+	uint32_t chunk, off;
+	int ret;
+
+	/* a worker waiting for others of cryptodev_wq could deadlock */
+	if (!(ses_ptr->flags & SES_FLAG_SPLIT) || mode == SPLIT_NONE ||
+	    len < 2 * SPLIT_MIN_CHUNK || (current->flags & PF_WQ_WORKER))
+		return 1;
+
+	n = min_t(unsigned int, len / SPLIT_MIN_CHUNK, num_online_cpus());
+	n = min(n, SPLIT_MAX_CHUNKS);
+	if (n < 2)
+		return 1;
+
+	/* chunks start on a block, or on a counter block with CTR */
+	unit = sop ? sop->sector_size : max(cdata->blocksize, ivsize);
+	chunk = rounddown(len / n, unit);
+
+	chunks = kcalloc(n, sizeof(*chunks), GFP_KERNEL);
+	if (unlikely(!chunks))
+		return 1;
+	cryptodev_cipher_get_iv(cdata, iv, ivsize);
+
+	/* all IVs are taken before anything is ciphered in place; if
+	 * requests run out the chunk at hand becomes the last one */
+	for (i = 0, off = 0; i < n; i++, off += chunk) {
+		c = &chunks[i];
+		if (i < n - 1) {
+			c->req = crypto_get_req(ses_ptr);
+			if (unlikely(!c->req))
+				n = i + 1;
+		}
+		c->len = i < n - 1 ? chunk : len - off;
+		c->op = op;
+		c->sop = sop;
+		c->src = scatterwalk_ffwd(c->sbuf, src_sg, off);
+		c->dst = src_sg == dst_sg ? c->src :
+			scatterwalk_ffwd(c->dbuf, dst_sg, off);
+
+		if (sop) {
+			c->sector = sop->sector + off / sop->sector_size;
+		} else if (mode == SPLIT_CBC && off) {
+			sg_pcopy_to_buffer(src_sg, sg_nents(src_sg), c->iv,
+					ivsize, off - ivsize);
+		} else {
+			memcpy(c->iv, iv, ivsize);
+			if (mode == SPLIT_CTR)
+				ctr_add(c->iv, ivsize, off / ivsize);
+		}
+	}
+
+	cpu = raw_smp_processor_id();
+	for (i = 0; i < n - 1; i++) {
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		init_completion(&chunks[i].done);
+		INIT_WORK(&chunks[i].work, split_chunk_run);
+		queue_work_on(cpu, cryptodev_wq, &chunks[i].work);
+	}
+
+	ret = split_chunk_crypt(cdata, &chunks[n - 1]);
+
+	for (i = 0; i < n - 1; i++) {
+		wait_for_completion(&chunks[i].done);
+		if (!ret)
+			ret = chunks[i].ret;
+		crypto_put_req(ses_ptr, chunks[i].req);
+	}
+
+	kfree(chunks);
+	return ret;
+}
+#else
+/* there is no scatterwalk_ffwd() to cut out the chunks */
+static inline int
+crypt_split(struct csession *ses_ptr, struct cipher_data *cdata,
+		struct scatterlist *src_sg, struct scatterlist *dst_sg,
+		uint32_t len, int op, struct crypt_sector_op *sop)
+{
+	return 1;
+}
+#endif
+
+static char *alloc_bounce_pages(int node, gfp_t gfp, unsigned int order)
+{
+	struct page *page = alloc_pages_node(node, gfp, order);
+
+	return page ? page_address(page) : NULL;
+}
+
+/* A bounce area stays with the session or request that took it until
+ * that is freed, and then waits here for the next one, so that sessions
+ * that come and go do not each allocate BOUNCE_ORDER pages. */
+static DEFINE_SPINLOCK(bounce_pool_lock);
+static char *bounce_pool[BOUNCE_POOL_SIZE];
+static unsigned int bounce_pool_count;
+
+static char *bounce_pool_get(int node)
+{
+	char *bounce = NULL;
+	unsigned int i;
+
+	spin_lock(&bounce_pool_lock);
+	for (i = bounce_pool_count; i-- > 0; ) {
+		if (node == NUMA_NO_NODE ||
+		    page_to_nid(virt_to_page(bounce_pool[i])) == node) {
+			bounce = bounce_pool[i];
+			bounce_pool[i] = bounce_pool[--bounce_pool_count];
+			break;
+		}
+	}
+	spin_unlock(&bounce_pool_lock);
+
+	return bounce;
+}
+
+void __release_bounce_buf(struct cryptodev_pages *zc)
+{
+	char *bounce = zc->bounce;
+
+	zc->bounce = NULL;
+	if (zc->bounce_order == BOUNCE_ORDER) {
+		spin_lock(&bounce_pool_lock);
+		if (bounce_pool_count < BOUNCE_POOL_SIZE) {
+			bounce_pool[bounce_pool_count++] = bounce;
+			bounce = NULL;
+		}
+		spin_unlock(&bounce_pool_lock);
+	}
+
+	if (bounce)
+		free_pages((unsigned long)bounce, zc->bounce_order);
+}
+
+void cryptodev_bounce_pool_flush(void)
+{
+	while (bounce_pool_count)
+		free_pages((unsigned long)bounce_pool[--bounce_pool_count],
+				BOUNCE_ORDER);
+}
+
+/* Get the bounce area of zc on its node, trying for several pages
+ * first so that whole chunks go to the engine in one request. */
+static char *get_bounce_buf(struct cryptodev_pages *zc)
+{
+	if (likely(zc->bounce))
+		return zc->bounce;
+
+	zc->bounce_order = BOUNCE_ORDER;
+	zc->bounce = bounce_pool_get(zc->node);
+	if (likely(zc->bounce))
+		return zc->bounce;
+
+	zc->bounce = alloc_bounce_pages(zc->node, GFP_KERNEL | __GFP_NOWARN |
+			__GFP_NORETRY, zc->bounce_order);
+	if (unlikely(!zc->bounce)) {
+		zc->bounce_order = 0;
+		zc->bounce = alloc_bounce_pages(zc->node, GFP_KERNEL, 0);
+	}
+	return zc->bounce;
+}
+
+/* Cipher-only bounced operation using the two halves of the bounce
+ * area in turn: while the engine processes one chunk, the next one is
+ * copied in. The request is only reused after it completed, so the IV
+ * of each chunk still follows from the previous one. */
+static int
+__crypto_run_std_pipelined(struct cipher_data *cdata, struct crypt_op *cop,
+		char *data, size_t bufsize)
+{
+	char *buf[2] = { data, data + bufsize };
+	char __user *src = cop->src, *dst = cop->dst;
+	struct scatterlist sg[2];
+	size_t nbytes = cop->len, len, next_len;
+	int cur = 0, ret, rc;
+
+	len = min(nbytes, bufsize);
+	if (unlikely(copy_from_user(buf[cur], src, len))) {
+		derr(1, "Error copying %zu bytes from user address %p.", len, src);
+		return -EFAULT;
+	}
+
+	while (nbytes > 0) {
+		sg_init_one(&sg[cur], buf[cur], len);
+		ret = cryptodev_cipher_start(cdata, &sg[cur], &sg[cur], len,
+				cop->op == COP_ENCRYPT);
+
+		src += len;
+		next_len = min(nbytes - len, bufsize);
+		rc = 0;
+		if (next_len && unlikely(copy_from_user(buf[!cur], src, next_len))) {
+			derr(1, "Error copying %zu bytes from user address %p.", next_len, src);
+			rc = -EFAULT;
+		}
+
+		/* wait even in case of error, the engine may still be
+		 * using the buffer */
+		ret = cryptodev_cipher_wait(cdata, ret);
+		if (unlikely(ret)) {
+			derr(0, "CryptoAPI failure: %d", ret);
+			return ret;
+		}
+		if (unlikely(rc))
+			return rc;
+
+		if (unlikely(copy_to_user(dst, buf[cur], len))) {
+			derr(1, "could not copy to user.");
+			return -EFAULT;
+		}
+
+		dst += len;
+		nbytes -= len;
+		len = next_len;
+		cur = !cur;
+	}
+
+	return 0;
+}
+
 /* This is the main crypto function - feed it with plaintext
    and get a ciphertext (or vice versa :-) */
 static int
-__crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
+__crypto_run_std(struct csession *ses_ptr, struct cipher_data *cdata,
+		struct cryptodev_pages *zc, struct crypt_op *cop)
 {
 	char *data;
 	char __user *src, *dst;
@@ -111,14 +544,22 @@ __crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
 	int ret = 0;
 
 	nbytes = cop->len;
-	data = (char *)__get_free_page(GFP_KERNEL);
+	data = get_bounce_buf(zc);
 
 	if (unlikely(!data)) {
 		derr(1, "Error getting free page.");
 		return -ENOMEM;
 	}
 
-	bufsize = PAGE_SIZE < nbytes ? PAGE_SIZE : nbytes;
+	bufsize = PAGE_SIZE << zc->bounce_order;
+
+	/* the hash has to be fed in order with the cipher, so only
+	 * plain cipher operations are double buffered */
+	if (cdata->init != 0 && cdata->aead == 0 &&
+	    ses_ptr->hdata.init == 0 && nbytes > bufsize / 2)
+		return __crypto_run_std_pipelined(cdata, cop, data, bufsize / 2);
+
+	bufsize = bufsize < nbytes ? bufsize : nbytes;
 
 	src = cop->src;
 	dst = cop->dst;
@@ -134,14 +575,14 @@ __crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
 
 		sg_init_one(&sg, data, current_len);
 
-		ret = hash_n_crypt(ses_ptr, cop, &sg, &sg, current_len);
+		ret = hash_n_crypt(ses_ptr, cdata, cop, &sg, &sg, current_len);
 
 		if (unlikely(ret)) {
 		        derr(1, "hash_n_crypt failed.");
 			break;
 		}
 
-		if (ses_ptr->cdata.init != 0) {
+		if (cdata->init != 0) {
 			if (unlikely(copy_to_user(dst, data, current_len))) {
 			        derr(1, "could not copy to user.");
 				ret = -EFAULT;
@@ -154,50 +595,210 @@ __crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
 		src += current_len;
 	}
 
-	free_page((unsigned long)data);
 	return ret;
 }
 
 
 
+/* Operations that fit the small buffer of zc are copied through it,
+ * without pinning pages, building a scatterlist of them or allocating
+ * anything */
+static inline int
+crypto_op_is_small(struct csession *ses_ptr, struct crypt_op *cop)
+{
+	return cop->len <= SMALL_OP_MAX &&
+		ses_ptr->alignmask < SMALL_OP_ALIGN;
+}
+
+static int
+__crypto_run_small(struct csession *ses_ptr, struct cipher_data *cdata,
+		struct cryptodev_pages *zc, struct crypt_op *cop)
+{
+	struct scatterlist sg;
+	int ret;
+
+	if (unlikely(copy_from_user(zc->small, cop->src, cop->len))) {
+		derr(1, "Error copying %u bytes from user address %p.",
+				cop->len, cop->src);
+		return -EFAULT;
+	}
+
+	sg_init_one(&sg, zc->small, cop->len);
+	ret = hash_n_crypt(ses_ptr, cdata, cop, &sg, &sg, cop->len);
+	if (unlikely(ret))
+		return ret;
+
+	if (cdata->init != 0 &&
+	    unlikely(copy_to_user(cop->dst, zc->small, cop->len))) {
+		derr(1, "could not copy to user.");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 /* This is the main crypto function - zero-copy edition */
 static int
-__crypto_run_zc(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
+__crypto_run_zc(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct cipher_data *cdata, struct cryptodev_pages *zc,
+		struct kernel_crypt_op *kcop)
 {
 	struct scatterlist *src_sg, *dst_sg;
 	struct crypt_op *cop = &kcop->cop;
 	int ret = 0;
 
-	ret = get_userbuf(ses_ptr, cop->src, cop->len, cop->dst, cop->len,
+	ret = get_userbuf(fcr, zc, cop->src, cop->len, cop->dst, cop->len,
 	                  kcop->task, kcop->mm, &src_sg, &dst_sg);
 	if (unlikely(ret)) {
 		derr(1, "Error getting user pages. Falling back to non zero copy.");
-		return __crypto_run_std(ses_ptr, cop);
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_USERBUF_ERR);
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC_FALLBACK);
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+		return __crypto_run_std(ses_ptr, cdata, zc, cop);
 	}
+	cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC);
 
-	ret = hash_n_crypt(ses_ptr, cop, src_sg, dst_sg, cop->len);
+	ret = 1;
+	if (crypto_hash_cipher_concurrent(ses_ptr, cdata, cop))
+		ret = hash_n_crypt_concurrent(ses_ptr, cdata, src_sg, dst_sg,
+				cop->len);
+	else if (cdata->init != 0)
+		ret = crypt_split(ses_ptr, cdata, src_sg, dst_sg, cop->len,
+				cop->op, NULL);
+	if (ret > 0)
+		ret = hash_n_crypt(ses_ptr, cdata, cop, src_sg, dst_sg, cop->len);
 
-	release_user_pages(ses_ptr);
+	release_user_pages(zc);
 	return ret;
 }
 
+/* Pinning pays off only with some whole pages in the middle */
+#define ZC_EDGES_MIN	PAGE_SIZE
+
+static void zc_edges(struct userbuf_edges *e, uint8_t __user *addr,
+		uint32_t len, unsigned int align, char *bounce)
+{
+	e->head = (uint8_t __user *)PTR_ALIGN(addr, align) - addr;
+	e->tail = (unsigned long)(addr + len) & (align - 1);
+	e->hbuf = bounce;
+	e->tbuf = bounce + align;
+}
+
+/* Zero-copy operation on buffers that are not aligned as the session
+ * requires: only the unaligned head and tail of each buffer go through
+ * the bounce area, the pages in between are used directly. Returns 1
+ * if the operation cannot be done this way. */
+static int
+__crypto_run_zc_edges(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct cipher_data *cdata, struct cryptodev_pages *zc,
+		struct kernel_crypt_op *kcop)
+{
+	struct scatterlist *src_sg, *dst_sg;
+	struct crypt_op *cop = &kcop->cop;
+	unsigned int align = ses_ptr->alignmask + 1;
+	struct userbuf_edges se, de;
+	char *bounce;
+	int ret;
+
+	if (cdata->init == 0 || !cop->src || !cop->dst ||
+	    cop->len < ZC_EDGES_MIN + 2 * align)
+		return 1;
+
+	bounce = get_bounce_buf(zc);
+	if (unlikely(!bounce || 4 * align > (PAGE_SIZE << zc->bounce_order)))
+		return 1;
+
+	zc_edges(&se, cop->src, cop->len, align, bounce);
+	zc_edges(&de, cop->dst, cop->len, align, bounce + 2 * align);
+
+	if (unlikely(copy_from_user(se.hbuf, cop->src, se.head) ||
+		     copy_from_user(se.tbuf, cop->src + cop->len - se.tail,
+				    se.tail)))
+		return -EFAULT;
+
+	ret = get_userbuf_edges(fcr, zc, cop->src, &se, cop->dst, &de,
+			cop->len, kcop->task, kcop->mm, &src_sg, &dst_sg);
+	if (unlikely(ret)) {
+		dwarning(2, "could not pin the aligned part of %p", cop->src);
+		return 1;
+	}
+	cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC);
+	cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC_EDGES);
+
+	ret = 1;
+	if (crypto_hash_cipher_concurrent(ses_ptr, cdata, cop))
+		ret = hash_n_crypt_concurrent(ses_ptr, cdata, src_sg, dst_sg,
+				cop->len);
+	if (ret > 0)
+		ret = hash_n_crypt(ses_ptr, cdata, cop, src_sg, dst_sg, cop->len);
+
+	release_user_pages(zc);
+	if (unlikely(ret))
+		return ret;
+
+	/* in place the edges were processed in the source slots */
+	if (cop->src == cop->dst)
+		de = se;
+	if (unlikely(copy_to_user(cop->dst, de.hbuf, de.head) ||
+		     copy_to_user(cop->dst + cop->len - de.tail, de.tbuf,
+				  de.tail)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/* Operations on cipher-only sessions that bring their own IV do not
+ * depend on the state kept in the session, so they may run
+ * concurrently on requests of their own. So do ones that got a
+ * generated IV. */
+static inline int
+crypto_run_parallel(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
+{
+	return ses_ptr->cdata.init != 0 && ses_ptr->cdata.aead == 0 &&
+		ses_ptr->hdata.init == 0 &&
+		kcop->ivlen >= ses_ptr->cdata.ivsize;
+}
+
 int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
 {
 	struct csession *ses_ptr;
+	struct cryptodev_req *req = NULL;
+	struct cipher_data *cdata;
+	struct cryptodev_pages *zc;
 	struct crypt_op *cop = &kcop->cop;
-	int ret;
+	ktime_t start;
+	int ret = 0;
 
 	if (unlikely(cop->op != COP_ENCRYPT && cop->op != COP_DECRYPT)) {
 		ddebug(1, "invalid operation op=%u", cop->op);
 		return -EINVAL;
 	}
 
+	trace_cryptodev_op_start(cop->ses, cop->op, cop->len, cop->flags);
+
 	/* this also enters ses_ptr->sem */
 	ses_ptr = crypto_get_session_by_sid(fcr, cop->ses);
 	if (unlikely(!ses_ptr)) {
 		derr(1, "invalid session ID=0x%08X", cop->ses);
 		return -EINVAL;
 	}
+	start = ktime_get();
+
+	cdata = &ses_ptr->cdata;
+	zc = &ses_ptr->zc;
+	if (crypto_op_gen_iv(ses_ptr, cop->op)) {
+		crypto_gen_iv(ses_ptr, kcop->iv, cop->len);
+		kcop->ivlen = ses_ptr->cdata.ivsize;
+	}
+	if (crypto_run_parallel(ses_ptr, kcop)) {
+		req = crypto_get_req(ses_ptr);
+		if (likely(req)) {
+			/* the reference we hold keeps the session around */
+			mutex_unlock(&ses_ptr->sem);
+			cdata = &req->cdata;
+			zc = &req->zc;
+		}
+	}
 
 	if (ses_ptr->hdata.init != 0 && (cop->flags == 0 || cop->flags & COP_FLAG_RESET)) {
 		ret = cryptodev_hash_reset(&ses_ptr->hdata);
@@ -207,8 +808,8 @@ int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
 		}
 	}
 
-	if (ses_ptr->cdata.init != 0) {
-		int blocksize = ses_ptr->cdata.blocksize;
+	if (cdata->init != 0) {
+		int blocksize = cdata->blocksize;
 
 		if (unlikely(cop->len % blocksize)) {
 			derr(1, "data size (%u) isn't a multiple of block size (%u)",
@@ -217,36 +818,54 @@ int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
 			goto out_unlock;
 		}
 
-		cryptodev_cipher_set_iv(&ses_ptr->cdata, kcop->iv,
-				min(ses_ptr->cdata.ivsize, kcop->ivlen));
+		cryptodev_cipher_set_iv(cdata, kcop->iv,
+				min(cdata->ivsize, kcop->ivlen));
 	}
 
-	if (likely(cop->len)) {
+	if (likely(cop->len) && crypto_op_is_small(ses_ptr, cop)) {
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+		ret = __crypto_run_small(ses_ptr, cdata, zc, cop);
+		if (unlikely(ret))
+			goto out_unlock;
+	} else if (likely(cop->len)) {
+		int misaligned = 0;
+
 		if (!(cop->flags & COP_FLAG_NO_ZC)) {
 			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->src, ses_ptr->alignmask + 1))) {
-				dwarning(2, "source address %p is not %d byte aligned - disabling zero copy",
+				dwarning(2, "source address %p is not %d byte aligned - bouncing its edges",
 						cop->src, ses_ptr->alignmask + 1);
-				cop->flags |= COP_FLAG_NO_ZC;
+				misaligned = 1;
 			}
 
 			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->dst, ses_ptr->alignmask + 1))) {
-				dwarning(2, "destination address %p is not %d byte aligned - disabling zero copy",
+				dwarning(2, "destination address %p is not %d byte aligned - bouncing its edges",
 						cop->dst, ses_ptr->alignmask + 1);
-				cop->flags |= COP_FLAG_NO_ZC;
+				misaligned = 1;
 			}
 		}
 
-		if (cop->flags & COP_FLAG_NO_ZC)
-			ret = __crypto_run_std(ses_ptr, &kcop->cop);
-		else
-			ret = __crypto_run_zc(ses_ptr, kcop);
+		ret = misaligned ?
+			__crypto_run_zc_edges(fcr, ses_ptr, cdata, zc, kcop) : 1;
+		if (ret > 0) {
+			if (misaligned) {
+				dwarning(2, "disabling zero copy");
+				cop->flags |= COP_FLAG_NO_ZC;
+			}
+			if (cop->flags & COP_FLAG_NO_ZC) {
+				cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+				ret = __crypto_run_std(ses_ptr, cdata, zc, &kcop->cop);
+			} else {
+				ret = __crypto_run_zc(fcr, ses_ptr, cdata, zc, kcop);
+			}
+		}
 		if (unlikely(ret))
 			goto out_unlock;
 	}
 
-	if (ses_ptr->cdata.init != 0) {
-		cryptodev_cipher_get_iv(&ses_ptr->cdata, kcop->iv,
-				min(ses_ptr->cdata.ivsize, kcop->ivlen));
+	/* a generated IV is returned as it was used */
+	if (cdata->init != 0 && !crypto_op_gen_iv(ses_ptr, cop->op)) {
+		cryptodev_cipher_get_iv(cdata, kcop->iv,
+				min(cdata->ivsize, kcop->ivlen));
 	}
 
 	if (ses_ptr->hdata.init != 0 &&
@@ -261,6 +880,906 @@ int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
 		kcop->digestsize = ses_ptr->hdata.digestsize;
 	}
 
+	cryptodev_stat_op(&ses_ptr->stats, cop->len, start);
+
+out_unlock:
+	/* zc is the mode the operation started in, a failed pinning in
+	 * between shows a fallback */
+	trace_cryptodev_op_done(cop->ses, cop->op, cop->len,
+			ses_ptr->stats.alg->name,
+			!(cop->flags & COP_FLAG_NO_ZC), ret);
+	if (req) {
+		crypto_put_req(ses_ptr, req);
+		crypto_release_session(ses_ptr);
+	} else {
+		crypto_put_session(ses_ptr);
+	}
+	return ret;
+}
+
+/* Hash one message of CIOCHASH_MULTI. Messages that fit the bounce
+ * area are copied, which is cheaper than pinning their pages. */
+static int
+crypto_hash_one(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct crypt_hash_vec *vec, uint32_t flags)
+{
+	struct kernel_crypt_op kcop;
+	struct crypt_op *cop = &kcop.cop;
+	ktime_t start = ktime_get();
+	int ret;
+
+	memset(cop, 0, sizeof(*cop));
+	cop->ses = ses_ptr->sid;
+	cop->op = COP_ENCRYPT;
+	cop->flags = flags;
+	cop->len = vec->len;
+	cop->src = vec->src;
+	kcop.task = current;
+	kcop.mm = current->mm;
+
+	ret = cryptodev_hash_reset(&ses_ptr->hdata);
+	if (unlikely(ret)) {
+		derr(1, "error in cryptodev_hash_reset()");
+		return ret;
+	}
+
+	if (likely(cop->len)) {
+		if ((cop->flags & COP_FLAG_NO_ZC) ||
+		    cop->len <= (PAGE_SIZE << ses_ptr->zc.bounce_order) ||
+		    (ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->src,
+						ses_ptr->alignmask + 1))) {
+			cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+			ret = __crypto_run_std(ses_ptr, &ses_ptr->cdata,
+					&ses_ptr->zc, cop);
+		} else {
+			ret = __crypto_run_zc(fcr, ses_ptr, &ses_ptr->cdata,
+					&ses_ptr->zc, &kcop);
+		}
+		if (unlikely(ret))
+			return ret;
+	}
+
+	ret = cryptodev_hash_final(&ses_ptr->hdata, kcop.hash_output);
+	if (unlikely(ret)) {
+		derr(0, "CryptoAPI failure: %d", ret);
+		return ret;
+	}
+
+	if (unlikely(copy_to_user(vec->mac, kcop.hash_output,
+					ses_ptr->hdata.digestsize)))
+		return -EFAULT;
+
+	cryptodev_stat_op(&ses_ptr->stats, cop->len, start);
+	return 0;
+}
+
+/* Hash every message of hmop on its session, which is looked up and
+ * locked only once for the whole array. Its elements are of size bytes
+ * and read by from_user, for crypt_hash_vec or crypt_hash_vec64. */
+int crypto_hash_multi(struct fcrypt *fcr, struct crypt_hash_multi_op *hmop,
+		size_t size,
+		int (*from_user)(struct crypt_hash_vec *vec, void __user *arg))
+{
+	void __user *uvecs = hmop->vecs;
+	struct crypt_hash_vec vec;
+	struct csession *ses_ptr;
+	unsigned int i;
+	int ret = 0;
+
+	if (unlikely((hmop->flags & ~COP_FLAG_NO_ZC) || hmop->__reserved ||
+		     (hmop->count && !uvecs)))
+		return -EINVAL;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, hmop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", hmop->ses);
+		return -EINVAL;
+	}
+
+	if (unlikely(ses_ptr->hdata.init == 0 || ses_ptr->cdata.init != 0)) {
+		derr(1, "session 0x%08X is not a hash session", hmop->ses);
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	/* sizes the messages that are copied rather than pinned */
+	if (unlikely(!get_bounce_buf(&ses_ptr->zc))) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+
+	for (i = 0; i < hmop->count; i++) {
+		ret = from_user(&vec, uvecs + i * size);
+		if (likely(!ret))
+			ret = crypto_hash_one(fcr, ses_ptr, &vec, hmop->flags);
+
+		if (hmop->status) {
+			if (unlikely(put_user(ret, &hmop->status[i]))) {
+				ret = -EFAULT;
+				goto out_unlock;
+			}
+			ret = 0;
+		} else if (unlikely(ret)) {
+			dwarning(1, "message %u of %u failed: %d", i, hmop->count, ret);
+			goto out_unlock;
+		}
+		cond_resched();
+	}
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* A position in an array of user segments */
+struct iov_pos {
+	const struct crypt_iovec *iov;
+	unsigned int cnt, idx;
+	uint32_t off;
+};
+
+/* copy len bytes between buf and the segments at pos and advance it */
+static int iov_copy(struct iov_pos *pos, char *buf, size_t len, int to_user)
+{
+	const struct crypt_iovec *v;
+	char __user *ubuf;
+	size_t n;
+
+	while (len > 0) {
+		if (unlikely(pos->idx >= pos->cnt))
+			return -EINVAL;
+
+		v = &pos->iov[pos->idx];
+		n = min_t(size_t, v->len - pos->off, len);
+		ubuf = (char __user *)v->base + pos->off;
+		if (unlikely(to_user ? copy_to_user(ubuf, buf, n) :
+					copy_from_user(buf, ubuf, n))) {
+			derr(1, "Error copying %zu bytes %s user address %p.", n,
+					to_user ? "to" : "from", ubuf);
+			return -EFAULT;
+		}
+
+		buf += n;
+		len -= n;
+		pos->off += n;
+		if (pos->off == v->len) {
+			pos->idx++;
+			pos->off = 0;
+		}
+	}
+
+	return 0;
+}
+
+/* The same as __crypto_run_std() gathering the input from and
+ * scattering the output to segments */
+static int
+__crypto_run_iov_std(struct csession *ses_ptr, struct crypt_op *cop,
+		const struct crypt_iovec *src, unsigned int src_cnt,
+		const struct crypt_iovec *dst, unsigned int dst_cnt)
+{
+	struct iov_pos spos = { src, src_cnt, 0, 0 };
+	struct iov_pos dpos = { dst, dst_cnt, 0, 0 };
+	struct cryptodev_pages *zc = &ses_ptr->zc;
+	struct scatterlist sg;
+	size_t nbytes = cop->len, bufsize, len;
+	char *data;
+	int ret;
+
+	data = get_bounce_buf(zc);
+	if (unlikely(!data)) {
+		derr(1, "Error getting free page.");
+		return -ENOMEM;
+	}
+	bufsize = PAGE_SIZE << zc->bounce_order;
+
+	while (nbytes > 0) {
+		len = min(nbytes, bufsize);
+
+		ret = iov_copy(&spos, data, len, 0);
+		if (unlikely(ret))
+			return ret;
+
+		sg_init_one(&sg, data, len);
+		ret = hash_n_crypt(ses_ptr, &ses_ptr->cdata, cop, &sg, &sg, len);
+		if (unlikely(ret)) {
+			derr(1, "hash_n_crypt failed.");
+			return ret;
+		}
+
+		if (ses_ptr->cdata.init != 0) {
+			ret = iov_copy(&dpos, data, len, 1);
+			if (unlikely(ret))
+				return ret;
+		}
+		nbytes -= len;
+	}
+
+	return 0;
+}
+
+/* copy in the segments of uiov with from_user and return their total
+ * length in len */
+static int iov_from_user(struct crypt_iovec *iov, void __user *uiov,
+		unsigned int cnt, uint32_t *len, uint16_t alignmask,
+		uint16_t *flags,
+		int (*from_user)(struct crypt_iovec *iov, void __user *arg,
+				unsigned int cnt))
+{
+	unsigned int i;
+	int ret;
+
+	ret = from_user(iov, uiov, cnt);
+	if (unlikely(ret))
+		return ret;
+
+	*len = 0;
+	for (i = 0; i < cnt; i++) {
+		if (unlikely(iov[i].len > UINT_MAX - *len ||
+			     (!iov[i].base && iov[i].len)))
+			return -EINVAL;
+		*len += iov[i].len;
+
+		if (alignmask && !IS_ALIGNED((unsigned long)iov[i].base,
+					     alignmask + 1)) {
+			dwarning(2, "segment %p is not %d byte aligned - disabling zero copy",
+					iov[i].base, alignmask + 1);
+			*flags |= COP_FLAG_NO_ZC;
+		}
+	}
+
+	return 0;
+}
+
+/* Run a CIOCCRYPTV; the segments are arrays of crypt_iovec or of
+ * crypt_iovec64, as read by from_user */
+int crypto_run_iov(struct fcrypt *fcr, struct crypt_iov_op *iop,
+		int (*from_user)(struct crypt_iovec *iov, void __user *arg,
+				unsigned int cnt))
+{
+	struct crypt_iovec fast[2][UIO_FASTIOV], *src = fast[0], *dst = NULL;
+	struct scatterlist *src_sg, *dst_sg;
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	struct csession *ses_ptr;
+	struct crypt_op cop;
+	uint32_t dst_len = 0;
+	ktime_t start;
+	int ret;
+
+	if (unlikely((iop->op != COP_ENCRYPT && iop->op != COP_DECRYPT) ||
+		     (iop->flags & ~COP_FLAG_NO_ZC) ||
+		     iop->src_cnt > CRYPTO_IOV_MAX ||
+		     iop->dst_cnt > CRYPTO_IOV_MAX))
+		return -EINVAL;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, iop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", iop->ses);
+		return -EINVAL;
+	}
+	start = ktime_get();
+
+	memset(&cop, 0, sizeof(cop));
+	cop.ses = iop->ses;
+	cop.op = iop->op;
+	cop.flags = iop->flags;
+
+	if (unlikely(ses_ptr->cdata.aead != 0)) {
+		derr(1, "AEAD sessions are not supported on segments");
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	if (iop->src_cnt > UIO_FASTIOV) {
+		src = kmalloc_array(iop->src_cnt, sizeof(*src), GFP_KERNEL);
+		if (unlikely(!src)) {
+			ret = -ENOMEM;
+			goto out_unlock;
+		}
+	}
+	ret = iov_from_user(src, iop->src, iop->src_cnt, &cop.len,
+			ses_ptr->alignmask, &cop.flags, from_user);
+	if (unlikely(ret))
+		goto out_free;
+
+	if (iop->dst == iop->src && iop->dst_cnt == iop->src_cnt) {
+		dst = src;
+		dst_len = cop.len;
+	} else if (iop->dst) {
+		dst = fast[1];
+		if (iop->dst_cnt > UIO_FASTIOV) {
+			dst = kmalloc_array(iop->dst_cnt, sizeof(*dst), GFP_KERNEL);
+			if (unlikely(!dst)) {
+				ret = -ENOMEM;
+				goto out_free;
+			}
+		}
+		ret = iov_from_user(dst, iop->dst, iop->dst_cnt, &dst_len,
+				ses_ptr->alignmask, &cop.flags, from_user);
+		if (unlikely(ret))
+			goto out_free;
+	}
+
+	if (ses_ptr->cdata.init != 0) {
+		if (unlikely(!dst || dst_len < cop.len)) {
+			derr(1, "output segments hold %u of %u bytes",
+					dst_len, cop.len);
+			ret = -EINVAL;
+			goto out_free;
+		}
+
+		if (unlikely(cop.len % ses_ptr->cdata.blocksize)) {
+			derr(1, "data size (%u) isn't a multiple of block size (%u)",
+				cop.len, ses_ptr->cdata.blocksize);
+			ret = -EINVAL;
+			goto out_free;
+		}
+
+		if (crypto_op_gen_iv(ses_ptr, cop.op)) {
+			crypto_gen_iv(ses_ptr, iv, cop.len);
+			cryptodev_cipher_set_iv(&ses_ptr->cdata, iv,
+					ses_ptr->cdata.ivsize);
+		} else if (iop->iv) {
+			if (unlikely(copy_from_user(iv, iop->iv,
+						ses_ptr->cdata.ivsize))) {
+				ret = -EFAULT;
+				goto out_free;
+			}
+			cryptodev_cipher_set_iv(&ses_ptr->cdata, iv,
+					ses_ptr->cdata.ivsize);
+		}
+	}
+
+	if (ses_ptr->hdata.init != 0) {
+		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+		if (unlikely(ret)) {
+			derr(1, "error in cryptodev_hash_reset()");
+			goto out_free;
+		}
+	}
+
+	if (likely(cop.len)) {
+		if (!(cop.flags & COP_FLAG_NO_ZC)) {
+			ret = get_userbuf_iov(fcr, &ses_ptr->zc, src, iop->src_cnt,
+					dst, iop->dst_cnt, current, current->mm,
+					&src_sg, &dst_sg);
+			if (unlikely(ret)) {
+				derr(1, "Error getting user pages. Falling back to non zero copy.");
+				cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_USERBUF_ERR);
+				cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC_FALLBACK);
+				cop.flags |= COP_FLAG_NO_ZC;
+			}
+		}
+
+		if (cop.flags & COP_FLAG_NO_ZC) {
+			cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+			ret = __crypto_run_iov_std(ses_ptr, &cop, src, iop->src_cnt,
+					dst, iop->dst_cnt);
+		} else {
+			cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC);
+			ret = hash_n_crypt(ses_ptr, &ses_ptr->cdata, &cop,
+					src_sg, dst_sg, cop.len);
+			release_user_pages(&ses_ptr->zc);
+		}
+		if (unlikely(ret))
+			goto out_free;
+	}
+
+	if (ses_ptr->cdata.init != 0 && iop->iv) {
+		if (!crypto_op_gen_iv(ses_ptr, cop.op))
+			cryptodev_cipher_get_iv(&ses_ptr->cdata, iv,
+					ses_ptr->cdata.ivsize);
+		if (unlikely(copy_to_user(iop->iv, iv, ses_ptr->cdata.ivsize))) {
+			ret = -EFAULT;
+			goto out_free;
+		}
+	}
+
+	if (ses_ptr->hdata.init != 0) {
+		ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+		if (unlikely(ret)) {
+			derr(0, "CryptoAPI failure: %d", ret);
+			goto out_free;
+		}
+		if (unlikely(copy_to_user(iop->mac, hash_output,
+					ses_ptr->hdata.digestsize))) {
+			ret = -EFAULT;
+			goto out_free;
+		}
+	}
+
+	cryptodev_stat_op(&ses_ptr->stats, cop.len, start);
+
+out_free:
+	if (dst && dst != src && dst != fast[1])
+		kfree(dst);
+	if (src != fast[0])
+		kfree(src);
+out_unlock:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+static int
+__crypto_run_sectors_std(struct csession *ses_ptr, struct crypt_sector_op *sop)
+{
+	char __user *src = sop->src, *dst = sop->dst;
+	uint64_t sector = sop->sector;
+	struct scatterlist sg;
+	size_t nbytes = sop->len, bufsize, len, off;
+	char *data;
+	int ret;
+
+	data = get_bounce_buf(&ses_ptr->zc);
+	if (unlikely(!data)) {
+		derr(1, "Error getting free page.");
+		return -ENOMEM;
+	}
+	/* both are powers of two and a sector never exceeds a page */
+	bufsize = PAGE_SIZE << ses_ptr->zc.bounce_order;
+
+	while (nbytes > 0) {
+		len = min(nbytes, bufsize);
+		if (unlikely(copy_from_user(data, src, len))) {
+			derr(1, "Error copying %zu bytes from user address %p.", len, src);
+			return -EFAULT;
+		}
+
+		for (off = 0; off < len; off += sop->sector_size) {
+			sg_init_one(&sg, data + off, sop->sector_size);
+			ret = crypt_sector(&ses_ptr->cdata, sop, &sg, &sg, sector++);
+			if (unlikely(ret))
+				return ret;
+		}
+
+		if (unlikely(copy_to_user(dst, data, len))) {
+			derr(1, "could not copy to user.");
+			return -EFAULT;
+		}
+
+		src += len;
+		dst += len;
+		nbytes -= len;
+	}
+
+	return 0;
+}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0))
+/* The pages are mapped once for the whole run; the sectors are then
+ * cut out of the mapping. */
+static int
+__crypto_run_sectors_zc(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct crypt_sector_op *sop)
+{
+	struct scatterlist *src_sg, *dst_sg, sbuf[2], dbuf[2], *src, *dst;
+	uint64_t sector = sop->sector;
+	uint32_t off;
+	int ret;
+
+	ret = get_userbuf(fcr, &ses_ptr->zc, sop->src, sop->len, sop->dst,
+			sop->len, current, current->mm, &src_sg, &dst_sg);
+	if (unlikely(ret)) {
+		derr(1, "Error getting user pages. Falling back to non zero copy.");
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_USERBUF_ERR);
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC_FALLBACK);
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+		return __crypto_run_sectors_std(ses_ptr, sop);
+	}
+	cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC);
+
+	ret = crypt_split(ses_ptr, &ses_ptr->cdata, src_sg, dst_sg, sop->len,
+			sop->op, sop);
+	if (ret > 0) {
+		for (off = 0; off < sop->len; off += sop->sector_size) {
+			src = scatterwalk_ffwd(sbuf, src_sg, off);
+			dst = src_sg == dst_sg ? src :
+				scatterwalk_ffwd(dbuf, dst_sg, off);
+			ret = crypt_sector(&ses_ptr->cdata, sop, src, dst,
+					sector++);
+			if (unlikely(ret))
+				break;
+		}
+	}
+
+	release_user_pages(&ses_ptr->zc);
+	return ret;
+}
+#else
+/* there is no scatterwalk_ffwd() to cut out the sectors */
+static inline int
+__crypto_run_sectors_zc(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct crypt_sector_op *sop)
+{
+	cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+	return __crypto_run_sectors_std(ses_ptr, sop);
+}
+#endif
+
+int crypto_run_sectors(struct fcrypt *fcr, struct crypt_sector_op *sop)
+{
+	struct csession *ses_ptr;
+	uint16_t flags = sop->flags;
+	ktime_t start;
+	int ret;
+
+	if (unlikely((sop->op != COP_ENCRYPT && sop->op != COP_DECRYPT) ||
+		     (sop->flags & ~COP_FLAG_NO_ZC) ||
+		     sop->sector_size < CRYPTO_SECTOR_MIN ||
+		     sop->sector_size > CRYPTO_SECTOR_MAX ||
+		     !is_power_of_2(sop->sector_size) ||
+		     sop->len % sop->sector_size))
+		return -EINVAL;
+
+	if (unlikely(!sop->len))
+		return 0;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, sop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", sop->ses);
+		return -EINVAL;
+	}
+	start = ktime_get();
+
+	if (unlikely(ses_ptr->cdata.init == 0 || ses_ptr->cdata.aead ||
+		     ses_ptr->hdata.init != 0 || ses_ptr->cdata.ivsize < 8 ||
+		     sop->sector_size % ses_ptr->cdata.blocksize)) {
+		derr(1, "sectors need a cipher-only session with an IV");
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	if (ses_ptr->alignmask &&
+	    (!IS_ALIGNED((unsigned long)sop->src, ses_ptr->alignmask + 1) ||
+	     !IS_ALIGNED((unsigned long)sop->dst, ses_ptr->alignmask + 1))) {
+		dwarning(2, "buffers are not %d byte aligned - disabling zero copy",
+				ses_ptr->alignmask + 1);
+		flags |= COP_FLAG_NO_ZC;
+	}
+
+	if (flags & COP_FLAG_NO_ZC) {
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+		ret = __crypto_run_sectors_std(ses_ptr, sop);
+	} else {
+		ret = __crypto_run_sectors_zc(fcr, ses_ptr, sop);
+	}
+	if (likely(!ret))
+		cryptodev_stat_op(&ses_ptr->stats, sop->len, start);
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* the number of page cache pages hashed with a single update */
+#define FD_HASH_PAGES 16
+
+/* Whether the file can be hashed straight from its page cache pages */
+static int
+crypto_fd_has_pages(struct file *file)
+{
+	struct inode *inode = file_inode(file);
+
+	if (!S_ISREG(inode->i_mode) || !file->f_mapping)
+		return 0;
+#ifdef IS_DAX
+	if (IS_DAX(inode))
+		return 0;
+#endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0))
+	return file->f_mapping->a_ops->read_folio != NULL;
+#else
+	return file->f_mapping->a_ops->readpage != NULL;
+#endif
+}
+
+static int
+__crypto_hash_fd_pages(struct csession *ses_ptr, struct file *file,
+		loff_t pos, uint64_t len, uint64_t *done)
+{
+	struct cryptodev_pages *zc = &ses_ptr->zc;
+	struct address_space *mapping = file->f_mapping;
+	loff_t end, size = i_size_read(file_inode(file));
+	unsigned int i, n, off, chunk, batch;
+	struct page *page;
+	int ret;
+
+	if (pos >= size)
+		return 0;
+	end = len < size - pos ? pos + len : size;
+
+	ret = adjust_sg_array(zc, FD_HASH_PAGES);
+	if (unlikely(ret))
+		return ret;
+
+	while (pos < end) {
+		sg_init_table(zc->sg, FD_HASH_PAGES);
+		for (n = 0, batch = 0; n < FD_HASH_PAGES && pos < end; n++) {
+			page = read_mapping_page(mapping, pos >> PAGE_SHIFT, file);
+			if (IS_ERR(page)) {
+				ret = PTR_ERR(page);
+				break;
+			}
+
+			off = pos & ~PAGE_MASK;
+			chunk = min_t(loff_t, PAGE_SIZE - off, end - pos);
+			zc->pages[n] = page;
+			sg_set_page(&zc->sg[n], page, chunk, off);
+			pos += chunk;
+			batch += chunk;
+		}
+
+		if (n) {
+			sg_mark_end(&zc->sg[n - 1]);
+			if (likely(!ret))
+				ret = cryptodev_hash_update(&ses_ptr->hdata,
+						zc->sg, batch);
+			for (i = 0; i < n; i++)
+				put_page(zc->pages[i]);
+		}
+		if (unlikely(ret))
+			return ret;
+
+		*done += batch;
+		if (fatal_signal_pending(current))
+			return -EINTR;
+	}
+
+	return 0;
+}
+
+/* Files outside of the page cache are read into a bounce area of their
+ * own. A pipe or socket may block for as long as its writer likes, so
+ * the session is left unlocked while reading, which the reference the
+ * caller holds keeps around; it is only locked for each update. */
+static int
+__crypto_hash_fd_read(struct csession *ses_ptr, struct file *file,
+		loff_t pos, uint64_t len, uint64_t *done)
+{
+	struct cryptodev_pages rd = { .node = ses_ptr->zc.node };
+	struct scatterlist sg;
+	size_t bufsize;
+	ssize_t n;
+	char *data;
+	int ret = 0;
+
+	data = get_bounce_buf(&rd);
+	if (unlikely(!data)) {
+		derr(1, "Error getting free page.");
+		return -ENOMEM;
+	}
+	bufsize = PAGE_SIZE << rd.bounce_order;
+
+	while (*done < len) {
+		mutex_unlock(&ses_ptr->sem);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0))
+		n = kernel_read(file, data, min_t(uint64_t, bufsize, len - *done),
+				&pos);
+#else
+		n = kernel_read(file, pos, data,
+				min_t(uint64_t, bufsize, len - *done));
+		if (n > 0)
+			pos += n;
+#endif
+		mutex_lock(&ses_ptr->sem);
+		if (n <= 0) {
+			ret = n;
+			break;
+		}
+
+		sg_init_one(&sg, data, n);
+		ret = cryptodev_hash_update(&ses_ptr->hdata, &sg, n);
+		if (unlikely(ret))
+			break;
+
+		*done += n;
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+	}
+
+	release_bounce_buf(&rd);
+	return ret;
+}
+
+int crypto_hash_fd(struct fcrypt *fcr, struct crypt_fd_op *fop)
+{
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+	struct csession *ses_ptr;
+	struct file *file;
+	uint64_t done = 0;
+	ktime_t start;
+	int ret;
+
+	if (unlikely(fop->flags &
+		     ~(COP_FLAG_UPDATE | COP_FLAG_FINAL | COP_FLAG_RESET) ||
+		     fop->offset > LLONG_MAX))
+		return -EINVAL;
+
+	file = fget(fop->fd);
+	if (unlikely(!file))
+		return -EBADF;
+	if (unlikely(!(file->f_mode & FMODE_READ))) {
+		ret = -EBADF;
+		goto out_fput;
+	}
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, fop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", fop->ses);
+		ret = -EINVAL;
+		goto out_fput;
+	}
+	start = ktime_get();
+
+	if (unlikely(ses_ptr->hdata.init == 0 || ses_ptr->cdata.init != 0)) {
+		derr(1, "files can only be hashed on hash-only sessions");
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	if (fop->flags == 0 || fop->flags & COP_FLAG_RESET) {
+		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+		if (unlikely(ret)) {
+			derr(1, "error in cryptodev_hash_reset()");
+			goto out_unlock;
+		}
+	}
+
+	if (crypto_fd_has_pages(file)) {
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC);
+		ret = __crypto_hash_fd_pages(ses_ptr, file, fop->offset,
+				fop->len, &done);
+	} else {
+		cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_BOUNCED);
+		ret = __crypto_hash_fd_read(ses_ptr, file, fop->offset,
+				fop->len, &done);
+	}
+	if (unlikely(ret))
+		goto out_unlock;
+
+	if (fop->flags & COP_FLAG_FINAL || !(fop->flags & COP_FLAG_UPDATE)) {
+		ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+		if (unlikely(ret)) {
+			derr(0, "CryptoAPI failure: %d", ret);
+			goto out_unlock;
+		}
+		if (unlikely(copy_to_user(fop->mac, hash_output,
+					ses_ptr->hdata.digestsize))) {
+			ret = -EFAULT;
+			goto out_unlock;
+		}
+	}
+
+	fop->len = done;
+	cryptodev_stat_op(&ses_ptr->stats, done, start);
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+out_fput:
+	fput(file);
+	return ret;
+}
+
+/* the bytes of user memory a CIOCHASHMEM update is given at once */
+#define MEM_HASH_WINDOW (1 << 20)
+
+/* Hash len bytes at src in windows, the next one of which is pinned
+ * while the engine hashes the current one. Only two windows are pinned
+ * at any time, whatever the length. */
+static int
+__crypto_hash_mem(struct fcrypt *fcr, struct csession *ses_ptr,
+		uint8_t __user *src, uint64_t len, uint64_t *done)
+{
+	struct cryptodev_pages spare = { .node = ses_ptr->node };
+	struct cryptodev_pages *zc[2] = { &ses_ptr->zc, &spare };
+	struct scatterlist *sg[2], *dst_sg;
+	uint32_t wlen[2];
+	int cur = 0, ret, hret;
+
+	if (!len)
+		return 0;
+
+	wlen[0] = min_t(uint64_t, len, MEM_HASH_WINDOW);
+	ret = get_userbuf(fcr, zc[0], src, wlen[0], NULL, 0, current,
+			current->mm, &sg[0], &dst_sg);
+	while (likely(!ret)) {
+		hret = cryptodev_hash_start(&ses_ptr->hdata, sg[cur], wlen[cur]);
+
+		wlen[!cur] = min_t(uint64_t, len - *done - wlen[cur],
+				MEM_HASH_WINDOW);
+		if (wlen[!cur])
+			ret = get_userbuf(fcr, zc[!cur],
+					src + *done + wlen[cur], wlen[!cur],
+					NULL, 0, current, current->mm,
+					&sg[!cur], &dst_sg);
+
+		hret = cryptodev_hash_wait(&ses_ptr->hdata, hret);
+		release_user_pages(zc[cur]);
+		if (unlikely(hret)) {
+			derr(0, "CryptoAPI failure: %d", hret);
+			if (wlen[!cur] && !ret)
+				release_user_pages(zc[!cur]);
+			ret = hret;
+			break;
+		}
+		*done += wlen[cur];
+		if (!wlen[!cur])
+			break;
+
+		cur = !cur;
+		if (unlikely(!ret && fatal_signal_pending(current))) {
+			release_user_pages(zc[cur]);
+			ret = -EINTR;
+		}
+	}
+
+	kfree(spare.pages);
+	kfree(spare.sg);
+	return ret;
+}
+
+int crypto_hash_mem(struct fcrypt *fcr, struct crypt_hash_mem_op *hmop)
+{
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+	struct csession *ses_ptr;
+	uint64_t done = 0;
+	ktime_t start;
+	int ret;
+
+	if (unlikely(hmop->flags &
+		     ~(COP_FLAG_UPDATE | COP_FLAG_FINAL | COP_FLAG_RESET)))
+		return -EINVAL;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, hmop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", hmop->ses);
+		return -EINVAL;
+	}
+	start = ktime_get();
+
+	if (unlikely(ses_ptr->hdata.init == 0 || ses_ptr->cdata.init != 0)) {
+		derr(1, "memory can only be hashed on hash-only sessions");
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	if (hmop->flags == 0 || hmop->flags & COP_FLAG_RESET) {
+		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+		if (unlikely(ret)) {
+			derr(1, "error in cryptodev_hash_reset()");
+			goto out_unlock;
+		}
+	}
+
+	cryptodev_stat_inc(&ses_ptr->stats, CRYPTODEV_STAT_ZC);
+	ret = __crypto_hash_mem(fcr, ses_ptr, hmop->src, hmop->len, &done);
+	if (unlikely(ret))
+		goto out_unlock;
+
+	if (hmop->flags & COP_FLAG_FINAL || !(hmop->flags & COP_FLAG_UPDATE)) {
+		ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+		if (unlikely(ret)) {
+			derr(0, "CryptoAPI failure: %d", ret);
+			goto out_unlock;
+		}
+		if (unlikely(copy_to_user(hmop->mac, hash_output,
+					ses_ptr->hdata.digestsize))) {
+			ret = -EFAULT;
+			goto out_unlock;
+		}
+	}
+
+	hmop->len = done;
+	cryptodev_stat_op(&ses_ptr->stats, done, start);
+
 out_unlock:
 	crypto_put_session(ses_ptr);
 	return ret;
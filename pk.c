@@ -0,0 +1,288 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * This file handles the public key operations of CIOCKEY, which are
+ * run by the akcipher and kpp implementations of the kernel, so that
+ * engines registering those do the work.
+ */
+
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/crypto.h>
+#include <crypto/cryptodev.h>
+#include "cryptodev_int.h"
+#include "cryptlib.h"
+#include "pk.h"
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+#include <crypto/dh.h>
+
+/* the largest number of a parameter */
+#define PK_MAX_BITS 8192
+
+/* a parameter, big endian and without leading zeros at p */
+struct pk_num {
+	u8 *buf;
+	u8 *p;
+	unsigned int len;
+};
+
+/* Read the little endian number of cp */
+static int pk_get_param(const struct crparam *cp, struct pk_num *num)
+{
+	unsigned int len = DIV_ROUND_UP(cp->crp_nbits, 8), i;
+
+	if (unlikely(!cp->crp_nbits || cp->crp_nbits > PK_MAX_BITS))
+		return -EINVAL;
+
+	num->buf = kmalloc(len, GFP_KERNEL);
+	if (unlikely(!num->buf))
+		return -ENOMEM;
+	if (unlikely(copy_from_user(num->buf, (void __user *)cp->crp_p, len)))
+		return -EFAULT;
+
+	for (i = 0; i < len / 2; i++)
+		swap(num->buf[i], num->buf[len - 1 - i]);
+
+	num->p = num->buf;
+	num->len = len;
+	while (num->len && !*num->p) {
+		num->p++;
+		num->len--;
+	}
+	return 0;
+}
+
+/* Write the big endian number of len bytes at be to cp, little endian
+ * and padded to its crp_nbits */
+static int pk_put_param(const struct crparam *cp, const u8 *be,
+		unsigned int len)
+{
+	unsigned int size = DIV_ROUND_UP(cp->crp_nbits, 8), i;
+	u8 *buf;
+	int ret = 0;
+
+	while (len && !*be) {
+		be++;
+		len--;
+	}
+	if (unlikely(len > size || cp->crp_nbits > PK_MAX_BITS)) {
+		ddebug(1, "result of %u bytes does not fit %u bits", len,
+				cp->crp_nbits);
+		return -ENOSPC;
+	}
+
+	buf = kzalloc(size, GFP_KERNEL);
+	if (unlikely(!buf))
+		return -ENOMEM;
+	for (i = 0; i < len; i++)
+		buf[i] = be[len - 1 - i];
+	if (unlikely(copy_to_user((void __user *)cp->crp_p, buf, size)))
+		ret = -EFAULT;
+
+	kfree(buf);
+	return ret;
+}
+
+static unsigned int pk_der_len_size(unsigned int len)
+{
+	return len < 0x80 ? 1 : len < 0x100 ? 2 : 3;
+}
+
+static u8 *pk_der_len(u8 *p, unsigned int len)
+{
+	if (len >= 0x100) {
+		*p++ = 0x82;
+		*p++ = len >> 8;
+	} else if (len >= 0x80) {
+		*p++ = 0x81;
+	}
+	*p++ = len;
+	return p;
+}
+
+/* a positive INTEGER needs a zero in front of a set top bit */
+static inline unsigned int pk_der_int_len(const struct pk_num *num)
+{
+	return num->len + (!num->len || num->p[0] & 0x80);
+}
+
+static unsigned int pk_der_int_size(const struct pk_num *num)
+{
+	unsigned int len = pk_der_int_len(num);
+
+	return 1 + pk_der_len_size(len) + len;
+}
+
+static u8 *pk_der_int(u8 *p, const struct pk_num *num)
+{
+	unsigned int len = pk_der_int_len(num);
+
+	*p++ = 0x02;
+	p = pk_der_len(p, len);
+	if (len > num->len)
+		*p++ = 0;
+	memcpy(p, num->p, num->len);
+	return p + num->len;
+}
+
+/* base ^ exponent mod modulus, as the RSA public key operation with
+ * the key (modulus, exponent) */
+static int pk_mod_exp(struct crypt_kop *kop, struct pk_num *num)
+{
+	struct pk_num *base = &num[0], *exp = &num[1], *mod = &num[2];
+	unsigned int seqlen, keylen, outlen = mod->len;
+	u8 *key, *p, *out;
+	int ret;
+
+	seqlen = pk_der_int_size(mod) + pk_der_int_size(exp);
+	keylen = 1 + pk_der_len_size(seqlen) + seqlen;
+	key = kmalloc(keylen, GFP_KERNEL);
+	out = kmalloc(outlen, GFP_KERNEL);
+	if (unlikely(!key || !out)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* RSAPublicKey ::= SEQUENCE { modulus INTEGER, exponent INTEGER } */
+	p = key;
+	*p++ = 0x30;
+	p = pk_der_len(p, seqlen);
+	p = pk_der_int(p, mod);
+	pk_der_int(p, exp);
+
+	ret = cryptodev_rsa_encrypt(key, keylen, base->p, base->len, out,
+			&outlen);
+	if (likely(!ret))
+		ret = pk_put_param(&kop->crk_param[3], out, outlen);
+out:
+	kfree(out);
+	kfree(key);
+	return ret;
+}
+
+/* the shared secret of a private key and a peer's public value */
+static int pk_dh_compute_key(struct crypt_kop *kop, struct pk_num *num)
+{
+	struct pk_num *priv = &num[0], *pub = &num[1], *prime = &num[2];
+	/* only needed for the public value, which is not computed here */
+	static u8 generator = 2;
+	unsigned int outlen = prime->len;
+	struct dh params;
+	u8 *out;
+	int ret;
+
+	out = kmalloc(outlen, GFP_KERNEL);
+	if (unlikely(!out))
+		return -ENOMEM;
+
+	memset(&params, 0, sizeof(params));
+	params.key = priv->p;
+	params.key_size = priv->len;
+	params.p = prime->p;
+	params.p_size = prime->len;
+	params.g = &generator;
+	params.g_size = 1;
+
+	ret = cryptodev_dh_compute(&params, pub->p, pub->len, out, &outlen);
+	if (likely(!ret))
+		ret = pk_put_param(&kop->crk_param[3], out, outlen);
+
+	memzero_explicit(out, prime->len);
+	kfree(out);
+	return ret;
+}
+
+int cryptodev_pk_run(struct crypt_kop *kop)
+{
+	struct pk_num num[3];
+	unsigned int i;
+	int ret;
+
+	switch (kop->crk_op) {
+	case CRK_MOD_EXP:
+	case CRK_DH_COMPUTE_KEY:
+		break;
+	default:
+		ddebug(1, "unsupported public key operation %u", kop->crk_op);
+		return -EOPNOTSUPP;
+	}
+
+	/* both take three numbers and give one */
+	if (unlikely(kop->crk_iparams != ARRAY_SIZE(num) ||
+		     kop->crk_oparams != 1)) {
+		ddebug(1, "bad number of parameters: %u in, %u out",
+				kop->crk_iparams, kop->crk_oparams);
+		return -EINVAL;
+	}
+
+	memset(num, 0, sizeof(num));
+	for (i = 0; i < ARRAY_SIZE(num); i++) {
+		ret = pk_get_param(&kop->crk_param[i], &num[i]);
+		if (unlikely(ret))
+			goto out;
+	}
+
+	if (kop->crk_op == CRK_MOD_EXP)
+		ret = pk_mod_exp(kop, num);
+	else
+		ret = pk_dh_compute_key(kop, num);
+
+out:
+	for (i = 0; i < ARRAY_SIZE(num); i++) {
+		/* private keys and exponents */
+		if (num[i].buf)
+			memzero_explicit(num[i].buf,
+				DIV_ROUND_UP(kop->crk_param[i].crp_nbits, 8));
+		kfree(num[i].buf);
+	}
+	kop->crk_status = ret;
+	return ret;
+}
+
+/* the CRF_* of the operations there is an implementation for */
+__u32 cryptodev_pk_features(void)
+{
+	__u32 features = 0;
+
+	if (crypto_has_alg("rsa", CRYPTO_ALG_TYPE_AKCIPHER,
+			   CRYPTO_ALG_TYPE_MASK))
+		features |= CRF_MOD_EXP;
+	if (crypto_has_alg("dh", CRYPTO_ALG_TYPE_KPP, CRYPTO_ALG_TYPE_MASK))
+		features |= CRF_DH_COMPUTE_KEY;
+
+	return features;
+}
+
+#else
+
+int cryptodev_pk_run(struct crypt_kop *kop)
+{
+	return -EOPNOTSUPP;
+}
+
+__u32 cryptodev_pk_features(void)
+{
+	return 0;
+}
+
+#endif
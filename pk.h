@@ -0,0 +1,8 @@
+#ifndef PK_H
+# define PK_H
+
+/* Public key operations of CIOCKEY */
+int cryptodev_pk_run(struct crypt_kop *kop);
+__u32 cryptodev_pk_features(void);
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * This file handles the shared memory submission and completion
+ * rings of /dev/crypto.
+ */
+
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/poll.h>
+#include <crypto/cryptodev.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0))
+# include <linux/kthread.h>
+#else
+# include <linux/mmu_context.h>
+#endif
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0))
+# include <linux/sched/mm.h>
+#endif
+#include "cryptodev_int.h"
+#include "ring.h"
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0))
+# define use_mm kthread_use_mm
+# define unuse_mm kthread_unuse_mm
+#endif
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 11, 0))
+static inline void mmgrab(struct mm_struct *mm)
+{
+	atomic_inc(&mm->mm_count);
+}
+
+static inline bool mmget_not_zero(struct mm_struct *mm)
+{
+	return atomic_inc_not_zero(&mm->mm_users);
+}
+#endif
+
+/* Upper limit for the number of entries of either ring */
+#define MAX_RING_ENTRIES 4096
+
+struct crypt_ring {
+	struct crypt_ring_hdr *hdr;	/* start of the shared area */
+	struct crypt_ring_sqe *sqes;
+	struct crypt_ring_cqe *cqes;
+	size_t size;
+
+	/* The kernel's own copies of the ring geometry and of the indices
+	 * it owns; the shared ones may be overwritten by userspace. */
+	uint32_t sq_entries, cq_entries;
+	uint32_t sq_head, cq_tail;
+
+	struct fcrypt *fcr;
+	wait_queue_head_t *waiter;
+	struct workqueue_struct *wq;
+	struct work_struct work;
+
+	/* the address space the ring buffers were set up from */
+	struct mm_struct *mm;
+};
+
+/* the number of completion entries not yet reaped by userspace */
+static inline uint32_t ring_cq_pending(struct crypt_ring *ring)
+{
+	return READ_ONCE(ring->cq_tail) - READ_ONCE(ring->hdr->cq_head);
+}
+
+static void ring_run_sqe(struct crypt_ring *ring, struct crypt_ring_sqe *sqe,
+		struct crypt_ring_cqe *cqe)
+{
+	struct kernel_crypt_op kcop;
+	struct crypt_op *cop = &kcop.cop;
+	int ret;
+
+	memset(cop, 0, sizeof(*cop));
+	cop->ses = sqe->ses;
+	cop->op = sqe->op;
+	cop->flags = sqe->flags;
+	cop->len = sqe->len;
+	cop->src = u64_to_user_ptr(sqe->src);
+	cop->dst = u64_to_user_ptr(sqe->dst);
+
+	/* crypto_run() uses no more than the session's IV size */
+	kcop.ivlen = sizeof(kcop.iv);
+	memcpy(kcop.iv, sqe->iv, sizeof(kcop.iv));
+	kcop.digestsize = 0;
+	kcop.task = NULL;
+	kcop.mm = ring->mm;
+
+	ret = crypto_run(ring->fcr, &kcop);
+
+	cqe->user_data = sqe->user_data;
+	cqe->res = ret;
+	cqe->mac_len = ret ? 0 : kcop.digestsize;
+	memcpy(cqe->iv, kcop.iv, sizeof(cqe->iv));
+	if (cqe->mac_len)
+		memcpy(cqe->mac, kcop.hash_output, cqe->mac_len);
+}
+
+/* Consume the submission ring. This runs from the workqueue with the
+ * submitter's address space attached, so that the user buffers can be
+ * accessed just as from the ioctl. */
+static void cryptodev_ring_routine(struct work_struct *work)
+{
+	struct crypt_ring *ring = container_of(work, struct crypt_ring, work);
+	struct crypt_ring_hdr *hdr = ring->hdr;
+	struct crypt_ring_sqe sqe;
+	uint32_t tail;
+
+	if (unlikely(!mmget_not_zero(ring->mm)))
+		return;
+	use_mm(ring->mm);
+
+	for (;;) {
+		tail = smp_load_acquire(&hdr->sq_tail);
+		if (ring->sq_head == tail)
+			break;
+
+		if (unlikely(tail - ring->sq_head > ring->sq_entries)) {
+			derr(1, "invalid submission ring tail %u (head %u)",
+					tail, ring->sq_head);
+			break;
+		}
+
+		/* stop when there is no room left for the completion;
+		 * the next CIOCRINGENTER resumes from here */
+		if (ring_cq_pending(ring) >= ring->cq_entries)
+			break;
+
+		/* userspace may modify the entry at any time */
+		memcpy(&sqe, &ring->sqes[ring->sq_head & (ring->sq_entries - 1)],
+				sizeof(sqe));
+		smp_store_release(&hdr->sq_head, ++ring->sq_head);
+
+		ring_run_sqe(ring, &sqe,
+			&ring->cqes[ring->cq_tail & (ring->cq_entries - 1)]);
+		smp_store_release(&hdr->cq_tail, ++ring->cq_tail);
+
+		/* wake for POLLIN */
+		wake_up_interruptible(ring->waiter);
+		cond_resched();
+	}
+
+	unuse_mm(ring->mm);
+	mmput(ring->mm);
+}
+
+int cryptodev_ring_setup(struct crypt_ring **ringp, struct fcrypt *fcr,
+		wait_queue_head_t *waiter, struct workqueue_struct *wq,
+		struct crypt_ring_setup *rsp)
+{
+	struct crypt_ring *ring;
+	size_t sqes_off, cqes_off;
+
+	if (unlikely(rsp->flags || rsp->sq_entries == 0 ||
+		     rsp->sq_entries > MAX_RING_ENTRIES ||
+		     rsp->cq_entries > 2 * MAX_RING_ENTRIES))
+		return -EINVAL;
+
+	rsp->sq_entries = roundup_pow_of_two(rsp->sq_entries);
+	if (rsp->cq_entries == 0)
+		rsp->cq_entries = 2 * rsp->sq_entries;
+	else
+		rsp->cq_entries = roundup_pow_of_two(rsp->cq_entries);
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (unlikely(!ring))
+		return -ENOMEM;
+
+	sqes_off = ALIGN(sizeof(struct crypt_ring_hdr), 64);
+	cqes_off = ALIGN(sqes_off +
+			rsp->sq_entries * sizeof(struct crypt_ring_sqe), 64);
+	ring->size = PAGE_ALIGN(cqes_off +
+			rsp->cq_entries * sizeof(struct crypt_ring_cqe));
+
+	ring->hdr = vmalloc_user(ring->size);
+	if (unlikely(!ring->hdr)) {
+		kfree(ring);
+		return -ENOMEM;
+	}
+	ring->sqes = (void *)ring->hdr + sqes_off;
+	ring->cqes = (void *)ring->hdr + cqes_off;
+
+	ring->sq_entries = rsp->sq_entries;
+	ring->cq_entries = rsp->cq_entries;
+	ring->hdr->sq_entries = ring->sq_entries;
+	ring->hdr->sq_mask = ring->sq_entries - 1;
+	ring->hdr->cq_entries = ring->cq_entries;
+	ring->hdr->cq_mask = ring->cq_entries - 1;
+	ring->hdr->sqes = sqes_off;
+	ring->hdr->cqes = cqes_off;
+
+	ring->fcr = fcr;
+	ring->waiter = waiter;
+	ring->wq = wq;
+	INIT_WORK(&ring->work, cryptodev_ring_routine);
+
+	ring->mm = current->mm;
+	mmgrab(ring->mm);
+
+	/* only a single ring per file descriptor */
+	if (cmpxchg(ringp, NULL, ring) != NULL) {
+		mmdrop(ring->mm);
+		vfree(ring->hdr);
+		kfree(ring);
+		return -EBUSY;
+	}
+
+	rsp->size = ring->size;
+	ddebug(2, "ring set up with %u/%u entries, %zu bytes",
+			ring->sq_entries, ring->cq_entries, ring->size);
+	return 0;
+}
+
+int cryptodev_ring_enter(struct crypt_ring *ring, struct crypt_ring_enter *rep)
+{
+	uint32_t min_complete;
+
+	if (unlikely(!ring || rep->flags))
+		return -EINVAL;
+
+	if (unlikely(current->mm != ring->mm)) {
+		derr(1, "ring used from a foreign address space");
+		return -EINVAL;
+	}
+
+	queue_work(ring->wq, &ring->work);
+
+	min_complete = min(rep->min_complete, ring->cq_entries);
+	if (min_complete == 0)
+		return 0;
+
+	return wait_event_interruptible(*ring->waiter,
+			ring_cq_pending(ring) >= min_complete);
+}
+
+int cryptodev_ring_mmap(struct crypt_ring *ring, struct vm_area_struct *vma)
+{
+	if (unlikely(!ring || vma->vm_pgoff != 0))
+		return -EINVAL;
+
+	if (unlikely(vma->vm_end - vma->vm_start > ring->size))
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->hdr, 0);
+}
+
+unsigned int cryptodev_ring_poll(struct crypt_ring *ring)
+{
+	if (ring && ring_cq_pending(ring))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+void cryptodev_ring_free(struct crypt_ring *ring)
+{
+	if (!ring)
+		return;
+
+	cancel_work_sync(&ring->work);
+	mmdrop(ring->mm);
+	vfree(ring->hdr);
+	kfree(ring);
+}
@@ -0,0 +1,15 @@
+#ifndef RING_H
+# define RING_H
+
+/* Shared memory submission and completion rings */
+struct crypt_ring;
+
+int cryptodev_ring_setup(struct crypt_ring **ringp, struct fcrypt *fcr,
+		wait_queue_head_t *waiter, struct workqueue_struct *wq,
+		struct crypt_ring_setup *rsp);
+int cryptodev_ring_enter(struct crypt_ring *ring, struct crypt_ring_enter *rep);
+int cryptodev_ring_mmap(struct crypt_ring *ring, struct vm_area_struct *vma);
+unsigned int cryptodev_ring_poll(struct crypt_ring *ring);
+void cryptodev_ring_free(struct crypt_ring *ring);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * This file keeps the performance counters of /dev/crypto, per session
+ * and per driver, and exports the latter in debugfs/cryptodev/stats.
+ */
+
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/bitops.h>
+#include <crypto/cryptodev.h>
+#include "cryptodev_int.h"
+
+struct cryptodev_alg_stats cryptodev_global_stats = {
+	.name = "(none)",
+};
+
+/* the driver entries, including the global one */
+static LIST_HEAD(alg_stats_list);
+static DEFINE_MUTEX(alg_stats_lock);
+static struct dentry *stats_dir;
+
+static const char * const stat_names[CRYPTODEV_STAT_MAX] = {
+	[CRYPTODEV_STAT_OPS] = "ops",
+	[CRYPTODEV_STAT_BYTES] = "bytes",
+	[CRYPTODEV_STAT_ZC] = "zc",
+	[CRYPTODEV_STAT_BOUNCED] = "bounced",
+	[CRYPTODEV_STAT_ZC_FALLBACK] = "zc_fallback",
+	[CRYPTODEV_STAT_ZC_EDGES] = "zc_edges",
+	[CRYPTODEV_STAT_USERBUF_ERR] = "userbuf_err",
+	[CRYPTODEV_STAT_SG_REALLOC] = "sg_realloc",
+	[CRYPTODEV_STAT_ASYNC_QUEUED] = "async_queued",
+	[CRYPTODEV_STAT_ASYNC_BUSY] = "async_busy",
+};
+
+void cryptodev_stat_op(struct cryptodev_ses_stats *st, size_t len,
+		ktime_t start)
+{
+	s64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+	int bucket = us > 0 ? fls64(us) : 0;
+
+	if (bucket >= CRYPTO_STATS_LAT_BUCKETS)
+		bucket = CRYPTO_STATS_LAT_BUCKETS - 1;
+
+	cryptodev_stat_inc(st, CRYPTODEV_STAT_OPS);
+	cryptodev_stat_add(st, CRYPTODEV_STAT_BYTES, len);
+	atomic64_inc(&st->lat[bucket]);
+	this_cpu_inc(st->alg->pc->lat[bucket]);
+}
+
+/* Find or add the entry for the given drivers, either may be NULL.
+ * Sessions that can not get an entry of their own use the global one. */
+struct cryptodev_alg_stats *cryptodev_stats_get_alg(const char *cipher,
+		const char *hash)
+{
+	struct cryptodev_alg_stats *alg;
+	char name[sizeof(alg->name)];
+
+	snprintf(name, sizeof(name), "%s%s%s", cipher ? : "",
+			cipher && hash ? "+" : "", hash ? : "");
+
+	mutex_lock(&alg_stats_lock);
+	list_for_each_entry(alg, &alg_stats_list, entry) {
+		if (strcmp(alg->name, name) == 0)
+			goto out;
+	}
+
+	alg = kzalloc(sizeof(*alg), GFP_KERNEL);
+	if (unlikely(!alg)) {
+		alg = &cryptodev_global_stats;
+		goto out;
+	}
+	alg->pc = alloc_percpu(struct cryptodev_counters);
+	if (unlikely(!alg->pc)) {
+		kfree(alg);
+		alg = &cryptodev_global_stats;
+		goto out;
+	}
+	strcpy(alg->name, name);
+	list_add_tail(&alg->entry, &alg_stats_list);
+out:
+	mutex_unlock(&alg_stats_lock);
+	return alg;
+}
+
+static void alg_stats_sum(struct cryptodev_alg_stats *alg,
+		struct cryptodev_counters *sum)
+{
+	struct cryptodev_counters *pc;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		pc = per_cpu_ptr(alg->pc, cpu);
+		for (i = 0; i < CRYPTODEV_STAT_MAX; i++)
+			sum->v[i] += pc->v[i];
+		for (i = 0; i < CRYPTO_STATS_LAT_BUCKETS; i++)
+			sum->lat[i] += pc->lat[i];
+	}
+}
+
+/* fill in stop from the counters of st, or the totals if it is NULL */
+void cryptodev_stats_read(struct cryptodev_ses_stats *st,
+		struct crypt_stats_op *stop)
+{
+	struct cryptodev_counters sum;
+	struct cryptodev_alg_stats *alg;
+	int i;
+
+	memset(&sum, 0, sizeof(sum));
+	if (st) {
+		for (i = 0; i < CRYPTODEV_STAT_MAX; i++)
+			sum.v[i] = atomic64_read(&st->v[i]);
+		for (i = 0; i < CRYPTO_STATS_LAT_BUCKETS; i++)
+			sum.lat[i] = atomic64_read(&st->lat[i]);
+	} else {
+		mutex_lock(&alg_stats_lock);
+		list_for_each_entry(alg, &alg_stats_list, entry)
+			alg_stats_sum(alg, &sum);
+		mutex_unlock(&alg_stats_lock);
+	}
+
+	stop->ops = sum.v[CRYPTODEV_STAT_OPS];
+	stop->bytes = sum.v[CRYPTODEV_STAT_BYTES];
+	stop->zc_ops = sum.v[CRYPTODEV_STAT_ZC];
+	stop->bounced_ops = sum.v[CRYPTODEV_STAT_BOUNCED];
+	stop->zc_fallbacks = sum.v[CRYPTODEV_STAT_ZC_FALLBACK];
+	stop->userbuf_errors = sum.v[CRYPTODEV_STAT_USERBUF_ERR];
+	stop->sg_reallocs = sum.v[CRYPTODEV_STAT_SG_REALLOC];
+	stop->async_queued = sum.v[CRYPTODEV_STAT_ASYNC_QUEUED];
+	stop->async_busy = sum.v[CRYPTODEV_STAT_ASYNC_BUSY];
+	memcpy(stop->latency, sum.lat, sizeof(stop->latency));
+}
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	struct cryptodev_counters sum;
+	struct cryptodev_alg_stats *alg;
+	int i;
+
+	mutex_lock(&alg_stats_lock);
+	list_for_each_entry(alg, &alg_stats_list, entry) {
+		memset(&sum, 0, sizeof(sum));
+		alg_stats_sum(alg, &sum);
+
+		seq_printf(m, "%s:", alg->name);
+		for (i = 0; i < CRYPTODEV_STAT_MAX; i++)
+			seq_printf(m, " %s %llu", stat_names[i],
+					(unsigned long long)sum.v[i]);
+		seq_puts(m, "\n  latency_us:");
+		for (i = 0; i < CRYPTO_STATS_LAT_BUCKETS; i++)
+			seq_printf(m, " <%lu:%llu", 1UL << i,
+					(unsigned long long)sum.lat[i]);
+		seq_putc(m, '\n');
+	}
+	mutex_unlock(&alg_stats_lock);
+
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int cryptodev_stats_init(void)
+{
+	cryptodev_global_stats.pc = alloc_percpu(struct cryptodev_counters);
+	if (unlikely(!cryptodev_global_stats.pc))
+		return -ENOMEM;
+	list_add(&cryptodev_global_stats.entry, &alg_stats_list);
+
+	/* the counters work without debugfs, so errors are ignored */
+	stats_dir = debugfs_create_dir("cryptodev", NULL);
+	debugfs_create_file("stats", 0444, stats_dir, NULL, &stats_fops);
+
+	return 0;
+}
+
+void cryptodev_stats_exit(void)
+{
+	struct cryptodev_alg_stats *alg, *tmp;
+
+	debugfs_remove_recursive(stats_dir);
+
+	list_for_each_entry_safe(alg, tmp, &alg_stats_list, entry) {
+		list_del(&alg->entry);
+		free_percpu(alg->pc);
+		if (alg != &cryptodev_global_stats)
+			kfree(alg);
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef STATS_H
+# define STATS_H
+
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/crypto.h>
+#include <crypto/cryptodev.h>
+
+/* Performance counters, see CIOCGSTATS */
+enum cryptodev_stat {
+	CRYPTODEV_STAT_OPS,
+	CRYPTODEV_STAT_BYTES,
+	CRYPTODEV_STAT_ZC,
+	CRYPTODEV_STAT_BOUNCED,
+	CRYPTODEV_STAT_ZC_FALLBACK,
+	CRYPTODEV_STAT_ZC_EDGES,
+	CRYPTODEV_STAT_USERBUF_ERR,
+	CRYPTODEV_STAT_SG_REALLOC,
+	CRYPTODEV_STAT_ASYNC_QUEUED,
+	CRYPTODEV_STAT_ASYNC_BUSY,
+	CRYPTODEV_STAT_MAX
+};
+
+struct cryptodev_counters {
+	u64 v[CRYPTODEV_STAT_MAX];
+	u64 lat[CRYPTO_STATS_LAT_BUCKETS];
+};
+
+/* The counters of all sessions on a driver, or on a cipher and hash
+ * driver pair. Entries live until the module is unloaded. */
+struct cryptodev_alg_stats {
+	struct list_head entry;
+	struct cryptodev_counters __percpu *pc;
+	char name[2 * CRYPTO_MAX_ALG_NAME];
+};
+
+/* The counters of a session; updates also go to its driver's entry */
+struct cryptodev_ses_stats {
+	struct cryptodev_alg_stats *alg;
+	atomic64_t v[CRYPTODEV_STAT_MAX];
+	atomic64_t lat[CRYPTO_STATS_LAT_BUCKETS];
+};
+
+/* the entry for events without a session */
+extern struct cryptodev_alg_stats cryptodev_global_stats;
+
+static inline void cryptodev_stat_add(struct cryptodev_ses_stats *st,
+		enum cryptodev_stat id, u64 n)
+{
+	if (st) {
+		atomic64_add(n, &st->v[id]);
+		this_cpu_add(st->alg->pc->v[id], n);
+	} else {
+		this_cpu_add(cryptodev_global_stats.pc->v[id], n);
+	}
+}
+
+static inline void cryptodev_stat_inc(struct cryptodev_ses_stats *st,
+		enum cryptodev_stat id)
+{
+	cryptodev_stat_add(st, id, 1);
+}
+
+void cryptodev_stat_op(struct cryptodev_ses_stats *st, size_t len,
+		ktime_t start);
+struct cryptodev_alg_stats *cryptodev_stats_get_alg(const char *cipher,
+		const char *hash);
+void cryptodev_stats_read(struct cryptodev_ses_stats *st,
+		struct crypt_stats_op *stop);
+int cryptodev_stats_init(void);
+void cryptodev_stats_exit(void);
+
+#endif
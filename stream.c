@@ -0,0 +1,314 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * This file handles the streaming mode of /dev/crypto, in which data
+ * written to the descriptor is ciphered with the session bound to it
+ * and read back from it, or spliced in and out.
+ */
+
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
+#include <linux/scatterlist.h>
+#include <crypto/cryptodev.h>
+#include "cryptodev_int.h"
+#include "cryptlib.h"
+#include "stream.h"
+
+/* 64 KiB of buffer, fewer if that much is not available at once */
+#define STREAM_ORDER 4
+
+struct crypt_stream {
+	struct csession *ses;	/* referenced, not locked */
+	int encrypt;
+
+	/* the data between head and done has been ciphered and can be
+	 * read, the one between done and tail is short of a block */
+	char *buf;
+	unsigned int order;
+	uint32_t size;
+	uint32_t head, done, tail;	/* free running */
+	struct mutex lock;
+
+	wait_queue_head_t *waiter;
+};
+
+static inline uint32_t stream_readable(struct crypt_stream *stream)
+{
+	return READ_ONCE(stream->done) - READ_ONCE(stream->head);
+}
+
+static inline uint32_t stream_space(struct crypt_stream *stream)
+{
+	return stream->size -
+		(READ_ONCE(stream->tail) - READ_ONCE(stream->head));
+}
+
+/* The contiguous part of len bytes at free running index pos */
+static inline uint32_t stream_seg(struct crypt_stream *stream, uint32_t pos,
+		uint32_t len)
+{
+	return min(len, stream->size - (pos & (stream->size - 1)));
+}
+
+static inline char *stream_ptr(struct crypt_stream *stream, uint32_t pos)
+{
+	return stream->buf + (pos & (stream->size - 1));
+}
+
+/* Cipher the whole blocks written so far. Called with stream->lock held. */
+static int stream_process(struct crypt_stream *stream)
+{
+	struct cipher_data *cdata = &stream->ses->cdata;
+	struct scatterlist sg[2];
+	uint32_t len, first;
+	ktime_t start;
+	int ret;
+
+	len = stream->tail - stream->done;
+	len -= len % cdata->blocksize;
+	if (!len)
+		return 0;
+
+	/* at most two pieces, if the data wraps around the end */
+	first = stream_seg(stream, stream->done, len);
+	sg_init_table(sg, first < len ? 2 : 1);
+	sg_set_buf(&sg[0], stream_ptr(stream, stream->done), first);
+	if (first < len)
+		sg_set_buf(&sg[1], stream->buf, len - first);
+
+	/* the IV the session keeps chains the writes together */
+	mutex_lock(&stream->ses->sem);
+	start = ktime_get();
+	if (stream->encrypt)
+		ret = cryptodev_cipher_encrypt(cdata, sg, sg, len);
+	else
+		ret = cryptodev_cipher_decrypt(cdata, sg, sg, len);
+	mutex_unlock(&stream->ses->sem);
+	if (unlikely(ret)) {
+		derr(0, "CryptoAPI failure: %d", ret);
+		return ret;
+	}
+
+	cryptodev_stat_op(&stream->ses->stats, len, start);
+	smp_store_release(&stream->done, stream->done + len);
+	return 0;
+}
+
+ssize_t cryptodev_stream_write(struct crypt_stream *stream,
+		struct iov_iter *from, int nonblock)
+{
+	ssize_t written = 0;
+	size_t n, seg;
+	int ret;
+
+	if (unlikely(!stream))
+		return -EINVAL;
+
+	mutex_lock(&stream->lock);
+	while (iov_iter_count(from)) {
+		n = min_t(size_t, iov_iter_count(from), stream_space(stream));
+		if (!n) {
+			if (written)
+				break;
+			mutex_unlock(&stream->lock);
+			if (nonblock)
+				return -EAGAIN;
+			ret = wait_event_interruptible(*stream->waiter,
+					stream_space(stream));
+			if (unlikely(ret))
+				return ret;
+			mutex_lock(&stream->lock);
+			continue;
+		}
+
+		seg = stream_seg(stream, stream->tail, n);
+		seg = copy_from_iter(stream_ptr(stream, stream->tail), seg, from);
+		if (seg == stream_seg(stream, stream->tail, n) && seg < n)
+			seg += copy_from_iter(stream->buf, n - seg, from);
+		if (unlikely(!seg)) {
+			if (!written)
+				written = -EFAULT;
+			break;
+		}
+		stream->tail += seg;
+		written += seg;
+
+		ret = stream_process(stream);
+		if (unlikely(ret)) {
+			/* drop what could not be ciphered */
+			stream->tail = stream->done;
+			written = ret;
+			break;
+		}
+		wake_up(stream->waiter);
+		if (seg < n)
+			break;
+	}
+	mutex_unlock(&stream->lock);
+
+	return written;
+}
+
+ssize_t cryptodev_stream_read(struct crypt_stream *stream,
+		struct iov_iter *to, int nonblock)
+{
+	size_t n, seg;
+	int ret;
+
+	if (unlikely(!stream))
+		return -EINVAL;
+	if (!iov_iter_count(to))
+		return 0;
+
+	mutex_lock(&stream->lock);
+	while (!stream_readable(stream)) {
+		mutex_unlock(&stream->lock);
+		if (nonblock)
+			return -EAGAIN;
+		ret = wait_event_interruptible(*stream->waiter,
+				stream_readable(stream));
+		if (unlikely(ret))
+			return ret;
+		mutex_lock(&stream->lock);
+	}
+
+	n = min_t(size_t, iov_iter_count(to), stream_readable(stream));
+	seg = stream_seg(stream, stream->head, n);
+	seg = copy_to_iter(stream_ptr(stream, stream->head), seg, to);
+	if (seg == stream_seg(stream, stream->head, n) && seg < n)
+		seg += copy_to_iter(stream->buf, n - seg, to);
+	stream->head += seg;
+	mutex_unlock(&stream->lock);
+
+	if (unlikely(!seg))
+		return -EFAULT;
+
+	wake_up(stream->waiter);
+	return seg;
+}
+
+int cryptodev_stream_setup(struct crypt_stream **streamp, struct fcrypt *fcr,
+		wait_queue_head_t *waiter, struct crypt_stream_op *sop)
+{
+	struct crypt_stream *stream;
+	struct csession *ses_ptr;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	int ret;
+
+	if (unlikely(sop->flags ||
+		     (sop->op != COP_ENCRYPT && sop->op != COP_DECRYPT)))
+		return -EINVAL;
+
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (unlikely(!stream))
+		return -ENOMEM;
+
+	stream->order = STREAM_ORDER;
+	stream->buf = (char *)__get_free_pages(GFP_KERNEL | __GFP_NOWARN |
+			__GFP_NORETRY, stream->order);
+	if (unlikely(!stream->buf)) {
+		stream->order = 0;
+		stream->buf = (char *)__get_free_page(GFP_KERNEL);
+	}
+	if (unlikely(!stream->buf)) {
+		kfree(stream);
+		return -ENOMEM;
+	}
+	stream->size = PAGE_SIZE << stream->order;
+	stream->encrypt = sop->op == COP_ENCRYPT;
+	stream->waiter = waiter;
+	mutex_init(&stream->lock);
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, sop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", sop->ses);
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (unlikely(ses_ptr->cdata.init == 0 || ses_ptr->cdata.aead ||
+		     ses_ptr->hdata.init != 0)) {
+		derr(1, "only cipher sessions can be streamed");
+		crypto_put_session(ses_ptr);
+		ret = -EINVAL;
+		goto error;
+	}
+
+	if (sop->iv) {
+		if (unlikely(copy_from_user(iv, sop->iv,
+					    ses_ptr->cdata.ivsize))) {
+			crypto_put_session(ses_ptr);
+			ret = -EFAULT;
+			goto error;
+		}
+		cryptodev_cipher_set_iv(&ses_ptr->cdata, iv,
+				ses_ptr->cdata.ivsize);
+	}
+
+	/* keep the reference until the stream is freed */
+	mutex_unlock(&ses_ptr->sem);
+	stream->ses = ses_ptr;
+
+	/* only a single stream per file descriptor */
+	if (cmpxchg(streamp, NULL, stream) != NULL) {
+		ret = -EBUSY;
+		goto error;
+	}
+
+	ddebug(2, "stream set up on session 0x%08X with %u bytes",
+			sop->ses, stream->size);
+	return 0;
+
+error:
+	cryptodev_stream_free(stream);
+	return ret;
+}
+
+unsigned int cryptodev_stream_poll(struct crypt_stream *stream)
+{
+	unsigned int ret = 0;
+
+	if (!stream)
+		return 0;
+
+	if (stream_readable(stream))
+		ret |= POLLIN | POLLRDNORM;
+	if (stream_space(stream))
+		ret |= POLLOUT | POLLWRNORM;
+
+	return ret;
+}
+
+void cryptodev_stream_free(struct crypt_stream *stream)
+{
+	if (!stream)
+		return;
+
+	if (stream->ses)
+		crypto_release_session(stream->ses);
+	mutex_destroy(&stream->lock);
+	free_pages((unsigned long)stream->buf, stream->order);
+	kfree(stream);
+}
@@ -0,0 +1,16 @@
+#ifndef STREAM_H
+# define STREAM_H
+
+/* Ciphering of the data written to and read from the descriptor */
+struct crypt_stream;
+
+int cryptodev_stream_setup(struct crypt_stream **streamp, struct fcrypt *fcr,
+		wait_queue_head_t *waiter, struct crypt_stream_op *sop);
+ssize_t cryptodev_stream_write(struct crypt_stream *stream,
+		struct iov_iter *from, int nonblock);
+ssize_t cryptodev_stream_read(struct crypt_stream *stream,
+		struct iov_iter *to, int nonblock);
+unsigned int cryptodev_stream_poll(struct crypt_stream *stream);
+void cryptodev_stream_free(struct crypt_stream *stream);
+
+#endif
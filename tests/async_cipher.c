@@ -4,6 +4,7 @@
  * Placed under public domain.
  *
  */
+#include <errno.h>
 #include <poll.h>
 #include <stdio.h>
 #include <string.h>
@@ -283,6 +284,232 @@ static int test_aes(int cfd)
 	return 0;
 }
 
+#define	DEPTH	4
+
+/* no more jobs than the depth can be queued before they are fetched */
+static int
+test_depth(int cfd)
+{
+	static uint8_t data[DEPTH + 1][BLOCK_SIZE];
+	uint8_t iv[BLOCK_SIZE], key[KEY_SIZE];
+	struct session_op sess;
+	struct crypt_op cryp;
+	uint32_t depth;
+	int i;
+
+	if (debug) printf("running %s\n", __func__);
+
+	memset(key, 0x33, sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	depth = DEPTH;
+	if (ioctl(cfd, CIOCASYNCDEPTH, &depth)) {
+		perror("ioctl(CIOCASYNCDEPTH)");
+		return 1;
+	}
+	depth = 0;
+	if (ioctl(cfd, CIOCASYNCDEPTH, &depth) || depth != DEPTH) {
+		fprintf(stderr, "FAIL: queue depth is %u, not %d\n", depth, DEPTH);
+		return 1;
+	}
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = BLOCK_SIZE;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	for (i = 0; i < DEPTH; i++) {
+		cryp.src = cryp.dst = data[i];
+		if (ioctl(cfd, CIOCASYNCCRYPT, &cryp)) {
+			perror("ioctl(CIOCASYNCCRYPT)");
+			return 1;
+		}
+	}
+	cryp.src = cryp.dst = data[DEPTH];
+	if (ioctl(cfd, CIOCASYNCCRYPT, &cryp) == 0 || errno != EBUSY) {
+		fprintf(stderr, "FAIL: job beyond the queue depth was accepted\n");
+		return 1;
+	}
+
+	for (i = 0; i < DEPTH; i++)
+		if (do_async_fetch(cfd, &cryp))
+			return 1;
+
+	/* the limit of the module */
+	depth = UINT32_MAX;
+	if (ioctl(cfd, CIOCASYNCDEPTH, &depth) == 0) {
+		fprintf(stderr, "FAIL: queue depth %u was accepted\n", depth);
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+#define	LARGE_SIZE	(256 * 1024)	/* cut into chunks by the worker */
+
+/* a large job of a mode that does not chain through its IV gives the
+ * same result as CIOCCRYPT */
+static int
+test_xts(int cfd)
+{
+	static uint8_t data[LARGE_SIZE], expected[LARGE_SIZE];
+	uint8_t iv[BLOCK_SIZE], key[2 * KEY_SIZE];
+	struct session_op sess;
+	struct crypt_op cryp;
+
+	if (debug) printf("running %s\n", __func__);
+
+	memset(key, 0x37, sizeof(key));
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_XTS;
+	sess.keylen = sizeof(key);
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(data, 0x5a, sizeof(data));
+	memset(iv, 0x07, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = LARGE_SIZE;
+	cryp.src = data;
+	cryp.dst = expected;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	cryp.dst = data;
+	DO_OR_DIE(do_async_crypt(cfd, &cryp), 0);
+	DO_OR_DIE(do_async_fetch(cfd, &cryp), 0);
+
+	if (memcmp(data, expected, LARGE_SIZE) != 0) {
+		fprintf(stderr, "FAIL: asynchronous XTS differs from CIOCCRYPT\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* jobs queued with crypt_op64, as a 32-bit program would, are told
+ * apart by the structure CIOCASYNCFETCH64 fills in */
+static int
+test_crypto64(int cfd)
+{
+	static uint8_t data[2][DATA_SIZE], expected[2][DATA_SIZE];
+	uint8_t iv[2][BLOCK_SIZE], key[KEY_SIZE];
+	struct session_op sess;
+	struct crypt_op cryp;
+	struct crypt_op64 cop64;
+	struct pollfd pfd;
+	int i, done = 0;
+
+	if (debug) printf("running %s\n", __func__);
+
+	memset(key, 0x33, sizeof(key));
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		memset(data[i], 0x15 + i, DATA_SIZE);
+		memset(iv[i], 0x03 + i, BLOCK_SIZE);
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = data[i];
+		cryp.dst = expected[i];
+		cryp.iv = iv[i];
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		memset(&cop64, 0, sizeof(cop64));
+		cop64.ses = sess.ses;
+		cop64.len = DATA_SIZE;
+		cop64.src = cop64.dst = (uintptr_t)data[i];
+		cop64.iv = (uintptr_t)iv[i];
+		cop64.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCASYNCCRYPT64, &cop64)) {
+			perror("ioctl(CIOCASYNCCRYPT64)");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		pfd.fd = cfd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 1) {
+			perror("poll()");
+			return 1;
+		}
+
+		memset(&cop64, 0, sizeof(cop64));
+		if (ioctl(cfd, CIOCASYNCFETCH64, &cop64)) {
+			perror("ioctl(CIOCASYNCFETCH64)");
+			return 1;
+		}
+		if (cop64.ses != sess.ses || cop64.len != DATA_SIZE ||
+		    cop64.src != cop64.dst) {
+			fprintf(stderr, "FAIL: fetched crypt_op64 is not filled in\n");
+			return 1;
+		}
+		if (cop64.src == (uintptr_t)data[0])
+			done |= 1;
+		else if (cop64.src == (uintptr_t)data[1])
+			done |= 2;
+	}
+	if (done != 3) {
+		fprintf(stderr, "FAIL: fetched jobs are not the queued ones\n");
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (memcmp(data[i], expected[i], DATA_SIZE) != 0) {
+			fprintf(stderr, "FAIL: job %d differs from CIOCCRYPT\n", i);
+			return 1;
+		}
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
 int
 main(int argc, char** argv)
 {
@@ -316,6 +543,15 @@ main(int argc, char** argv)
 	if (test_crypto(cfd))
 		return 1;
 
+	if (test_depth(cfd))
+		return 1;
+
+	if (test_crypto64(cfd))
+		return 1;
+
+	if (test_xts(cfd))
+		return 1;
+
 	/* Close cloned descriptor */
 	if (close(cfd)) {
 		perror("close(cfd)");
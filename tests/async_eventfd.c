@@ -0,0 +1,271 @@
+/*
+ * Demo on how to be notified of completed asynchronous jobs of
+ * /dev/crypto device through an eventfd.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <crypto/cryptodev.h>
+
+#include "asynchelper.h"
+
+#ifdef ENABLE_ASYNC
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NJOBS		8
+#define	BULK_SIZE	(1024 * 1024)
+
+static int
+test_eventfd(int cfd)
+{
+	static uint8_t data[NJOBS][DATA_SIZE];
+	uint8_t iv[NJOBS][BLOCK_SIZE], key[KEY_SIZE];
+	struct session_op sess;
+	struct crypt_op cryp;
+	uint64_t count, done = 0;
+	int i, efd, nofd = -1;
+
+	memset(key, 0x33, sizeof(key));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	efd = eventfd(0, 0);
+	if (efd < 0) {
+		perror("eventfd");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCASYNCEVENTFD, &efd)) {
+		perror("ioctl(CIOCASYNCEVENTFD)");
+		return 1;
+	}
+
+	for (i = 0; i < NJOBS; i++) {
+		memset(data[i], i, DATA_SIZE);
+		memset(iv[i], 0x03, BLOCK_SIZE);
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = cryp.dst = data[i];
+		cryp.iv = iv[i];
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCASYNCCRYPT, &cryp)) {
+			perror("ioctl(CIOCASYNCCRYPT)");
+			return 1;
+		}
+	}
+
+	/* each read returns the jobs completed since the last one */
+	while (done < NJOBS) {
+		if (read(efd, &count, sizeof(count)) != sizeof(count)) {
+			perror("read(eventfd)");
+			return 1;
+		}
+		if (debug)
+			printf("%llu jobs completed\n", (unsigned long long)count);
+		done += count;
+	}
+	if (done != NJOBS) {
+		fprintf(stderr, "FAIL: %llu completions counted for %d jobs\n",
+			(unsigned long long)done, NJOBS);
+		return 1;
+	}
+
+	/* so they can all be fetched without waiting */
+	for (i = 0; i < NJOBS; i++) {
+		if (ioctl(cfd, CIOCASYNCFETCH, &cryp)) {
+			perror("ioctl(CIOCASYNCFETCH)");
+			return 1;
+		}
+	}
+
+	if (ioctl(cfd, CIOCASYNCEVENTFD, &nofd)) {
+		perror("ioctl(CIOCASYNCEVENTFD)");
+		return 1;
+	}
+	close(efd);
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* COP_FLAG_PRIO jobs need not wait for a bulk job of the same session
+ * queued before them; all of them give the same results as CIOCCRYPT */
+static int
+test_prio(int cfd)
+{
+	static uint8_t bulk[BULK_SIZE], expected[BULK_SIZE];
+	uint8_t data[NJOBS][DATA_SIZE], out[DATA_SIZE];
+	uint8_t iv[NJOBS][BLOCK_SIZE], tmp_iv[BLOCK_SIZE], key[KEY_SIZE];
+	struct session_op sess, twin;
+	struct crypt_op cryp;
+	int i, bulk_pos = -1;
+
+	memset(key, 0x44, sizeof(key));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	twin = sess;
+	if (ioctl(cfd, CIOCGSESSION, &sess) || ioctl(cfd, CIOCGSESSION, &twin)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* the bulk job chains the IV of the session, like the twin does */
+	memset(bulk, 0x5a, sizeof(bulk));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = twin.ses;
+	cryp.len = BULK_SIZE;
+	cryp.src = bulk;
+	cryp.dst = expected;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	cryp.ses = sess.ses;
+	cryp.dst = bulk;
+	if (ioctl(cfd, CIOCASYNCCRYPT, &cryp)) {
+		perror("ioctl(CIOCASYNCCRYPT)");
+		return 1;
+	}
+
+	for (i = 0; i < NJOBS; i++) {
+		memset(data[i], i, DATA_SIZE);
+		memset(iv[i], i, BLOCK_SIZE);
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = cryp.dst = data[i];
+		cryp.iv = iv[i];
+		cryp.op = COP_ENCRYPT;
+		cryp.flags = COP_FLAG_PRIO;
+		if (ioctl(cfd, CIOCASYNCCRYPT, &cryp)) {
+			perror("ioctl(CIOCASYNCCRYPT)");
+			return 1;
+		}
+	}
+
+	/* the order depends on how far the bulk job got */
+	for (i = 0; i <= NJOBS; i++) {
+		if (do_async_fetch(cfd, &cryp))
+			return 1;
+		if (cryp.len == BULK_SIZE)
+			bulk_pos = i;
+	}
+	if (debug)
+		printf("bulk job completed as %d of %d\n", bulk_pos + 1, NJOBS + 1);
+
+	if (bulk_pos < 0 || memcmp(bulk, expected, BULK_SIZE) != 0) {
+		fprintf(stderr, "FAIL: bulk job differs from CIOCCRYPT\n");
+		return 1;
+	}
+	for (i = 0; i < NJOBS; i++) {
+		memset(out, i, DATA_SIZE);
+		memset(tmp_iv, i, BLOCK_SIZE);
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = twin.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = cryp.dst = out;
+		cryp.iv = tmp_iv;
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		if (memcmp(out, data[i], DATA_SIZE) != 0) {
+			fprintf(stderr, "FAIL: priority job %d differs from CIOCCRYPT\n", i);
+			return 1;
+		}
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses) ||
+	    ioctl(cfd, CIOCFSESSION, &twin.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_eventfd(cfd) || test_prio(cfd))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
+#else
+int
+main(int argc, char** argv)
+{
+	return (0);
+}
+#endif
@@ -0,0 +1,520 @@
+/*  benchmark - throughput and latency benchmark for cryptodev
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Runs every algorithm /dev/crypto knows over a range of buffer sizes,
+ * from any number of threads spread over any number of descriptors,
+ * and reports operations per second, throughput and latency
+ * percentiles, either as a table or as JSON.
+ *
+ * With -T the measurements are repeated for 1, 2, 4... up to the given
+ * number of threads, which shows how the aggregate throughput scales
+ * and where the descriptor and session locks start to serialize. */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+
+#include <crypto/cryptodev.h>
+
+struct bench_alg {
+	const char *name;
+	int cipher;
+	int mac;
+	int keylen;
+	int mackeylen;
+	int ivlen;
+	int aead;
+};
+
+/* the algorithms of crypto_create_session() */
+static const struct bench_alg algs[] = {
+	{ "null",		CRYPTO_NULL,		0, 0, 0, 0, 0 },
+	{ "des-cbc",		CRYPTO_DES_CBC,		0, 8, 0, 8, 0 },
+	{ "3des-cbc",		CRYPTO_3DES_CBC,	0, 24, 0, 8, 0 },
+	{ "blowfish-cbc",	CRYPTO_BLF_CBC,		0, 16, 0, 8, 0 },
+	{ "aes-128-cbc",	CRYPTO_AES_CBC,		0, 16, 0, 16, 0 },
+	{ "aes-256-cbc",	CRYPTO_AES_CBC,		0, 32, 0, 16, 0 },
+	{ "aes-128-ecb",	CRYPTO_AES_ECB,		0, 16, 0, 0, 0 },
+	{ "aes-128-ctr",	CRYPTO_AES_CTR,		0, 16, 0, 16, 0 },
+	{ "aes-128-gcm",	CRYPTO_AES_GCM,		0, 16, 0, 12, 1 },
+	{ "camellia-128-cbc",	CRYPTO_CAMELLIA_CBC,	0, 16, 0, 16, 0 },
+	{ "md5",		0, CRYPTO_MD5,		0, 0, 0, 0 },
+	{ "rmd160",		0, CRYPTO_RIPEMD160,	0, 0, 0, 0 },
+	{ "sha1",		0, CRYPTO_SHA1,		0, 0, 0, 0 },
+	{ "sha224",		0, CRYPTO_SHA2_224,	0, 0, 0, 0 },
+	{ "sha256",		0, CRYPTO_SHA2_256,	0, 0, 0, 0 },
+	{ "sha384",		0, CRYPTO_SHA2_384,	0, 0, 0, 0 },
+	{ "sha512",		0, CRYPTO_SHA2_512,	0, 0, 0, 0 },
+	{ "hmac-md5",		0, CRYPTO_MD5_HMAC,	0, 16, 0, 0 },
+	{ "hmac-rmd160",	0, CRYPTO_RIPEMD160_HMAC, 0, 20, 0, 0 },
+	{ "hmac-sha1",		0, CRYPTO_SHA1_HMAC,	0, 20, 0, 0 },
+	{ "hmac-sha224",	0, CRYPTO_SHA2_224_HMAC, 0, 28, 0, 0 },
+	{ "hmac-sha256",	0, CRYPTO_SHA2_256_HMAC, 0, 32, 0, 0 },
+	{ "hmac-sha384",	0, CRYPTO_SHA2_384_HMAC, 0, 48, 0, 0 },
+	{ "hmac-sha512",	0, CRYPTO_SHA2_512_HMAC, 0, 64, 0, 0 },
+	{ "aes-128-cbc-hmac-sha1", CRYPTO_AES_CBC, CRYPTO_SHA1_HMAC, 16, 20, 16, 0 },
+};
+
+#define NALGS (sizeof(algs) / sizeof(algs[0]))
+
+/* latency samples kept per thread; later ones overwrite earlier ones */
+#define MAX_SAMPLES (1 << 18)
+
+/* room for the tag of AEAD ciphers */
+#define TAG_ROOM 64
+
+static struct {
+	int threads;
+	int fds;		/* zero for one per thread */
+	size_t min_size, max_size;
+	double duration;
+	int nozc;
+	int json;
+	int shared_ses;		/* threads on a descriptor share a session */
+	int scale;
+} opts = { 1, 1, 16, 4 << 20, 0.2, 0, 0, 0, 0 };
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	const struct bench_alg *alg;
+	size_t size;
+	uint32_t ses;
+	unsigned char *src, *dst;
+
+	uint64_t ops;
+	double elapsed;
+	double *lat;
+	size_t nlat;
+	int err;
+};
+
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_session(int fd, const struct bench_alg *alg, uint32_t *ses)
+{
+	static unsigned char key[64], mackey[64];
+	struct session_op sess;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33, sizeof(key));
+	memset(mackey, 0x44, sizeof(mackey));
+
+	sess.cipher = alg->cipher;
+	sess.keylen = alg->keylen;
+	sess.key = key;
+	sess.mac = alg->mac;
+	sess.mackeylen = alg->mackeylen;
+	sess.mackey = alg->mackeylen ? mackey : NULL;
+	if (ioctl(fd, CIOCGSESSION, &sess))
+		return -errno;
+
+	*ses = sess.ses;
+	return 0;
+}
+
+static int run_op(struct worker *w)
+{
+	unsigned char iv[32], mac[AALG_MAX_RESULT_LEN];
+	struct crypt_auth_op cao;
+	struct crypt_op cop;
+
+	memset(iv, 0x03, sizeof(iv));
+
+	if (w->alg->aead) {
+		/* always on the user pages, -n does not apply */
+		memset(&cao, 0, sizeof(cao));
+		cao.ses = w->ses;
+		cao.op = COP_ENCRYPT;
+		cao.len = w->size;
+		cao.src = w->src;
+		cao.dst = w->dst;
+		cao.iv = iv;
+		cao.iv_len = w->alg->ivlen;
+		return ioctl(w->fd, CIOCAUTHCRYPT, &cao);
+	}
+
+	memset(&cop, 0, sizeof(cop));
+	cop.ses = w->ses;
+	cop.op = COP_ENCRYPT;
+	cop.flags = opts.nozc ? COP_FLAG_NO_ZC : 0;
+	cop.len = w->size;
+	cop.src = w->src;
+	cop.dst = w->alg->cipher ? w->dst : NULL;
+	cop.iv = w->alg->ivlen ? iv : NULL;
+	cop.mac = w->alg->mac ? mac : NULL;
+	return ioctl(w->fd, CIOCCRYPT, &cop);
+}
+
+static void *worker_routine(void *arg)
+{
+	struct worker *w = arg;
+	double start, t0, t1;
+
+	pthread_barrier_wait(&barrier);
+
+	start = t1 = now();
+	do {
+		t0 = t1;
+		if (run_op(w)) {
+			w->err = errno;
+			break;
+		}
+		t1 = now();
+		w->lat[w->nlat++ % MAX_SAMPLES] = t1 - t0;
+		w->ops++;
+	} while (t1 - start < opts.duration);
+	w->elapsed = t1 - start;
+
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+struct result {
+	uint64_t ops;
+	double ops_per_sec, mb_per_sec;
+	double p50, p99, p999;	/* microseconds */
+};
+
+/* the sessions of the threads; shared ones belong to the first
+ * thread on each descriptor */
+static int open_sessions(struct worker *workers, int nthreads, int nfds)
+{
+	int i, ret;
+
+	for (i = 0; i < nthreads; i++) {
+		if (opts.shared_ses && i >= nfds) {
+			workers[i].ses = workers[i % nfds].ses;
+			continue;
+		}
+		ret = open_session(workers[i].fd, workers[i].alg, &workers[i].ses);
+		if (ret) {
+			while (i-- > 0)
+				if (!opts.shared_ses || i < nfds)
+					ioctl(workers[i].fd, CIOCFSESSION,
+						&workers[i].ses);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* run alg with buffers of size from nthreads threads at once, which
+ * use the first nfds descriptors in turn */
+static int bench(int *fds, int nthreads, int nfds, struct worker *workers,
+		const struct bench_alg *alg, size_t size, struct result *res)
+{
+	double elapsed = 0, *all;
+	size_t nall = 0, n;
+	int i, ret = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		struct worker *w = &workers[i];
+
+		w->fd = fds[i % nfds];
+		w->alg = alg;
+		w->size = size;
+		w->ops = w->nlat = 0;
+		w->err = 0;
+	}
+	ret = open_sessions(workers, nthreads, nfds);
+	if (ret)
+		return ret;
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&workers[i].thread, NULL, worker_routine,
+				&workers[i]);
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].thread, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	memset(res, 0, sizeof(*res));
+	for (i = 0; i < nthreads; i++) {
+		struct worker *w = &workers[i];
+
+		if (!opts.shared_ses || i < nfds)
+			ioctl(w->fd, CIOCFSESSION, &w->ses);
+		if (w->err)
+			ret = -w->err;
+		res->ops += w->ops;
+		if (w->elapsed > elapsed)
+			elapsed = w->elapsed;
+		nall += w->nlat < MAX_SAMPLES ? w->nlat : MAX_SAMPLES;
+	}
+	if (ret || nall == 0)
+		return ret ? ret : -EIO;
+
+	all = malloc(nall * sizeof(double));
+	if (!all)
+		return -ENOMEM;
+	for (nall = 0, i = 0; i < nthreads; i++) {
+		n = workers[i].nlat < MAX_SAMPLES ? workers[i].nlat : MAX_SAMPLES;
+		memcpy(all + nall, workers[i].lat, n * sizeof(double));
+		nall += n;
+	}
+	qsort(all, nall, sizeof(double), cmp_double);
+
+	res->ops_per_sec = res->ops / elapsed;
+	res->mb_per_sec = res->ops * (double)size / elapsed / 1e6;
+	res->p50 = all[nall / 2] * 1e6;
+	res->p99 = all[(size_t)(nall * 0.99)] * 1e6;
+	res->p999 = all[(size_t)(nall * 0.999)] * 1e6;
+	free(all);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	size_t i;
+
+	fprintf(stderr,
+		"Usage: %s [-a alg] [-t threads] [-f fds] [-m min] [-M max]\n"
+		"          [-d seconds] [-s] [-T] [-n] [-j]\n"
+		"  -a alg      run only this algorithm (default: all)\n"
+		"  -t threads  number of threads (default: 1)\n"
+		"  -f fds      number of descriptors shared by the threads, 0 for one\n"
+		"              per thread (default: 1)\n"
+		"  -s          threads on the same descriptor share one session\n"
+		"  -T          repeat with 1, 2, 4... threads up to -t and report the\n"
+		"              speedup over a single thread\n"
+		"  -m, -M      smallest and largest buffer size (default: 16 and 4194304)\n"
+		"  -d seconds  duration of each measurement (default: 0.2)\n"
+		"  -n          disable zero copy with COP_FLAG_NO_ZC; AEAD algorithms\n"
+		"              always run on the user pages and are marked with *\n"
+		"  -j          print the results as JSON\n"
+		"Algorithms:", prog);
+	for (i = 0; i < NALGS; i++)
+		fprintf(stderr, " %s", algs[i].name);
+	fprintf(stderr, "\n");
+}
+
+static void print_result(const struct bench_alg *alg, size_t size,
+		int nthreads, int nfds, const struct result *res, double base,
+		int first)
+{
+	/* CIOCAUTHCRYPT has no COP_FLAG_NO_ZC */
+	int zc = !opts.nozc || alg->aead;
+
+	if (opts.json) {
+		printf("%s\n    { \"algorithm\": \"%s\", \"size\": %zu, "
+			"\"threads\": %d, \"fds\": %d, "
+			"\"ops\": %llu, \"ops_per_sec\": %.1f, "
+			"\"mb_per_sec\": %.3f, \"zc\": %s, ",
+			first ? "" : ",", alg->name, size, nthreads, nfds,
+			(unsigned long long)res->ops, res->ops_per_sec,
+			res->mb_per_sec, zc ? "true" : "false");
+		if (opts.scale && base > 0)
+			printf("\"speedup\": %.2f, ", res->ops_per_sec / base);
+		printf("\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f }",
+			res->p50, res->p99, res->p999);
+	} else {
+		printf("%-21s%c %9zu %4d %4d %12.0f %10.2f", alg->name,
+			zc && opts.nozc ? '*' : ' ', size, nthreads, nfds,
+			res->ops_per_sec, res->mb_per_sec);
+		if (opts.scale)
+			printf(" %7.2f", base > 0 ? res->ops_per_sec / base : 0.0);
+		printf(" %10.1f %10.1f %10.1f\n", res->p50, res->p99, res->p999);
+	}
+	fflush(stdout);
+}
+
+/* the number of descriptors used by nthreads threads */
+static int nfds_for(int nthreads)
+{
+	if (opts.fds == 0 || opts.fds > nthreads)
+		return nthreads;
+	return opts.fds;
+}
+
+/* the thread counts to measure with, 1, 2, 4... and the maximum */
+static int next_threads(int nthreads)
+{
+	if (nthreads == 0)
+		return opts.scale ? 1 : opts.threads;
+	if (nthreads >= opts.threads)
+		return 0;
+	return nthreads * 2 < opts.threads ? nthreads * 2 : opts.threads;
+}
+
+int main(int argc, char **argv)
+{
+	const char *only = NULL;
+	struct worker *workers;
+	struct result res;
+	struct utsname uts;
+	int *fds, i, c, first = 1, ret, nthreads, nfds;
+	double base;
+	size_t a, size;
+
+	while ((c = getopt(argc, argv, "a:t:f:m:M:d:sTnjh")) != -1) {
+		switch (c) {
+		case 'a':
+			only = optarg;
+			break;
+		case 't':
+			opts.threads = atoi(optarg);
+			break;
+		case 'f':
+			opts.fds = atoi(optarg);
+			break;
+		case 'm':
+			opts.min_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			opts.max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			opts.duration = atof(optarg);
+			break;
+		case 's':
+			opts.shared_ses = 1;
+			break;
+		case 'T':
+			opts.scale = 1;
+			break;
+		case 'n':
+			opts.nozc = 1;
+			break;
+		case 'j':
+			opts.json = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (opts.threads < 1 || opts.fds < 0 || opts.min_size < 1 ||
+	    opts.max_size < opts.min_size) {
+		usage(argv[0]);
+		return 1;
+	}
+	opts.fds = nfds_for(opts.threads);
+
+	fds = calloc(opts.fds, sizeof(int));
+	workers = calloc(opts.threads, sizeof(struct worker));
+	if (!fds || !workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (i = 0; i < opts.fds; i++) {
+		fds[i] = open("/dev/crypto", O_RDWR, 0);
+		if (fds[i] < 0) {
+			perror("open(/dev/crypto)");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < opts.threads; i++) {
+		struct worker *w = &workers[i];
+
+		w->lat = malloc(MAX_SAMPLES * sizeof(double));
+		if (!w->lat || posix_memalign((void **)&w->src, 4096, opts.max_size) ||
+		    posix_memalign((void **)&w->dst, 4096, opts.max_size + TAG_ROOM)) {
+			perror("malloc");
+			return 1;
+		}
+		memset(w->src, 0x15, opts.max_size);
+	}
+
+	if (opts.json) {
+		uname(&uts);
+		printf("{\n  \"kernel\": \"%s\",\n  \"machine\": \"%s\",\n"
+			"  \"threads\": %d,\n  \"fds\": %d,\n"
+			"  \"shared_sessions\": %s,\n  \"zc\": %s,\n"
+			"  \"duration\": %g,\n  \"results\": [",
+			uts.release, uts.machine, opts.threads, opts.fds,
+			opts.shared_ses ? "true" : "false",
+			opts.nozc ? "false" : "true", opts.duration);
+	} else {
+		printf("%-22s %9s %4s %4s %12s %10s", "algorithm", "size",
+			"thr", "fds", "ops/s", "MB/s");
+		if (opts.scale)
+			printf(" %7s", "speedup");
+		printf(" %10s %10s %10s\n", "p50 us", "p99 us", "p999 us");
+	}
+
+	for (a = 0; a < NALGS; a++) {
+		const struct bench_alg *alg = &algs[a];
+
+		if (only && strcmp(only, alg->name))
+			continue;
+
+		/* skip what this kernel does not support */
+		if (open_session(fds[0], alg, &workers[0].ses)) {
+			if (!opts.json)
+				printf("%-22s not available\n", alg->name);
+			continue;
+		}
+		ioctl(fds[0], CIOCFSESSION, &workers[0].ses);
+
+		for (size = opts.min_size; size <= opts.max_size; size *= 2) {
+			base = 0;
+			for (nthreads = next_threads(0); nthreads;
+			     nthreads = next_threads(nthreads)) {
+				nfds = nfds_for(nthreads);
+				ret = bench(fds, nthreads, nfds, workers, alg,
+						size, &res);
+				if (ret) {
+					fprintf(stderr, "%s with %zu bytes and %d threads: %s\n",
+						alg->name, size, nthreads,
+						strerror(-ret));
+					continue;
+				}
+				if (nthreads == 1)
+					base = res.ops_per_sec;
+
+				print_result(alg, size, nthreads, nfds, &res,
+						base, first);
+				first = 0;
+			}
+		}
+	}
+
+	if (opts.json)
+		printf("\n  ]\n}\n");
+
+	for (i = 0; i < opts.fds; i++)
+		close(fds[i]);
+
+	return 0;
+}
@@ -516,6 +516,179 @@ test_encrypt_decrypt_error(int cfd, int err)
 	return 1;
 }
 
+/* A burst of packets across a sequence number wrap, with the IVs and
+ * rollover counter handled by the session */
+#define	RTP_HEADER	12
+#define	RTP_PAYLOAD	160
+#define	RTP_PACKET	(RTP_HEADER + RTP_PAYLOAD)
+#define	NPACKETS	4
+#define	SRTP_TAG	10
+
+static int
+srtp_session(int cfd, uint8_t *key, uint8_t *mackey, uint8_t *salt,
+		uint32_t *ses)
+{
+	struct session_op sess;
+	struct crypt_srtp_op srop;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CTR;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.mac = CRYPTO_SHA1_HMAC;
+	sess.mackeylen = 16;
+	sess.mackey = mackey;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(&srop, 0, sizeof(srop));
+	srop.ses = sess.ses;
+	memcpy(srop.salt, salt, sizeof(srop.salt));
+	if (ioctl(cfd, CIOCSRTPSETUP, &srop)) {
+		perror("ioctl(CIOCSRTPSETUP)");
+		return 1;
+	}
+
+	*ses = sess.ses;
+	return 0;
+}
+
+static int
+test_srtp_index(int cfd)
+{
+	static const uint16_t seqs[NPACKETS] = { 65534, 65535, 0, 1 };
+	uint8_t packets[NPACKETS][RTP_PACKET], orig[NPACKETS][RTP_PACKET];
+	uint8_t tags[NPACKETS][SRTP_TAG];
+	uint8_t expected[RTP_PACKET + 4], mac[MAC_SIZE];
+	uint8_t key[KEY_SIZE], salt[14], iv[BLOCK_SIZE];
+	uint8_t mackey[] = "\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d\x0d";
+	struct crypt_auth_op cao[NPACKETS];
+	struct crypt_multi_op mop;
+	struct session_op plain;
+	struct crypt_op co;
+	uint32_t ses, dec_ses, roc;
+	int status[NPACKETS];
+	int i, j;
+
+	memset(key, 0x5a, sizeof(key));
+	memset(salt, 0xa5, sizeof(salt));
+	if (srtp_session(cfd, key, mackey, salt, &ses) ||
+	    srtp_session(cfd, key, mackey, salt, &dec_ses))
+		return 1;
+
+	memset(cao, 0, sizeof(cao));
+	for (i = 0; i < NPACKETS; i++) {
+		memset(packets[i], 0x30 + i, RTP_PACKET);
+		packets[i][0] = 0x80;
+		packets[i][2] = seqs[i] >> 8;
+		packets[i][3] = seqs[i];
+		memcpy(&packets[i][8], "\x12\x34\x56\x78", 4);
+		memcpy(orig[i], packets[i], RTP_PACKET);
+
+		cao[i].ses = ses;
+		cao[i].len = RTP_PAYLOAD;
+		cao[i].auth_len = RTP_PACKET;
+		cao[i].auth_src = packets[i];
+		cao[i].src = packets[i] + RTP_HEADER;
+		cao[i].dst = cao[i].src;
+		cao[i].tag = tags[i];
+		cao[i].tag_len = SRTP_TAG;
+		cao[i].op = COP_ENCRYPT;
+		cao[i].flags = COP_FLAG_AEAD_SRTP_TYPE | COP_FLAG_SRTP_INDEX;
+	}
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = NPACKETS;
+	mop.ops = cao;
+	mop.status = status;
+	if (ioctl(cfd, CIOCAUTHCRYPT_MULTI, &mop)) {
+		perror("ioctl(CIOCAUTHCRYPT_MULTI)");
+		return 1;
+	}
+
+	/* check each packet against its IV and MAC computed here */
+	memset(&plain, 0, sizeof(plain));
+	plain.cipher = CRYPTO_AES_CTR;
+	plain.keylen = KEY_SIZE;
+	plain.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &plain)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < NPACKETS; i++) {
+		if (status[i]) {
+			fprintf(stderr, "FAIL: packet %d: %d\n", i, status[i]);
+			return 1;
+		}
+
+		roc = seqs[i] < seqs[0] ? 1 : 0;
+		memcpy(iv, salt, sizeof(salt));
+		iv[14] = iv[15] = 0;
+		for (j = 0; j < 4; j++) {
+			iv[4 + j] ^= orig[i][8 + j];
+			iv[8 + j] ^= roc >> (24 - 8 * j);
+		}
+		iv[12] ^= seqs[i] >> 8;
+		iv[13] ^= seqs[i];
+
+		memcpy(expected, orig[i], RTP_PACKET);
+		memset(&co, 0, sizeof(co));
+		co.ses = plain.ses;
+		co.len = RTP_PAYLOAD;
+		co.src = orig[i] + RTP_HEADER;
+		co.dst = expected + RTP_HEADER;
+		co.iv = iv;
+		co.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &co)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		for (j = 0; j < 4; j++)
+			expected[RTP_PACKET + j] = roc >> (24 - 8 * j);
+
+		if (get_sha1_hmac(cfd, mackey, 16, expected, RTP_PACKET + 4, mac))
+			return 1;
+
+		if (memcmp(expected, packets[i], RTP_PACKET) != 0 ||
+		    memcmp(mac, tags[i], SRTP_TAG) != 0) {
+			fprintf(stderr, "FAIL: packet %d (ROC %u) differs\n", i, roc);
+			return 1;
+		}
+	}
+
+	/* and the other side follows the rollover counter as well */
+	for (i = 0; i < NPACKETS; i++) {
+		cao[i].ses = dec_ses;
+		cao[i].op = COP_DECRYPT;
+	}
+	if (ioctl(cfd, CIOCAUTHCRYPT_MULTI, &mop)) {
+		perror("ioctl(CIOCAUTHCRYPT_MULTI)");
+		return 1;
+	}
+	for (i = 0; i < NPACKETS; i++) {
+		if (status[i] || memcmp(orig[i], packets[i], RTP_PACKET) != 0) {
+			fprintf(stderr, "FAIL: packet %d does not decrypt: %d\n",
+				i, status[i]);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("SRTP index test passed\n");
+
+	if (ioctl(cfd, CIOCFSESSION, &ses) ||
+	    ioctl(cfd, CIOCFSESSION, &dec_ses) ||
+	    ioctl(cfd, CIOCFSESSION, &plain.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
 int
 main(int argc, char** argv)
 {
@@ -556,6 +729,9 @@ main(int argc, char** argv)
 	if (test_encrypt_decrypt_error(cfd,1))
 		return 1;
 
+	if (test_srtp_index(cfd))
+		return 1;
+
 	/* Close cloned descriptor */
 	if (close(cfd)) {
 		perror("close(cfd)");
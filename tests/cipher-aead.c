@@ -520,6 +520,112 @@ test_encrypt_decrypt_error(int cfd, int err)
 	return 1;
 }
 
+/* Records encrypted with one CIOCAUTHCRYPT_MULTI must be the same as
+ * with a CIOCAUTHCRYPT each */
+#define	NRECORDS	5
+#define	RECORD_SIZE	(2*1024 + 3)
+#define	TLS_AUTH_SIZE	13
+#define	RECORD_SPACE	(RECORD_SIZE + MAC_SIZE + BLOCK_SIZE)
+
+static int
+test_tls_batch(int cfd)
+{
+	static uint8_t batch[NRECORDS][RECORD_SPACE];
+	static uint8_t single[NRECORDS][RECORD_SPACE];
+	uint8_t iv[NRECORDS][BLOCK_SIZE], iv2[BLOCK_SIZE];
+	uint8_t auth[NRECORDS][TLS_AUTH_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct crypt_auth_op cao[NRECORDS];
+	struct crypt_multi_op mop;
+	struct session_op sess;
+	int status[NRECORDS];
+	int i;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x27, sizeof(key));
+
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.mac = CRYPTO_SHA1_HMAC;
+	sess.mackeylen = 16;
+	sess.mackey = (uint8_t *)"\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c\x0c";
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* records of different lengths, each with its own header and IV */
+	memset(cao, 0, sizeof(cao));
+	for (i = 0; i < NRECORDS; i++) {
+		memset(batch[i], 0x40 + i, RECORD_SIZE);
+		memcpy(single[i], batch[i], RECORD_SIZE);
+		memset(auth[i], i, TLS_AUTH_SIZE);
+		memset(iv[i], 0x80 + i, BLOCK_SIZE);
+
+		cao[i].ses = sess.ses;
+		cao[i].auth_src = auth[i];
+		cao[i].auth_len = TLS_AUTH_SIZE;
+		cao[i].len = RECORD_SIZE - i * 100;
+		cao[i].src = batch[i];
+		cao[i].dst = batch[i];
+		cao[i].iv = iv[i];
+		cao[i].op = COP_ENCRYPT;
+		cao[i].flags = COP_FLAG_AEAD_TLS_TYPE;
+	}
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = NRECORDS;
+	mop.ops = cao;
+	mop.status = status;
+	if (ioctl(cfd, CIOCAUTHCRYPT_MULTI, &mop)) {
+		perror("ioctl(CIOCAUTHCRYPT_MULTI)");
+		return 1;
+	}
+
+	for (i = 0; i < NRECORDS; i++) {
+		struct crypt_auth_op one;
+
+		if (status[i]) {
+			fprintf(stderr, "FAIL: record %d: %d\n", i, status[i]);
+			return 1;
+		}
+
+		memset(&one, 0, sizeof(one));
+		memset(iv2, 0x80 + i, BLOCK_SIZE);
+		one.ses = sess.ses;
+		one.auth_src = auth[i];
+		one.auth_len = TLS_AUTH_SIZE;
+		one.len = RECORD_SIZE - i * 100;
+		one.src = single[i];
+		one.dst = single[i];
+		one.iv = iv2;
+		one.op = COP_ENCRYPT;
+		one.flags = COP_FLAG_AEAD_TLS_TYPE;
+		if (ioctl(cfd, CIOCAUTHCRYPT, &one)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return 1;
+		}
+
+		if (one.len != cao[i].len ||
+		    memcmp(single[i], batch[i], one.len) != 0) {
+			fprintf(stderr,
+				"FAIL: batched record %d differs from a single one\n", i);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("TLS batch test passed\n");
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
 int
 main()
 {
@@ -558,6 +664,9 @@ main()
 	if (test_encrypt_decrypt_error(cfd, 1))
 		return 1;
 
+	if (test_tls_batch(cfd))
+		return 1;
+
 	/* Close cloned descriptor */
 	if (close(cfd)) {
 		perror("close(cfd)");
@@ -0,0 +1,392 @@
+/*
+ * Demo on how to choose the implementation of the algorithms of a
+ * /dev/crypto session, how to spread it over several of them and how
+ * to poll for them.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	KEY_SIZE	16
+#define	BLOCK_SIZE	16
+#define	DATA_SIZE	4096
+#define	NENGINES	4
+
+static int
+get_session(int cfd, const char *driver, uint32_t flags, uint32_t *ses)
+{
+	struct session2_op sess;
+	static uint8_t key[KEY_SIZE];
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.flags = flags;
+	if (driver)
+		strncpy(sess.cipher_driver, driver,
+			sizeof(sess.cipher_driver) - 1);
+	if (ioctl(cfd, CIOCGSESSION2, &sess))
+		return -1;
+
+	*ses = sess.ses;
+	return 0;
+}
+
+static int
+get_info(int cfd, uint32_t ses, struct session_info_op *siop)
+{
+	memset(siop, 0, sizeof(*siop));
+	siop->ses = ses;
+	if (ioctl(cfd, CIOCGSESSINFO, siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_driver(int cfd)
+{
+	struct session_info_op siop;
+	struct session_op hsess;
+	char driver[CRYPTODEV_MAX_ALG_NAME];
+	uint32_t ses;
+
+	/* whatever the crypto API picks, asked for by name */
+	if (get_session(cfd, NULL, 0, &ses)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	if (get_info(cfd, ses, &siop))
+		return 1;
+	ioctl(cfd, CIOCFSESSION, &ses);
+	strcpy(driver, siop.cipher_info.cra_driver_name);
+	if (debug)
+		printf("default driver: %s\n", driver);
+
+	if (get_session(cfd, driver, 0, &ses)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	if (get_info(cfd, ses, &siop))
+		return 1;
+	if (strcmp(siop.cipher_info.cra_driver_name, driver)) {
+		fprintf(stderr, "FAIL: got driver %s instead of %s\n",
+			siop.cipher_info.cra_driver_name, driver);
+		return 1;
+	}
+	ioctl(cfd, CIOCFSESSION, &ses);
+
+	/* the driver of another algorithm */
+	memset(&hsess, 0, sizeof(hsess));
+	hsess.mac = CRYPTO_SHA2_256;
+	if (ioctl(cfd, CIOCGSESSION, &hsess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+	if (get_info(cfd, hsess.ses, &siop))
+		return 1;
+	ioctl(cfd, CIOCFSESSION, &hsess.ses);
+	if (get_session(cfd, siop.hash_info.cra_driver_name, 0, &ses) == 0) {
+		fprintf(stderr, "FAIL: AES session with driver %s\n",
+			siop.hash_info.cra_driver_name);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_preference(int cfd)
+{
+	struct session_info_op siop;
+	uint32_t ses;
+
+	/* there is always a software implementation */
+	if (get_session(cfd, NULL, SES_FLAG_SW_ONLY, &ses)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	if (get_info(cfd, ses, &siop))
+		return 1;
+	if (siop.flags & SIOP_FLAG_KERNEL_DRIVER_ONLY) {
+		fprintf(stderr, "FAIL: got hardware driver %s\n",
+			siop.cipher_info.cra_driver_name);
+		return 1;
+	}
+	ioctl(cfd, CIOCFSESSION, &ses);
+
+	/* but not always a hardware one */
+	if (get_session(cfd, NULL, SES_FLAG_HW_ONLY, &ses) == 0) {
+		if (get_info(cfd, ses, &siop))
+			return 1;
+		if (!(siop.flags & SIOP_FLAG_KERNEL_DRIVER_ONLY)) {
+			fprintf(stderr, "FAIL: got software driver %s\n",
+				siop.cipher_info.cra_driver_name);
+			return 1;
+		}
+		if (debug)
+			printf("hardware driver: %s\n",
+			       siop.cipher_info.cra_driver_name);
+		ioctl(cfd, CIOCFSESSION, &ses);
+	} else if (debug)
+		printf("no hardware driver\n");
+
+	if (get_session(cfd, NULL, SES_FLAG_SW_ONLY | SES_FLAG_HW_ONLY,
+			&ses) == 0) {
+		fprintf(stderr, "FAIL: both hardware and software only\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+encrypt(int cfd, uint32_t ses, uint8_t *in, uint8_t *out, uint8_t *iv)
+{
+	struct crypt_op cryp;
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = in;
+	cryp.dst = out;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+/* operations spread over several transforms give the same results */
+static int
+test_engines(int cfd)
+{
+	static uint8_t in[DATA_SIZE], out[DATA_SIZE], expected[DATA_SIZE];
+	uint8_t iv[BLOCK_SIZE], key[KEY_SIZE];
+	struct session2_op sess;
+	struct session_op skey;
+	uint32_t ses;
+	int i;
+
+	memset(in, 0x5a, sizeof(in));
+	memset(key, 0x11, sizeof(key));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.engines = NENGINES;
+	if (ioctl(cfd, CIOCGSESSION2, &sess)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+
+	/* the reference, with a single transform and the new key */
+	memset(key, 0x22, sizeof(key));
+	if (get_session(cfd, NULL, 0, &ses))
+		return 1;
+	memset(&skey, 0, sizeof(skey));
+	skey.ses = ses;
+	skey.keylen = KEY_SIZE;
+	skey.key = key;
+	if (ioctl(cfd, CIOCSETKEY, &skey)) {
+		perror("ioctl(CIOCSETKEY)");
+		return 1;
+	}
+	skey.ses = sess.ses;
+	if (ioctl(cfd, CIOCSETKEY, &skey)) {
+		perror("ioctl(CIOCSETKEY)");
+		return 1;
+	}
+
+	/* more operations than engines, each one with its own IV */
+	for (i = 0; i < NENGINES * 2; i++) {
+		memset(iv, i, sizeof(iv));
+		if (encrypt(cfd, ses, in, expected, iv))
+			return 1;
+		memset(iv, i, sizeof(iv));
+		if (encrypt(cfd, sess.ses, in, out, iv))
+			return 1;
+		if (memcmp(out, expected, DATA_SIZE)) {
+			fprintf(stderr, "FAIL: operation %d differs\n", i);
+			return 1;
+		}
+	}
+
+	ioctl(cfd, CIOCFSESSION, &ses);
+	ioctl(cfd, CIOCFSESSION, &sess.ses);
+
+	sess.engines = CRYPTO_MAX_ENGINES + 1;
+	if (ioctl(cfd, CIOCGSESSION2, &sess) == 0) {
+		fprintf(stderr, "FAIL: too many engines were accepted\n");
+		return 1;
+	}
+	sess.engines = NENGINES;
+	sess.mac = CRYPTO_SHA1_HMAC;
+	sess.mackeylen = KEY_SIZE;
+	sess.mackey = key;
+	if (ioctl(cfd, CIOCGSESSION2, &sess) == 0) {
+		fprintf(stderr, "FAIL: engines with a MAC were accepted\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* polling for the driver only changes how the results are waited for */
+static int
+test_poll(int cfd)
+{
+	static uint8_t in[DATA_SIZE], out[DATA_SIZE], expected[DATA_SIZE];
+	uint8_t iv[BLOCK_SIZE], key[KEY_SIZE];
+	struct session2_op sess;
+	uint32_t ses;
+
+	memset(in, 0x3c, sizeof(in));
+	memset(key, 0, sizeof(key));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.poll_us = 50;
+	if (ioctl(cfd, CIOCGSESSION2, &sess)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	if (get_session(cfd, NULL, 0, &ses))
+		return 1;
+
+	memset(iv, 0x01, sizeof(iv));
+	if (encrypt(cfd, ses, in, expected, iv))
+		return 1;
+	memset(iv, 0x01, sizeof(iv));
+	if (encrypt(cfd, sess.ses, in, out, iv))
+		return 1;
+	if (memcmp(out, expected, DATA_SIZE)) {
+		fprintf(stderr, "FAIL: polling session differs\n");
+		return 1;
+	}
+
+	ioctl(cfd, CIOCFSESSION, &ses);
+	ioctl(cfd, CIOCFSESSION, &sess.ses);
+
+	sess.poll_us = CRYPTO_MAX_POLL_US + 1;
+	if (ioctl(cfd, CIOCGSESSION2, &sess) == 0) {
+		fprintf(stderr, "FAIL: too long polling was accepted\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* the memory of a session can be put on a given NUMA node */
+static int
+test_node(int cfd)
+{
+	struct session_info_op siop;
+	struct session2_op sess;
+	uint8_t key[KEY_SIZE];
+	uint32_t ses;
+
+	memset(key, 0x66, sizeof(key));
+	if (get_session(cfd, NULL, 0, &ses) || get_info(cfd, ses, &siop))
+		return 1;
+	ioctl(cfd, CIOCFSESSION, &ses);
+	if (siop.node < 0) {
+		fprintf(stderr, "FAIL: session is on no NUMA node\n");
+		return 1;
+	}
+	if (debug)
+		printf("session is on node %d\n", siop.node);
+
+	/* the node of the CPU, which is online */
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.flags = SES_FLAG_NODE;
+	sess.node = siop.node;
+	if (ioctl(cfd, CIOCGSESSION2, &sess)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	if (get_info(cfd, sess.ses, &siop))
+		return 1;
+	ioctl(cfd, CIOCFSESSION, &sess.ses);
+	if (siop.node != (int)sess.node) {
+		fprintf(stderr, "FAIL: session is on node %d instead of %u\n",
+			siop.node, sess.node);
+		return 1;
+	}
+
+	sess.node = 1 << 20;
+	if (ioctl(cfd, CIOCGSESSION2, &sess) == 0) {
+		fprintf(stderr, "FAIL: bad NUMA node was accepted\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the tests */
+	if (test_driver(cfd) || test_preference(cfd) || test_engines(cfd) ||
+	    test_poll(cfd) || test_node(cfd))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
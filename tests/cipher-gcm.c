@@ -187,6 +187,133 @@ static int test_crypto(int cfd)
 	return 0;
 }
 
+/* The test vectors through CIOCAUTHCRYPT64, as a 32-bit program would
+ * run them */
+static int test_crypto64(int cfd)
+{
+	int i;
+	uint8_t tmp[128];
+
+	struct session_op sess;
+	struct crypt_auth_op64 cao;
+
+	for (i = 0;
+	     i < sizeof(aes_gcm_vectors) / sizeof(aes_gcm_vectors[0]);
+	     i++) {
+		memset(&sess, 0, sizeof(sess));
+		memset(tmp, 0, sizeof(tmp));
+
+		sess.cipher = CRYPTO_AES_GCM;
+		sess.keylen = 16;
+		sess.key = (void *) aes_gcm_vectors[i].key;
+
+		if (ioctl(cfd, CIOCGSESSION, &sess)) {
+			my_perror("ioctl(CIOCGSESSION)");
+			return 1;
+		}
+
+		memset(&cao, 0, sizeof(cao));
+
+		cao.ses = sess.ses;
+		cao.dst = (uintptr_t) tmp;
+		cao.iv = (uintptr_t) aes_gcm_vectors[i].iv;
+		cao.iv_len = 12;
+		cao.op = COP_ENCRYPT;
+		cao.auth_src = (uintptr_t) aes_gcm_vectors[i].auth;
+		cao.auth_len = aes_gcm_vectors[i].auth_size;
+		cao.src = (uintptr_t) aes_gcm_vectors[i].plaintext;
+		cao.len = aes_gcm_vectors[i].plaintext_size;
+
+		if (ioctl(cfd, CIOCAUTHCRYPT64, &cao)) {
+			my_perror("ioctl(CIOCAUTHCRYPT64)");
+			return 1;
+		}
+
+		if (memcmp(tmp, aes_gcm_vectors[i].ciphertext,
+			   aes_gcm_vectors[i].plaintext_size) != 0 ||
+		    memcmp(&tmp[cao.len - cao.tag_len], aes_gcm_vectors[i].tag,
+			   16) != 0) {
+			fprintf(stderr,
+				"AES-GCM test vector %d failed with crypt_auth_op64!\n",
+				i);
+			return 1;
+		}
+
+		if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+			my_perror("ioctl(CIOCFSESSION)");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+#define NVECTORS (sizeof(aes_gcm_vectors) / sizeof(aes_gcm_vectors[0]))
+
+/* All the test vectors with a single CIOCAUTHCRYPT_MULTI64 */
+static int test_multi64(int cfd)
+{
+	uint8_t tmp[NVECTORS][128];
+	struct session_op sess[NVECTORS];
+	struct crypt_auth_op64 cao[NVECTORS];
+	struct crypt_multi_op64 mop;
+	int32_t status[NVECTORS];
+	int i;
+
+	memset(tmp, 0, sizeof(tmp));
+	memset(cao, 0, sizeof(cao));
+	for (i = 0; i < NVECTORS; i++) {
+		memset(&sess[i], 0, sizeof(sess[i]));
+		sess[i].cipher = CRYPTO_AES_GCM;
+		sess[i].keylen = 16;
+		sess[i].key = (void *) aes_gcm_vectors[i].key;
+		if (ioctl(cfd, CIOCGSESSION, &sess[i])) {
+			my_perror("ioctl(CIOCGSESSION)");
+			return 1;
+		}
+
+		cao[i].ses = sess[i].ses;
+		cao[i].dst = (uintptr_t) tmp[i];
+		cao[i].iv = (uintptr_t) aes_gcm_vectors[i].iv;
+		cao[i].iv_len = 12;
+		cao[i].op = COP_ENCRYPT;
+		cao[i].auth_src = (uintptr_t) aes_gcm_vectors[i].auth;
+		cao[i].auth_len = aes_gcm_vectors[i].auth_size;
+		cao[i].src = (uintptr_t) aes_gcm_vectors[i].plaintext;
+		cao[i].len = aes_gcm_vectors[i].plaintext_size;
+		status[i] = -1;
+	}
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = NVECTORS;
+	mop.ops = (uintptr_t) cao;
+	mop.status = (uintptr_t) status;
+	if (ioctl(cfd, CIOCAUTHCRYPT_MULTI64, &mop)) {
+		my_perror("ioctl(CIOCAUTHCRYPT_MULTI64)");
+		return 1;
+	}
+
+	for (i = 0; i < NVECTORS; i++) {
+		if (status[i] != 0 ||
+		    memcmp(tmp[i], aes_gcm_vectors[i].ciphertext,
+			   aes_gcm_vectors[i].plaintext_size) != 0 ||
+		    memcmp(&tmp[i][cao[i].len - cao[i].tag_len],
+			   aes_gcm_vectors[i].tag, 16) != 0) {
+			fprintf(stderr,
+				"AES-GCM test vector %d failed in a batch (%d)!\n",
+				i, status[i]);
+			return 1;
+		}
+
+		if (ioctl(cfd, CIOCFSESSION, &sess[i].ses)) {
+			my_perror("ioctl(CIOCFSESSION)");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
 /* Checks if encryption and subsequent decryption 
  * produces the same data.
  */
@@ -467,6 +594,85 @@ static int test_encrypt_decrypt_error(int cfd, int err)
 	return 1;
 }
 
+/* associated data larger than a page, changing its last byte must make
+ * the decryption fail */
+#define	LARGE_AUTH_SIZE	(3 * 4096 + 5)
+
+static int test_large_auth(int cfd)
+{
+	static uint8_t auth[LARGE_AUTH_SIZE];
+	uint8_t data[DATA_SIZE + 16], plaintext[DATA_SIZE];
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct session_op sess;
+	struct crypt_auth_op cao;
+	int enc_len;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33, sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+	memset(auth, 0xf1, sizeof(auth));
+	memset(plaintext, 0x15, sizeof(plaintext));
+	memcpy(data, plaintext, DATA_SIZE);
+
+	sess.cipher = CRYPTO_AES_GCM;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		my_perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(&cao, 0, sizeof(cao));
+	cao.ses = sess.ses;
+	cao.auth_src = auth;
+	cao.auth_len = sizeof(auth);
+	cao.len = DATA_SIZE;
+	cao.src = data;
+	cao.dst = data;
+	cao.iv = iv;
+	cao.iv_len = 12;
+	cao.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+		my_perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+	enc_len = cao.len;
+
+	cao.len = enc_len;
+	cao.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+		my_perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+	if (cao.len != DATA_SIZE || memcmp(data, plaintext, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: decryption with large auth data.\n");
+		return 1;
+	}
+
+	/* data is the plaintext again, encrypt it anew */
+	cao.len = DATA_SIZE;
+	cao.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+		my_perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+	auth[sizeof(auth) - 1] ^= 1;
+	cao.len = enc_len;
+	cao.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao) == 0) {
+		fprintf(stderr, "FAIL: modified auth data were accepted.\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		my_perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
 	int fd = -1, cfd = -1;
@@ -497,6 +703,12 @@ int main(int argc, char** argv)
 	if (test_crypto(cfd))
 		return 1;
 
+	if (test_crypto64(cfd))
+		return 1;
+
+	if (test_multi64(cfd))
+		return 1;
+
 	if (test_encrypt_decrypt(cfd))
 		return 1;
 
@@ -506,6 +718,9 @@ int main(int argc, char** argv)
 	if (test_encrypt_decrypt_error(cfd, 1))
 		return 1;
 
+	if (test_large_auth(cfd))
+		return 1;
+
 	/* Close cloned descriptor */
 	if (close(cfd)) {
 		my_perror("close(cfd)");
@@ -0,0 +1,292 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering and hashing
+ * data scattered over several buffers.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	8192
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	DIGEST_SIZE	20
+
+/* segment sizes only need to add up to whole blocks */
+static const uint32_t src_sizes[] = { 13, 1000, 5000, 2179 };
+static const uint32_t dst_sizes[] = { 4096, 4096 };
+
+#define	NSRC	(sizeof(src_sizes) / sizeof(src_sizes[0]))
+#define	NDST	(sizeof(dst_sizes) / sizeof(dst_sizes[0]))
+
+static uint8_t plaintext[DATA_SIZE], expected[DATA_SIZE];
+static uint8_t src_bufs[NSRC][DATA_SIZE], dst_bufs[NDST][DATA_SIZE];
+
+static void
+set_segments(struct crypt_iovec *iov, uint8_t bufs[][DATA_SIZE],
+		const uint32_t *sizes, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		iov[i].base = bufs[i];
+		iov[i].len = sizes[i];
+	}
+}
+
+/* compare the segments to a contiguous buffer */
+static int
+cmp_segments(struct crypt_iovec *iov, int n, const uint8_t *data)
+{
+	int i;
+
+	for (i = 0; i < n; data += iov[i].len, i++)
+		if (memcmp(iov[i].base, data, iov[i].len))
+			return 1;
+
+	return 0;
+}
+
+static int
+test_cipher(int cfd, uint16_t flags)
+{
+	struct crypt_iovec src[NSRC], dst[NDST];
+	struct crypt_iovec64 src64[NSRC], dst64[NDST];
+	struct crypt_iov_op iop;
+	struct crypt_iov_op64 iop64;
+	struct session_op sess;
+	struct crypt_op cryp;
+	uint8_t iv[BLOCK_SIZE], key[KEY_SIZE];
+	uint32_t i, off;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33, sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < DATA_SIZE; i++)
+		plaintext[i] = i;
+	for (i = 0, off = 0; i < NSRC; off += src_sizes[i], i++)
+		memcpy(src_bufs[i], plaintext + off, src_sizes[i]);
+	set_segments(src, src_bufs, src_sizes, NSRC);
+	set_segments(dst, dst_bufs, dst_sizes, NDST);
+
+	/* Encrypt the source segments into the destination ones */
+	memset(iv, 0x03, sizeof(iv));
+	memset(&iop, 0, sizeof(iop));
+	iop.ses = sess.ses;
+	iop.op = COP_ENCRYPT;
+	iop.flags = flags;
+	iop.src_cnt = NSRC;
+	iop.src = src;
+	iop.dst_cnt = NDST;
+	iop.dst = dst;
+	iop.iv = iv;
+	if (ioctl(cfd, CIOCCRYPTV, &iop)) {
+		perror("ioctl(CIOCCRYPTV)");
+		return 1;
+	}
+
+	/* Verify the result against a single CIOCCRYPT */
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = expected;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (cmp_segments(dst, NDST, expected)) {
+		fprintf(stderr, "FAIL: segments differ from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	/* Decrypt in place */
+	memset(iv, 0x03, sizeof(iv));
+	iop.op = COP_DECRYPT;
+	iop.src_cnt = iop.dst_cnt = NDST;
+	iop.src = iop.dst = dst;
+	if (ioctl(cfd, CIOCCRYPTV, &iop)) {
+		perror("ioctl(CIOCCRYPTV)");
+		return 1;
+	}
+
+	if (cmp_segments(dst, NDST, plaintext)) {
+		fprintf(stderr,
+			"FAIL: Decrypted data are different from the input data.\n");
+		return 1;
+	}
+
+	/* the same with the fixed-layout structures */
+	memset(src64, 0, sizeof(src64));
+	memset(dst64, 0, sizeof(dst64));
+	for (i = 0; i < NSRC; i++) {
+		src64[i].base = (uintptr_t)src[i].base;
+		src64[i].len = src[i].len;
+	}
+	for (i = 0; i < NDST; i++) {
+		dst64[i].base = (uintptr_t)dst[i].base;
+		dst64[i].len = dst[i].len;
+	}
+	memset(iv, 0x03, sizeof(iv));
+	memset(&iop64, 0, sizeof(iop64));
+	iop64.ses = sess.ses;
+	iop64.op = COP_ENCRYPT;
+	iop64.flags = flags;
+	iop64.src_cnt = NSRC;
+	iop64.src = (uintptr_t)src64;
+	iop64.dst_cnt = NDST;
+	iop64.dst = (uintptr_t)dst64;
+	iop64.iv = (uintptr_t)iv;
+	if (ioctl(cfd, CIOCCRYPTV64, &iop64)) {
+		perror("ioctl(CIOCCRYPTV64)");
+		return 1;
+	}
+
+	if (cmp_segments(dst, NDST, expected)) {
+		fprintf(stderr, "FAIL: segments of crypt_iov_op64 differ.\n");
+		return 1;
+	}
+
+	/* too little room for the output */
+	dst[NDST - 1].len--;
+	iop.op = COP_ENCRYPT;
+	iop.src_cnt = NSRC;
+	iop.src = src;
+	if (ioctl(cfd, CIOCCRYPTV, &iop) == 0) {
+		fprintf(stderr, "FAIL: short destination was accepted\n");
+		return 1;
+	}
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_hash(int cfd, uint16_t flags)
+{
+	struct crypt_iovec src[NSRC];
+	struct crypt_iov_op iop;
+	struct session_op sess;
+	struct crypt_op cryp;
+	uint8_t digest[DIGEST_SIZE], expected_digest[DIGEST_SIZE];
+
+	memset(&sess, 0, sizeof(sess));
+	sess.mac = CRYPTO_SHA1;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	set_segments(src, src_bufs, src_sizes, NSRC);
+
+	memset(&iop, 0, sizeof(iop));
+	iop.ses = sess.ses;
+	iop.op = COP_ENCRYPT;
+	iop.flags = flags;
+	iop.src_cnt = NSRC;
+	iop.src = src;
+	iop.mac = digest;
+	if (ioctl(cfd, CIOCCRYPTV, &iop)) {
+		perror("ioctl(CIOCCRYPTV)");
+		return 1;
+	}
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.mac = expected_digest;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(digest, expected_digest, DIGEST_SIZE)) {
+		fprintf(stderr, "FAIL: digest differs from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the tests with zero copy and through the kernel buffer */
+	if (test_cipher(cfd, 0) || test_cipher(cfd, COP_FLAG_NO_ZC))
+		return 1;
+	if (test_hash(cfd, 0) || test_hash(cfd, COP_FLAG_NO_ZC))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ * Demo on how to let /dev/crypto generate the IVs of a session.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	40	/* not a whole number of blocks */
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NONCE_SIZE	12
+#define	TAG_SIZE	16
+
+/* b == a + n as big endian numbers */
+static int
+iv_advanced_by(const uint8_t *a, const uint8_t *b, int size, unsigned n)
+{
+	uint8_t tmp[BLOCK_SIZE];
+	int i;
+
+	memcpy(tmp, a, size);
+	for (i = size - 1; i >= 0 && n; i--) {
+		n += tmp[i];
+		tmp[i] = n & 0xff;
+		n >>= 8;
+	}
+
+	return memcmp(tmp, b, size) == 0;
+}
+
+static int
+get_session(int cfd, uint32_t cipher, uint8_t *key, uint32_t flags,
+		uint32_t *ses)
+{
+	struct session2_op sess;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = cipher;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.flags = flags;
+	if (ioctl(cfd, CIOCGSESSION2, &sess))
+		return -1;
+
+	*ses = sess.ses;
+	return 0;
+}
+
+static int
+test_ctr(int cfd)
+{
+	uint8_t data[DATA_SIZE], out[2][DATA_SIZE], tmp[DATA_SIZE];
+	uint8_t iv[2][BLOCK_SIZE], key[KEY_SIZE];
+	struct crypt_op cryp;
+	uint32_t ses, plain_ses;
+	int i;
+
+	memset(data, 0x15, sizeof(data));
+	memset(key, 0x33, sizeof(key));
+
+	if (get_session(cfd, CRYPTO_AES_CTR, key, SES_FLAG_IV_GEN, &ses) ||
+	    get_session(cfd, CRYPTO_AES_CTR, key, 0, &plain_ses)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+
+	/* Encrypt twice, getting back the IVs used */
+	for (i = 0; i < 2; i++) {
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = data;
+		cryp.dst = out[i];
+		cryp.iv = iv[i];
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+	}
+
+	/* the second one follows the three blocks of the first */
+	if (!iv_advanced_by(iv[0], iv[1], BLOCK_SIZE, 3)) {
+		fprintf(stderr, "FAIL: CTR counter was not advanced by 3\n");
+		return 1;
+	}
+
+	/* they decrypt with the IVs given, on the same session and on a
+	 * session of our own, without advancing the counter */
+	for (i = 0; i < 4; i++) {
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = i < 2 ? ses : plain_ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = out[i % 2];
+		cryp.dst = tmp;
+		cryp.iv = iv[i % 2];
+		cryp.op = COP_DECRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		if (memcmp(tmp, data, DATA_SIZE) != 0) {
+			fprintf(stderr, "FAIL: CTR operation %d does not decrypt\n", i % 2);
+			return 1;
+		}
+	}
+
+	/* an operation without an IV pointer still advances the counter */
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = data;
+	cryp.dst = tmp;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	cryp.iv = iv[0];
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	if (!iv_advanced_by(iv[1], iv[0], BLOCK_SIZE, 6)) {
+		fprintf(stderr, "FAIL: CTR counter was not advanced by 6\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &ses) ||
+	    ioctl(cfd, CIOCFSESSION, &plain_ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_gcm(int cfd)
+{
+	uint8_t data[DATA_SIZE], out[2][DATA_SIZE + TAG_SIZE];
+	uint8_t tmp[DATA_SIZE + TAG_SIZE];
+	uint8_t iv[2][NONCE_SIZE], key[KEY_SIZE];
+	struct crypt_auth_op cao;
+	uint32_t ses, plain_ses;
+	int i;
+
+	memset(data, 0x15, sizeof(data));
+	memset(key, 0x44, sizeof(key));
+
+	if (get_session(cfd, CRYPTO_AES_GCM, key, SES_FLAG_IV_GEN, &ses) ||
+	    get_session(cfd, CRYPTO_AES_GCM, key, 0, &plain_ses)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		memset(&cao, 0, sizeof(cao));
+		cao.ses = ses;
+		cao.len = DATA_SIZE;
+		cao.src = data;
+		cao.dst = out[i];
+		cao.iv = iv[i];
+		cao.iv_len = NONCE_SIZE;
+		cao.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return 1;
+		}
+	}
+
+	/* one nonce per operation */
+	if (!iv_advanced_by(iv[0], iv[1], NONCE_SIZE, 1)) {
+		fprintf(stderr, "FAIL: GCM nonce was not advanced by 1\n");
+		return 1;
+	}
+
+	for (i = 0; i < 4; i++) {
+		memset(&cao, 0, sizeof(cao));
+		cao.ses = i < 2 ? ses : plain_ses;
+		cao.len = DATA_SIZE + TAG_SIZE;
+		cao.src = out[i % 2];
+		cao.dst = tmp;
+		cao.iv = iv[i % 2];
+		cao.iv_len = NONCE_SIZE;
+		cao.op = COP_DECRYPT;
+		if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return 1;
+		}
+		if (cao.len != DATA_SIZE || memcmp(tmp, data, DATA_SIZE) != 0) {
+			fprintf(stderr, "FAIL: GCM operation %d does not decrypt\n", i % 2);
+			return 1;
+		}
+	}
+
+	/* the decryptions did not use up nonces */
+	memset(&cao, 0, sizeof(cao));
+	cao.ses = ses;
+	cao.len = DATA_SIZE;
+	cao.src = data;
+	cao.dst = tmp;
+	cao.iv = iv[0];
+	cao.iv_len = NONCE_SIZE;
+	cao.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+		perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+	if (!iv_advanced_by(iv[1], iv[0], NONCE_SIZE, 1)) {
+		fprintf(stderr, "FAIL: GCM nonce was advanced by a decryption\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &ses) ||
+	    ioctl(cfd, CIOCFSESSION, &plain_ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_invalid(int cfd)
+{
+	struct session2_op sess;
+	uint8_t key[KEY_SIZE];
+	uint32_t ses;
+
+	memset(key, 0x55, sizeof(key));
+
+	/* chained IVs would be predictable */
+	if (get_session(cfd, CRYPTO_AES_CBC, key, SES_FLAG_IV_GEN, &ses) == 0) {
+		fprintf(stderr, "FAIL: IV generation on a CBC session\n");
+		return 1;
+	}
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CTR;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.__reserved[0] = 1;
+	if (ioctl(cfd, CIOCGSESSION2, &sess) == 0) {
+		fprintf(stderr, "FAIL: reserved field was accepted\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* binaries built before session2_op had driver names pass a shorter one */
+#define CIOCGSESSION2_V1 _IOC(_IOC_READ | _IOC_WRITE, 'c', 127, \
+		offsetof(struct session2_op, cipher_driver))
+
+static int
+test_short(int cfd)
+{
+	struct session2_op sess;
+	uint8_t key[KEY_SIZE];
+
+	memset(key, 0x66, sizeof(key));
+
+	/* the driver names are past its end and must not be read */
+	memset(&sess, 0, sizeof(sess));
+	memset(sess.cipher_driver, 'x', sizeof(sess.cipher_driver));
+	sess.cipher = CRYPTO_AES_CTR;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.flags = SES_FLAG_IV_GEN;
+	if (ioctl(cfd, CIOCGSESSION2_V1, &sess)) {
+		perror("ioctl(CIOCGSESSION2_V1)");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_ctr(cfd) || test_gcm(cfd) || test_invalid(cfd) ||
+	    test_short(cfd))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Demo on how to use buffers allocated by /dev/crypto and mapped
+ * into the process for ciphering.
+ *
+ * Placed under public domain.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	(16*1024)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+
+static int
+test_crypto(int cfd)
+{
+	uint8_t expected[DATA_SIZE];
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	uint8_t *map, *plaintext, *ciphertext;
+	void *moved;
+
+	struct session_op sess;
+	struct crypt_op cryp;
+	struct crypt_buf_op bop;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(&cryp, 0, sizeof(cryp));
+
+	memset(key, 0x33, sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* Allocate room for the plaintext and the ciphertext */
+	memset(&bop, 0, sizeof(bop));
+	bop.len = 2 * DATA_SIZE;
+	if (ioctl(cfd, CIOCALLOCBUF, &bop)) {
+		perror("ioctl(CIOCALLOCBUF)");
+		return 1;
+	}
+
+	map = mmap(NULL, bop.len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			cfd, bop.addr);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	plaintext = map;
+	ciphertext = map + DATA_SIZE;
+
+	if (debug)
+		printf("buffer %u of %u bytes mapped at %p\n",
+			bop.id, bop.len, map);
+
+	/* the buffer can only be mapped once */
+	if (mmap(NULL, bop.len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		 cfd, bop.addr) != MAP_FAILED) {
+		fprintf(stderr, "FAIL: buffer was mapped twice\n");
+		return 1;
+	}
+
+	memset(plaintext, 0x15, DATA_SIZE);
+
+	/* Encrypt within the buffer */
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = ciphertext;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	/* Compare with ordinary memory */
+	memcpy(expected, plaintext, DATA_SIZE);
+	cryp.src = expected;
+	cryp.dst = expected;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(expected, ciphertext, DATA_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Encrypted data differ from those of ordinary memory.\n");
+		return 1;
+	}
+
+	/* Decrypt in place */
+	cryp.src = ciphertext;
+	cryp.dst = ciphertext;
+	cryp.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(plaintext, ciphertext, DATA_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Decrypted data are different from the input data.\n");
+		return 1;
+	}
+
+	/* a mapped buffer cannot be released */
+	if (ioctl(cfd, CIOCUNREGBUF, &bop.id) == 0 || errno != EBUSY) {
+		fprintf(stderr, "FAIL: mapped buffer was released\n");
+		return 1;
+	}
+
+	/* a smaller mapping does not shrink the buffer for later ones */
+	munmap(map, bop.len);
+	map = mmap(NULL, DATA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			cfd, bop.addr);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	munmap(map, DATA_SIZE);
+	map = mmap(NULL, bop.len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			cfd, bop.addr);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	/* and it moves with its mapping */
+	moved = mmap(NULL, bop.len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+			-1, 0);
+	if (moved == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	map = mremap(map, bop.len, bop.len, MREMAP_MAYMOVE | MREMAP_FIXED,
+			moved);
+	if (map == MAP_FAILED) {
+		perror("mremap");
+		return 1;
+	}
+	plaintext = map;
+	ciphertext = map + DATA_SIZE;
+
+	cryp.src = plaintext;
+	cryp.dst = ciphertext;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	if (memcmp(expected, ciphertext, DATA_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Encrypted data differ after the buffer was remapped.\n");
+		return 1;
+	}
+
+	munmap(map, bop.len);
+
+	if (ioctl(cfd, CIOCUNREGBUF, &bop.id)) {
+		perror("ioctl(CIOCUNREGBUF)");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
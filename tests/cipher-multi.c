@@ -0,0 +1,324 @@
+/*
+ * Demo on how to use /dev/crypto device for submitting several
+ * cipher operations with a single ioctl.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+#include "testhelper.h"
+
+static int debug = 0;
+
+#define	DATA_SIZE	1024
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NOPS		8
+
+static int
+test_crypto(int cfd)
+{
+	uint8_t plaintext_raw[NOPS][DATA_SIZE + 63], *plaintext[NOPS];
+	uint8_t ciphertext_raw[NOPS][DATA_SIZE + 63], *ciphertext[NOPS];
+	uint8_t expected_raw[DATA_SIZE + 63], *expected;
+	uint8_t iv[NOPS][BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	int32_t status[NOPS];
+	int i;
+
+	struct session_op sess;
+#ifdef CIOCGSESSINFO
+	struct session_info_op siop;
+#endif
+	struct crypt_op cryp, ops[NOPS];
+	struct crypt_multi_op mop;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(ops, 0, sizeof(ops));
+
+	memset(key, 0x33, sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+#ifdef CIOCGSESSINFO
+	siop.ses = sess.ses;
+	if (ioctl(cfd, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	if (debug)
+		printf("requested cipher CRYPTO_AES_CBC, got %s with driver %s\n",
+			siop.cipher_info.cra_name, siop.cipher_info.cra_driver_name);
+
+	for (i = 0; i < NOPS; i++) {
+		plaintext[i] = buf_align(plaintext_raw[i], siop.alignmask);
+		ciphertext[i] = buf_align(ciphertext_raw[i], siop.alignmask);
+	}
+	expected = buf_align(expected_raw, siop.alignmask);
+#else
+	for (i = 0; i < NOPS; i++) {
+		plaintext[i] = plaintext_raw[i];
+		ciphertext[i] = ciphertext_raw[i];
+	}
+	expected = expected_raw;
+#endif
+
+	/* Encrypt all buffers with a single ioctl */
+	for (i = 0; i < NOPS; i++) {
+		memset(plaintext[i], 0x15 + i, DATA_SIZE);
+		memset(iv[i], 0x03 + i, BLOCK_SIZE);
+
+		ops[i].ses = sess.ses;
+		ops[i].len = DATA_SIZE;
+		ops[i].src = plaintext[i];
+		ops[i].dst = ciphertext[i];
+		ops[i].iv = iv[i];
+		ops[i].op = COP_ENCRYPT;
+		status[i] = -1;
+	}
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = NOPS;
+	mop.ops = ops;
+	mop.status = status;
+	if (ioctl(cfd, CIOCCRYPT_MULTI, &mop)) {
+		perror("ioctl(CIOCCRYPT_MULTI)");
+		return 1;
+	}
+
+	/* Verify each result against a single CIOCCRYPT */
+	for (i = 0; i < NOPS; i++) {
+		if (status[i] != 0) {
+			fprintf(stderr, "FAIL: operation %d returned %d\n",
+				i, status[i]);
+			return 1;
+		}
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = plaintext[i];
+		cryp.dst = expected;
+		cryp.iv = iv[i];
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(expected, ciphertext[i], DATA_SIZE) != 0) {
+			fprintf(stderr,
+				"FAIL: operation %d differs from CIOCCRYPT.\n", i);
+			return 1;
+		}
+	}
+
+	/* Decrypt all buffers in place */
+	for (i = 0; i < NOPS; i++) {
+		ops[i].src = ciphertext[i];
+		ops[i].dst = ciphertext[i];
+		ops[i].op = COP_DECRYPT;
+	}
+
+	/* without a status array the first error is returned */
+	mop.status = NULL;
+	if (ioctl(cfd, CIOCCRYPT_MULTI, &mop)) {
+		perror("ioctl(CIOCCRYPT_MULTI)");
+		return 1;
+	}
+
+	for (i = 0; i < NOPS; i++) {
+		if (memcmp(plaintext[i], ciphertext[i], DATA_SIZE) != 0) {
+			fprintf(stderr,
+				"FAIL: Decrypted data of operation %d are different from the input data.\n", i);
+			return 1;
+		}
+	}
+
+	/* an invalid session must only fail its own element */
+	ops[1].ses = sess.ses + 1;
+	mop.status = status;
+	if (ioctl(cfd, CIOCCRYPT_MULTI, &mop)) {
+		perror("ioctl(CIOCCRYPT_MULTI)");
+		return 1;
+	}
+	if (status[0] != 0 || status[1] == 0 || status[2] != 0) {
+		fprintf(stderr, "FAIL: unexpected status %d/%d/%d\n",
+			status[0], status[1], status[2]);
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* The fixed-layout structures, as a 32-bit program would use them, give
+ * the same results as crypt_op */
+static int
+test_crypto64(int cfd)
+{
+	uint8_t plaintext[NOPS][DATA_SIZE], ciphertext[NOPS][DATA_SIZE];
+	uint8_t expected[DATA_SIZE];
+	uint8_t iv[NOPS][BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	int32_t status[NOPS];
+	int i;
+
+	struct session_op sess;
+	struct crypt_op cryp;
+	struct crypt_op64 ops[NOPS];
+	struct crypt_multi_op64 mop;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(ops, 0, sizeof(ops));
+
+	memset(key, 0x44, sizeof(key));
+
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < NOPS; i++) {
+		memset(plaintext[i], 0x25 + i, DATA_SIZE);
+		memset(iv[i], 0x13 + i, BLOCK_SIZE);
+
+		ops[i].ses = sess.ses;
+		ops[i].len = DATA_SIZE;
+		ops[i].src = (uintptr_t)plaintext[i];
+		ops[i].dst = (uintptr_t)ciphertext[i];
+		ops[i].iv = (uintptr_t)iv[i];
+		ops[i].op = COP_ENCRYPT;
+		status[i] = -1;
+	}
+
+	/* the first one alone, the others with a single ioctl */
+	if (ioctl(cfd, CIOCCRYPT64, &ops[0])) {
+		perror("ioctl(CIOCCRYPT64)");
+		return 1;
+	}
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = NOPS - 1;
+	mop.ops = (uintptr_t)&ops[1];
+	mop.status = (uintptr_t)&status[1];
+	if (ioctl(cfd, CIOCCRYPT_MULTI64, &mop)) {
+		perror("ioctl(CIOCCRYPT_MULTI64)");
+		return 1;
+	}
+
+	for (i = 0; i < NOPS; i++) {
+		if (i && status[i] != 0) {
+			fprintf(stderr, "FAIL: operation %d returned %d\n",
+				i, status[i]);
+			return 1;
+		}
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = plaintext[i];
+		cryp.dst = expected;
+		cryp.iv = iv[i];
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(expected, ciphertext[i], DATA_SIZE) != 0) {
+			fprintf(stderr,
+				"FAIL: crypt_op64 %d differs from CIOCCRYPT.\n", i);
+			return 1;
+		}
+	}
+
+	/* the reserved field is checked */
+	ops[0].__reserved = 1;
+	if (ioctl(cfd, CIOCCRYPT64, &ops[0]) == 0) {
+		fprintf(stderr, "FAIL: reserved field was accepted\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test of the fixed-layout structures passed\n");
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto(cfd))
+		return 1;
+
+	if (test_crypto64(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Demo on how to use registered buffers with the /dev/crypto device.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	(16*1024)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+
+static int
+encrypt(int cfd, uint32_t ses, void *src, void *dst, int op)
+{
+	struct crypt_op cryp;
+	uint8_t iv[BLOCK_SIZE];
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = src;
+	cryp.dst = dst;
+	cryp.iv = iv;
+	cryp.op = op;
+
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_crypto(int cfd)
+{
+	uint8_t *region, *plaintext, *ciphertext, *expected;
+	uint8_t key[KEY_SIZE];
+	struct session_op sess;
+	struct crypt_buf_op bop, robop;
+
+	/* plaintext and ciphertext share one registered region */
+	if (posix_memalign((void **)&region, 4096, 2 * DATA_SIZE) ||
+	    posix_memalign((void **)&expected, 4096, DATA_SIZE)) {
+		fprintf(stderr, "posix_memalign failed\n");
+		return 1;
+	}
+	plaintext = region;
+	ciphertext = region + DATA_SIZE;
+	memset(plaintext, 0x15, DATA_SIZE);
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33, sizeof(key));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* reference result from unregistered memory */
+	if (encrypt(cfd, sess.ses, plaintext, expected, COP_ENCRYPT))
+		return 1;
+
+	memset(&bop, 0, sizeof(bop));
+	bop.addr = (uintptr_t)region;
+	bop.len = 2 * DATA_SIZE;
+	if (ioctl(cfd, CIOCREGBUF, &bop)) {
+		perror("ioctl(CIOCREGBUF)");
+		return 1;
+	}
+	if (debug)
+		printf("registered buffer %u\n", bop.id);
+
+	/* encrypt and decrypt within the region */
+	if (encrypt(cfd, sess.ses, plaintext, ciphertext, COP_ENCRYPT))
+		return 1;
+	if (memcmp(ciphertext, expected, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: registered buffer gives a different result\n");
+		return 1;
+	}
+	if (encrypt(cfd, sess.ses, ciphertext, ciphertext, COP_DECRYPT))
+		return 1;
+	if (memcmp(ciphertext, plaintext, DATA_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Decrypted data are different from the input data.\n");
+		return 1;
+	}
+
+	/* a read-only region may only serve as a source */
+	memset(&robop, 0, sizeof(robop));
+	robop.addr = (uintptr_t)expected;
+	robop.len = DATA_SIZE;
+	robop.flags = CRYPT_BUF_RDONLY;
+	if (ioctl(cfd, CIOCREGBUF, &robop)) {
+		perror("ioctl(CIOCREGBUF)");
+		return 1;
+	}
+	if (encrypt(cfd, sess.ses, expected, ciphertext, COP_DECRYPT))
+		return 1;
+	if (memcmp(ciphertext, plaintext, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: read-only region gives a different result\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCUNREGBUF, &robop.id)) {
+		perror("ioctl(CIOCUNREGBUF)");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCUNREGBUF, &bop.id)) {
+		perror("ioctl(CIOCUNREGBUF)");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCUNREGBUF, &bop.id) == 0) {
+		fprintf(stderr, "FAIL: unregistered a buffer twice\n");
+		return 1;
+	}
+
+	/* memory remains usable after unregistering */
+	if (encrypt(cfd, sess.ses, plaintext, ciphertext, COP_ENCRYPT))
+		return 1;
+	if (memcmp(ciphertext, expected, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: wrong result after unregistering\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	free(region);
+	free(expected);
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
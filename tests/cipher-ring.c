@@ -0,0 +1,264 @@
+/*
+ * Demo on how to use the shared memory rings of /dev/crypto for
+ * submitting cipher operations.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <crypto/cryptodev.h>
+#include "testhelper.h"
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NOPS		16
+#define	RING_ENTRIES	8
+
+static int
+test_crypto(int cfd)
+{
+	static uint8_t plaintext_raw[NOPS][DATA_SIZE + 63], *plaintext[NOPS];
+	static uint8_t ciphertext_raw[NOPS][DATA_SIZE + 63], *ciphertext[NOPS];
+	uint8_t expected_raw[DATA_SIZE + 63], *expected;
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	int i, submitted, completed;
+
+	struct session_op sess;
+#ifdef CIOCGSESSINFO
+	struct session_info_op siop;
+#endif
+	struct crypt_op cryp;
+	struct crypt_ring_setup setup;
+	struct crypt_ring_enter enter;
+	struct crypt_ring_hdr *hdr;
+	struct crypt_ring_sqe *sqes, *sqe;
+	struct crypt_ring_cqe *cqes, *cqe;
+	struct pollfd pfd;
+	void *map;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33, sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+#ifdef CIOCGSESSINFO
+	siop.ses = sess.ses;
+	if (ioctl(cfd, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	for (i = 0; i < NOPS; i++) {
+		plaintext[i] = buf_align(plaintext_raw[i], siop.alignmask);
+		ciphertext[i] = buf_align(ciphertext_raw[i], siop.alignmask);
+	}
+	expected = buf_align(expected_raw, siop.alignmask);
+#else
+	for (i = 0; i < NOPS; i++) {
+		plaintext[i] = plaintext_raw[i];
+		ciphertext[i] = ciphertext_raw[i];
+	}
+	expected = expected_raw;
+#endif
+
+	/* Set up and map the rings */
+	memset(&setup, 0, sizeof(setup));
+	setup.sq_entries = RING_ENTRIES;
+	if (ioctl(cfd, CIOCRINGSETUP, &setup)) {
+		perror("ioctl(CIOCRINGSETUP)");
+		return 1;
+	}
+
+	/* a second ring on the same descriptor is refused */
+	if (ioctl(cfd, CIOCRINGSETUP, &setup) == 0) {
+		fprintf(stderr, "FAIL: second CIOCRINGSETUP succeeded\n");
+		return 1;
+	}
+
+	map = mmap(NULL, setup.size, PROT_READ | PROT_WRITE, MAP_SHARED, cfd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	hdr = map;
+	sqes = (void *)((uint8_t *)map + hdr->sqes);
+	cqes = (void *)((uint8_t *)map + hdr->cqes);
+
+	if (debug)
+		printf("ring: %u submission and %u completion entries, %u bytes\n",
+			hdr->sq_entries, hdr->cq_entries, setup.size);
+
+	/* Submit more operations than the submission ring holds */
+	submitted = completed = 0;
+	memset(iv, 0x03, sizeof(iv));
+	while (completed < NOPS) {
+		while (submitted < NOPS &&
+		       hdr->sq_tail - __atomic_load_n(&hdr->sq_head, __ATOMIC_ACQUIRE) < hdr->sq_entries) {
+			memset(plaintext[submitted], 0x15 + submitted, DATA_SIZE);
+
+			sqe = &sqes[hdr->sq_tail & hdr->sq_mask];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->user_data = submitted;
+			sqe->ses = sess.ses;
+			sqe->op = COP_ENCRYPT;
+			sqe->len = DATA_SIZE;
+			sqe->src = (uintptr_t)plaintext[submitted];
+			sqe->dst = (uintptr_t)ciphertext[submitted];
+			memcpy(sqe->iv, iv, BLOCK_SIZE);
+			__atomic_store_n(&hdr->sq_tail, hdr->sq_tail + 1, __ATOMIC_RELEASE);
+			submitted++;
+		}
+
+		memset(&enter, 0, sizeof(enter));
+		if (ioctl(cfd, CIOCRINGENTER, &enter)) {
+			perror("ioctl(CIOCRINGENTER)");
+			return 1;
+		}
+
+		/* wait for completions with poll() */
+		pfd.fd = cfd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 1000) < 1 || !(pfd.revents & POLLIN)) {
+			fprintf(stderr, "FAIL: poll() reported no completion\n");
+			return 1;
+		}
+
+		while (hdr->cq_head != __atomic_load_n(&hdr->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &cqes[hdr->cq_head & hdr->cq_mask];
+			if (cqe->res != 0 || cqe->user_data >= NOPS) {
+				fprintf(stderr, "FAIL: completion %d returned %d\n",
+					(int)cqe->user_data, cqe->res);
+				return 1;
+			}
+			__atomic_store_n(&hdr->cq_head, hdr->cq_head + 1, __ATOMIC_RELEASE);
+			completed++;
+		}
+	}
+
+	/* Verify each result against a single CIOCCRYPT */
+	for (i = 0; i < NOPS; i++) {
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = plaintext[i];
+		cryp.dst = expected;
+		cryp.iv = iv;
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(expected, ciphertext[i], DATA_SIZE) != 0) {
+			fprintf(stderr,
+				"FAIL: operation %d differs from CIOCCRYPT.\n", i);
+			return 1;
+		}
+	}
+
+	/* Decrypt the first buffer in place, waiting in CIOCRINGENTER */
+	sqe = &sqes[hdr->sq_tail & hdr->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->ses = sess.ses;
+	sqe->op = COP_DECRYPT;
+	sqe->len = DATA_SIZE;
+	sqe->src = (uintptr_t)ciphertext[0];
+	sqe->dst = (uintptr_t)ciphertext[0];
+	memcpy(sqe->iv, iv, BLOCK_SIZE);
+	__atomic_store_n(&hdr->sq_tail, hdr->sq_tail + 1, __ATOMIC_RELEASE);
+
+	memset(&enter, 0, sizeof(enter));
+	enter.min_complete = 1;
+	if (ioctl(cfd, CIOCRINGENTER, &enter)) {
+		perror("ioctl(CIOCRINGENTER)");
+		return 1;
+	}
+
+	cqe = &cqes[hdr->cq_head & hdr->cq_mask];
+	if (hdr->cq_head == hdr->cq_tail || cqe->res != 0) {
+		fprintf(stderr, "FAIL: decryption did not complete\n");
+		return 1;
+	}
+	hdr->cq_head++;
+
+	if (memcmp(plaintext[0], ciphertext[0], DATA_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Decrypted data are different from the input data.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	munmap(map, setup.size);
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * Demo on how to use /dev/crypto device for encrypting runs of
+ * storage sectors with AES-XTS.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	SECTOR_SIZE	512
+#define	NSECTORS	64
+#define	DATA_SIZE	(SECTOR_SIZE * NSECTORS)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	32	/* two AES-128 keys */
+#define	FIRST_SECTOR	0x123456789ULL
+
+static uint8_t plaintext[DATA_SIZE], ciphertext[DATA_SIZE], tmp[DATA_SIZE];
+
+/* the IV of a sector, as plain64 in dm-crypt */
+static void
+sector_iv(uint8_t *iv, uint64_t sector)
+{
+	int i;
+
+	memset(iv, 0, BLOCK_SIZE);
+	for (i = 0; i < 8; i++)
+		iv[i] = sector >> (8 * i);
+}
+
+static int
+test_sectors(int cfd, uint16_t flags)
+{
+	struct session_op sess;
+	struct crypt_sector_op sop;
+	struct crypt_op cryp;
+	uint8_t iv[BLOCK_SIZE], key[KEY_SIZE];
+	int i;
+
+	memset(&sess, 0, sizeof(sess));
+	for (i = 0; i < KEY_SIZE; i++)
+		key[i] = i;
+	for (i = 0; i < DATA_SIZE; i++)
+		plaintext[i] = i * 7;
+
+	sess.cipher = CRYPTO_AES_XTS;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* Encrypt all sectors with a single ioctl */
+	memset(&sop, 0, sizeof(sop));
+	sop.ses = sess.ses;
+	sop.op = COP_ENCRYPT;
+	sop.flags = flags;
+	sop.len = DATA_SIZE;
+	sop.sector_size = SECTOR_SIZE;
+	sop.sector = FIRST_SECTOR;
+	sop.src = plaintext;
+	sop.dst = ciphertext;
+	if (ioctl(cfd, CIOCCRYPT_SECTORS, &sop)) {
+		perror("ioctl(CIOCCRYPT_SECTORS)");
+		return 1;
+	}
+
+	/* Each sector is the same as with a CIOCCRYPT of its own */
+	for (i = 0; i < NSECTORS; i++) {
+		sector_iv(iv, FIRST_SECTOR + i);
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = SECTOR_SIZE;
+		cryp.src = plaintext + i * SECTOR_SIZE;
+		cryp.dst = tmp;
+		cryp.iv = iv;
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		if (memcmp(tmp, ciphertext + i * SECTOR_SIZE, SECTOR_SIZE)) {
+			fprintf(stderr, "FAIL: sector %d differs from CIOCCRYPT.\n", i);
+			return 1;
+		}
+	}
+
+	/* Decrypt in place */
+	memcpy(tmp, ciphertext, DATA_SIZE);
+	sop.op = COP_DECRYPT;
+	sop.src = sop.dst = tmp;
+	if (ioctl(cfd, CIOCCRYPT_SECTORS, &sop)) {
+		perror("ioctl(CIOCCRYPT_SECTORS)");
+		return 1;
+	}
+	if (memcmp(tmp, plaintext, DATA_SIZE)) {
+		fprintf(stderr,
+			"FAIL: Decrypted data are different from the input data.\n");
+		return 1;
+	}
+
+	/* not a whole number of sectors */
+	sop.len = DATA_SIZE - 16;
+	if (ioctl(cfd, CIOCCRYPT_SECTORS, &sop) == 0) {
+		fprintf(stderr, "FAIL: partial sector was accepted\n");
+		return 1;
+	}
+	sop.len = DATA_SIZE;
+	sop.sector_size = 1000;
+	if (ioctl(cfd, CIOCCRYPT_SECTORS, &sop) == 0) {
+		fprintf(stderr, "FAIL: bad sector size was accepted\n");
+		return 1;
+	}
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the tests with zero copy and through the kernel buffer */
+	if (test_sectors(cfd, 0) || test_sectors(cfd, COP_FLAG_NO_ZC))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Demo on how to have /dev/crypto cipher a single large operation on
+ * several CPUs at once.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	(4 * 1024 * 1024 + 5)	/* not a whole counter block */
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	32
+#define	SECTOR_SIZE	4096
+
+static int
+get_session(int cfd, uint32_t cipher, uint32_t flags, uint32_t *ses)
+{
+	struct session2_op sess;
+	uint8_t key[KEY_SIZE];
+
+	memset(key, 0x42, sizeof(key));
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = cipher;
+	sess.keylen = cipher == CRYPTO_AES_XTS ? 32 : 16;
+	sess.key = key;
+	sess.flags = flags;
+	if (ioctl(cfd, CIOCGSESSION2, &sess)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+
+	*ses = sess.ses;
+	return 0;
+}
+
+static int
+run_op(int cfd, uint32_t ses, uint16_t op, uint8_t *in, uint8_t *out,
+		uint32_t len, uint8_t *iv)
+{
+	struct crypt_op cryp;
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = len;
+	cryp.src = in;
+	cryp.dst = out;
+	cryp.iv = iv;
+	cryp.op = op;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+/* a split session gives the same data and IV as a plain one */
+static int
+test_cipher(int cfd, uint32_t cipher, uint16_t op, uint32_t len,
+		uint8_t *data, uint8_t *out, uint8_t *tmp)
+{
+	uint8_t iv[BLOCK_SIZE], split_iv[BLOCK_SIZE];
+	uint32_t ses, split_ses;
+
+	if (get_session(cfd, cipher, 0, &ses) ||
+	    get_session(cfd, cipher, SES_FLAG_SPLIT, &split_ses))
+		return 1;
+
+	memset(iv, 0xfe, sizeof(iv));
+	memcpy(split_iv, iv, sizeof(iv));
+	if (run_op(cfd, ses, op, data, out, len, iv))
+		return 1;
+
+	/* in place */
+	memcpy(tmp, data, len);
+	if (run_op(cfd, split_ses, op, tmp, tmp, len, split_iv))
+		return 1;
+	if (memcmp(tmp, out, len) != 0) {
+		fprintf(stderr, "FAIL: split operation of cipher %u differs\n",
+			cipher);
+		return 1;
+	}
+	if (memcmp(iv, split_iv, sizeof(iv)) != 0) {
+		fprintf(stderr, "FAIL: split operation of cipher %u left another IV\n",
+			cipher);
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &ses) ||
+	    ioctl(cfd, CIOCFSESSION, &split_ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_sectors(int cfd, uint8_t *data, uint8_t *out, uint8_t *tmp)
+{
+	struct crypt_sector_op sop;
+	uint32_t len = DATA_SIZE - DATA_SIZE % SECTOR_SIZE;
+	uint32_t ses, split_ses;
+
+	if (get_session(cfd, CRYPTO_AES_XTS, 0, &ses) ||
+	    get_session(cfd, CRYPTO_AES_XTS, SES_FLAG_SPLIT, &split_ses))
+		return 1;
+
+	memset(&sop, 0, sizeof(sop));
+	sop.ses = ses;
+	sop.op = COP_ENCRYPT;
+	sop.len = len;
+	sop.sector_size = SECTOR_SIZE;
+	sop.sector = 1000;
+	sop.src = data;
+	sop.dst = out;
+	if (ioctl(cfd, CIOCCRYPT_SECTORS, &sop)) {
+		perror("ioctl(CIOCCRYPT_SECTORS)");
+		return 1;
+	}
+
+	sop.ses = split_ses;
+	sop.dst = tmp;
+	if (ioctl(cfd, CIOCCRYPT_SECTORS, &sop)) {
+		perror("ioctl(CIOCCRYPT_SECTORS)");
+		return 1;
+	}
+	if (memcmp(tmp, out, len) != 0) {
+		fprintf(stderr, "FAIL: split sectors differ\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &ses) ||
+	    ioctl(cfd, CIOCFSESSION, &split_ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_invalid(int cfd)
+{
+	struct session2_op sess;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.mac = CRYPTO_SHA1;
+	sess.flags = SES_FLAG_SPLIT;
+	if (ioctl(cfd, CIOCGSESSION2, &sess) == 0) {
+		fprintf(stderr, "FAIL: split hash session was accepted\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	uint32_t blocks = DATA_SIZE - DATA_SIZE % BLOCK_SIZE;
+	uint8_t *data, *out, *tmp;
+	int fd = -1, cfd = -1;
+	int i;
+
+	if (argc > 1) debug = 1;
+
+	data = malloc(DATA_SIZE);
+	out = malloc(DATA_SIZE);
+	tmp = malloc(DATA_SIZE);
+	if (!data || !out || !tmp) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < DATA_SIZE; i++)
+		data[i] = i * 11;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the tests: the modes that split, and one that does not */
+	if (test_cipher(cfd, CRYPTO_AES_CTR, COP_ENCRYPT, DATA_SIZE,
+			data, out, tmp) ||
+	    test_cipher(cfd, CRYPTO_AES_ECB, COP_ENCRYPT, blocks,
+			data, out, tmp) ||
+	    test_cipher(cfd, CRYPTO_AES_CBC, COP_DECRYPT, blocks,
+			data, out, tmp) ||
+	    test_cipher(cfd, CRYPTO_AES_CBC, COP_ENCRYPT, blocks,
+			data, out, tmp) ||
+	    test_sectors(cfd, data, out, tmp) || test_invalid(cfd))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	free(data);
+	free(out);
+	free(tmp);
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
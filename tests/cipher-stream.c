@@ -0,0 +1,246 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering a stream of
+ * data with read(), write() and splice().
+ *
+ * Placed under public domain.
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	(16 * 1024)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	CHUNK		1000	/* not a whole number of blocks */
+
+static uint8_t plaintext[DATA_SIZE], expected[DATA_SIZE], out[DATA_SIZE];
+
+static int
+get_session(int cfd, uint8_t *key, uint32_t *ses)
+{
+	struct session_op sess;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	*ses = sess.ses;
+	return 0;
+}
+
+/* a descriptor of its own, with an encrypting stream bound to it */
+static int
+open_stream(int fd, uint8_t *key, uint8_t *iv)
+{
+	struct crypt_stream_op stop;
+	int sfd;
+
+	if (ioctl(fd, CRIOGET, &sfd)) {
+		perror("ioctl(CRIOGET)");
+		return -1;
+	}
+
+	memset(&stop, 0, sizeof(stop));
+	if (get_session(sfd, key, &stop.ses))
+		return -1;
+	stop.op = COP_ENCRYPT;
+	stop.iv = iv;
+	if (ioctl(sfd, CIOCSTREAM, &stop)) {
+		perror("ioctl(CIOCSTREAM)");
+		return -1;
+	}
+
+	/* only one per descriptor */
+	if (ioctl(sfd, CIOCSTREAM, &stop) == 0) {
+		fprintf(stderr, "FAIL: second stream was accepted\n");
+		return -1;
+	}
+
+	return sfd;
+}
+
+static int
+test_rw(int fd, uint8_t *key, uint8_t *iv)
+{
+	size_t off, len;
+	ssize_t n;
+	int sfd;
+
+	sfd = open_stream(fd, key, iv);
+	if (sfd < 0)
+		return 1;
+
+	/* what is written in odd chunks comes out of it as a whole */
+	for (off = 0; off < DATA_SIZE; off += len) {
+		len = DATA_SIZE - off < CHUNK ? DATA_SIZE - off : CHUNK;
+		if (write(sfd, plaintext + off, len) != (ssize_t)len) {
+			perror("write");
+			return 1;
+		}
+	}
+	for (off = 0; off < DATA_SIZE; off += n) {
+		n = read(sfd, out + off, DATA_SIZE - off);
+		if (n <= 0) {
+			perror("read");
+			return 1;
+		}
+	}
+	if (memcmp(out, expected, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: stream differs from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	/* nothing more to read */
+	fcntl(sfd, F_SETFL, O_NONBLOCK);
+	if (read(sfd, out, BLOCK_SIZE) >= 0) {
+		fprintf(stderr, "FAIL: read data that was not written\n");
+		return 1;
+	}
+
+	close(sfd);
+	return 0;
+}
+
+/* pipe -> cipher -> pipe, without going through our buffers */
+static int
+test_splice(int fd, uint8_t *key, uint8_t *iv)
+{
+	int in[2], outp[2], sfd;
+	size_t off, len;
+	ssize_t n;
+
+	sfd = open_stream(fd, key, iv);
+	if (sfd < 0)
+		return 1;
+	if (pipe(in) || pipe(outp)) {
+		perror("pipe");
+		return 1;
+	}
+
+	for (off = 0; off < DATA_SIZE; off += len) {
+		len = DATA_SIZE - off < 4096 ? DATA_SIZE - off : 4096;
+		if (write(in[1], plaintext + off, len) != (ssize_t)len) {
+			perror("write");
+			return 1;
+		}
+		if (splice(in[0], NULL, sfd, NULL, len, 0) != (ssize_t)len) {
+			perror("splice(pipe, stream)");
+			return 1;
+		}
+		n = splice(sfd, NULL, outp[1], NULL, len, 0);
+		if (n <= 0) {
+			perror("splice(stream, pipe)");
+			return 1;
+		}
+		if (read(outp[0], out + off, n) != n) {
+			perror("read");
+			return 1;
+		}
+		if ((size_t)n != len) {
+			fprintf(stderr, "FAIL: spliced %zd bytes of %zu\n", n, len);
+			return 1;
+		}
+	}
+	if (memcmp(out, expected, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: spliced stream differs from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	close(in[0]);
+	close(in[1]);
+	close(outp[0]);
+	close(outp[1]);
+	close(sfd);
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	uint8_t key[KEY_SIZE], iv[BLOCK_SIZE];
+	struct crypt_op cryp;
+	uint32_t ses;
+	int fd = -1, cfd = -1;
+	int i;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	memset(key, 0x21, sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+	for (i = 0; i < DATA_SIZE; i++)
+		plaintext[i] = i * 5;
+
+	/* the reference, with a single operation */
+	if (get_session(cfd, key, &ses))
+		return 1;
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = expected;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	/* Run the tests */
+	if (test_rw(fd, key, iv) || test_splice(fd, key, iv))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
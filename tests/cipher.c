@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <crypto/cryptodev.h>
 #include "testhelper.h"
 
@@ -142,6 +143,286 @@ test_crypto(int cfd)
 	return 0;
 }
 
+/* Operations that go through the bounce buffer must give the same
+ * result as zero copy ones, also when they span several chunks */
+#define	NOZC_SIZE	(200*1024 + 48)
+
+static int test_nozc(int cfd)
+{
+	static uint8_t plaintext[NOZC_SIZE], ciphertext[NOZC_SIZE];
+	static uint8_t expected[NOZC_SIZE];
+	static uint8_t unaligned[NOZC_SIZE + 8];
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	int i;
+
+	struct session_op sess;
+	struct crypt_op cryp;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(&cryp, 0, sizeof(cryp));
+
+	memset(key, 0x42, sizeof(key));
+	for (i = 0; i < NOZC_SIZE; i++)
+		plaintext[i] = i;
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* Encrypt with zero copy and through the bounce buffer */
+	memset(iv, 0x07, sizeof(iv));
+	cryp.ses = sess.ses;
+	cryp.len = NOZC_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = expected;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	memset(iv, 0x07, sizeof(iv));
+	cryp.dst = ciphertext;
+	cryp.flags = COP_FLAG_NO_ZC;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(expected, ciphertext, NOZC_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Bounced encryption differs from zero copy.\n");
+		return 1;
+	}
+
+	/* Buffers off the alignment of the driver take the same result */
+	memcpy(unaligned + 1, plaintext, NOZC_SIZE);
+	memset(iv, 0x07, sizeof(iv));
+	cryp.src = unaligned + 1;
+	cryp.dst = unaligned + 1;
+	cryp.flags = 0;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(expected, unaligned + 1, NOZC_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Unaligned encryption differs from aligned.\n");
+		return 1;
+	}
+
+	memset(iv, 0x07, sizeof(iv));
+	cryp.src = unaligned + 1;
+	cryp.dst = ciphertext;
+	cryp.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(plaintext, ciphertext, NOZC_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Unaligned decryption differs from the input data.\n");
+		return 1;
+	}
+
+	memcpy(ciphertext, expected, NOZC_SIZE);
+	cryp.flags = COP_FLAG_NO_ZC;
+
+	/* Decrypt in place through the bounce buffer */
+	memset(iv, 0x07, sizeof(iv));
+	cryp.src = ciphertext;
+	cryp.dst = ciphertext;
+	cryp.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(plaintext, ciphertext, NOZC_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Decrypted data are different from the input data.\n");
+		return 1;
+	}
+
+	if (debug) printf("Bounce buffer test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Single blocks and other tiny operations are copied rather than
+ * pinned; a CBC encryption of a prefix is the prefix of the ciphertext */
+#define	SMALL_MAX	96
+
+static int test_small(int cfd)
+{
+	uint8_t plaintext[DATA_SIZE], expected[DATA_SIZE];
+	uint8_t buf[SMALL_MAX + 1];
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct session_op sess;
+	struct crypt_op cryp;
+	int i, len;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(&cryp, 0, sizeof(cryp));
+
+	memset(key, 0x24, sizeof(key));
+	for (i = 0; i < DATA_SIZE; i++)
+		plaintext[i] = i * 3;
+
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(iv, 0x09, sizeof(iv));
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = expected;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	for (len = BLOCK_SIZE; len <= SMALL_MAX; len += BLOCK_SIZE) {
+		/* in place, off any alignment */
+		memcpy(buf + 1, plaintext, len);
+		memset(iv, 0x09, sizeof(iv));
+		cryp.len = len;
+		cryp.src = cryp.dst = buf + 1;
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		if (memcmp(buf + 1, expected, len) != 0) {
+			fprintf(stderr, "FAIL: encryption of %d bytes differs.\n", len);
+			return 1;
+		}
+
+		memset(iv, 0x09, sizeof(iv));
+		cryp.op = COP_DECRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		if (memcmp(buf + 1, plaintext, len) != 0) {
+			fprintf(stderr, "FAIL: decryption of %d bytes differs.\n", len);
+			return 1;
+		}
+	}
+
+	if (debug) printf("Small operations test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* A buffer that may be backed by a transparent huge page, whose pages
+ * the driver gives to the cipher as few large pieces */
+#define	HUGE_SIZE	(2*1024*1024)
+
+static int test_hugepage(int cfd)
+{
+	static uint8_t expected[HUGE_SIZE];
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	uint8_t *map, *buf;
+	int i;
+
+	struct session_op sess;
+	struct crypt_op cryp;
+
+	map = mmap(NULL, 2 * HUGE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	buf = (uint8_t *)(((uintptr_t)map + HUGE_SIZE - 1) & ~(uintptr_t)(HUGE_SIZE - 1));
+#ifdef MADV_HUGEPAGE
+	madvise(buf, HUGE_SIZE, MADV_HUGEPAGE);
+#endif
+	for (i = 0; i < HUGE_SIZE; i++)
+		buf[i] = i * 3;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(&cryp, 0, sizeof(cryp));
+	memset(key, 0x24, sizeof(key));
+
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* through the bounce buffer first, then in place on the pages */
+	memset(iv, 0x09, sizeof(iv));
+	cryp.ses = sess.ses;
+	cryp.len = HUGE_SIZE;
+	cryp.src = buf;
+	cryp.dst = expected;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	cryp.flags = COP_FLAG_NO_ZC;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	memset(iv, 0x09, sizeof(iv));
+	cryp.dst = buf;
+	cryp.flags = 0;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(expected, buf, HUGE_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Encryption of a huge page differs from bounced.\n");
+		return 1;
+	}
+
+	if (debug) printf("Huge page test passed\n");
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	munmap(map, 2 * HUGE_SIZE);
+	return 0;
+}
+
 static int test_aes(int cfd)
 {
 	uint8_t plaintext1_raw[BLOCK_SIZE + 63], *plaintext1;
@@ -310,6 +591,15 @@ main(int argc, char** argv)
 	if (test_crypto(cfd))
 		return 1;
 
+	if (test_nozc(cfd))
+		return 1;
+
+	if (test_small(cfd))
+		return 1;
+
+	if (test_hugepage(cfd))
+		return 1;
+
 	/* Close cloned descriptor */
 	if (close(cfd)) {
 		perror("close(cfd)");
@@ -0,0 +1,294 @@
+/*
+ * Demo on how to use /dev/crypto device for hashing the contents of
+ * a file without reading it into userspace, and large memory regions
+ * with a single call.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DIGEST_SIZE	32
+#define	FILE_SIZE	(300 * 1024 + 3)
+#define	PIPE_SIZE	1000
+#define	MEM_SIZE	(3 * 1024 * 1024 + 1234)	/* several windows */
+
+static uint8_t data[FILE_SIZE];
+
+/* the digest of len bytes of data with a plain CIOCCRYPT */
+static int
+hash_buf(int cfd, uint32_t ses, uint8_t *buf, uint32_t len, uint8_t *digest)
+{
+	struct crypt_op cryp;
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = len;
+	cryp.src = buf;
+	cryp.mac = digest;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_file(int cfd, uint32_t ses)
+{
+	uint8_t digest[DIGEST_SIZE], expected[DIGEST_SIZE];
+	char name[] = "/tmp/hash-fd.XXXXXX";
+	struct crypt_fd_op fop;
+	int i, fd;
+
+	for (i = 0; i < FILE_SIZE; i++)
+		data[i] = i * 13;
+
+	fd = mkstemp(name);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	unlink(name);
+	if (write(fd, data, FILE_SIZE) != FILE_SIZE) {
+		perror("write");
+		return 1;
+	}
+
+	/* more than there is, hashing stops at the end of the file */
+	memset(&fop, 0, sizeof(fop));
+	fop.ses = ses;
+	fop.fd = fd;
+	fop.offset = 0;
+	fop.len = FILE_SIZE * 2;
+	fop.mac = digest;
+	if (ioctl(cfd, CIOCHASHFD, &fop)) {
+		perror("ioctl(CIOCHASHFD)");
+		return 1;
+	}
+	if (fop.len != FILE_SIZE) {
+		fprintf(stderr, "FAIL: hashed %llu bytes of %d\n",
+			(unsigned long long)fop.len, FILE_SIZE);
+		return 1;
+	}
+	if (hash_buf(cfd, ses, data, FILE_SIZE, expected))
+		return 1;
+	if (memcmp(digest, expected, DIGEST_SIZE) != 0) {
+		fprintf(stderr, "FAIL: digest of the file differs from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	/* a range in two parts, neither of them page aligned */
+	fop.offset = 1000;
+	fop.len = 70000;
+	fop.flags = COP_FLAG_UPDATE | COP_FLAG_RESET;
+	if (ioctl(cfd, CIOCHASHFD, &fop)) {
+		perror("ioctl(CIOCHASHFD)");
+		return 1;
+	}
+	fop.offset = 71000;
+	fop.len = 100001;
+	fop.flags = COP_FLAG_FINAL;
+	if (ioctl(cfd, CIOCHASHFD, &fop)) {
+		perror("ioctl(CIOCHASHFD)");
+		return 1;
+	}
+	if (hash_buf(cfd, ses, data + 1000, 170001, expected))
+		return 1;
+	if (memcmp(digest, expected, DIGEST_SIZE) != 0) {
+		fprintf(stderr, "FAIL: digest of the range differs from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	close(fd);
+
+	/* a descriptor that is not open for reading */
+	fd = open("/dev/null", O_WRONLY);
+	if (fd < 0) {
+		perror("open(/dev/null)");
+		return 1;
+	}
+	fop.fd = fd;
+	fop.offset = 0;
+	fop.flags = 0;
+	if (ioctl(cfd, CIOCHASHFD, &fop) == 0) {
+		fprintf(stderr, "FAIL: hashed a write-only descriptor\n");
+		return 1;
+	}
+	close(fd);
+
+	return 0;
+}
+
+/* files without a page cache are read */
+static int
+test_pipe(int cfd, uint32_t ses)
+{
+	uint8_t digest[DIGEST_SIZE], expected[DIGEST_SIZE];
+	struct crypt_fd_op fop;
+	int fds[2];
+
+	if (pipe(fds)) {
+		perror("pipe");
+		return 1;
+	}
+	if (write(fds[1], data, PIPE_SIZE) != PIPE_SIZE) {
+		perror("write");
+		return 1;
+	}
+	close(fds[1]);
+
+	memset(&fop, 0, sizeof(fop));
+	fop.ses = ses;
+	fop.fd = fds[0];
+	fop.len = FILE_SIZE;
+	fop.mac = digest;
+	if (ioctl(cfd, CIOCHASHFD, &fop)) {
+		perror("ioctl(CIOCHASHFD)");
+		return 1;
+	}
+	close(fds[0]);
+
+	if (hash_buf(cfd, ses, data, PIPE_SIZE, expected))
+		return 1;
+	if (fop.len != PIPE_SIZE || memcmp(digest, expected, DIGEST_SIZE) != 0) {
+		fprintf(stderr, "FAIL: digest of the pipe differs from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+hash_mem(int cfd, uint32_t ses, uint8_t *buf, uint64_t len, uint16_t flags,
+		uint8_t *digest)
+{
+	struct crypt_hash_mem_op hmop;
+
+	memset(&hmop, 0, sizeof(hmop));
+	hmop.ses = ses;
+	hmop.len = len;
+	hmop.flags = flags;
+	hmop.src = buf;
+	hmop.mac = digest;
+	if (ioctl(cfd, CIOCHASHMEM, &hmop)) {
+		perror("ioctl(CIOCHASHMEM)");
+		return 1;
+	}
+	if (hmop.len != len) {
+		fprintf(stderr, "FAIL: hashed %llu bytes of %llu\n",
+			(unsigned long long)hmop.len, (unsigned long long)len);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_mem(int cfd, uint32_t ses)
+{
+	uint8_t digest[DIGEST_SIZE], expected[DIGEST_SIZE];
+	uint8_t *buf;
+	int i;
+
+	buf = malloc(MEM_SIZE);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < MEM_SIZE; i++)
+		buf[i] = i * 7;
+
+	if (hash_buf(cfd, ses, buf, MEM_SIZE, expected) ||
+	    hash_mem(cfd, ses, buf, MEM_SIZE, 0, digest))
+		return 1;
+	if (memcmp(digest, expected, DIGEST_SIZE) != 0) {
+		fprintf(stderr, "FAIL: digest of the memory differs from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	/* in two parts, the second one neither starting nor ending on a page */
+	if (hash_mem(cfd, ses, buf, 1000001, COP_FLAG_UPDATE | COP_FLAG_RESET,
+		     digest) ||
+	    hash_mem(cfd, ses, buf + 1000001, MEM_SIZE - 1000001,
+		     COP_FLAG_FINAL, digest))
+		return 1;
+	if (memcmp(digest, expected, DIGEST_SIZE) != 0) {
+		fprintf(stderr, "FAIL: digest of the parts differs from CIOCCRYPT.\n");
+		return 1;
+	}
+
+	free(buf);
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	struct session_op sess;
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	memset(&sess, 0, sizeof(sess));
+	sess.mac = CRYPTO_SHA2_256;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* Run the tests */
+	if (test_file(cfd, sess.ses) || test_pipe(cfd, sess.ses) ||
+	    test_mem(cfd, sess.ses))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
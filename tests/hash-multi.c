@@ -0,0 +1,205 @@
+/*
+ * Demo on how to use /dev/crypto device for hashing many independent
+ * messages with a single ioctl.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DIGEST_SIZE	32
+#define	NMSGS		6
+
+/* the last one is larger than the bounce area and gets pinned */
+static const uint32_t sizes[NMSGS] = { 0, 1, 64, 1000, 4096, 300 * 1024 };
+
+static int
+test_crypto(int cfd)
+{
+	uint8_t *msgs[NMSGS];
+	uint8_t digests[NMSGS][DIGEST_SIZE], expected[DIGEST_SIZE];
+	int32_t status[NMSGS];
+	int i;
+
+	struct session_op sess;
+	struct crypt_op cryp;
+	struct crypt_hash_vec vecs[NMSGS];
+	struct crypt_hash_multi_op hmop;
+	struct crypt_hash_vec64 vecs64[NMSGS];
+	struct crypt_hash_multi_op64 hmop64;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(vecs, 0, sizeof(vecs));
+
+	sess.mac = CRYPTO_SHA2_256;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < NMSGS; i++) {
+		msgs[i] = malloc(sizes[i] + 1);
+		if (!msgs[i]) {
+			perror("malloc");
+			return 1;
+		}
+		memset(msgs[i], 0x15 + i, sizes[i] + 1);
+
+		vecs[i].src = msgs[i];
+		vecs[i].len = sizes[i];
+		vecs[i].mac = digests[i];
+		status[i] = -1;
+	}
+
+	/* Hash all messages with a single ioctl */
+	memset(&hmop, 0, sizeof(hmop));
+	hmop.ses = sess.ses;
+	hmop.count = NMSGS;
+	hmop.vecs = vecs;
+	hmop.status = status;
+	if (ioctl(cfd, CIOCHASH_MULTI, &hmop)) {
+		perror("ioctl(CIOCHASH_MULTI)");
+		return 1;
+	}
+
+	/* Verify each digest against a single CIOCCRYPT */
+	for (i = 0; i < NMSGS; i++) {
+		if (status[i] != 0) {
+			fprintf(stderr, "FAIL: message %d returned %d\n",
+				i, status[i]);
+			return 1;
+		}
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = sizes[i];
+		cryp.src = msgs[i];
+		cryp.mac = expected;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(expected, digests[i], DIGEST_SIZE) != 0) {
+			fprintf(stderr,
+				"FAIL: digest of message %d differs from CIOCCRYPT.\n", i);
+			return 1;
+		}
+	}
+
+	/* the same through the kernel buffer */
+	memset(digests, 0, sizeof(digests));
+	hmop.flags = COP_FLAG_NO_ZC;
+	hmop.status = NULL;
+	if (ioctl(cfd, CIOCHASH_MULTI, &hmop)) {
+		perror("ioctl(CIOCHASH_MULTI)");
+		return 1;
+	}
+	if (memcmp(expected, digests[NMSGS - 1], DIGEST_SIZE) != 0) {
+		fprintf(stderr, "FAIL: digest without zero copy differs.\n");
+		return 1;
+	}
+
+	/* the same with the fixed-layout structures */
+	memset(digests, 0, sizeof(digests));
+	memset(vecs64, 0, sizeof(vecs64));
+	for (i = 0; i < NMSGS; i++) {
+		vecs64[i].src = (uintptr_t)msgs[i];
+		vecs64[i].len = sizes[i];
+		vecs64[i].mac = (uintptr_t)digests[i];
+	}
+	memset(&hmop64, 0, sizeof(hmop64));
+	hmop64.ses = sess.ses;
+	hmop64.count = NMSGS;
+	hmop64.vecs = (uintptr_t)vecs64;
+	if (ioctl(cfd, CIOCHASH_MULTI64, &hmop64)) {
+		perror("ioctl(CIOCHASH_MULTI64)");
+		return 1;
+	}
+	if (memcmp(expected, digests[NMSGS - 1], DIGEST_SIZE) != 0) {
+		fprintf(stderr, "FAIL: digest of crypt_hash_vec64 differs.\n");
+		return 1;
+	}
+
+	/* an unreadable message must only fail its own element */
+	vecs[1].src = NULL;
+	hmop.flags = 0;
+	hmop.status = status;
+	if (ioctl(cfd, CIOCHASH_MULTI, &hmop)) {
+		perror("ioctl(CIOCHASH_MULTI)");
+		return 1;
+	}
+	if (status[0] != 0 || status[1] == 0 || status[2] != 0) {
+		fprintf(stderr, "FAIL: unexpected status %d/%d/%d\n",
+			status[0], status[1], status[2]);
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	for (i = 0; i < NMSGS; i++)
+		free(msgs[i]);
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
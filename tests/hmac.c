@@ -194,6 +194,24 @@ test_crypto(int cfd)
 		return 1;
 	} else if (debug) printf("HMAC Test 2: passed\n");
 
+	/* In place, the hash has to be done before the encryption; the
+	 * result must be the same as with separate buffers */
+	memcpy(data.decrypted, data.in, sizeof(data.in));
+	cryp.src = data.decrypted;
+	cryp.dst = data.decrypted;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(data.encrypted, data.decrypted, sizeof(data.in)) != 0 ||
+	    memcmp(mac, oldmac, 20) != 0) {
+		fprintf(stderr,
+			"FAIL: In place encryption differs from out of place.\n");
+		return 1;
+	} else if (debug) printf("HMAC Test 3: passed\n");
+
 	/* Finish crypto session */
 	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
 		perror("ioctl(CIOCFSESSION)");
@@ -286,6 +304,169 @@ test_extras(int cfd)
 	return 0;
 }
 
+static int
+hmac_part(int cfd, uint32_t ses, const char *s, uint16_t flags, uint8_t *mac)
+{
+	struct crypt_op cryp;
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = strlen(s);
+	cryp.src = (uint8_t *)s;
+	cryp.mac = mac;
+	cryp.op = COP_ENCRYPT;
+	cryp.flags = flags;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+/* sessions with the same key share the key schedule, until one of
+ * them is given another key */
+static int
+test_shared(int cfd)
+{
+	uint8_t md5_hmac_out[] = "\x75\x0c\x78\x3e\x6a\xb0\xb5\x03\xea\xa8\x6e\x31\x0a\x5d\xb7\x38";
+	uint8_t mac[AALG_MAX_RESULT_LEN], other[AALG_MAX_RESULT_LEN];
+	struct session_op sess[3];
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		memset(&sess[i], 0, sizeof(sess[i]));
+		sess[i].mac = CRYPTO_MD5_HMAC;
+		sess[i].mackey = (uint8_t *)"Jefe";
+		sess[i].mackeylen = 4;
+		if (ioctl(cfd, CIOCGSESSION, &sess[i])) {
+			perror("ioctl(CIOCGSESSION)");
+			return 1;
+		}
+	}
+
+	/* interleaved, each with a state of its own */
+	for (i = 0; i < 3; i++)
+		if (hmac_part(cfd, sess[i].ses, "what do", COP_FLAG_UPDATE, mac))
+			return 1;
+	for (i = 0; i < 3; i++) {
+		memset(mac, 0, sizeof(mac));
+		if (hmac_part(cfd, sess[i].ses, " ya want for nothing?",
+			      COP_FLAG_FINAL, mac))
+			return 1;
+		if (memcmp(mac, md5_hmac_out, 16) != 0) {
+			fprintf(stderr, "FAIL: HMAC of session %d with a shared key differs\n", i);
+			return 1;
+		}
+	}
+
+	/* a new key for the first one leaves the others alone */
+	sess[0].mackey = (uint8_t *)"Jeff";
+	if (ioctl(cfd, CIOCSETKEY, &sess[0])) {
+		perror("ioctl(CIOCSETKEY)");
+		return 1;
+	}
+	if (hmac_part(cfd, sess[0].ses, "what do ya want for nothing?", 0, other) ||
+	    hmac_part(cfd, sess[1].ses, "what do ya want for nothing?", 0, mac))
+		return 1;
+	if (memcmp(mac, md5_hmac_out, 16) != 0 ||
+	    memcmp(other, md5_hmac_out, 16) == 0) {
+		fprintf(stderr, "FAIL: rekeying a session changed the others\n");
+		return 1;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (ioctl(cfd, CIOCFSESSION, &sess[i].ses)) {
+			perror("ioctl(CIOCFSESSION)");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+#ifdef CIOCHASHEXPORT
+/* the state after a common prefix, finished several times over */
+static int
+test_state(int cfd)
+{
+	uint8_t md5_hmac_out[] = "\x75\x0c\x78\x3e\x6a\xb0\xb5\x03\xea\xa8\x6e\x31\x0a\x5d\xb7\x38";
+	uint8_t mac[AALG_MAX_RESULT_LEN], state[1024];
+	struct crypt_hash_state_op hsop;
+	struct session_op sess[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		memset(&sess[i], 0, sizeof(sess[i]));
+		sess[i].mac = CRYPTO_MD5_HMAC;
+		sess[i].mackey = (uint8_t *)"Jefe";
+		sess[i].mackeylen = 4;
+		if (ioctl(cfd, CIOCGSESSION, &sess[i])) {
+			perror("ioctl(CIOCGSESSION)");
+			return 1;
+		}
+	}
+
+	if (hmac_part(cfd, sess[0].ses, "what do", COP_FLAG_UPDATE, mac))
+		return 1;
+
+	memset(&hsop, 0, sizeof(hsop));
+	hsop.ses = sess[0].ses;
+	if (ioctl(cfd, CIOCHASHEXPORT, &hsop)) {
+		perror("ioctl(CIOCHASHEXPORT)");
+		return 1;
+	}
+	if (hsop.len == 0 || hsop.len > sizeof(state)) {
+		fprintf(stderr, "FAIL: hash state of %u bytes\n", hsop.len);
+		return 1;
+	}
+	hsop.state = state;
+	if (ioctl(cfd, CIOCHASHEXPORT, &hsop)) {
+		perror("ioctl(CIOCHASHEXPORT)");
+		return 1;
+	}
+
+	/* into the other session twice, and back into the first one */
+	for (i = 0; i < 3; i++) {
+		hsop.ses = sess[i == 2 ? 0 : 1].ses;
+		if (ioctl(cfd, CIOCHASHIMPORT, &hsop)) {
+			perror("ioctl(CIOCHASHIMPORT)");
+			return 1;
+		}
+		memset(mac, 0, sizeof(mac));
+		if (hmac_part(cfd, hsop.ses, " ya want for nothing?",
+			      COP_FLAG_FINAL, mac))
+			return 1;
+		if (memcmp(mac, md5_hmac_out, 16) != 0) {
+			fprintf(stderr, "FAIL: HMAC from imported state %d differs\n", i);
+			return 1;
+		}
+	}
+
+	/* a state that was tampered with */
+	state[0] ^= 1;
+	if (ioctl(cfd, CIOCHASHIMPORT, &hsop) == 0) {
+		fprintf(stderr, "FAIL: modified hash state was accepted\n");
+		return 1;
+	}
+	state[0] ^= 1;
+
+	/* a state of the wrong size */
+	hsop.len--;
+	if (ioctl(cfd, CIOCHASHIMPORT, &hsop) == 0) {
+		fprintf(stderr, "FAIL: short hash state was accepted\n");
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (ioctl(cfd, CIOCFSESSION, &sess[i].ses)) {
+			perror("ioctl(CIOCFSESSION)");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+#endif
 
 int
 main(int argc, char** argv)
@@ -320,6 +501,14 @@ main(int argc, char** argv)
 	if (test_extras(cfd))
 		return 1;
 
+	if (test_shared(cfd))
+		return 1;
+
+#ifdef CIOCHASHEXPORT
+	if (test_state(cfd))
+		return 1;
+#endif
+
 	/* Close cloned descriptor */
 	if (close(cfd)) {
 		perror("close(cfd)");
@@ -0,0 +1,447 @@
+/*
+ * Compare the throughput of /dev/crypto with the one of openssl, and
+ * fail if it has regressed against a stored baseline.
+ *
+ * For every algorithm and size, operations are run back to back for a
+ * while through /dev/crypto with zero copy, with COP_FLAG_NO_ZC and, if
+ * built with ENABLE_ASYNC, queued with CIOCASYNCCRYPT, and through
+ * openssl_cioccrypt(). The rate of each is printed in operations per
+ * second and in cycles per byte, counted by the TSC where there is one
+ * and in nanoseconds elsewhere.
+ *
+ * A baseline is written with -w and compared against with -b. The kernel
+ * is measured relative to openssl on the same machine, so a kernel mode
+ * has regressed when its ratio to openssl dropped more than the tolerance
+ * (-t, in percent) below the one in the baseline.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#include "openssl_wrapper.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define	BLOCK_SIZE	16
+#define MAX_DATALEN	(64 * 1024)
+#define	ASYNC_DEPTH	16
+
+#define	BASELINE_MAGIC	"cryptodev-perf 1"
+
+struct alg {
+	const char *name;
+	int cipher, keylen;
+	int mac, mackeylen;
+};
+
+static const struct alg algs[] = {
+	{ "aes-128-cbc", CRYPTO_AES_CBC, 16, 0, 0 },
+	{ "aes-256-cbc", CRYPTO_AES_CBC, 32, 0, 0 },
+	{ "aes-128-ecb", CRYPTO_AES_ECB, 16, 0, 0 },
+	{ "sha1", 0, 0, CRYPTO_SHA1, 0 },
+	{ "hmac-sha1", 0, 0, CRYPTO_SHA1_HMAC, 20 },
+	{ "hmac-sha256", 0, 0, CRYPTO_SHA2_256_HMAC, 32 },
+};
+
+#define	NALGS	(sizeof(algs) / sizeof(algs[0]))
+
+static const int sizes[] = { 64, 256, 1024, 4096, 16 * 1024, MAX_DATALEN };
+
+#define	NSIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+enum mode { MODE_ZC, MODE_NO_ZC, MODE_ASYNC, MODE_OPENSSL, NMODES };
+
+static const char *mode_names[NMODES] = { "zc", "no-zc", "async", "openssl" };
+
+/* operations per second, 0 if not measured */
+static double rates[NALGS][NSIZES][NMODES];
+static double baseline[NALGS][NSIZES][NMODES];
+
+static double duration = 0.2;
+
+static uint8_t key[32], mackey[32], iv[BLOCK_SIZE];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return now() * 1e9;
+#endif
+}
+
+static void init_op(struct crypt_op *cryp, struct session_op *sess,
+		uint8_t *buf, uint8_t *mac, int len)
+{
+	memset(cryp, 0, sizeof(*cryp));
+	cryp->ses = sess->ses;
+	cryp->len = len;
+	cryp->src = buf;
+	cryp->dst = sess->cipher ? buf : NULL;
+	cryp->mac = sess->mac ? mac : NULL;
+	cryp->iv = sess->cipher == CRYPTO_AES_CBC ? iv : NULL;
+	cryp->op = COP_ENCRYPT;
+}
+
+#ifdef ENABLE_ASYNC
+/* keeps up to ASYNC_DEPTH jobs queued and fetches one of them */
+static int run_async(int cfd, struct crypt_op *cryp, uint64_t *done,
+		int *inflight)
+{
+	struct crypt_op out;
+	struct pollfd pfd;
+
+	while (*inflight < ASYNC_DEPTH) {
+		if (ioctl(cfd, CIOCASYNCCRYPT, cryp) == 0) {
+			(*inflight)++;
+			continue;
+		}
+		if (errno != EBUSY) {
+			perror("ioctl(CIOCASYNCCRYPT)");
+			return 1;
+		}
+		break;
+	}
+
+	pfd.fd = cfd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, -1) < 1) {
+		perror("poll()");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCASYNCFETCH, &out)) {
+		perror("ioctl(CIOCASYNCFETCH)");
+		return 1;
+	}
+	(*inflight)--;
+	(*done)++;
+	return 0;
+}
+
+static int drain_async(int cfd, int inflight)
+{
+	struct crypt_op out;
+	struct pollfd pfd;
+
+	pfd.fd = cfd;
+	pfd.events = POLLIN;
+	while (inflight--) {
+		if (poll(&pfd, 1, -1) < 1 || ioctl(cfd, CIOCASYNCFETCH, &out)) {
+			perror("ioctl(CIOCASYNCFETCH)");
+			return 1;
+		}
+	}
+	return 0;
+}
+#endif
+
+/* Runs operations of len bytes until the duration is over and stores
+ * their rate in *rate and the cycles per byte in *cpb. */
+static int measure(int cfd, struct session_op *sess, enum mode mode,
+		uint8_t *buf, int len, double *rate, double *cpb)
+{
+	uint8_t mac[AALG_MAX_RESULT_LEN];
+	struct crypt_op cryp;
+	uint64_t done = 0, c0;
+	double t0, elapsed;
+#ifdef ENABLE_ASYNC
+	int inflight = 0;
+#endif
+
+	init_op(&cryp, sess, buf, mac, len);
+	if (mode == MODE_NO_ZC)
+		cryp.flags = COP_FLAG_NO_ZC;
+
+	t0 = now();
+	c0 = cycles();
+	do {
+		switch (mode) {
+		case MODE_ZC:
+		case MODE_NO_ZC:
+			if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+				perror("ioctl(CIOCCRYPT)");
+				return 1;
+			}
+			done++;
+			break;
+#ifdef ENABLE_ASYNC
+		case MODE_ASYNC:
+			if (run_async(cfd, &cryp, &done, &inflight))
+				return 1;
+			break;
+#endif
+		case MODE_OPENSSL:
+			if (openssl_cioccrypt(sess, &cryp)) {
+				fprintf(stderr, "openssl_cioccrypt() failed!\n");
+				return 1;
+			}
+			done++;
+			break;
+		default:
+			return 1;
+		}
+	} while ((elapsed = now() - t0) < duration);
+
+#ifdef ENABLE_ASYNC
+	if (inflight && drain_async(cfd, inflight))
+		return 1;
+#endif
+
+	*rate = done / elapsed;
+	*cpb = (double)(cycles() - c0) / ((double)done * len);
+	return 0;
+}
+
+static int measure_alg(int cfd, int a, uint8_t *buf)
+{
+	struct session_op sess;
+	double cpb;
+	size_t i;
+	int m;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = algs[a].cipher;
+	sess.keylen = algs[a].keylen;
+	sess.key = algs[a].keylen ? key : NULL;
+	sess.mac = algs[a].mac;
+	sess.mackeylen = algs[a].mackeylen;
+	sess.mackey = algs[a].mackeylen ? mackey : NULL;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		fprintf(stderr, "%s: not available, skipped\n", algs[a].name);
+		return 0;
+	}
+
+	for (i = 0; i < NSIZES; i++) {
+		for (m = 0; m < NMODES; m++) {
+#ifndef ENABLE_ASYNC
+			if (m == MODE_ASYNC)
+				continue;
+#endif
+			if (measure(cfd, &sess, m, buf, sizes[i],
+				    &rates[a][i][m], &cpb))
+				return 1;
+			printf("%-12s %6d %-8s %12.0f %10.2f\n", algs[a].name,
+				sizes[i], mode_names[m], rates[a][i][m], cpb);
+		}
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	return 0;
+}
+
+static int find(const char *name, int size, const char *mode,
+		int *a, int *i, int *m)
+{
+	for (*a = 0; *a < (int)NALGS; (*a)++)
+		if (!strcmp(algs[*a].name, name))
+			break;
+	for (*i = 0; *i < (int)NSIZES; (*i)++)
+		if (sizes[*i] == size)
+			break;
+	for (*m = 0; *m < NMODES; (*m)++)
+		if (!strcmp(mode_names[*m], mode))
+			break;
+	return *a < (int)NALGS && *i < (int)NSIZES && *m < NMODES ? 0 : -1;
+}
+
+static int load_baseline(const char *path)
+{
+	char line[256], name[64], mode[16];
+	int a, i, m, size, ret = -1;
+	double rate;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	if (!fgets(line, sizeof(line), fp) ||
+	    strncmp(line, BASELINE_MAGIC "\n", sizeof(BASELINE_MAGIC))) {
+		fprintf(stderr, "%s: not a baseline\n", path);
+		goto out;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%63s %d %15s %lf", name, &size, mode,
+			   &rate) != 4) {
+			fprintf(stderr, "%s: bad line: %s", path, line);
+			goto out;
+		}
+		/* entries of algorithms no longer measured are ignored */
+		if (find(name, size, mode, &a, &i, &m) == 0)
+			baseline[a][i][m] = rate;
+	}
+	ret = 0;
+out:
+	fclose(fp);
+	return ret;
+}
+
+static int save_baseline(const char *path)
+{
+	size_t a, i;
+	FILE *fp;
+	int m;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+
+	fprintf(fp, "%s\n", BASELINE_MAGIC);
+	for (a = 0; a < NALGS; a++)
+		for (i = 0; i < NSIZES; i++)
+			for (m = 0; m < NMODES; m++)
+				if (rates[a][i][m] > 0)
+					fprintf(fp, "%s %d %s %.0f\n",
+						algs[a].name, sizes[i],
+						mode_names[m], rates[a][i][m]);
+
+	return fclose(fp) ? -1 : 0;
+}
+
+/* the number of kernel modes that are slower against openssl than in
+ * the baseline by more than tolerance percent */
+static int compare_baseline(double tolerance)
+{
+	double ratio, base_ratio;
+	int regressions = 0;
+	size_t a, i;
+	int m;
+
+	for (a = 0; a < NALGS; a++) {
+		for (i = 0; i < NSIZES; i++) {
+			if (rates[a][i][MODE_OPENSSL] <= 0 ||
+			    baseline[a][i][MODE_OPENSSL] <= 0)
+				continue;
+			for (m = 0; m < MODE_OPENSSL; m++) {
+				if (rates[a][i][m] <= 0 || baseline[a][i][m] <= 0)
+					continue;
+				ratio = rates[a][i][m] / rates[a][i][MODE_OPENSSL];
+				base_ratio = baseline[a][i][m] /
+					baseline[a][i][MODE_OPENSSL];
+				if (ratio >= base_ratio * (1 - tolerance / 100))
+					continue;
+				printf("REGRESSION: %s %d %s at %.2f of openssl, "
+				       "baseline %.2f\n", algs[a].name, sizes[i],
+				       mode_names[m], ratio, base_ratio);
+				regressions++;
+			}
+		}
+	}
+
+	return regressions;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d msec] [-t percent] [-b baseline] "
+		"[-w baseline]\n", prog);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *base_path = NULL, *save_path = NULL;
+	double tolerance = 10;
+	uint8_t *buf;
+	size_t a;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "d:t:b:w:")) != -1) {
+		switch (opt) {
+		case 'd':
+			duration = atoi(optarg) / 1000.0;
+			break;
+		case 't':
+			tolerance = atof(optarg);
+			break;
+		case 'b':
+			base_path = optarg;
+			break;
+		case 'w':
+			save_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc || duration <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (base_path && load_baseline(base_path))
+		return 1;
+
+	buf = malloc(MAX_DATALEN);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	memset(buf, 0x15, MAX_DATALEN);
+	memset(key, 0x33, sizeof(key));
+	memset(mackey, 0x44, sizeof(mackey));
+	memset(iv, 0x03, sizeof(iv));
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	printf("%-12s %6s %-8s %12s %10s\n", "algorithm", "size", "mode",
+		"ops/s",
+#ifdef HAVE_TSC
+		"cyc/byte"
+#else
+		"nsec/byte"
+#endif
+		);
+	for (a = 0; a < NALGS; a++)
+		if (measure_alg(fd, a, buf))
+			return 1;
+
+	close(fd);
+	free(buf);
+
+	if (save_path && save_baseline(save_path))
+		return 1;
+
+	if (base_path && compare_baseline(tolerance)) {
+		printf("FAIL: slower than the baseline\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * Demo on how to use /dev/crypto device for the public key operations
+ * of CIOCKEY.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	NUM_BITS	2048
+#define	NUM_SIZE	(NUM_BITS / 8)
+
+/* numbers are little endian */
+static uint8_t modulus[NUM_SIZE], base[NUM_SIZE];
+
+static void
+set_small(uint8_t *num, uint8_t v)
+{
+	memset(num, 0, NUM_SIZE);
+	num[0] = v;
+}
+
+/* out = the one result of three numbers in */
+static int
+run_kop(int cfd, uint32_t op, uint8_t *a, uint8_t *b, uint8_t *c,
+		uint8_t *out)
+{
+	struct crypt_kop kop;
+	uint8_t *in[3] = { a, b, c };
+	int i;
+
+	memset(&kop, 0, sizeof(kop));
+	kop.crk_op = op;
+	kop.crk_iparams = 3;
+	kop.crk_oparams = 1;
+	for (i = 0; i < 3; i++) {
+		kop.crk_param[i].crp_p = in[i];
+		kop.crk_param[i].crp_nbits = NUM_BITS;
+	}
+	kop.crk_param[3].crp_p = out;
+	kop.crk_param[3].crp_nbits = NUM_BITS;
+	if (ioctl(cfd, CIOCKEY, &kop)) {
+		perror("ioctl(CIOCKEY)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+mod_exp(int cfd, uint8_t *b, uint8_t *e, uint8_t *out)
+{
+	return run_kop(cfd, CRK_MOD_EXP, b, e, modulus, out);
+}
+
+/* (x ^ 3) ^ 5 = (x ^ 5) ^ 3 = x ^ 15 and x ^ 1 = x */
+static int
+test_mod_exp(int cfd)
+{
+	uint8_t e[NUM_SIZE], t[NUM_SIZE], r[3][NUM_SIZE];
+
+	set_small(e, 1);
+	if (mod_exp(cfd, base, e, r[0]))
+		return 1;
+	if (memcmp(r[0], base, NUM_SIZE)) {
+		fprintf(stderr, "FAIL: x ^ 1 differs from x\n");
+		return 1;
+	}
+
+	set_small(e, 3);
+	if (mod_exp(cfd, base, e, t))
+		return 1;
+	set_small(e, 5);
+	if (mod_exp(cfd, t, e, r[0]))
+		return 1;
+	if (mod_exp(cfd, base, e, t))
+		return 1;
+	set_small(e, 3);
+	if (mod_exp(cfd, t, e, r[1]))
+		return 1;
+	set_small(e, 15);
+	if (mod_exp(cfd, base, e, r[2]))
+		return 1;
+	if (memcmp(r[0], r[1], NUM_SIZE) || memcmp(r[0], r[2], NUM_SIZE)) {
+		fprintf(stderr, "FAIL: powers of x do not agree\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* both sides of an exchange get the same secret */
+static int
+test_dh(int cfd, int have_mod_exp)
+{
+	uint8_t g[NUM_SIZE], x[2][NUM_SIZE], y[2][NUM_SIZE];
+	uint8_t s[3][NUM_SIZE];
+	int i;
+
+	set_small(g, 2);
+	for (i = 0; i < 2; i++) {
+		memset(x[i], 0, NUM_SIZE);
+		memset(x[i], 0x5a + i, 32);
+	}
+
+	/* the public values, g ^ x, are needed first */
+	if (!have_mod_exp) {
+		if (debug)
+			printf("no CRK_MOD_EXP for the public values\n");
+		return 0;
+	}
+	for (i = 0; i < 2; i++)
+		if (mod_exp(cfd, g, x[i], y[i]))
+			return 1;
+
+	if (run_kop(cfd, CRK_DH_COMPUTE_KEY, x[0], y[1], modulus, s[0]) ||
+	    run_kop(cfd, CRK_DH_COMPUTE_KEY, x[1], y[0], modulus, s[1]) ||
+	    mod_exp(cfd, y[1], x[0], s[2]))
+		return 1;
+	if (memcmp(s[0], s[1], NUM_SIZE) || memcmp(s[0], s[2], NUM_SIZE)) {
+		fprintf(stderr, "FAIL: DH shared secrets differ\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_invalid(int cfd)
+{
+	struct crypt_kop kop;
+
+	memset(&kop, 0, sizeof(kop));
+	kop.crk_op = CRK_MOD_EXP;
+	kop.crk_iparams = 2;
+	kop.crk_oparams = 1;
+	if (ioctl(cfd, CIOCKEY, &kop) == 0) {
+		fprintf(stderr, "FAIL: missing parameter was accepted\n");
+		return 1;
+	}
+
+	kop.crk_op = CRK_ALGORITHM_ALL;
+	kop.crk_iparams = 3;
+	if (ioctl(cfd, CIOCKEY, &kop) == 0) {
+		fprintf(stderr, "FAIL: unknown operation was accepted\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1, i;
+	uint32_t features;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCASYMFEAT, &features)) {
+		perror("ioctl(CIOCASYMFEAT)");
+		return 1;
+	}
+	if (debug)
+		printf("public key features: 0x%x\n", features);
+
+	/* an odd modulus of full size; it needs not be a prime here */
+	for (i = 0; i < NUM_SIZE; i++) {
+		modulus[i] = i * 37 + 11;
+		base[i] = i * 13;
+	}
+	modulus[0] |= 1;
+	modulus[NUM_SIZE - 1] |= 0x80;
+	base[NUM_SIZE - 1] = 0;
+
+	/* Run the tests for what the kernel can do */
+	if ((features & CRF_MOD_EXP) && test_mod_exp(cfd))
+		return 1;
+	if ((features & CRF_DH_COMPUTE_KEY) &&
+	    test_dh(cfd, features & CRF_MOD_EXP))
+		return 1;
+	if (test_invalid(cfd))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,414 @@
+/*
+ * Demo on how to use many /dev/crypto sessions on a single descriptor,
+ * and how to share a session between descriptors.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	64
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NSESSIONS	4096
+
+static uint32_t ses[NSESSIONS];
+
+static int
+encrypt(int cfd, uint32_t sid, uint8_t *data, uint8_t *out)
+{
+	struct crypt_op cryp;
+	uint8_t iv[BLOCK_SIZE];
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sid;
+	cryp.len = DATA_SIZE;
+	cryp.src = data;
+	cryp.dst = out;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+
+	return ioctl(cfd, CIOCCRYPT, &cryp);
+}
+
+static int
+test_sessions(int cfd)
+{
+	uint8_t data[DATA_SIZE], out[251][DATA_SIZE], tmp[DATA_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct session_op sess;
+	int i, j;
+
+	memset(data, 0x15, sizeof(data));
+
+	/* Create the sessions; each distinct key gives a distinct result */
+	for (i = 0; i < NSESSIONS; i++) {
+		memset(&sess, 0, sizeof(sess));
+		memset(key, 0, sizeof(key));
+		key[0] = i % 251;
+		sess.cipher = CRYPTO_AES_CBC;
+		sess.keylen = KEY_SIZE;
+		sess.key = key;
+		if (ioctl(cfd, CIOCGSESSION, &sess)) {
+			perror("ioctl(CIOCGSESSION)");
+			return 1;
+		}
+		ses[i] = sess.ses;
+
+		for (j = 0; j < i; j++) {
+			if (ses[j] == ses[i]) {
+				fprintf(stderr, "FAIL: duplicate sid 0x%08x\n", ses[i]);
+				return 1;
+			}
+		}
+
+		if (i < 251 && encrypt(cfd, ses[i], data, out[i])) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("%d sessions created\n", NSESSIONS);
+
+	/* Every session finds its own keys */
+	for (i = NSESSIONS - 1; i >= 0; i--) {
+		if (encrypt(cfd, ses[i], data, tmp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		if (memcmp(tmp, out[i % 251], DATA_SIZE) != 0) {
+			fprintf(stderr, "FAIL: session %d gave a wrong result\n", i);
+			return 1;
+		}
+	}
+
+	/* Finish every other session; finished ones must be gone */
+	for (i = 0; i < NSESSIONS; i += 2) {
+		if (ioctl(cfd, CIOCFSESSION, &ses[i])) {
+			perror("ioctl(CIOCFSESSION)");
+			return 1;
+		}
+	}
+	for (i = 0; i < NSESSIONS; i++) {
+		if ((encrypt(cfd, ses[i], data, tmp) == 0) != (i & 1)) {
+			fprintf(stderr, "FAIL: session %d %s\n", i,
+				(i & 1) ? "is lost" : "is still usable");
+			return 1;
+		}
+	}
+	if (ioctl(cfd, CIOCFSESSION, &ses[0]) == 0) {
+		fprintf(stderr, "FAIL: finished a session twice\n");
+		return 1;
+	}
+
+	/* A clone has the algorithm of its template and a key of its own */
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0, sizeof(key));
+	key[0] = 7;
+	sess.ses = ses[1];
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCCLONESESSION, &sess)) {
+		perror("ioctl(CIOCCLONESESSION)");
+		return 1;
+	}
+	if (sess.cipher != CRYPTO_AES_CBC || sess.ses == ses[1]) {
+		fprintf(stderr, "FAIL: clone got cipher %u and sid 0x%08x\n",
+			sess.cipher, sess.ses);
+		return 1;
+	}
+	if (encrypt(cfd, sess.ses, data, tmp) ||
+	    memcmp(tmp, out[7], DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: clone gave a wrong result\n");
+		return 1;
+	}
+	sess.ses = ses[0];
+	if (ioctl(cfd, CIOCCLONESESSION, &sess) == 0) {
+		fprintf(stderr, "FAIL: cloned a finished session\n");
+		return 1;
+	}
+
+	/* A rekeyed session behaves like a new one with that key */
+	memset(&sess, 0, sizeof(sess));
+	key[0] = 9;
+	sess.ses = ses[1];
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCSETKEY, &sess)) {
+		perror("ioctl(CIOCSETKEY)");
+		return 1;
+	}
+	if (encrypt(cfd, ses[1], data, tmp) ||
+	    memcmp(tmp, out[9], DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: rekeyed session gave a wrong result\n");
+		return 1;
+	}
+	sess.key = NULL;
+	sess.mackeylen = KEY_SIZE;
+	sess.mackey = key;
+	if (ioctl(cfd, CIOCSETKEY, &sess) == 0) {
+		fprintf(stderr, "FAIL: set a MAC key on a cipher session\n");
+		return 1;
+	}
+	sess.ses = ses[0];
+	sess.mackey = NULL;
+	sess.key = key;
+	if (ioctl(cfd, CIOCSETKEY, &sess) == 0) {
+		fprintf(stderr, "FAIL: rekeyed a finished session\n");
+		return 1;
+	}
+
+	/* The rest is released on close */
+	if (debug)
+		printf("Test passed\n");
+
+	return 0;
+}
+
+#define	NBATCH	1000
+
+static struct session_op sops[NBATCH];
+static int32_t status[NBATCH + 1];
+
+/* Create and finish sessions with a single ioctl each */
+static int
+test_batch(int cfd)
+{
+	uint8_t data[DATA_SIZE], tmp[DATA_SIZE], ref[DATA_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct crypt_multi_op mop;
+	uint32_t sids[NBATCH + 1];
+	int i;
+
+	memset(data, 0x15, sizeof(data));
+	memset(key, 0x42, sizeof(key));
+	for (i = 0; i < NBATCH; i++) {
+		sops[i].cipher = CRYPTO_AES_CBC;
+		sops[i].keylen = KEY_SIZE;
+		sops[i].key = key;
+	}
+	/* one bad element fails on its own */
+	sops[NBATCH / 2].cipher = 0xffff;
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = NBATCH;
+	mop.ops = sops;
+	mop.status = status;
+	if (ioctl(cfd, CIOCGSESSION_MULTI, &mop)) {
+		perror("ioctl(CIOCGSESSION_MULTI)");
+		return 1;
+	}
+
+	for (i = 0; i < NBATCH; i++) {
+		if ((status[i] == 0) != (i != NBATCH / 2)) {
+			fprintf(stderr, "FAIL: session %d returned %d\n",
+				i, status[i]);
+			return 1;
+		}
+		if (i == NBATCH / 2)
+			continue;
+
+		if (encrypt(cfd, sops[i].ses, data, tmp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		if (i == 0)
+			memcpy(ref, tmp, sizeof(ref));
+		else if (memcmp(tmp, ref, DATA_SIZE) != 0) {
+			fprintf(stderr, "FAIL: session %d gave a wrong result\n", i);
+			return 1;
+		}
+	}
+
+	/* finish them all; two of the IDs are finished twice and fail */
+	for (i = 0; i < NBATCH; i++)
+		sids[i] = sops[i].ses;
+	sids[NBATCH / 2] = sids[0];
+	sids[NBATCH] = sids[1];
+	mop.count = NBATCH + 1;
+	mop.ops = sids;
+	if (ioctl(cfd, CIOCFSESSION_MULTI, &mop)) {
+		perror("ioctl(CIOCFSESSION_MULTI)");
+		return 1;
+	}
+	if (status[0] || status[NBATCH / 2] == 0 || status[NBATCH] == 0) {
+		fprintf(stderr, "FAIL: unexpected status %d/%d/%d\n",
+			status[0], status[NBATCH / 2], status[NBATCH]);
+		return 1;
+	}
+	if (encrypt(cfd, sids[NBATCH - 1], data, tmp) == 0) {
+		fprintf(stderr, "FAIL: finished session is still usable\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* a worker with a descriptor of its own uses the exported session */
+static int
+shared_worker(int sfd, uint8_t *data, uint8_t *expected)
+{
+	struct crypt_ses_share_op shop;
+	uint8_t tmp[DATA_SIZE];
+	int wfd;
+
+	wfd = open("/dev/crypto", O_RDWR, 0);
+	if (wfd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	memset(&shop, 0, sizeof(shop));
+	shop.fd = sfd;
+	if (ioctl(wfd, CIOCSESATTACH, &shop)) {
+		perror("ioctl(CIOCSESATTACH)");
+		return 1;
+	}
+	if (encrypt(wfd, shop.ses, data, tmp) ||
+	    memcmp(tmp, expected, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: attached session gave a wrong result\n");
+		return 1;
+	}
+
+	close(wfd);
+	return 0;
+}
+
+static int
+test_shared(int cfd)
+{
+	uint8_t data[DATA_SIZE], out[DATA_SIZE], tmp[DATA_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct crypt_ses_share_op shop;
+	struct session_op sess;
+	int status;
+	pid_t pid;
+
+	memset(data, 0x25, sizeof(data));
+	memset(key, 0x77, sizeof(key));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+	if (encrypt(cfd, sess.ses, data, out)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	memset(&shop, 0, sizeof(shop));
+	shop.ses = sess.ses;
+	if (ioctl(cfd, CIOCSESEXPORT, &shop)) {
+		perror("ioctl(CIOCSESEXPORT)");
+		return 1;
+	}
+
+	/* the key is fixed from now on */
+	if (ioctl(cfd, CIOCSETKEY, &sess) == 0) {
+		fprintf(stderr, "FAIL: rekeyed an exported session\n");
+		return 1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0)
+		_exit(shared_worker(shop.fd, data, out));
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "FAIL: worker with the shared session failed\n");
+		return 1;
+	}
+
+	/* the session outlives the one it was exported from */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	shop.ses = 0;
+	if (ioctl(cfd, CIOCSESATTACH, &shop)) {
+		perror("ioctl(CIOCSESATTACH)");
+		return 1;
+	}
+	close(shop.fd);
+	if (encrypt(cfd, shop.ses, data, tmp) ||
+	    memcmp(tmp, out, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: attached session gave a wrong result\n");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCFSESSION, &shop.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	/* only exported sessions can be attached to */
+	shop.fd = cfd;
+	if (ioctl(cfd, CIOCSESATTACH, &shop) == 0) {
+		fprintf(stderr, "FAIL: attached to a /dev/crypto descriptor\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_sessions(cfd) || test_batch(cfd) || test_shared(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * Demo on how to read the performance counters of /dev/crypto.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+#include "testhelper.h"
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NOPS		4
+
+static void print_stats(const char *what, struct crypt_stats_op *stop)
+{
+	int i;
+
+	printf("%s: %llu ops, %llu bytes, %llu zero copy, %llu bounced, "
+		"%llu fallbacks, %llu page errors, %llu reallocations\n", what,
+		(unsigned long long)stop->ops, (unsigned long long)stop->bytes,
+		(unsigned long long)stop->zc_ops,
+		(unsigned long long)stop->bounced_ops,
+		(unsigned long long)stop->zc_fallbacks,
+		(unsigned long long)stop->userbuf_errors,
+		(unsigned long long)stop->sg_reallocs);
+	printf("  latency:");
+	for (i = 0; i < CRYPTO_STATS_LAT_BUCKETS; i++)
+		printf(" <%luus:%llu", 1UL << i,
+			(unsigned long long)stop->latency[i]);
+	printf("\n");
+}
+
+static int
+test_crypto(int cfd)
+{
+	uint8_t plaintext_raw[DATA_SIZE + 63], *plaintext;
+	uint8_t ciphertext_raw[DATA_SIZE + 63], *ciphertext;
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	uint64_t nlat;
+	int i;
+
+	struct session_op sess;
+#ifdef CIOCGSESSINFO
+	struct session_info_op siop;
+#endif
+	struct crypt_op cryp;
+	struct crypt_stats_op stop;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(&cryp, 0, sizeof(cryp));
+
+	memset(key, 0x33, sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+#ifdef CIOCGSESSINFO
+	siop.ses = sess.ses;
+	if (ioctl(cfd, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	plaintext = buf_align(plaintext_raw, siop.alignmask);
+	ciphertext = buf_align(ciphertext_raw, siop.alignmask);
+#else
+	plaintext = plaintext_raw;
+	ciphertext = ciphertext_raw;
+#endif
+	memset(plaintext, 0x15, DATA_SIZE);
+
+	/* Run a few operations, the last one through the bounce buffer */
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = ciphertext;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	for (i = 0; i < NOPS; i++) {
+		if (i == NOPS - 1)
+			cryp.flags = COP_FLAG_NO_ZC;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+	}
+
+	/* Check the counters of the session */
+	memset(&stop, 0, sizeof(stop));
+	stop.ses = sess.ses;
+	if (ioctl(cfd, CIOCGSTATS, &stop)) {
+		perror("ioctl(CIOCGSTATS)");
+		return 1;
+	}
+	if (debug)
+		print_stats("session", &stop);
+
+	for (nlat = 0, i = 0; i < CRYPTO_STATS_LAT_BUCKETS; i++)
+		nlat += stop.latency[i];
+
+	if (stop.ops != NOPS || stop.bytes != NOPS * DATA_SIZE ||
+	    stop.zc_ops + stop.bounced_ops != NOPS ||
+	    stop.bounced_ops < 1 || nlat != NOPS) {
+		fprintf(stderr, "FAIL: unexpected session counters\n");
+		return 1;
+	}
+
+	/* The totals include at least this session, and are only there
+	 * for the administrator */
+	memset(&stop, 0, sizeof(stop));
+	if (ioctl(cfd, CIOCGSTATS, &stop) == 0) {
+		if (debug)
+			print_stats("total", &stop);
+
+		if (stop.ops < NOPS || stop.bytes < NOPS * DATA_SIZE ||
+		    stop.async_pending != 0) {
+			fprintf(stderr, "FAIL: unexpected total counters\n");
+			return 1;
+		}
+	} else if (errno != EPERM || geteuid() == 0) {
+		perror("ioctl(CIOCGSTATS)");
+		return 1;
+	}
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	/* which can no longer be queried */
+	stop.ses = sess.ses;
+	if (ioctl(cfd, CIOCGSTATS, &stop) == 0) {
+		fprintf(stderr, "FAIL: counters of a finished session\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really needed here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -32,11 +32,18 @@
 #include <linux/syscalls.h>
 #include <linux/pagemap.h>
 #include <linux/uaccess.h>
+#include <linux/capability.h>
+#include <linux/cred.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0))
+# include <linux/sched/signal.h>
+# include <linux/sched/user.h>
+#endif
 #include <crypto/scatterwalk.h>
 #include <linux/scatterlist.h>
 #include "cryptodev_int.h"
 #include "zc.h"
 #include "version.h"
+#include "cryptodev_trace.h"
 
 /* Helper functions to assist zero copy.
  * This needs to be redesigned and moved out of the session. --nmav
@@ -45,102 +52,236 @@
 /* offset of buf in it's first page */
 #define PAGEOFFSET(buf) ((unsigned long)buf & ~PAGE_MASK)
 
-/* fetch the pages addr resides in into pg and initialise sg with them */
-int __get_userbuf(uint8_t __user *addr, uint32_t len, int write,
-		unsigned int pgcount, struct page **pg, struct scatterlist *sg,
-		struct task_struct *task, struct mm_struct *mm)
+/* A region of user memory pinned once with CIOCREGBUF, whose pages are
+ * then used by operations on it without walking the page tables.
+ * Readers walk fcr->bufs under RCU, updates are serialized by fcr->sem.
+ *
+ * Buffers allocated with CIOCALLOCBUF use the same structure, with the
+ * pages owned by the driver. Their address and mm are only set while
+ * they are mmap()ed. */
+struct cryptodev_buf {
+	struct list_head entry;
+	uint32_t id;
+	int writable;
+	unsigned long addr;
+	uint32_t len;
+	uint32_t alloc_len;	/* of a kernel buffer; len is what is mapped */
+	struct mm_struct *mm;
+	unsigned int npages;
+	struct page **pages;
+	unsigned long pgoff;	/* mmap offset of kernel buffers, else 0 */
+	int mapped;		/* the VMAs of a kernel buffer */
+	struct fcrypt *fcr;
+	struct user_struct *user;	/* charged for the pages */
+	struct mm_struct *mm_account;	/* the pages are pinned in */
+};
+
+/* Maximum size of a registered region, in pages */
+#define MAX_BUF_PAGES 1024
+
+/* pin pgcount pages starting at addr in mm */
+static int pin_user_range(unsigned long addr, unsigned int pgcount, int write,
+		struct page **pg, struct task_struct *task, struct mm_struct *mm)
 {
-	int ret, pglen, i = 0;
-	struct scatterlist *sgp;
+	int ret;
 
-	if (unlikely(!pgcount || !len || !addr)) {
-		sg_mark_end(sg);
-		return 0;
+	/* our own pages are found without taking mmap_sem */
+	if (mm == current->mm) {
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0))
+		ret = get_user_pages_fast(addr, pgcount, write, pg);
+#else
+		ret = get_user_pages_fast(addr, pgcount,
+				write ? FOLL_WRITE : 0, pg);
+#endif
+		return ret;
 	}
 
 	down_read(&mm->mmap_sem);
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 6, 0))
 	ret = get_user_pages(task, mm,
-			(unsigned long)addr, pgcount, write, 0, pg, NULL);
+			addr, pgcount, write, 0, pg, NULL);
 #elif (LINUX_VERSION_CODE < KERNEL_VERSION(4, 9, 0))
 	ret = get_user_pages_remote(task, mm,
-			(unsigned long)addr, pgcount, write, 0, pg, NULL);
+			addr, pgcount, write, 0, pg, NULL);
 #elif (LINUX_VERSION_CODE < KERNEL_VERSION(4, 10, 0))
 	ret = get_user_pages_remote(task, mm,
-			(unsigned long)addr, pgcount, write ? FOLL_WRITE : 0,
+			addr, pgcount, write ? FOLL_WRITE : 0,
 			pg, NULL);
 #else
 	ret = get_user_pages_remote(task, mm,
-			(unsigned long)addr, pgcount, write ? FOLL_WRITE : 0,
+			addr, pgcount, write ? FOLL_WRITE : 0,
 			pg, NULL, NULL);
 #endif
 	up_read(&mm->mmap_sem);
-	if (ret != pgcount)
-		return -EINVAL;
+
+	return ret;
+}
+
+/* Take references to the pages of a registered region that covers
+ * addr..addr+len. Returns zero on success. */
+static int get_registered_pages(struct fcrypt *fcr, unsigned long addr,
+		uint32_t len, int write, unsigned int pgcount,
+		struct page **pg, struct mm_struct *mm)
+{
+	struct cryptodev_buf *buf;
+	unsigned int first, i;
+	unsigned long start;
+	int ret = -ENOENT;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(buf, &fcr->bufs, entry) {
+		if (smp_load_acquire(&buf->mm) != mm)
+			continue;
+		/* a mapped kernel buffer moves with mremap() */
+		start = READ_ONCE(buf->addr);
+		if (addr < start || addr + len > start + buf->len ||
+		    (write && !buf->writable))
+			continue;
+
+		/* the region keeps the pages pinned until a grace period
+		 * after it was unregistered */
+		first = (addr >> PAGE_SHIFT) - (start >> PAGE_SHIFT);
+		for (i = 0; i < pgcount; i++) {
+			pg[i] = buf->pages[first + i];
+			get_page(pg[i]);
+		}
+		ret = 0;
+		break;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/* Longest scatterlist entry built from contiguous pages; the default
+ * DMA segment size, so that engines can map the entries as they are */
+#define MAX_SG_SEGMENT (64 * 1024)
+
+/* fetch the pages addr resides in into pg and initialise sg with them.
+ * Physically contiguous pages, as of huge pages, share an entry.
+ * Returns the number of entries used. */
+int __get_userbuf(struct fcrypt *fcr, uint8_t __user *addr, uint32_t len, int write,
+		unsigned int pgcount, struct page **pg, struct scatterlist *sg,
+		struct task_struct *task, struct mm_struct *mm)
+{
+	int ret, pglen, i = 0;
+	struct scatterlist *sgp;
+
+	if (unlikely(!pgcount || !len || !addr)) {
+		sg_mark_end(sg);
+		return 0;
+	}
+
+	if (!fcr || list_empty(&fcr->bufs) ||
+	    get_registered_pages(fcr, (unsigned long)addr, len, write,
+				 pgcount, pg, mm)) {
+		ret = pin_user_range((unsigned long)addr, pgcount, write, pg,
+				task, mm);
+		if (ret != pgcount) {
+			while (ret > 0)
+				put_page(pg[--ret]);
+			return -EINVAL;
+		}
+	}
 
 	sg_init_table(sg, pgcount);
 
 	pglen = min((ptrdiff_t)(PAGE_SIZE - PAGEOFFSET(addr)), (ptrdiff_t)len);
-	sg_set_page(sg, pg[i++], pglen, PAGEOFFSET(addr));
+	sgp = sg;
+	sg_set_page(sgp, pg[i++], pglen, PAGEOFFSET(addr));
 
 	len -= pglen;
-	for (sgp = sg_next(sg); len; sgp = sg_next(sgp)) {
+	while (len) {
 		pglen = min((uint32_t)PAGE_SIZE, len);
-		sg_set_page(sgp, pg[i++], pglen, 0);
+		if (page_to_pfn(pg[i]) == page_to_pfn(pg[i - 1]) + 1 &&
+		    sgp->length + pglen <= MAX_SG_SEGMENT) {
+			sgp->length += pglen;
+		} else {
+			sgp = sg_next(sgp);
+			sg_set_page(sgp, pg[i], pglen, 0);
+		}
+		i++;
 		len -= pglen;
 	}
-	sg_mark_end(sg_last(sg, pgcount));
-	return 0;
+	sg_mark_end(sgp);
+	return sgp - sg + 1;
 }
 
-int adjust_sg_array(struct csession *ses, int pagecount)
+int adjust_sg_array(struct cryptodev_pages *zc, int pagecount)
 {
 	struct scatterlist *sg;
 	struct page **pages;
 	int array_size;
 
-	for (array_size = ses->array_size; array_size < pagecount;
-	     array_size *= 2)
+	if (zc->array_size && zc->array_size >= pagecount)
+		return 0;
+
+	/* arrays that were never allocated start out with the default size */
+	for (array_size = zc->array_size ? : DEFAULT_PREALLOC_PAGES;
+	     array_size < pagecount; array_size *= 2)
 		;
-	ddebug(0, "reallocating from %d to %d pages",
-			ses->array_size, array_size);
-	pages = krealloc(ses->pages, array_size * sizeof(struct page *),
-			 GFP_KERNEL);
+	/* allocating them for the first time is nothing to report */
+	ddebug(zc->array_size ? 0 : 2, "reallocating from %d to %d pages",
+			zc->array_size, array_size);
+	if (zc->array_size)
+		cryptodev_stat_inc(NULL, CRYPTODEV_STAT_SG_REALLOC);
+	/* nothing is pinned yet, so the old contents need not be kept */
+	pages = kmalloc_node(array_size * sizeof(struct page *), GFP_KERNEL,
+			     zc->node);
 	if (unlikely(!pages))
 		return -ENOMEM;
-	ses->pages = pages;
-	sg = krealloc(ses->sg, array_size * sizeof(struct scatterlist),
-		      GFP_KERNEL);
+	kfree(zc->pages);
+	zc->pages = pages;
+	sg = kmalloc_node(array_size * sizeof(struct scatterlist), GFP_KERNEL,
+			  zc->node);
 	if (unlikely(!sg))
 		return -ENOMEM;
-	ses->sg = sg;
-	ses->array_size = array_size;
+	kfree(zc->sg);
+	zc->sg = sg;
+	zc->array_size = array_size;
 
 	return 0;
 }
 
-void release_user_pages(struct csession *ses)
+void release_user_pages(struct cryptodev_pages *zc)
 {
-	unsigned int i;
+	unsigned int i, n = zc->used_pages;
 
-	for (i = 0; i < ses->used_pages; i++) {
-		if (!PageReserved(ses->pages[i]))
-			SetPageDirty(ses->pages[i]);
+	trace_cryptodev_unpin_start(n, 0);
+	for (i = 0; i < n; i++) {
+		if (!PageReserved(zc->pages[i]))
+			SetPageDirty(zc->pages[i]);
 
-		if (ses->readonly_pages == 0)
-			flush_dcache_page(ses->pages[i]);
+		if (zc->readonly_pages == 0)
+			flush_dcache_page(zc->pages[i]);
 		else
-			ses->readonly_pages--;
+			zc->readonly_pages--;
+
+		put_page(zc->pages[i]);
+	}
+	zc->used_pages = 0;
+	trace_cryptodev_unpin_end(n, 0);
 
-		put_page(ses->pages[i]);
+	/* Arrays that grew for a burst of large operations are given back
+	 * once that many small ones followed, the next operation allocates
+	 * them at the default size again. */
+	if (zc->array_size > DEFAULT_PREALLOC_PAGES) {
+		if (n > zc->array_size / 4) {
+			zc->small_ops = 0;
+		} else if (++zc->small_ops >= ZC_SHRINK_OPS) {
+			ddebug(2, "releasing space for %d user pages",
+					zc->array_size);
+			kfree(zc->pages);
+			kfree(zc->sg);
+			zc->pages = NULL;
+			zc->sg = NULL;
+			zc->array_size = 0;
+			zc->small_ops = 0;
+		}
 	}
-	ses->used_pages = 0;
 }
 
-/* make src and dst available in scatterlists.
- * dst might be the same as src.
- */
-int get_userbuf(struct csession *ses,
+static int get_userbuf_pages(struct fcrypt *fcr, struct cryptodev_pages *zc,
                 void *__user src, unsigned int src_len,
                 void *__user dst, unsigned int dst_len,
                 struct task_struct *task, struct mm_struct *mm,
@@ -163,13 +304,14 @@ int get_userbuf(struct csession *ses,
 	src_pagecount = PAGECOUNT(src, src_len);
 	dst_pagecount = PAGECOUNT(dst, dst_len);
 
-	ses->used_pages = (src == dst) ? max(src_pagecount, dst_pagecount)
+	zc->used_pages = (src == dst) ? max(src_pagecount, dst_pagecount)
 	                               : src_pagecount + dst_pagecount;
 
-	ses->readonly_pages = (src == dst) ? 0 : src_pagecount;
+	zc->readonly_pages = (src == dst) ? 0 : src_pagecount;
 
-	if (ses->used_pages > ses->array_size) {
-		rc = adjust_sg_array(ses, ses->used_pages);
+	/* the arrays are allocated on first use */
+	if (zc->used_pages > zc->array_size || !zc->array_size) {
+		rc = adjust_sg_array(zc, zc->used_pages);
 		if (rc)
 			return rc;
 	}
@@ -179,13 +321,13 @@ int get_userbuf(struct csession *ses,
 		 * more data than the ones we read. */
 		if (src_len < dst_len)
 			src_len = dst_len;
-		rc = __get_userbuf(src, src_len, 1, ses->used_pages,
-			               ses->pages, ses->sg, task, mm);
-		if (unlikely(rc)) {
+		rc = __get_userbuf(fcr, src, src_len, 1, zc->used_pages,
+			               zc->pages, zc->sg, task, mm);
+		if (unlikely(rc < 0)) {
 			derr(1, "failed to get user pages for data IO");
 			return rc;
 		}
-		(*src_sg) = (*dst_sg) = ses->sg;
+		(*src_sg) = (*dst_sg) = zc->sg;
 		return 0;
 	}
 
@@ -193,28 +335,603 @@ int get_userbuf(struct csession *ses,
 	*dst_sg = NULL; /* default to ignore output */
 
 	if (likely(src)) {
-		rc = __get_userbuf(src, src_len, 0, ses->readonly_pages,
-					   ses->pages, ses->sg, task, mm);
-		if (unlikely(rc)) {
+		rc = __get_userbuf(fcr, src, src_len, 0, zc->readonly_pages,
+					   zc->pages, zc->sg, task, mm);
+		if (unlikely(rc < 0)) {
 			derr(1, "failed to get user pages for data input");
 			return rc;
 		}
-		*src_sg = ses->sg;
+		*src_sg = zc->sg;
 	}
 
 	if (likely(dst)) {
 		const unsigned int writable_pages =
-			ses->used_pages - ses->readonly_pages;
-		struct page **dst_pages = ses->pages + ses->readonly_pages;
-		*dst_sg = ses->sg + ses->readonly_pages;
+			zc->used_pages - zc->readonly_pages;
+		struct page **dst_pages = zc->pages + zc->readonly_pages;
+		*dst_sg = zc->sg + zc->readonly_pages;
 
-		rc = __get_userbuf(dst, dst_len, 1, writable_pages,
+		rc = __get_userbuf(fcr, dst, dst_len, 1, writable_pages,
 					   dst_pages, *dst_sg, task, mm);
-		if (unlikely(rc)) {
+		if (unlikely(rc < 0)) {
 			derr(1, "failed to get user pages for data output");
-			release_user_pages(ses);  /* FIXME: use __release_userbuf(src, ...) */
+			release_user_pages(zc);  /* FIXME: use __release_userbuf(src, ...) */
 			return rc;
 		}
 	}
 	return 0;
 }
+
+/* One buffer of get_userbuf_edges(): the edges of e are described by
+ * their bounce entries, the pages in between are pinned. sg has room
+ * for pgcount + 2 entries. Returns the number of entries used. */
+static int __get_userbuf_edges(struct fcrypt *fcr, uint8_t __user *addr,
+		uint32_t len, int write, const struct userbuf_edges *e,
+		unsigned int pgcount, struct page **pg, struct scatterlist *sg,
+		struct task_struct *task, struct mm_struct *mm)
+{
+	struct scatterlist *mid = e->head ? sg + 1 : sg;
+	int n;
+
+	n = __get_userbuf(fcr, addr + e->head, len - e->head - e->tail,
+			write, pgcount, pg, mid, task, mm);
+	if (unlikely(n < 0))
+		return n;
+
+	if (e->head) {
+		sg_init_table(sg, 1);
+		sg_unmark_end(sg);
+		sg_set_buf(sg, e->hbuf, e->head);
+	}
+	if (e->tail) {
+		sg_unmark_end(&mid[n - 1]);
+		sg_init_table(&mid[n], 1);
+		sg_set_buf(&mid[n], e->tbuf, e->tail);
+	}
+
+	return n + !!e->head + !!e->tail;
+}
+
+/* Like get_userbuf() for len bytes at src and dst, but only the aligned
+ * middle of each buffer is pinned; the scatterlists take their unaligned
+ * edges from the bounce entries in se and de. For an in-place operation
+ * de is not used. */
+int get_userbuf_edges(struct fcrypt *fcr, struct cryptodev_pages *zc,
+		uint8_t __user *src, const struct userbuf_edges *se,
+		uint8_t __user *dst, const struct userbuf_edges *de,
+		uint32_t len, struct task_struct *task, struct mm_struct *mm,
+		struct scatterlist **src_sg, struct scatterlist **dst_sg)
+{
+	unsigned int src_pagecount, dst_pagecount;
+	int rc;
+
+	src_pagecount = PAGECOUNT(src + se->head, len - se->head - se->tail);
+	dst_pagecount = src == dst ? 0 :
+		PAGECOUNT(dst + de->head, len - de->head - de->tail);
+
+	/* room for the edges as well */
+	if (zc->array_size < src_pagecount + dst_pagecount + 4) {
+		rc = adjust_sg_array(zc, src_pagecount + dst_pagecount + 4);
+		if (unlikely(rc))
+			return rc;
+	}
+
+	trace_cryptodev_pin_start(src == dst ? len : 2 * len);
+	zc->used_pages = 0;
+	zc->readonly_pages = 0;
+	rc = __get_userbuf_edges(fcr, src, len, src == dst, se, src_pagecount,
+			zc->pages, zc->sg, task, mm);
+	if (unlikely(rc < 0))
+		goto out;
+	zc->used_pages = src_pagecount;
+	*src_sg = *dst_sg = zc->sg;
+
+	if (src != dst) {
+		zc->readonly_pages = src_pagecount;
+		*dst_sg = zc->sg + rc;
+		rc = __get_userbuf_edges(fcr, dst, len, 1, de, dst_pagecount,
+				zc->pages + src_pagecount, *dst_sg, task, mm);
+		if (unlikely(rc < 0)) {
+			release_user_pages(zc);
+			goto out;
+		}
+		zc->used_pages += dst_pagecount;
+	}
+	rc = 0;
+out:
+	trace_cryptodev_pin_end(rc ? 0 : zc->used_pages, rc);
+	return rc;
+}
+
+static void add_pinned_vm(struct mm_struct *mm, long npages)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0))
+	atomic64_add(npages, &mm->pinned_vm);
+#else
+	down_write(&mm->mmap_sem);
+	mm->pinned_vm += npages;
+	up_write(&mm->mmap_sem);
+#endif
+}
+
+/* The pages of a buffer count against the locked memory limit of its
+ * user, whichever descriptors they are spread over, as the registered
+ * buffers of io_uring do. mm is the one the pages of a registered region
+ * are pinned in, and is kept until they are released; NULL for the
+ * pages of the driver. */
+static int account_buf_pages(struct cryptodev_buf *buf, struct mm_struct *mm)
+{
+	unsigned long limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	struct user_struct *user = get_uid(current_user());
+	unsigned long cur, new;
+
+	do {
+		cur = atomic_long_read(&user->locked_vm);
+		new = cur + buf->npages;
+		if (new > limit && !capable(CAP_IPC_LOCK)) {
+			free_uid(user);
+			return -ENOMEM;
+		}
+	} while (atomic_long_cmpxchg(&user->locked_vm, cur, new) != cur);
+	buf->user = user;
+
+	if (mm) {
+		mmgrab(mm);
+		add_pinned_vm(mm, buf->npages);
+		buf->mm_account = mm;
+	}
+	return 0;
+}
+
+static void unaccount_buf_pages(struct cryptodev_buf *buf)
+{
+	atomic_long_sub(buf->npages, &buf->user->locked_vm);
+	free_uid(buf->user);
+
+	if (buf->mm_account) {
+		add_pinned_vm(buf->mm_account, -(long)buf->npages);
+		mmdrop(buf->mm_account);
+	}
+}
+
+/* Pin the pages of a registered region for as long as it exists; they
+ * are not migrated away or replaced by copy on write under it */
+static int pin_buf_pages(struct cryptodev_buf *buf)
+{
+	unsigned long start = buf->addr & PAGE_MASK;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0))
+	return pin_user_pages_fast(start, buf->npages, FOLL_LONGTERM |
+			(buf->writable ? FOLL_WRITE : 0), buf->pages);
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0))
+	return get_user_pages_fast(start, buf->npages, FOLL_LONGTERM |
+			(buf->writable ? FOLL_WRITE : 0), buf->pages);
+#else
+	return pin_user_range(start, buf->npages, buf->writable, buf->pages,
+			current, current->mm);
+#endif
+}
+
+static void unpin_buf_pages(struct cryptodev_buf *buf, unsigned int npages)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0))
+	unpin_user_pages_dirty_lock(buf->pages, npages, buf->writable);
+#else
+	unsigned int i;
+
+	for (i = 0; i < npages; i++) {
+		if (buf->writable && !PageReserved(buf->pages[i]))
+			SetPageDirty(buf->pages[i]);
+		put_page(buf->pages[i]);
+	}
+#endif
+}
+
+/* make src and dst available in scatterlists.
+ * dst might be the same as src.
+ */
+int get_userbuf(struct fcrypt *fcr, struct cryptodev_pages *zc,
+                void *__user src, unsigned int src_len,
+                void *__user dst, unsigned int dst_len,
+                struct task_struct *task, struct mm_struct *mm,
+                struct scatterlist **src_sg,
+                struct scatterlist **dst_sg)
+{
+	int rc;
+
+	trace_cryptodev_pin_start(src == dst ? max(src_len, dst_len) :
+			src_len + dst_len);
+	rc = get_userbuf_pages(fcr, zc, src, src_len, dst, dst_len,
+			task, mm, src_sg, dst_sg);
+	trace_cryptodev_pin_end(rc ? 0 : zc->used_pages, rc);
+
+	return rc;
+}
+
+static unsigned int iov_pagecount(const struct crypt_iovec *iov,
+		unsigned int cnt)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < cnt; i++)
+		n += PAGECOUNT((uint8_t __user *)iov[i].base, iov[i].len);
+
+	return n;
+}
+
+/* Pin the segments of iov into consecutive entries of pg and sg, which
+ * then form a single scatterlist. *npages counts the pages pinned, also
+ * on failure. */
+static int get_iov_pages(struct fcrypt *fcr, const struct crypt_iovec *iov,
+		unsigned int cnt, int write, struct page **pg,
+		struct scatterlist *sg, struct task_struct *task,
+		struct mm_struct *mm, unsigned int *npages)
+{
+	struct scatterlist *last = NULL;
+	unsigned int i, n, nents = 0;
+	int rc;
+
+	*npages = 0;
+	for (i = 0; i < cnt; i++) {
+		n = PAGECOUNT((uint8_t __user *)iov[i].base, iov[i].len);
+		if (!n || !iov[i].base)
+			continue;
+
+		rc = __get_userbuf(fcr, iov[i].base, iov[i].len, write, n,
+				pg + *npages, sg + nents, task, mm);
+		if (unlikely(rc < 0))
+			return rc;
+
+		/* continue the list of the previous segment */
+		if (last)
+			sg_unmark_end(last);
+		*npages += n;
+		nents += rc;
+		last = sg + nents - 1;
+	}
+
+	return 0;
+}
+
+/* make the segments of src and dst available in scatterlists, as
+ * get_userbuf() does for single buffers. dst may be NULL or the same
+ * as src. */
+int get_userbuf_iov(struct fcrypt *fcr, struct cryptodev_pages *zc,
+		const struct crypt_iovec *src, unsigned int src_cnt,
+		const struct crypt_iovec *dst, unsigned int dst_cnt,
+		struct task_struct *task, struct mm_struct *mm,
+		struct scatterlist **src_sg, struct scatterlist **dst_sg)
+{
+	unsigned int src_pages, dst_pages, n;
+	int in_place = (src == dst);
+	int rc;
+
+	src_pages = iov_pagecount(src, src_cnt);
+	dst_pages = (dst && !in_place) ? iov_pagecount(dst, dst_cnt) : 0;
+
+	trace_cryptodev_pin_start((src_pages + dst_pages) << PAGE_SHIFT);
+	if (src_pages + dst_pages > zc->array_size || !zc->array_size) {
+		rc = adjust_sg_array(zc, src_pages + dst_pages);
+		if (unlikely(rc))
+			goto out;
+	}
+
+	*src_sg = *dst_sg = NULL;
+	zc->readonly_pages = in_place ? 0 : src_pages;
+	rc = get_iov_pages(fcr, src, src_cnt, in_place, zc->pages, zc->sg,
+			task, mm, &n);
+	zc->used_pages = n;
+	if (unlikely(rc)) {
+		derr(1, "failed to get user pages for data input");
+		zc->readonly_pages = in_place ? 0 : n;
+		release_user_pages(zc);
+		goto out;
+	}
+	if (n)
+		*src_sg = zc->sg;
+
+	if (in_place) {
+		*dst_sg = *src_sg;
+	} else if (dst) {
+		rc = get_iov_pages(fcr, dst, dst_cnt, 1, zc->pages + src_pages,
+				zc->sg + src_pages, task, mm, &n);
+		zc->used_pages += n;
+		if (unlikely(rc)) {
+			derr(1, "failed to get user pages for data output");
+			release_user_pages(zc);
+			goto out;
+		}
+		if (n)
+			*dst_sg = zc->sg + src_pages;
+	}
+
+out:
+	trace_cryptodev_pin_end(rc ? 0 : zc->used_pages, rc);
+	return rc;
+}
+
+/* Pin a region of the caller's memory for use by later operations */
+int crypto_register_buf(struct fcrypt *fcr, struct crypt_buf_op *bop)
+{
+	struct cryptodev_buf *buf;
+	unsigned long addr = (unsigned long)bop->addr;
+	int ret;
+
+	if (unlikely(bop->flags & ~CRYPT_BUF_RDONLY || bop->len == 0 ||
+		     addr != bop->addr || addr + bop->len < addr))
+		return -EINVAL;
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (unlikely(!buf))
+		return -ENOMEM;
+
+	buf->addr = addr;
+	buf->len = bop->len;
+	buf->writable = !(bop->flags & CRYPT_BUF_RDONLY);
+	buf->mm = current->mm;
+	buf->npages = PAGECOUNT(addr, bop->len);
+	if (unlikely(buf->npages > MAX_BUF_PAGES)) {
+		ret = -E2BIG;
+		goto fail;
+	}
+
+	buf->pages = kcalloc(buf->npages, sizeof(struct page *), GFP_KERNEL);
+	if (unlikely(!buf->pages)) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	ret = account_buf_pages(buf, current->mm);
+	if (unlikely(ret))
+		goto fail;
+
+	ret = pin_buf_pages(buf);
+	if (unlikely(ret != buf->npages)) {
+		derr(1, "failed to pin %u pages at 0x%lx", buf->npages, addr);
+		if (ret > 0)
+			unpin_buf_pages(buf, ret);
+		ret = -EFAULT;
+		goto fail_unaccount;
+	}
+
+	mutex_lock(&fcr->sem);
+	do {
+		buf->id = ++fcr->buf_id;
+	} while (unlikely(buf->id == 0));
+	list_add_rcu(&buf->entry, &fcr->bufs);
+	mutex_unlock(&fcr->sem);
+
+	bop->id = buf->id;
+	ddebug(2, "registered %u pages at 0x%lx as buffer %u",
+			buf->npages, addr, buf->id);
+	return 0;
+
+fail_unaccount:
+	unaccount_buf_pages(buf);
+fail:
+	kfree(buf->pages);
+	kfree(buf);
+	return ret;
+}
+
+/* Allocate a buffer in the kernel, to be mmap()ed by the caller */
+int crypto_alloc_buf(struct fcrypt *fcr, struct crypt_buf_op *bop)
+{
+	struct cryptodev_buf *buf;
+	unsigned int i;
+	int ret;
+
+	if (unlikely(bop->flags || bop->len == 0))
+		return -EINVAL;
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (unlikely(!buf))
+		return -ENOMEM;
+
+	buf->alloc_len = bop->len;
+	buf->writable = 1;
+	buf->fcr = fcr;
+	buf->npages = PAGE_ALIGN((unsigned long)bop->len) >> PAGE_SHIFT;
+	if (unlikely(buf->npages > MAX_BUF_PAGES)) {
+		ret = -E2BIG;
+		goto fail;
+	}
+
+	buf->pages = kcalloc(buf->npages, sizeof(struct page *), GFP_KERNEL);
+	if (unlikely(!buf->pages)) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	ret = account_buf_pages(buf, NULL);
+	if (unlikely(ret))
+		goto fail;
+
+	/* single pages from the linear mapping are usable by any engine
+	 * without bouncing, and satisfy every alignmask up to a page */
+	for (i = 0; i < buf->npages; i++) {
+		buf->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (unlikely(!buf->pages[i])) {
+			while (i > 0)
+				put_page(buf->pages[--i]);
+			ret = -ENOMEM;
+			goto fail_unaccount;
+		}
+	}
+
+	/* each buffer gets its own range of offsets, none of which
+	 * is the ring's offset zero */
+	mutex_lock(&fcr->sem);
+	do {
+		buf->id = ++fcr->buf_id;
+	} while (unlikely(buf->id == 0));
+	buf->pgoff = (unsigned long)buf->id * MAX_BUF_PAGES;
+	list_add_rcu(&buf->entry, &fcr->bufs);
+	mutex_unlock(&fcr->sem);
+
+	bop->id = buf->id;
+	bop->addr = (__u64)buf->pgoff << PAGE_SHIFT;
+	ddebug(2, "allocated %u pages as buffer %u", buf->npages, buf->id);
+	return 0;
+
+fail_unaccount:
+	unaccount_buf_pages(buf);
+fail:
+	kfree(buf->pages);
+	kfree(buf);
+	return ret;
+}
+
+/* a VMA copied by mremap() refers to the buffer as well; it is the one
+ * that stays, as the old one is unmapped right after, so operations
+ * now find the buffer at its address */
+static void crypto_buf_vm_open(struct vm_area_struct *vma)
+{
+	struct cryptodev_buf *buf = vma->vm_private_data;
+	struct fcrypt *fcr = buf->fcr;
+
+	mutex_lock(&fcr->sem);
+	buf->mapped++;
+	WRITE_ONCE(buf->addr, vma->vm_start);
+	mutex_unlock(&fcr->sem);
+}
+
+static void crypto_buf_vm_close(struct vm_area_struct *vma)
+{
+	struct cryptodev_buf *buf = vma->vm_private_data;
+	struct fcrypt *fcr = buf->fcr;
+
+	/* the pages stay with the buffer; once the last VMA is gone, only
+	 * stop matching operations on the vanishing addresses */
+	mutex_lock(&fcr->sem);
+	if (--buf->mapped == 0)
+		WRITE_ONCE(buf->mm, NULL);
+	mutex_unlock(&fcr->sem);
+}
+
+/* The buffer is matched by the address it was mapped at as a whole;
+ * pieces of it left by a partial munmap() or mprotect() would not be */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0))
+static int crypto_buf_vm_may_split(struct vm_area_struct *vma,
+		unsigned long addr)
+{
+	return -EINVAL;
+}
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0))
+static int crypto_buf_vm_split(struct vm_area_struct *vma,
+		unsigned long addr)
+{
+	return -EINVAL;
+}
+#endif
+
+static const struct vm_operations_struct crypto_buf_vm_ops = {
+	.open = crypto_buf_vm_open,
+	.close = crypto_buf_vm_close,
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0))
+	.may_split = crypto_buf_vm_may_split,
+#elif (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 15, 0))
+	.split = crypto_buf_vm_split,
+#endif
+};
+
+int crypto_mmap_buf(struct fcrypt *fcr, struct vm_area_struct *vma)
+{
+	struct cryptodev_buf *buf;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned int i;
+	int ret = -EINVAL;
+
+	mutex_lock(&fcr->sem);
+	list_for_each_entry(buf, &fcr->bufs, entry) {
+		if (buf->pgoff == 0 || buf->pgoff != vma->vm_pgoff)
+			continue;
+
+		if (unlikely(buf->mapped)) {
+			ret = -EBUSY;
+			break;
+		}
+		if (unlikely(size > (unsigned long)buf->npages << PAGE_SHIFT))
+			break;
+
+		for (i = 0; i < size >> PAGE_SHIFT; i++) {
+			ret = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE,
+					buf->pages[i]);
+			if (unlikely(ret))
+				goto out;
+		}
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0))
+		vm_flags_set(vma, VM_DONTCOPY | VM_DONTEXPAND);
+#else
+		vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND;
+#endif
+		vma->vm_ops = &crypto_buf_vm_ops;
+		vma->vm_private_data = buf;
+
+		buf->addr = vma->vm_start;
+		buf->len = min_t(unsigned long, buf->alloc_len, size);
+		buf->mapped = 1;
+		/* publish the address before lookups can match */
+		smp_store_release(&buf->mm, vma->vm_mm);
+		ret = 0;
+		break;
+	}
+out:
+	mutex_unlock(&fcr->sem);
+
+	return ret;
+}
+
+static void crypto_free_buf(struct cryptodev_buf *buf)
+{
+	unsigned int i;
+
+	if (buf->pgoff) {
+		for (i = 0; i < buf->npages; i++)
+			put_page(buf->pages[i]);
+	} else {
+		unpin_buf_pages(buf, buf->npages);
+	}
+	unaccount_buf_pages(buf);
+	kfree(buf->pages);
+	kfree(buf);
+}
+
+int crypto_unregister_buf(struct fcrypt *fcr, uint32_t id)
+{
+	struct cryptodev_buf *buf;
+
+	mutex_lock(&fcr->sem);
+	list_for_each_entry(buf, &fcr->bufs, entry) {
+		if (buf->id == id) {
+			if (unlikely(buf->mapped)) {
+				mutex_unlock(&fcr->sem);
+				return -EBUSY;
+			}
+			list_del_rcu(&buf->entry);
+			mutex_unlock(&fcr->sem);
+
+			/* operations that found the region hold their own
+			 * page references */
+			synchronize_rcu();
+			crypto_free_buf(buf);
+			return 0;
+		}
+	}
+	mutex_unlock(&fcr->sem);
+
+	derr(1, "Buffer with id=%u not found!", id);
+	return -ENOENT;
+}
+
+/* Remove all regions when closing the file */
+void crypto_free_all_bufs(struct fcrypt *fcr)
+{
+	struct cryptodev_buf *buf, *tmp;
+
+	/* nothing can look the regions up anymore */
+	list_for_each_entry_safe(buf, tmp, &fcr->bufs, entry) {
+		list_del(&buf->entry);
+		crypto_free_buf(buf);
+	}
+}
@@ -1,19 +1,45 @@
 #ifndef ZC_H
 # define ZC_H
 
-/* For zero copy */
-int __get_userbuf(uint8_t __user *addr, uint32_t len, int write,
+/* For zero copy; returns the number of sg entries used */
+int __get_userbuf(struct fcrypt *fcr, uint8_t __user *addr, uint32_t len, int write,
 		unsigned int pgcount, struct page **pg, struct scatterlist *sg,
 		struct task_struct *task, struct mm_struct *mm);
-void release_user_pages(struct csession *ses);
+void release_user_pages(struct cryptodev_pages *zc);
 
-int get_userbuf(struct csession *ses,
+/* Registered buffers */
+int crypto_register_buf(struct fcrypt *fcr, struct crypt_buf_op *bop);
+int crypto_unregister_buf(struct fcrypt *fcr, uint32_t id);
+int crypto_alloc_buf(struct fcrypt *fcr, struct crypt_buf_op *bop);
+int crypto_mmap_buf(struct fcrypt *fcr, struct vm_area_struct *vma);
+void crypto_free_all_bufs(struct fcrypt *fcr);
+
+int get_userbuf(struct fcrypt *fcr, struct cryptodev_pages *zc,
                 void *__user src, unsigned int src_len,
                 void *__user dst, unsigned int dst_len,
                 struct task_struct *task, struct mm_struct *mm,
                 struct scatterlist **src_sg,
                 struct scatterlist **dst_sg);
 
+/* The first and last bytes of a buffer that are not aligned, and the
+ * bounce space that holds them */
+struct userbuf_edges {
+	uint32_t head, tail;
+	char *hbuf, *tbuf;
+};
+
+int get_userbuf_edges(struct fcrypt *fcr, struct cryptodev_pages *zc,
+		uint8_t __user *src, const struct userbuf_edges *se,
+		uint8_t __user *dst, const struct userbuf_edges *de,
+		uint32_t len, struct task_struct *task, struct mm_struct *mm,
+		struct scatterlist **src_sg, struct scatterlist **dst_sg);
+
+int get_userbuf_iov(struct fcrypt *fcr, struct cryptodev_pages *zc,
+		const struct crypt_iovec *src, unsigned int src_cnt,
+		const struct crypt_iovec *dst, unsigned int dst_cnt,
+		struct task_struct *task, struct mm_struct *mm,
+		struct scatterlist **src_sg, struct scatterlist **dst_sg);
+
 /* buflen ? (last page - first page + 1) : 0 */
 #define PAGECOUNT(buf, buflen) ((buflen) \
 	? ((((unsigned long)(buf + buflen - 1)) >> PAGE_SHIFT) - \
@@ -21,5 +47,8 @@ int get_userbuf(struct csession *ses,
 	: 0)
 
 #define DEFAULT_PREALLOC_PAGES 32
+/* the number of operations that use at most a quarter of grown arrays
+ * before the arrays are released */
+#define ZC_SHRINK_OPS 64
 
 #endif